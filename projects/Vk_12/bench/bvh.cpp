@@ -0,0 +1,220 @@
+/*
+	Benchmark: scene BVH (bvh.hpp) vs the linear culling pass (culling.hpp).
+
+	100.000 instances of a mesh with random position, rotation and scale in a 2 km cube (like bench_culling).
+		- build:		Bvh::build() with 1 thread and with a WorkerPool.
+		- refit:		10% of the instances move a bit (Bvh::update() + Bvh::refit()).
+		- frustum:		CullingSet::cull() (linear, SIMD) vs Bvh::queryFrustum() (1 thread and parallel) for a wide and a narrow view.
+		- rays:			10.000 picking rays, brute force vs Bvh::queryRays() (1 thread and parallel).
+		- box:			1.000 range queries (50 m boxes), brute force vs Bvh::queryBox().
+	Every BVH result is checked against the brute force one (frustum queries against a scalar test of the same boxes, since CullingSet also uses the spheres).
+	Usage:	bench_bvh [instance count] [threads]
+*/
+
+#include <iostream>
+#include <iomanip>
+#include <vector>
+#include <random>
+#include <chrono>
+#include <algorithm>
+#include <cstdlib>
+
+#define GLM_FORCE_RADIANS
+#define GLM_FORCE_DEPTH_ZERO_TO_ONE
+#include <glm/glm.hpp>
+#include <glm/gtc/matrix_transform.hpp>
+
+#include "bvh.hpp"
+#include "culling.hpp"
+#include "workers.hpp"
+
+
+template<typename F>
+double measure(int repetitions, F step)
+{
+	auto start = std::chrono::high_resolution_clock::now();
+	for (int r = 0; r < repetitions; r++) step();
+	return std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - start).count() / repetitions;
+}
+
+bool boxInside(const Frustum& frustum, const glm::vec3& boxMin, const glm::vec3& boxMax)
+{
+	glm::vec3 center = (boxMin + boxMax) * 0.5f, extent = (boxMax - boxMin) * 0.5f;
+	for (const glm::vec4& plane : frustum.planes)
+		if (glm::dot(glm::vec3(plane), center) + plane.w + glm::dot(glm::abs(glm::vec3(plane)), extent) < 0.f) return false;
+	return true;
+}
+
+float rayBox(const glm::vec3& origin, const glm::vec3& direction, const glm::vec3& boxMin, const glm::vec3& boxMax)
+{
+	glm::vec3 inv = 1.f / direction;
+	glm::vec3 t0 = (boxMin - origin) * inv, t1 = (boxMax - origin) * inv;
+	glm::vec3 tNear = glm::min(t0, t1), tFar = glm::max(t0, t1);
+	float entry = std::max(std::max(tNear.x, tNear.y), std::max(tNear.z, 0.f));
+	float exit	= std::min(std::min(tFar.x, tFar.y), tFar.z);
+	return entry <= exit ? entry : -1.f;
+}
+
+int main(int argc, char* argv[])
+{
+	size_t instanceCount = argc > 1 ? std::strtoul(argv[1], nullptr, 10) : 100000;
+	WorkerPool workers(argc > 2 ? std::strtoul(argv[2], nullptr, 10) : 0);
+
+	// Instances
+	std::mt19937 rng(1234);
+	std::uniform_real_distribution<float> position(-1000.f, 1000.f), angle(0.f, 6.2832f), scale(0.5f, 4.f), unit(-1.f, 1.f);
+
+	glm::vec3 boxMin(-1.f, -1.f, 0.f), boxMax(1.f, 1.f, 1.5f);		// Model space bounds
+	float sphereRadius = 1.6f;
+
+	std::vector<glm::mat4> models(instanceCount);
+	std::vector<glm::vec3> worldMin(instanceCount), worldMax(instanceCount);
+	CullingSet culling;
+	culling.resize(instanceCount);
+
+	for (size_t i = 0; i < instanceCount; i++)
+	{
+		glm::mat4& model = models[i];
+		model = glm::translate(glm::mat4(1.f), glm::vec3(position(rng), position(rng), position(rng)));
+		model = glm::rotate(model, angle(rng), glm::normalize(glm::vec3(position(rng), position(rng), position(rng) + 0.1f)));
+		model = glm::scale(model, glm::vec3(scale(rng)));
+		culling.set(i, boxMin, boxMax, sphereRadius, model);
+		transformBox(boxMin, boxMax, model, worldMin[i], worldMax[i]);
+	}
+
+	std::cout << instanceCount << " instances, " << workers.size() << " threads" << std::fixed << std::setprecision(3) << std::endl;
+	bool allSame = true;
+
+	// Build
+	Bvh bvh;
+	double buildSerial	 = measure(5, [&] { bvh.build(worldMin.data(), worldMax.data(), instanceCount); });
+	double buildParallel = measure(5, [&] { bvh.build(worldMin.data(), worldMax.data(), instanceCount, &workers); });
+	std::cout	<< "build:    " << buildSerial << " ms (1 thread), " << buildParallel << " ms (parallel). "
+				<< bvh.nodeCount() << " nodes (" << sizeof(BvhNode) << " bytes each), depth " << bvh.depth() << std::endl;
+
+	// Refit
+	std::vector<uint32_t> moved;
+	for (size_t i = 0; i < instanceCount; i += 10) moved.push_back(static_cast<uint32_t>(i));
+
+	double refit = measure(20, [&]
+	{
+		for (uint32_t i : moved)
+		{
+			glm::vec3 offset(unit(rng), unit(rng), unit(rng));
+			worldMin[i] += offset;
+			worldMax[i] += offset;
+			bvh.update(i, worldMin[i], worldMax[i]);
+		}
+		bvh.refit();
+	});
+	std::cout << "refit:    " << refit << " ms (" << moved.size() << " objects moved)" << std::endl;
+
+	for (size_t i = 0; i < instanceCount; i++)		// Keep the linear culling set in sync with the moved boxes
+		culling.set(i, worldMin[i], worldMax[i], 1e30f, glm::mat4(1.f));
+
+	// Frustum
+	std::cout << std::setw(10) << "view" << std::setw(14) << "linear (ms)" << std::setw(14) << "BVH (ms)" << std::setw(16) << "BVH par. (ms)" << std::setw(10) << "visible" << std::setw(8) << "same" << std::endl;
+
+	const float fovs[] = { 60.f, 10.f };
+	for (float fov : fovs)
+	{
+		glm::vec3 eye	= glm::vec3(200.f, 100.f, 50.f);
+		glm::mat4 proj	= glm::perspective(glm::radians(fov), 16.f / 9.f, 0.1f, 5000.f);
+		proj[1][1] *= -1;
+		Frustum frustum(proj * glm::lookAt(eye, eye * 2.f, glm::vec3(0.f, 0.f, 1.f)));
+
+		std::vector<uint32_t> linear(instanceCount), serial, parallel;
+		size_t linearCount = 0;
+		double linearTime	= measure(20, [&] { linearCount = culling.cull(frustum, linear.data()); });
+		double serialTime	= measure(20, [&] { serial.clear();   bvh.queryFrustum(frustum, serial); });
+		double parallelTime	= measure(20, [&] { parallel.clear(); bvh.queryFrustum(frustum, parallel, &workers); });
+
+		std::vector<uint32_t> reference;
+		for (uint32_t i = 0; i < instanceCount; i++)
+			if (boxInside(frustum, worldMin[i], worldMax[i])) reference.push_back(i);
+		std::sort(serial.begin(), serial.end());
+		std::sort(parallel.begin(), parallel.end());
+		bool same = serial == reference && parallel == reference && linearCount == reference.size();
+		allSame = allSame && same;
+
+		std::cout	<< std::setw(7) << std::setprecision(0) << fov << " deg" << std::setprecision(3)
+					<< std::setw(14) << linearTime << std::setw(14) << serialTime << std::setw(16) << parallelTime
+					<< std::setw(10) << serial.size() << std::setw(8) << (same ? "yes" : "NO") << std::endl;
+	}
+
+	// Rays
+	const size_t rayCount = 10000;
+	std::vector<glm::vec3> origins(rayCount), directions(rayCount);
+	for (size_t r = 0; r < rayCount; r++)
+	{
+		origins[r]		= glm::vec3(position(rng), position(rng), position(rng));
+		directions[r]	= glm::normalize(glm::vec3(unit(rng), unit(rng), unit(rng)) + glm::vec3(0.f, 0.f, 0.001f));
+	}
+
+	std::vector<BvhHit> bruteHits(rayCount), serialHits(rayCount), parallelHits(rayCount);
+	double bruteRays = measure(1, [&]
+	{
+		for (size_t r = 0; r < rayCount; r++)
+		{
+			bruteHits[r] = BvhHit();
+			for (uint32_t i = 0; i < instanceCount; i++)
+			{
+				float t = rayBox(origins[r], directions[r], worldMin[i], worldMax[i]);
+				if (t >= 0.f && (bruteHits[r].object == UINT32_MAX || t < bruteHits[r].t)) bruteHits[r] = { i, t };
+			}
+		}
+	});
+	double serialRays	= measure(5, [&] { bvh.queryRays(origins.data(), directions.data(), serialHits.data(), rayCount); });
+	double parallelRays	= measure(5, [&] { bvh.queryRays(origins.data(), directions.data(), parallelHits.data(), rayCount, 1e30f, &workers); });
+
+	size_t hitCount = 0, rayMismatches = 0;
+	for (size_t r = 0; r < rayCount; r++)
+	{
+		hitCount += bruteHits[r].object != UINT32_MAX;
+		for (const BvhHit& hit : { serialHits[r], parallelHits[r] })
+			if ((hit.object == UINT32_MAX) != (bruteHits[r].object == UINT32_MAX) || (hit.object != UINT32_MAX && hit.t != bruteHits[r].t))	// Ties may report another object at the same distance
+				rayMismatches++;
+	}
+	allSame = allSame && rayMismatches == 0;
+	std::cout	<< "rays:     " << bruteRays << " ms (brute force), " << serialRays << " ms (BVH), " << parallelRays << " ms (BVH parallel). "
+				<< hitCount << " hits, " << (rayMismatches ? "MISMATCH" : "same") << std::endl;
+
+	// Boxes
+	const size_t boxCount = 1000;
+	std::vector<glm::vec3> queryCenters(boxCount);
+	for (glm::vec3& center : queryCenters) center = glm::vec3(position(rng), position(rng), position(rng));
+	glm::vec3 halfSize(25.f);
+
+	std::vector<std::vector<uint32_t>> bruteBoxes(boxCount), bvhBoxes(boxCount);
+	double bruteBox = measure(1, [&]
+	{
+		for (size_t q = 0; q < boxCount; q++)
+		{
+			bruteBoxes[q].clear();
+			for (uint32_t i = 0; i < instanceCount; i++)
+				if (glm::all(glm::lessThanEqual(worldMin[i], queryCenters[q] + halfSize)) && glm::all(glm::lessThanEqual(queryCenters[q] - halfSize, worldMax[i])))
+					bruteBoxes[q].push_back(i);
+		}
+	});
+	double bvhBox = measure(5, [&]
+	{
+		for (size_t q = 0; q < boxCount; q++)
+		{
+			bvhBoxes[q].clear();
+			bvh.queryBox(queryCenters[q] - halfSize, queryCenters[q] + halfSize, bvhBoxes[q]);
+		}
+	});
+
+	size_t found = 0;
+	bool boxesSame = true;
+	for (size_t q = 0; q < boxCount; q++)
+	{
+		std::sort(bvhBoxes[q].begin(), bvhBoxes[q].end());
+		boxesSame = boxesSame && bvhBoxes[q] == bruteBoxes[q];
+		found += bruteBoxes[q].size();
+	}
+	allSame = allSame && boxesSame;
+	std::cout << "boxes:    " << bruteBox << " ms (brute force), " << bvhBox << " ms (BVH). " << found << " objects found, " << (boxesSame ? "same" : "MISMATCH") << std::endl;
+
+	return allSame ? 0 : 1;
+}
@@ -0,0 +1,93 @@
+/*
+	Benchmark: CPU view frustum culling (culling.hpp), as done in Renderer::updateUniformBuffer.
+
+	100.000 instances of a mesh (box and sphere bounds) with random position, rotation and scale in a 2 km cube. The camera is inside the cube, looking in different directions.
+		- update:		CullingSet::set() for every instance (model space bounds transformed by the model matrix).
+		- scalar:		CullingSet::cullScalar() (one instance at a time).
+		- SIMD:			CullingSet::cull() (4 instances per iteration with SSE, 8 with AVX).
+	Reports the time per frame of each step, the visible/culled counts, and checks that both culling paths produce the same visible list.
+	Usage:	bench_culling [instance count]
+*/
+
+#include <iostream>
+#include <iomanip>
+#include <vector>
+#include <random>
+#include <chrono>
+#include <cstdlib>
+
+#define GLM_FORCE_RADIANS
+#define GLM_FORCE_DEPTH_ZERO_TO_ONE
+#include <glm/glm.hpp>
+#include <glm/gtc/matrix_transform.hpp>
+
+#include "culling.hpp"
+
+
+template<typename F>
+double measure(int repetitions, F step)
+{
+	auto start = std::chrono::high_resolution_clock::now();
+	for (int r = 0; r < repetitions; r++) step();
+	return std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - start).count() / repetitions;
+}
+
+int main(int argc, char* argv[])
+{
+	size_t instanceCount = argc > 1 ? std::strtoul(argv[1], nullptr, 10) : 100000;
+
+	// Instances
+	std::mt19937 rng(1234);
+	std::uniform_real_distribution<float> position(-1000.f, 1000.f), angle(0.f, 6.2832f), scale(0.5f, 4.f);
+
+	std::vector<glm::mat4> models(instanceCount);
+	for (glm::mat4& model : models)
+	{
+		model = glm::translate(glm::mat4(1.f), glm::vec3(position(rng), position(rng), position(rng)));
+		model = glm::rotate(model, angle(rng), glm::normalize(glm::vec3(position(rng), position(rng), position(rng) + 0.1f)));
+		model = glm::scale(model, glm::vec3(scale(rng)));
+	}
+
+	glm::vec3 boxMin(-1.f, -1.f, 0.f), boxMax(1.f, 1.f, 1.5f);		// Model space bounds (like a small house)
+	float sphereRadius = 1.6f;
+
+	CullingSet culling;
+	culling.resize(instanceCount);
+	std::vector<uint32_t> visibleScalar(instanceCount), visibleSimd(instanceCount);
+
+	std::cout	<< instanceCount << " instances" << std::endl
+				<< std::setw(8) << "view" << std::setw(14) << "update (ms)" << std::setw(14) << "scalar (ms)" << std::setw(14) << "SIMD (ms)" << std::setw(10) << "speedup"
+				<< std::setw(10) << "visible" << std::setw(10) << "culled" << std::setw(8) << "same" << std::endl;
+
+	bool allSame = true;
+	const int views = 6, repetitions = 20;
+	for (int view = 0; view < views; view++)
+	{
+		float a = view * 6.2832f / views;
+		glm::vec3 eye	= glm::vec3(200.f * std::cos(a), 200.f * std::sin(a), 50.f);		// Inside the cube, looking outwards
+		glm::mat4 proj	= glm::perspective(glm::radians(60.f), 16.f / 9.f, 0.1f, 5000.f);
+		proj[1][1] *= -1;
+		Frustum frustum(proj * glm::lookAt(eye, eye * 2.f, glm::vec3(0.f, 0.f, 1.f)));
+
+		double update = measure(repetitions, [&]
+		{
+			for (size_t i = 0; i < instanceCount; i++)
+				culling.set(i, boxMin, boxMax, sphereRadius, models[i]);
+		});
+
+		size_t scalarCount = 0, simdCount = 0;
+		double scalar	= measure(repetitions, [&] { scalarCount = culling.cullScalar(frustum, visibleScalar.data()); });
+		double simd		= measure(repetitions, [&] { simdCount   = culling.cull(frustum, visibleSimd.data()); });
+
+		bool same = scalarCount == simdCount && std::equal(visibleScalar.begin(), visibleScalar.begin() + scalarCount, visibleSimd.begin());
+		allSame = allSame && same;
+
+		std::cout	<< std::setw(8) << view << std::fixed << std::setprecision(3)
+					<< std::setw(14) << update << std::setw(14) << scalar << std::setw(14) << simd
+					<< std::setw(9) << std::setprecision(1) << scalar / simd << 'x'
+					<< std::setw(10) << simdCount << std::setw(10) << instanceCount - simdCount
+					<< std::setw(8) << (same ? "yes" : "NO") << std::endl;
+	}
+
+	return allSame ? 0 : 1;
+}
@@ -0,0 +1,178 @@
+/*
+	Benchmark: meshlets (meshlets.hpp), as built in modelData::loadModel and culled in Renderer::updateUniformBuffer.
+
+	The mesh is optimized for the vertex cache (like loadModel does) and split into meshlets of 64 vertices and 124 triangles. Reports the build time, the meshlet sizes and the width of their normal cones.
+	Then the meshlets are culled from cameras around the mesh (half of them close enough to leave part of it out of the view), reporting the time, the meshlets culled by the frustum and by their normal cones, the triangles left and the number of draw ranges (vkCmdDrawIndexed calls), also when ranges separated by 128 culled triangles or less are merged (like Renderer does).
+	Checks:
+		- The meshlets contain the same triangles as the input, within the vertex and triangle limits.
+		- Culling is conservative: every triangle of a back-facing meshlet faces away from the camera, and every triangle of an outside meshlet is behind one frustum plane.
+	Usage:	bench_meshlets [file.obj]		Without arguments, a torus of ~200k triangles is generated.
+*/
+
+#include <iostream>
+#include <iomanip>
+#include <vector>
+#include <array>
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+
+#define TINYOBJLOADER_IMPLEMENTATION
+#include "tiny_obj_loader.h"
+
+#define GLM_FORCE_RADIANS
+#define GLM_FORCE_DEPTH_ZERO_TO_ONE
+#include <glm/glm.hpp>
+#include <glm/gtc/matrix_transform.hpp>
+
+#include "meshlets.hpp"
+#include "meshOptimizer.hpp"
+
+
+template<typename F>
+double measure(int repetitions, F step)
+{
+	auto start = std::chrono::high_resolution_clock::now();
+	for (int r = 0; r < repetitions; r++) step();
+	return std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - start).count() / repetitions;
+}
+
+void generateTorus(std::vector<glm::vec3>& positions, std::vector<uint32_t>& indices, uint32_t rings, uint32_t sides)
+{
+	for (uint32_t i = 0; i < rings; i++)
+		for (uint32_t j = 0; j < sides; j++)
+		{
+			float u = i * 6.2831853f / rings, v = j * 6.2831853f / sides;
+			positions.push_back(glm::vec3((1.f + 0.3f * std::cos(v)) * std::cos(u), (1.f + 0.3f * std::cos(v)) * std::sin(u), 0.3f * std::sin(v)));
+		}
+
+	for (uint32_t i = 0; i < rings; i++)
+		for (uint32_t j = 0; j < sides; j++)
+		{
+			uint32_t a = i * sides + j, b = ((i + 1) % rings) * sides + j, c = i * sides + (j + 1) % sides, d = ((i + 1) % rings) * sides + (j + 1) % sides;
+			indices.insert(indices.end(), { a, b, d, a, d, c });		// Counter-clockwise seen from outside
+		}
+}
+
+std::vector<std::array<uint32_t, 3>> triangleSet(const uint32_t* indices, size_t count)
+{
+	std::vector<std::array<uint32_t, 3>> set;
+	for (size_t i = 0; i + 2 < count; i += 3)
+	{
+		std::array<uint32_t, 3> t = { indices[i], indices[i + 1], indices[i + 2] };
+		std::rotate(t.begin(), std::min_element(t.begin(), t.end()), t.end());
+		set.push_back(t);
+	}
+	std::sort(set.begin(), set.end());
+	return set;
+}
+
+int main(int argc, char* argv[])
+{
+	std::vector<glm::vec3>	positions;
+	std::vector<uint32_t>	indices;
+
+	if (argc > 1)
+	{
+		tinyobj::attrib_t					attrib;
+		std::vector<tinyobj::shape_t>		shapes;
+		std::vector<tinyobj::material_t>	materials;
+		std::string							warn, err;
+		if (!tinyobj::LoadObj(&attrib, &shapes, &materials, &warn, &err, argv[1]))
+		{
+			std::cerr << warn << err << std::endl;
+			return 1;
+		}
+
+		for (size_t v = 0; v + 2 < attrib.vertices.size(); v += 3)
+			positions.push_back(glm::vec3(attrib.vertices[v], attrib.vertices[v + 1], attrib.vertices[v + 2]));
+		for (const auto& shape : shapes)
+			for (const tinyobj::index_t& index : shape.mesh.indices)
+				indices.push_back(index.vertex_index);
+	}
+	else generateTorus(positions, indices, 400, 250);
+
+	optimizeVertexCache(indices, positions.size());
+	std::vector<uint32_t> input = indices;
+
+	// Build
+	std::vector<Meshlet> meshlets;
+	double buildTime = measure(1, [&] { meshlets = buildMeshlets(indices, 0, indices.size(), &positions[0].x, sizeof(glm::vec3), positions.size()); });
+
+	size_t maxVertices = 0, maxTriangles = 0, vertexSum = 0, noCone = 0;
+	bool valid = triangleSet(indices.data(), indices.size()) == triangleSet(input.data(), input.size());
+	uint32_t expectedFirst = 0;
+	for (const Meshlet& meshlet : meshlets)
+	{
+		valid = valid && meshlet.firstIndex == expectedFirst && meshlet.vertexCount <= 64 && meshlet.indexCount <= 124 * 3;
+		expectedFirst += meshlet.indexCount;
+		maxVertices		= std::max<size_t>(maxVertices, meshlet.vertexCount);
+		maxTriangles	= std::max<size_t>(maxTriangles, meshlet.indexCount / 3);
+		vertexSum		+= meshlet.vertexCount;
+		noCone			+= meshlet.coneCutoff >= 1.f;
+	}
+	valid = valid && expectedFirst == indices.size();
+
+	std::cout	<< indices.size() / 3 << " triangles, " << positions.size() << " vertices" << std::endl << std::fixed << std::setprecision(1)
+				<< meshlets.size() << " meshlets in " << buildTime << " ms. Average " << double(vertexSum) / meshlets.size() << " vertices, " << double(indices.size() / 3) / meshlets.size()
+				<< " triangles (max " << maxVertices << ", " << maxTriangles << "). " << noCone << " without a usable normal cone. Valid: " << (valid ? "yes" : "NO") << std::endl;
+
+	// Cull
+	glm::vec3 boxMin = positions[0], boxMax = positions[0];
+	for (const glm::vec3& p : positions) { boxMin = glm::min(boxMin, p); boxMax = glm::max(boxMax, p); }
+	glm::vec3 center = (boxMin + boxMax) * 0.5f;
+	float size = glm::length(boxMax - boxMin);
+
+	std::cout	<< std::setw(8) << "camera" << std::setw(12) << "time (ms)" << std::setw(10) << "visible" << std::setw(12) << "backfacing" << std::setw(10) << "outside"
+				<< std::setw(12) << "triangles" << std::setw(10) << "ranges" << std::setw(18) << "merged: triangles" << std::setw(10) << "ranges" << std::setw(14) << "conservative" << std::endl;
+
+	bool allConservative = true;
+	const int cameras = 8;
+	for (int c = 0; c < cameras; c++)
+	{
+		float a			= c * 6.2831853f / cameras;
+		float distance	= (c % 2 ? 1.5f : 0.6f) * size;		// Odd cameras see the whole mesh; even ones, part of it
+		glm::vec3 eye	= center + distance * glm::vec3(std::cos(a), std::sin(a), 0.5f);
+		glm::mat4 proj	= glm::perspective(glm::radians(45.f), 16.f / 9.f, 0.01f, 100.f * size);
+		proj[1][1] *= -1;
+		Frustum frustum(proj * glm::lookAt(eye, center + glm::vec3(0.f, 0.f, 0.1f * size), glm::vec3(0.f, 0.f, 1.f)));
+
+		std::vector<DrawRange> ranges;
+		MeshletCullingStats stats;
+		double time = measure(100, [&] { ranges.clear(); stats = cullMeshlets(meshlets.data(), meshlets.size(), frustum, eye, ranges); });
+
+		std::vector<DrawRange> merged;
+		cullMeshlets(meshlets.data(), meshlets.size(), frustum, eye, merged, 128 * 3);
+
+		size_t triangles = 0, mergedTriangles = 0;
+		for (const DrawRange& range : ranges) triangles += range.indexCount / 3;
+		for (const DrawRange& range : merged) mergedTriangles += range.indexCount / 3;
+
+		// Conservativeness: re-run the tests per triangle for the culled meshlets
+		std::vector<DrawRange> single;
+		bool conservative = true;
+		for (const Meshlet& meshlet : meshlets)
+		{
+			single.clear();
+			cullMeshlets(&meshlet, 1, frustum, eye, single);
+			if (!single.empty()) continue;
+
+			for (uint32_t k = meshlet.firstIndex; k < meshlet.firstIndex + meshlet.indexCount; k += 3)
+			{
+				glm::vec3 p0 = positions[indices[k]], p1 = positions[indices[k + 1]], p2 = positions[indices[k + 2]];
+				bool backFacing = glm::dot(glm::cross(p1 - p0, p2 - p0), p0 - eye) >= 0.f;
+				bool outside	= false;
+				for (const glm::vec4& plane : frustum.planes)
+					outside = outside || (glm::dot(glm::vec3(plane), p0) + plane.w < 0.f && glm::dot(glm::vec3(plane), p1) + plane.w < 0.f && glm::dot(glm::vec3(plane), p2) + plane.w < 0.f);
+				conservative = conservative && (backFacing || outside);
+			}
+		}
+		allConservative = allConservative && conservative;
+
+		std::cout	<< std::setw(8) << c << std::setw(12) << std::setprecision(3) << time << std::setw(10) << stats.visible << std::setw(12) << stats.backFacing << std::setw(10) << stats.outside
+					<< std::setw(11) << std::setprecision(1) << 100.0 * triangles / (indices.size() / 3) << '%' << std::setw(10) << ranges.size()
+					<< std::setw(17) << 100.0 * mergedTriangles / (indices.size() / 3) << '%' << std::setw(10) << merged.size() << std::setw(14) << (conservative ? "yes" : "NO") << std::endl;
+	}
+
+	return valid && allConservative ? 0 : 1;
+}
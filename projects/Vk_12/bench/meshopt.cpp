@@ -0,0 +1,154 @@
+/*
+	Benchmark: mesh optimization (meshOptimizer.hpp), as done in modelData::loadModel.
+
+	Reports the simulated post-transform cache efficiency (ACMR and ATVR for FIFO caches of 8, 16 and 32 entries) of:
+		- input:		Index order of the OBJ file after welding.
+		- shuffled:		Triangles in random order (worst case for meshes exported without locality).
+		- vertex cache:	optimizeVertexCache() over the shuffled order.
+		- + overdraw:	optimizeOverdraw() after it (it trades a bit of cache efficiency for less overdraw).
+	And the time spent on each step. Also checks that the optimized index buffers contain the same triangles as the input, and that optimizeVertexFetch() keeps them too.
+	Usage:	bench_meshopt [file.obj]		Without arguments, a grid mesh of ~500k triangles is generated in the working directory.
+*/
+
+#include <iostream>
+#include <iomanip>
+#include <fstream>
+#include <vector>
+#include <array>
+#include <random>
+#include <algorithm>
+#include <chrono>
+#include <cstring>
+
+#define TINYOBJLOADER_IMPLEMENTATION
+#include "tiny_obj_loader.h"
+
+#include "meshOptimizer.hpp"
+
+
+struct Vertex
+{
+	float pos[3];
+	float texCoord[2];
+};
+
+void generateGrid(const char* path, int n)
+{
+	std::ofstream file(path);
+	for (int y = 0; y < n; y++)
+		for (int x = 0; x < n; x++)
+			file << "v " << x * 0.01f << ' ' << y * 0.01f << ' ' << ((x * 7 + y * 13) % 17) * 0.001f << '\n';
+	for (int y = 0; y + 1 < n; y++)
+		for (int x = 0; x + 1 < n; x++)
+		{
+			int a = y * n + x + 1, b = a + 1, c = a + n, d = c + 1;		// OBJ indices start at 1
+			file << "f " << a << ' ' << b << ' ' << d << '\n';
+			file << "f " << a << ' ' << d << ' ' << c << '\n';
+		}
+}
+
+/// Sorted list of triangles (each one rotated so that its smallest vertex goes first), for comparing index buffers.
+std::vector<std::array<uint32_t, 3>> triangleSet(const std::vector<uint32_t>& indices, const std::vector<Vertex>* vertices = nullptr)
+{
+	std::vector<std::array<uint32_t, 3>> set;
+	for (size_t i = 0; i + 2 < indices.size(); i += 3)
+	{
+		std::array<uint32_t, 3> t = { indices[i], indices[i + 1], indices[i + 2] };
+		if (vertices)		// Compare by position (vertices may have been reordered)
+			for (uint32_t& v : t) { float x = (*vertices)[v].pos[0] * 100.f, y = (*vertices)[v].pos[1] * 100.f; v = uint32_t(x + 0.5f) * 65536 + uint32_t(y + 0.5f); }
+		std::rotate(t.begin(), std::min_element(t.begin(), t.end()), t.end());
+		set.push_back(t);
+	}
+	std::sort(set.begin(), set.end());
+	return set;
+}
+
+void printStats(const char* name, const std::vector<uint32_t>& indices, size_t vertexCount, double ms)
+{
+	std::cout << std::setw(16) << name;
+	for (unsigned cacheSize : { 8u, 16u, 32u })
+	{
+		VertexCacheStats stats = analyzeVertexCache(indices.data(), indices.size(), vertexCount, cacheSize);
+		std::cout << std::fixed << std::setprecision(3) << std::setw(10) << stats.acmr << std::setw(8) << stats.atvr;
+	}
+	std::cout << std::setw(12) << std::setprecision(1) << ms << std::endl;
+}
+
+template<typename F>
+double measure(F step)
+{
+	auto start = std::chrono::high_resolution_clock::now();
+	step();
+	return std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - start).count();
+}
+
+int main(int argc, char* argv[])
+{
+	const char* path = "bench_meshopt_grid.obj";
+	if (argc > 1) path = argv[1];
+	else
+	{
+		std::cout << "Generating " << path << "..." << std::endl;
+		generateGrid(path, 500);
+	}
+
+	tinyobj::attrib_t					attrib;
+	std::vector<tinyobj::shape_t>		shapes;
+	std::vector<tinyobj::material_t>	materials;
+	std::string							warn, err;
+	if (!tinyobj::LoadObj(&attrib, &shapes, &materials, &warn, &err, path))
+	{
+		std::cerr << warn << err << std::endl;
+		return 1;
+	}
+
+	// Positions only (same topology as the welded mesh when there are no seams)
+	std::vector<Vertex> vertices(attrib.vertices.size() / 3);
+	for (size_t v = 0; v < vertices.size(); v++)
+		memcpy(vertices[v].pos, &attrib.vertices[3 * v], sizeof(vertices[v].pos));
+
+	std::vector<uint32_t> input;
+	for (const auto& shape : shapes)
+		for (const tinyobj::index_t& index : shape.mesh.indices)
+			input.push_back(index.vertex_index);
+
+	size_t vertexCount = vertices.size();
+	std::cout	<< input.size() / 3 << " triangles, " << vertexCount << " vertices" << std::endl
+				<< std::setw(16) << "order" << std::setw(18) << "ACMR/ATVR (8)" << std::setw(18) << "ACMR/ATVR (16)" << std::setw(18) << "ACMR/ATVR (32)" << std::setw(12) << "time (ms)" << std::endl;
+
+	printStats("input", input, vertexCount, 0.);
+
+	std::vector<uint32_t> shuffled = input;
+	{
+		std::vector<uint32_t> order(input.size() / 3);
+		for (size_t t = 0; t < order.size(); t++) order[t] = (uint32_t)t;
+		std::shuffle(order.begin(), order.end(), std::mt19937(1234));
+		for (size_t t = 0; t < order.size(); t++)
+			for (int c = 0; c < 3; c++) shuffled[3 * t + c] = input[3 * order[t] + c];
+	}
+	printStats("shuffled", shuffled, vertexCount, 0.);
+
+	std::vector<uint32_t> optimized = shuffled;
+	double ms = measure([&] { optimizeVertexCache(optimized, vertexCount); });
+	printStats("vertex cache", optimized, vertexCount, ms);
+
+	std::vector<uint32_t> overdraw = optimized;
+	ms = measure([&] { optimizeOverdraw(overdraw, vertices[0].pos, sizeof(Vertex), vertexCount); });
+	printStats("+ overdraw", overdraw, vertexCount, ms);
+
+	std::vector<Vertex>		fetchVertices	= vertices;
+	std::vector<uint32_t>	fetchIndices	= overdraw;
+	size_t					fetchCount		= 0;
+	ms = measure([&] { fetchCount = optimizeVertexFetch(fetchVertices.data(), sizeof(Vertex), vertexCount, fetchIndices); });
+	fetchVertices.resize(fetchCount);
+	std::cout << std::setw(16) << "vertex fetch" << std::setw(54) << "" << std::setw(12) << std::setprecision(1) << ms << std::endl;
+
+	// Same triangles (with the same winding) in every buffer
+	auto reference = triangleSet(input);
+	bool same = triangleSet(optimized) == reference && triangleSet(overdraw) == reference;
+	if (argc == 1)		// The positions of the generated grid identify its vertices
+		same = same && triangleSet(fetchIndices, &fetchVertices) == triangleSet(input, &vertices);
+
+	std::cout << "Same triangles: " << (same ? "yes" : "NO") << std::endl;
+	return same ? 0 : 1;
+}
@@ -0,0 +1,115 @@
+/*
+	Benchmark: draw sorting (renderQueue.hpp), as done in Renderer::buildRenderQueue.
+
+	Random draws (each one with a pipeline, a material, a mesh and a distance to the camera), like a scene with many models sharing a few pipelines and meshes.
+		- radix:		RenderQueue::sort() (LSD radix sort of the 64-bit keys).
+		- std::sort:	std::stable_sort of the same keys (reference).
+		- binds:		pipeline, material and mesh binds needed to record the draws in model order, in state order (SortMode::State) and front to back (SortMode::FrontToBack), counted like Renderer::recordDraws (a bind is skipped when the same object is already bound).
+	Checks that both sorts produce the same order.
+	Usage:	bench_renderqueue [draw count] [pipelines] [materials] [meshes]
+*/
+
+#include <iostream>
+#include <iomanip>
+#include <vector>
+#include <random>
+#include <chrono>
+#include <algorithm>
+#include <cstdlib>
+
+#include "renderQueue.hpp"
+
+
+struct Draw { uint32_t pipeline, material, mesh; float depth; };
+
+template<typename F>
+double measure(int repetitions, F step)
+{
+	auto start = std::chrono::high_resolution_clock::now();
+	for (int r = 0; r < repetitions; r++) step();
+	return std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - start).count() / repetitions;
+}
+
+/// Binds issued to record the draws in this order.
+size_t countBinds(const std::vector<Draw>& draws, const std::vector<DrawItem>& order)
+{
+	size_t binds = 0;
+	const Draw* bound = nullptr;
+	for (const DrawItem& item : order)
+	{
+		const Draw& draw = draws[item.model];
+		binds += !bound || draw.pipeline != bound->pipeline;
+		binds += !bound || draw.material != bound->material;
+		binds += !bound || draw.mesh	 != bound->mesh;
+		bound = &draw;
+	}
+	return binds;
+}
+
+void fill(RenderQueue& queue, const std::vector<Draw>& draws)
+{
+	queue.clear();
+	for (uint32_t d = 0; d < draws.size(); d++)		// Handles start at 1 (0 would be VK_NULL_HANDLE)
+		queue.add(queue.makeKey(0, queue.getState(draws[d].pipeline + 1, draws[d].material + 1, draws[d].mesh + 1), draws[d].depth), d);
+}
+
+int main(int argc, char* argv[])
+{
+	size_t drawCount	 = argc > 1 ? std::strtoul(argv[1], nullptr, 10) : 20000;
+	uint32_t pipelines	 = argc > 2 ? std::strtoul(argv[2], nullptr, 10) : 8;
+	uint32_t materials	 = argc > 3 ? std::strtoul(argv[3], nullptr, 10) : 500;
+	uint32_t meshes		 = argc > 4 ? std::strtoul(argv[4], nullptr, 10) : 200;
+
+	// Draws: each material is used with one pipeline, each mesh with a few materials
+	std::mt19937 rng(1234);
+	std::uniform_int_distribution<uint32_t> material(0, materials - 1), mesh(0, meshes - 1);
+	std::uniform_real_distribution<float> depth(1.f, 2000.f);
+
+	std::vector<Draw> draws(drawCount);
+	for (Draw& draw : draws)
+	{
+		draw.material	= material(rng);
+		draw.pipeline	= draw.material % pipelines;
+		draw.mesh		= mesh(rng);
+		draw.depth		= depth(rng);
+	}
+
+	RenderQueue queue;
+	fill(queue, draws);
+	std::vector<DrawItem> unsorted = queue.getItems();
+
+	// Sort time
+	const int repetitions = 50;
+	std::vector<DrawItem> reference;
+	double radix = measure(repetitions, [&] { fill(queue, draws); queue.sort(); });
+	double fillOnly = measure(repetitions, [&] { fill(queue, draws); });
+	double comparison = measure(repetitions, [&]
+	{
+		reference = unsorted;
+		std::stable_sort(reference.begin(), reference.end(), [](const DrawItem& a, const DrawItem& b) { return a.key < b.key; });
+	});
+
+	fill(queue, draws);
+	queue.sort();
+	bool same = std::equal(reference.begin(), reference.end(), queue.getItems().begin(), [](const DrawItem& a, const DrawItem& b) { return a.key == b.key && a.model == b.model; });
+	size_t stateBinds = countBinds(draws, queue.getItems());
+
+	queue.mode = SortMode::FrontToBack;
+	fill(queue, draws);
+	queue.sort();
+	size_t depthBinds = countBinds(draws, queue.getItems());
+	size_t modelBinds = countBinds(draws, unsorted);
+
+	std::cout	<< drawCount << " draws, " << pipelines << " pipelines, " << materials << " materials, " << meshes << " meshes" << std::endl
+				<< std::fixed << std::setprecision(3)
+				<< "Keys:        " << std::setw(10) << fillOnly << " ms" << std::endl
+				<< "Radix sort:  " << std::setw(10) << radix - fillOnly << " ms" << std::endl
+				<< "std::sort:   " << std::setw(10) << comparison << " ms" << std::endl
+				<< "Same order:  " << std::setw(10) << (same ? "yes" : "NO") << std::endl
+				<< "Binds (pipeline + material + mesh), possible " << 3 * drawCount << ":" << std::endl
+				<< "  model order:  " << std::setw(8) << modelBinds << std::endl
+				<< "  state order:  " << std::setw(8) << stateBinds << std::endl
+				<< "  front to back:" << std::setw(8) << depthBinds << std::endl;
+
+	return same ? 0 : 1;
+}
@@ -0,0 +1,134 @@
+/*
+	Microbenchmark: CPU cost per frame of updating the uniforms of N models.
+
+	- staging:	Previous path. Each multi-instance model builds its UBOs in a heap allocated block (new/delete every frame) and then copies it to the mapped memory. Single-instance models build the UBO on the stack and copy it.
+	- arena:	Current path (UniformArena). Every model writes its UBOs straight into its aligned reservation of the mapped region.
+
+	Mapped memory is simulated with a host allocation of the same layout, so this only measures the CPU side (the vkMapMemory/vkUnmapMemory calls the path before the arena did per model and frame would come on top of "staging").
+	Models alternate between 1 and 4 instances (like the viking rooms in main.cpp).
+*/
+
+#include <iostream>
+#include <iomanip>
+#include <vector>
+#include <chrono>
+#include <cstring>
+#include <cstdint>
+
+#define GLM_FORCE_RADIANS
+#define GLM_FORCE_DEPTH_ZERO_TO_ONE
+#include <glm/glm.hpp>
+#include <glm/gtc/matrix_transform.hpp>
+
+struct UniformBufferObject {
+	alignas(16) glm::mat4 model;
+	alignas(16) glm::mat4 view;
+	alignas(16) glm::mat4 proj;
+};
+
+struct Model
+{
+	size_t instances;
+	size_t offset;			///< Offset of its reservation in the region
+};
+
+const size_t alignment	= 256;		///< Typical minUniformBufferOffsetAlignment
+const size_t uboStride	= alignment * (1 + sizeof(UniformBufferObject) / alignment);
+const int	 frames		= 200;
+
+glm::mat4 modelMatrix(size_t i, float time)
+{
+	return glm::rotate(glm::translate(glm::mat4(1.0f), glm::vec3(i % 100, i / 100, 0.f)), time, glm::vec3(0.f, 0.f, 1.f));
+}
+
+void frameStaging(std::vector<Model>& models, char* mapped, const glm::mat4& view, const glm::mat4& proj, float time)
+{
+	for (size_t m = 0; m < models.size(); m++)
+	{
+		if (models[m].instances == 1)
+		{
+			UniformBufferObject ubo;
+			ubo.model	= modelMatrix(m, time);
+			ubo.view	= view;
+			ubo.proj	= proj;
+			memcpy(mapped + models[m].offset, &ubo, sizeof(ubo));
+		}
+		else
+		{
+			size_t totalBytes = models[m].instances * uboStride;
+			char* data = new char[totalBytes];
+			for (size_t i = 0; i < models[m].instances; i++)
+			{
+				UniformBufferObject* ubo = (UniformBufferObject*)&data[i * uboStride];
+				ubo->model	= modelMatrix(m + i, time);
+				ubo->view	= view;
+				ubo->proj	= proj;
+			}
+			memcpy(mapped + models[m].offset, data, totalBytes);
+			delete[] data;
+		}
+	}
+}
+
+void frameArena(std::vector<Model>& models, char* mapped, const glm::mat4& view, const glm::mat4& proj, float time)
+{
+	for (size_t m = 0; m < models.size(); m++)
+		for (size_t i = 0; i < models[m].instances; i++)
+		{
+			UniformBufferObject* ubo = (UniformBufferObject*)(mapped + models[m].offset + i * uboStride);
+			ubo->model	= modelMatrix(m + i, time);
+			ubo->view	= view;
+			ubo->proj	= proj;
+		}
+}
+
+template<typename F>
+double measure(F frame, std::vector<Model>& models, char* mapped)
+{
+	glm::mat4 view = glm::lookAt(glm::vec3(10.f, 10.f, 10.f), glm::vec3(0.f), glm::vec3(0.f, 0.f, 1.f));
+	glm::mat4 proj = glm::perspective(glm::radians(45.f), 16.f / 9.f, 0.1f, 1000.f);
+
+	frame(models, mapped, view, proj, 0.f);		// Warm up
+
+	auto start = std::chrono::high_resolution_clock::now();
+	for (int f = 0; f < frames; f++)
+		frame(models, mapped, view, proj, f * 0.016f);
+	auto end = std::chrono::high_resolution_clock::now();
+
+	return std::chrono::duration<double, std::micro>(end - start).count() / frames;
+}
+
+int main()
+{
+	std::cout << "Per-frame uniform update cost (" << frames << " frames, UBO stride " << uboStride << " bytes)" << std::endl;
+	std::cout << std::setw(8) << "models" << std::setw(12) << "UBOs" << std::setw(16) << "staging (us)" << std::setw(16) << "arena (us)" << std::setw(10) << "speedup" << std::endl;
+
+	double checksum = 0;
+
+	for (size_t count : { 10, 100, 1000, 5000, 10000 })
+	{
+		std::vector<Model> models(count);
+		size_t regionSize = 0;
+		for (size_t m = 0; m < count; m++)
+		{
+			models[m].instances	= (m % 2) ? 4 : 1;
+			models[m].offset	= regionSize;
+			regionSize		   += models[m].instances * uboStride;
+		}
+
+		std::vector<char> region(regionSize + alignment);
+		char* mapped = region.data() + (alignment - (uintptr_t)region.data() % alignment) % alignment;
+
+		double staging	= measure(frameStaging, models, mapped);
+		double arena	= measure(frameArena, models, mapped);
+		checksum	   += ((float*)mapped)[0];
+
+		std::cout	<< std::setw(8) << count << std::setw(12) << regionSize / uboStride
+					<< std::setw(16) << std::fixed << std::setprecision(1) << staging
+					<< std::setw(16) << arena
+					<< std::setw(9) << std::setprecision(2) << staging / arena << "x" << std::endl;
+	}
+
+	std::cout << "(checksum " << checksum << ")" << std::endl;
+	return 0;
+}
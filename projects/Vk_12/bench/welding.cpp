@@ -0,0 +1,199 @@
+/*
+	Benchmark: vertex welding (deduplication) of an OBJ mesh, as done in modelData::loadModel.
+
+	- unordered_map:	Previous path. Every corner goes through std::unordered_map<Vertex, uint32_t> (node based, one allocation per unique vertex, single thread).
+	- flat (1 thread):	weldVertices() without worker pool (open addressing FlatVertexMap).
+	- flat (N threads):	weldVertices() with a WorkerPool (chunks welded in parallel, then merged deterministically).
+
+	Reports time, throughput (corners per second) and peak heap memory allocated during the welding (outputs included). Every path must produce the same vertices and indices.
+	Usage:	bench_welding [file.obj]		Without arguments, a grid mesh of ~3.6 million triangles is generated in the working directory.
+*/
+
+#include <iostream>
+#include <iomanip>
+#include <fstream>
+#include <vector>
+#include <unordered_map>
+#include <algorithm>
+#include <chrono>
+#include <atomic>
+#include <cstdlib>
+#include <new>
+
+#define GLM_FORCE_RADIANS
+#define GLM_ENABLE_EXPERIMENTAL
+#include <glm/glm.hpp>
+#include <glm/gtx/hash.hpp>
+
+#define TINYOBJLOADER_IMPLEMENTATION
+#include "tiny_obj_loader.h"
+
+#include "welder.hpp"
+
+// Heap usage tracking (current and peak bytes) -------------------------------------------------
+
+static std::atomic<size_t> heapCurrent{ 0 }, heapPeak{ 0 };
+
+void* operator new(size_t size)
+{
+	size_t* p = (size_t*)std::malloc(size + 16);
+	if (!p) throw std::bad_alloc();
+	*p = size;
+	size_t current = heapCurrent += size;
+	size_t peak = heapPeak.load();
+	while (current > peak && !heapPeak.compare_exchange_weak(peak, current));
+	return (char*)p + 16;
+}
+
+void operator delete(void* ptr) noexcept
+{
+	if (!ptr) return;
+	size_t* p = (size_t*)((char*)ptr - 16);
+	heapCurrent -= *p;
+	std::free(p);
+}
+
+void operator delete(void* ptr, size_t) noexcept { operator delete(ptr); }
+
+// Vertex (same layout as in models.hpp) --------------------------------------------------------
+
+struct Vertex
+{
+	glm::vec3 pos;
+	glm::vec3 color;
+	glm::vec2 texCoord;
+
+	bool operator==(const Vertex& other) const { return pos == other.pos && color == other.color && texCoord == other.texCoord; }
+};
+
+template<> struct std::hash<Vertex> {
+	size_t operator()(Vertex const& vertex) const { return ((hash<glm::vec3>()(vertex.pos) ^ (hash<glm::vec3>()(vertex.color) << 1)) >> 1) ^ (hash<glm::vec2>()(vertex.texCoord) << 1); }
+};
+
+// ----------------------------------------------------------------------------------------------
+
+void generateGrid(const char* path, int n)
+{
+	std::ofstream file(path);
+	for (int y = 0; y < n; y++)
+		for (int x = 0; x < n; x++)
+			file << "v " << x * 0.01f << ' ' << y * 0.01f << ' ' << ((x * 7 + y * 13) % 17) * 0.001f << '\n';
+	for (int y = 0; y < n; y++)
+		for (int x = 0; x < n; x++)
+			file << "vt " << x / float(n - 1) << ' ' << y / float(n - 1) << '\n';
+	for (int y = 0; y + 1 < n; y++)
+		for (int x = 0; x + 1 < n; x++)
+		{
+			int a = y * n + x + 1, b = a + 1, c = a + n, d = c + 1;		// OBJ indices start at 1
+			file << "f " << a << '/' << a << ' ' << b << '/' << b << ' ' << d << '/' << d << '\n';
+			file << "f " << a << '/' << a << ' ' << d << '/' << d << ' ' << c << '/' << c << '\n';
+		}
+}
+
+struct Result
+{
+	double					ms;
+	size_t					peakBytes;
+	std::vector<Vertex>		vertices;
+	std::vector<uint32_t>	indices;
+};
+
+template<typename F>
+Result measure(F weld)
+{
+	Result result;
+	heapPeak = heapCurrent.load();
+	size_t base = heapCurrent;
+
+	auto start = std::chrono::high_resolution_clock::now();
+	weld(result.vertices, result.indices);
+	auto end = std::chrono::high_resolution_clock::now();
+
+	result.ms			= std::chrono::duration<double, std::milli>(end - start).count();
+	result.peakBytes	= heapPeak - base;
+	return result;
+}
+
+int main(int argc, char* argv[])
+{
+	const char* path = "bench_welding_grid.obj";
+	if (argc > 1) path = argv[1];
+	else
+	{
+		std::cout << "Generating " << path << "..." << std::endl;
+		generateGrid(path, 1350);
+	}
+
+	tinyobj::attrib_t					attrib;
+	std::vector<tinyobj::shape_t>		shapes;
+	std::vector<tinyobj::material_t>	materials;
+	std::string							warn, err;
+	if (!tinyobj::LoadObj(&attrib, &shapes, &materials, &warn, &err, path))
+	{
+		std::cerr << warn << err << std::endl;
+		return 1;
+	}
+
+	std::vector<size_t> shapeStart(1, 0);
+	for (const auto& shape : shapes)
+		shapeStart.push_back(shapeStart.back() + shape.mesh.indices.size());
+	size_t cornerCount = shapeStart.back();
+
+	auto getVertex = [&](size_t k)
+	{
+		size_t s = std::upper_bound(shapeStart.begin(), shapeStart.end(), k) - shapeStart.begin() - 1;
+		const tinyobj::index_t& index = shapes[s].mesh.indices[k - shapeStart[s]];
+		Vertex vertex{};
+		vertex.pos		= { attrib.vertices[3 * index.vertex_index + 0], attrib.vertices[3 * index.vertex_index + 1], attrib.vertices[3 * index.vertex_index + 2] };
+		vertex.texCoord	= { attrib.texcoords[2 * index.texcoord_index + 0], 1.0f - attrib.texcoords[2 * index.texcoord_index + 1] };
+		vertex.color	= { 1.0f, 1.0f, 1.0f };
+		return vertex;
+	};
+
+	WorkerPool pool;
+
+	std::vector<std::pair<std::string, Result>> results;
+
+	results.push_back({ "unordered_map", measure([&](std::vector<Vertex>& vertices, std::vector<uint32_t>& indices)
+	{
+		std::unordered_map<Vertex, uint32_t> uniqueVertices{};
+		for (size_t k = 0; k < cornerCount; k++)
+		{
+			Vertex vertex = getVertex(k);
+			if (uniqueVertices.count(vertex) == 0)
+			{
+				uniqueVertices[vertex] = static_cast<uint32_t>(vertices.size());
+				vertices.push_back(vertex);
+			}
+			indices.push_back(uniqueVertices[vertex]);
+		}
+	}) });
+
+	results.push_back({ "flat (1 thread)", measure([&](std::vector<Vertex>& vertices, std::vector<uint32_t>& indices)
+	{
+		weldVertices(cornerCount, getVertex, vertices, indices, nullptr);
+	}) });
+
+	results.push_back({ "flat (" + std::to_string(pool.size()) + " threads)", measure([&](std::vector<Vertex>& vertices, std::vector<uint32_t>& indices)
+	{
+		weldVertices(cornerCount, getVertex, vertices, indices, &pool);
+	}) });
+
+	std::cout	<< cornerCount / 3 << " triangles, " << cornerCount << " corners, " << results[0].second.vertices.size() << " unique vertices" << std::endl
+				<< std::setw(20) << "path" << std::setw(12) << "time (ms)" << std::setw(16) << "Mcorners/s" << std::setw(16) << "peak (MB)" << std::setw(10) << "same" << std::endl;
+
+	for (auto& r : results)
+	{
+		bool same = r.second.vertices.size() == results[0].second.vertices.size() &&
+					r.second.indices == results[0].second.indices &&
+					std::equal(r.second.vertices.begin(), r.second.vertices.end(), results[0].second.vertices.begin());
+
+		std::cout	<< std::setw(20) << r.first
+					<< std::setw(12) << std::fixed << std::setprecision(1) << r.second.ms
+					<< std::setw(16) << std::setprecision(1) << cornerCount / (r.second.ms * 1000.)
+					<< std::setw(16) << r.second.peakBytes / (1024. * 1024.)
+					<< std::setw(10) << (same ? "yes" : "NO") << std::endl;
+	}
+
+	return 0;
+}
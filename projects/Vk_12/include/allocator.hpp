@@ -0,0 +1,90 @@
+#ifndef ALLOCATOR_HPP
+#define ALLOCATOR_HPP
+
+#include <vector>
+#include <list>
+#include <map>
+
+#include <vulkan/vulkan.h>
+
+
+/**
+	@brief Free-list manager for a linear range of bytes [0, capacity).
+
+	It hands out aligned sub-ranges (best fit) and merges adjacent free ranges back together when they are released. It doesn't touch any memory, it just does the bookkeeping, so it can be used for suballocating VkDeviceMemory blocks or any other big buffer.
+*/
+class RangeAllocator
+{
+	std::map<VkDeviceSize, VkDeviceSize> freeRanges;	///< Free ranges (offset, size), sorted by offset.
+	VkDeviceSize capacity;								///< Total size of the range.
+	VkDeviceSize used;									///< Bytes currently allocated (alignment padding not included).
+
+public:
+	RangeAllocator(VkDeviceSize capacity = 0);
+
+	bool			allocate(VkDeviceSize size, VkDeviceSize alignment, VkDeviceSize& offset);	///< Find a free sub-range (best fit). Returns false if there's no room for it.
+	void			free(VkDeviceSize offset, VkDeviceSize size);								///< Release a sub-range previously returned by allocate() (same offset and size).
+	void			reset();																	///< Release everything.
+
+	VkDeviceSize	getCapacity() const;
+	VkDeviceSize	getUsed() const;
+	size_t			getFreeRangeCount() const;													///< Number of holes (measures fragmentation).
+	VkDeviceSize	getLargestFreeRange() const;
+};
+
+struct MemoryBlock;
+
+/// Sub-range of a VkDeviceMemory block handed out by MemoryAllocator. Bind resources with memory + offset.
+struct Allocation
+{
+	VkDeviceMemory	memory	= VK_NULL_HANDLE;	///< Memory object (block) that contains this allocation.
+	VkDeviceSize	offset	= 0;				///< Offset (bytes) of the allocation inside the memory object.
+	VkDeviceSize	size	= 0;				///< Size (bytes) of the allocation.
+	void*			mapped	= nullptr;			///< Host address of the allocation. Only for host visible memory (it stays mapped during the whole block lifetime, so vkMapMemory must not be called on it).
+	MemoryBlock*	block	= nullptr;			///< Block that owns this allocation (used for freeing it).
+};
+
+/// Big VkDeviceMemory object that is suballocated by MemoryAllocator.
+struct MemoryBlock
+{
+	VkDeviceMemory	memory			= VK_NULL_HANDLE;
+	VkDeviceSize	size			= 0;
+	uint32_t		memoryType		= 0;		///< Index of the memory type (VkPhysicalDeviceMemoryProperties::memoryTypes).
+	bool			linear			= true;		///< Linear resources (buffers, linear images) and optimal images are kept in different blocks, so bufferImageGranularity never needs to be considered.
+	bool			dedicated		= false;	///< Block created for a single big resource.
+	void*			mapped			= nullptr;	///< Persistent mapping of the whole block (only for host visible memory).
+	size_t			allocationCount	= 0;
+	RangeAllocator	ranges;
+};
+
+/**
+	@brief Block-based device memory allocator.
+
+	Calling vkAllocateMemory for each resource is slow and the number of allocations is limited (maxMemoryAllocationCount, which may be as low as 4096). Instead, we allocate big blocks per memory type and suballocate resources from them (taking care of alignment requirements). Freed ranges are reused. Host visible blocks are persistently mapped.
+*/
+class MemoryAllocator
+{
+	VkPhysicalDevice					physicalDevice	= VK_NULL_HANDLE;
+	VkDevice							device			= VK_NULL_HANDLE;
+	VkPhysicalDeviceMemoryProperties	memProperties;
+	VkDeviceSize						nonCoherentAtomSize;
+
+	std::vector<std::list<MemoryBlock>>	pools;			///< Blocks per (memory type, linear/optimal). Index: 2 * memoryType + (linear ? 0 : 1)
+	size_t								deviceAllocations;	///< Number of vkAllocateMemory calls alive.
+
+	VkDeviceSize	getBlockSize(uint32_t memoryType);
+	MemoryBlock&	createBlock(uint32_t memoryType, bool linear, VkDeviceSize size, bool dedicated);
+	void			destroyBlock(MemoryBlock& block);
+
+public:
+	VkDeviceSize	preferredBlockSize = 64 * 1024 * 1024;	///< Size of new blocks (smaller heaps use heapSize / 8).
+
+	void			init(VkPhysicalDevice physicalDevice, VkDevice device);
+	Allocation		allocate(const VkMemoryRequirements& requirements, VkMemoryPropertyFlags properties, bool linear = true);	///< Suballocate memory for a resource. Linear: buffers and linear images.
+	void			free(Allocation& allocation);
+	uint32_t		findMemoryType(uint32_t typeFilter, VkMemoryPropertyFlags properties);
+	void			printStats();			///< Print blocks, usage and fragmentation per memory type.
+	void			cleanup();
+};
+
+#endif
@@ -0,0 +1,83 @@
+#ifndef BVH_HPP
+#define BVH_HPP
+
+#include <vector>
+#include <cstdint>
+#include <cstddef>
+
+#include <glm/glm.hpp>
+
+#include "culling.hpp"
+#include "workers.hpp"
+
+
+/**
+	Node of a Bvh (32 bytes, 2 per cache line). Children are stored together (right = left + 1) and after their parent in the node array.
+*/
+struct BvhNode
+{
+	float		boundsMin[3];
+	uint32_t	first;			///< Leaf: index of its first object in Bvh::objects. Inner node: index of its left child.
+	float		boundsMax[3];
+	uint32_t	count;			///< Leaf: number of objects (> 0). Inner node: 0.
+
+	bool isLeaf() const { return count != 0; }
+};
+
+/// Result of a ray query.
+struct BvhHit
+{
+	uint32_t	object = UINT32_MAX;	///< Closest object hit (UINT32_MAX if none)
+	float		t	   = 0.f;			///< Distance along the ray to the entry point of its box (in units of the direction vector)
+};
+
+/**
+	@brief Bounding volume hierarchy over the world space boxes of a set of objects (instances), for scenes too big for a linear culling pass.
+
+	build() creates the tree top-down, splitting each node where the surface area heuristic (SAH) is lowest among a few candidate planes per axis (binning). The top of the tree is built by the calling thread, and the subtrees below it are built in parallel by a WorkerPool.
+	When objects move, update() their boxes and refit() the tree: only the leaves of the moved objects and their ancestors are recomputed. The tree topology is kept, so if many objects travel far the queries get slower and a new build() is worth it.
+	Queries: objects inside a view frustum (nodes fully inside aren't tested any more), closest object hit by a ray (boxes only), and objects overlapping a box. Frustum queries and ray batches can also run in parallel.
+	The nodes are a flattened array in depth-first order, so traversals go forward in memory most of the time.
+*/
+class Bvh
+{
+	std::vector<BvhNode>	nodes;				///< nodes[0] is the root
+	std::vector<uint32_t>	objects;			///< Object indices, grouped by leaf
+	std::vector<glm::vec3>	objectMin, objectMax;	///< Box of each object
+	std::vector<uint32_t>	parents;			///< Parent of each node (UINT32_MAX for the root)
+	std::vector<uint32_t>	objectLeaf;			///< Leaf containing each object
+	std::vector<uint32_t>	dirtyObjects;		///< Objects updated since the last refit()
+	std::vector<uint8_t>	dirtyNodes;			///< Marks of refit() (all 0 between calls)
+
+	struct BuildTask { uint32_t node, begin, end; int depth; };	///< Subtree left for a worker: node owning objects[begin, end)
+
+	void	buildNode(std::vector<BvhNode>& out, uint32_t node, uint32_t begin, uint32_t end, int depth, std::vector<BuildTask>* pending, size_t pendingLimit);
+	bool	split(const glm::vec3& boundsMin, const glm::vec3& boundsMax, uint32_t begin, uint32_t end, uint32_t& middle);	///< Partition objects[begin, end) around the best SAH plane (objects[begin, middle) go left). Returns false if the node should be a leaf.
+	void	linkNodes();							///< Compute parents and objectLeaf
+	void	setBounds(uint32_t node);				///< Recompute the bounds of a node from its objects (leaf) or children
+	void	subtreeObjects(uint32_t node, std::vector<uint32_t>& result) const;	///< Append every object of a subtree
+	void	frustumTraverse(const Frustum& frustum, uint32_t root, std::vector<uint32_t>& result) const;
+
+public:
+	static const uint32_t	maxLeafSize = 4;		///< Nodes with this many objects or less may become leaves
+	static const uint32_t	binCount	= 16;		///< Candidate split planes per axis (+1)
+
+	/// Build the tree from scratch. Object i has the box [boxMin[i], boxMax[i]]. workers (optional) build the subtrees in parallel.
+	void	build(const glm::vec3* boxMin, const glm::vec3* boxMax, size_t objectCount, WorkerPool* workers = nullptr);
+	void	clear();
+
+	size_t	size() const { return objectMin.size(); }	///< Number of objects
+	size_t	nodeCount() const { return nodes.size(); }
+	int		depth() const;
+
+	void	update(uint32_t object, const glm::vec3& boxMin, const glm::vec3& boxMax);	///< Change the box of an object (takes effect in the next refit()).
+	void	refit();								///< Recompute the bounds of the nodes containing updated objects.
+
+	/// Append to result the objects whose box is (at least partially) inside the frustum. The order depends on the tree (sort it if needed). workers (optional) traverse the subtrees in parallel.
+	void	queryFrustum(const Frustum& frustum, std::vector<uint32_t>& result, WorkerPool* workers = nullptr) const;
+	BvhHit	queryRay(const glm::vec3& origin, const glm::vec3& direction, float maxT = 1e30f) const;	///< Closest object whose box is hit by the ray, with t in [0, maxT].
+	void	queryRays(const glm::vec3* origins, const glm::vec3* directions, BvhHit* hits, size_t rayCount, float maxT = 1e30f, WorkerPool* workers = nullptr) const;	///< queryRay() for a batch of rays (in parallel, if workers are provided).
+	void	queryBox(const glm::vec3& boxMin, const glm::vec3& boxMax, std::vector<uint32_t>& result) const;	///< Append to result the objects whose box overlaps [boxMin, boxMax].
+};
+
+#endif
@@ -0,0 +1,58 @@
+#ifndef CULLING_HPP
+#define CULLING_HPP
+
+#include <vector>
+#include <cstdint>
+#include <cstddef>
+
+#include <glm/glm.hpp>
+
+
+/// View frustum: 6 planes (xyz: normal pointing inside, w: distance), so a point p is inside if dot(xyz, p) + w >= 0 for every plane.
+struct Frustum
+{
+	glm::vec4 planes[6];		///< Left, right, bottom, top, near, far.
+
+	Frustum() = default;
+	Frustum(const glm::mat4& viewProj);		///< Extract the planes from a projection * view matrix (Gribb & Hartmann).
+};
+
+/// Visible and culled objects in the last culling pass.
+struct CullingStats
+{
+	size_t visible = 0;
+	size_t culled  = 0;
+};
+
+/// World space axis aligned box of a model space box [boxMin, boxMax] transformed by an affine matrix (absolute value of the matrix times the extents).
+void transformBox(const glm::vec3& boxMin, const glm::vec3& boxMax, const glm::mat4& modelMatrix, glm::vec3& worldMin, glm::vec3& worldMax);
+
+/**
+	@brief World space bounding volumes of a set of objects (instances), tested against a view frustum.
+
+	Each object has a bounding box and a bounding sphere. For each plane, the object is outside if it's behind the plane by more than the smaller of the 2 projected radii (sphere radius, or box extents projected on the plane normal). So the test is as tight as the tighter volume, for the cost of one test.
+	The data is stored as a structure of arrays (one array per component), so cull() tests 4 objects per iteration with SSE (8 with AVX, if the compiler targets it). The arrays are padded with objects that are always culled, so there's no scalar remainder loop.
+*/
+class CullingSet
+{
+	std::vector<float>	centerX, centerY, centerZ;		///< Center of the box (and the sphere)
+	std::vector<float>	extentX, extentY, extentZ;		///< Half size of the box
+	std::vector<float>	radius;							///< Radius of the sphere
+	size_t				count = 0;
+
+public:
+	static const size_t width = 8;						///< Padding of the arrays (widest SIMD register, in floats)
+
+	void	resize(size_t objectCount);
+	size_t	size() const { return count; }
+
+	/**
+		Set the bounds of object i. The model space bounds are a box [boxMin, boxMax] and a sphere centered in the box with radius sphereRadius. The box is transformed exactly as an affine box (absolute value of the matrix times the extents), and the sphere radius is scaled by the largest axis scale.
+	*/
+	void	set(size_t i, const glm::vec3& boxMin, const glm::vec3& boxMax, float sphereRadius, const glm::mat4& modelMatrix);
+
+	size_t	cull(const Frustum& frustum, uint32_t* visible) const;			///< Write the indices of the visible objects (in increasing order) in visible (room for size() indices). Returns the number of visible objects.
+	size_t	cullScalar(const Frustum& frustum, uint32_t* visible) const;	///< Same as cull(), one object at a time (reference for testing and benchmarking).
+};
+
+#endif
@@ -8,6 +8,15 @@
 #define GLFW_INCLUDE_VULKAN			// Makes GLFW load the Vulkan header with it
 #include "GLFW/glfw3.h"
 
+#include "allocator.hpp"
+#include "uploader.hpp"
+#include "uniforms.hpp"
+#include "stateCache.hpp"
+#include "textures.hpp"
+#include "geometry.hpp"
+#include "materials.hpp"
+#include "workers.hpp"
+
 #define DEGUB						// Standards: NDEBUG, _DEBUG
 #ifdef RELEASE
 const bool enableValidationLayers = false;
@@ -38,30 +47,47 @@ class VulkanEnvironment
 {
 	// Private parameters:
 
-	bool printInfo = false;
-
 	const uint32_t WIDTH  = 1920 / 2;	// <<< Does this change when recreating swap chain?
 	const uint32_t HEIGHT = 1080 / 2;
 
+	const char* pipelineCacheFile = "pipeline_cache.bin";		///< Pipeline cache file (relative to the working directory).
+	const uint32_t offscreenImageCount = 3;						///< Headless mode: number of offscreen color images (like a swap chain with minImageCount + 1 images).
+
 	const std::vector<const char*> requiredValidationLayers = {	"VK_LAYER_KHRONOS_validation" };
 	const std::vector<const char*> requiredDeviceExtensions = { VK_KHR_SWAPCHAIN_EXTENSION_NAME };	// Swap chain: Queue of images that are waiting to be presented to the screen. Our application will acquire such an image to draw to it, and then return it to the queue. Its general purpose is to synchronize the presentation of images with the refresh rate of the screen.
 
 public:
 	// Public parameters:
 
+	bool printInfo = false;				// Print information about the device, the swap chain and the loaded models (mesh optimization, LODs, meshlets).
 	const bool add_MSAA = true;			// Shader MSAA (MultiSample AntiAliasing) <<<<<
+	const bool usePipelineCache = true;	// Create pipelines through a pipeline cache saved to disk (faster startup after the first run). Set to false for measuring creation time without cache.
+	const bool useMeshCache		= true;	// Load models from their binary mesh cache (<model>.mesh, written the first time an OBJ is parsed).
+	const bool optimizeMeshes	= true;	// Reorder triangles and vertices of loaded meshes for the post-transform vertex cache and vertex fetch (done once, before writing the mesh cache).
+	const bool generateLods		= true;	// Generate simplified levels of detail of loaded meshes (done once, before writing the mesh cache). Renderer selects one per instance and frame.
+	const bool reduceOverdraw	= true;	// When optimizing meshes, also sort clusters of triangles so that outer surfaces are drawn first (slightly worse vertex cache, less overdraw).
+	const bool buildMeshlets	= true;	// Split loaded meshes into meshlets (small clusters of triangles with bounds for culling) (done once, before writing the mesh cache). Renderer culls them for single-draw models.
+	const bool gpuDriven		= false;// GPU-driven rendering: every mesh goes to one vertex and one index buffer (geometry), and Renderer culls the instances and selects their LODs in a compute shader that writes indirect draws (see GpuScene). Every model must use a vertex shader compiled from triangleV_gpu.vert.
+	const bool compressTextures	= true;	// Load textures block compressed (BC1/BC3, BC7 or BC5) with mipmaps precomputed on the CPU, from their texture cache (<texture>.tex, written by texconv or the first time a texture is loaded): no decoding and no mipmap blits at startup, and 4-8 times less memory. Only if the device supports BC formats (textureCompressionBC); otherwise, they are loaded as before.
+	const bool bindless			= false;// Bindless materials: every texture in one descriptor array and every material in one storage buffer (see MaterialTable), so models don't need a texture descriptor per model. Requires Vulkan 1.2 (descriptor indexing). Every model must use a fragment shader compiled from triangleF_bindless.frag (triangleF_bindless_gpu.spv if gpuDriven).
 	const bool add_SS   = true;			// Sample shading. This can solve some problems from shader MSAA (example: only smoothens out edges of geometry but not the interior filling) (https://www.khronos.org/registry/vulkan/specs/1.0/html/vkspec.html#primsrast-sampleshading).
 
-	VulkanEnvironment();
+	const bool headless;				// Headless mode: no window, surface nor swap chain. Frames are rendered into offscreen color images (swapChainImages) with the same render pass and framebuffers, so it works with any ICD, including software ones without presentation support (lavapipe, SwiftShader; select one with VK_ICD_FILENAMES).
+
+	VulkanEnvironment(bool headless = false);
 
 	// Public methods:
 
-	void			createImage(uint32_t width, uint32_t height, uint32_t mipLevels, VkSampleCountFlagBits numSamples, VkFormat format, VkImageTiling tiling, VkImageUsageFlags usage, VkMemoryPropertyFlags properties, VkImage& image, VkDeviceMemory& imageMemory);
+	void			createImage(uint32_t width, uint32_t height, uint32_t mipLevels, VkSampleCountFlagBits numSamples, VkFormat format, VkImageTiling tiling, VkImageUsageFlags usage, VkMemoryPropertyFlags properties, VkImage& image, Allocation& imageMemory);
 	uint32_t		findMemoryType(uint32_t typeFilter, VkMemoryPropertyFlags properties);	///< Finds the right type of memory to use, depending upon the requirements of the buffer and our own application requiremnts.
 	void			transitionImageLayout(VkImage image, VkFormat format, VkImageLayout oldLayout, VkImageLayout newLayout, uint32_t mipLevels);
 	VkCommandBuffer	beginSingleTimeCommands();
 	void			endSingleTimeCommands(VkCommandBuffer commandBuffer);
 	VkImageView		createImageView(VkImage image, VkFormat format, VkImageAspectFlags aspectFlags, uint32_t mipLevels);
+	QueueFamilyIndices findQueueFamilies(VkPhysicalDevice device);			///< Get the indices of the queue families we need (graphics, present). Also used for creating command pools outside the environment.
+	VkPipeline		createGraphicsPipeline(const VkGraphicsPipelineCreateInfo& pipelineInfo);	///< Create a graphics pipeline through the pipeline cache and account its creation time.
+	void			printPipelineStats();													///< Print the number of pipelines created, their creation time and the pipeline cache state (warm/cold).
+	void			readOffscreenImage(uint32_t imageIndex, std::vector<uint8_t>& pixels);	///< Headless mode: copy an offscreen image (RGBA8, swapChainExtent, rows top to bottom) to host memory. Its frame must have finished.
 
 	void			DestroyDebugUtilsMessengerEXT(VkInstance instance, VkDebugUtilsMessengerEXT debugMessenger, const VkAllocationCallbacks* pAllocator);
 	void			recreateSwapChain();
@@ -70,7 +96,7 @@ public:
 
 	// Main member variables:
 
-	GLFWwindow* window;												///< Opaque window object.
+	GLFWwindow* window = nullptr;									///< Opaque window object (nullptr in headless mode).
 
 	VkInstance					 instance;							///< Opaque handle to an instance object. There is no global state in Vulkan and all per-application state is stored here.
 	VkDebugUtilsMessengerEXT	 debugMessenger;					///< Opaque handle to a debug messenger object (the debug callback is part of it).
@@ -89,22 +115,42 @@ public:
 	std::vector<VkImage>		 swapChainImages;					///< List. Opaque handle to an image object.
 	std::vector<VkImageView>	 swapChainImageViews;				///< List. Opaque handle to an image view object. It allows to use VkImage in the render pipeline. It's a view into an image; it describes how to access the image and which part of the image to access.
 	std::vector<VkFramebuffer>	 swapChainFramebuffers;				///< List. Opaque handle to a framebuffer object.
+	std::vector<Allocation>		 offscreenImageMemory;				///< Headless mode: memory of the offscreen images (swapChainImages), suballocated from memAllocator.
 
 	VkRenderPass				 renderPass;						///< Opaque handle to a render pass object.
 
+	MemoryAllocator				 memAllocator;						///< Suballocates device memory for every buffer and image (avoids one vkAllocateMemory per resource).
+
 	VkCommandPool				 commandPool;						///< Opaque handle to a command pool object. It manages the memory that is used to store the buffers, and command buffers are allocated from them. 
+	UploadManager				 uploader;							///< Batches the transfers of data to device local buffers and images (staging ring + fences).
+	UniformArena				 uniforms;							///< Persistently mapped uniform buffer with a region per swap chain image. Models write their UBOs straight into it.
+	StateCache					 states;							///< Pipelines, pipeline layouts, descriptor set layouts, shader modules and samplers shared among models.
+	TextureCache				 textures;							///< Textures shared among models (one image per file and format).
+	VkPipelineCache				 pipelineCache;						///< Pipeline cache (loaded from pipelineCacheFile at startup and saved on cleanup). VK_NULL_HANDLE if usePipelineCache == false.
+	bool						 pipelineCacheWarm;					///< The pipeline cache was loaded from disk (and it's valid for this device and driver).
+	size_t						 pipelinesCreated;					///< Number of graphics pipelines created.
+	double						 pipelineCreationTime;				///< Total time (ms) spent in vkCreateGraphicsPipelines.
+	VkDescriptorSetLayout		 globalDescriptorSetLayout;			///< Layout of the descriptor set 0 (per-frame data shared by every model: camera, time...). Descriptor set 1 is per model.
+	GeometryArena				 geometry;							///< Vertex and index buffer shared by every model (only if gpuDriven).
+	MaterialTable				 materials;							///< Texture array and material buffer shared by every model (only if bindless).
+	WorkerPool					 meshWorkers;						///< Threads for welding big meshes (modelData::loadModel). Shared by every model: the loaders (startup threads, streaming thread) take turns.
+	bool						 multiDrawIndirect;					///< gpuDriven: the multiDrawIndirect feature is enabled (several indirect draws per call).
+	PFN_vkCmdDrawIndexedIndirectCountKHR vkCmdDrawIndexedIndirectCount = nullptr;	///< gpuDriven: VK_KHR_draw_indirect_count is enabled (the number of draws is read from a buffer). nullptr if it's not supported.
+	bool						 textureCompressionBC;				///< compressTextures: the textureCompressionBC feature is enabled (textures are loaded block compressed).
+	bool						 pipelineStatisticsQuery;			///< The pipelineStatisticsQuery feature is enabled (used by the Renderer's profiler, if available).
 
 	VkImage						 colorImage;						///< For MSAA
-	VkDeviceMemory				 colorImageMemory;					///< For MSAA
+	Allocation					 colorImageMemory;					///< For MSAA
 	VkImageView					 colorImageView;					///< For MSAA
 
 	VkImage						 depthImage;						///< Depth buffer (image object).
-	VkDeviceMemory				 depthImageMemory;					///< Depth buffer memory (memory object).
+	Allocation					 depthImageMemory;					///< Depth buffer memory (suballocated from memAllocator).
 	VkImageView					 depthImageView;					///< Depth buffer image view (images are accessed through image views rather than directly).
 
 	// Additional variables
 
 	VkDeviceSize				 minUniformBufferOffsetAlignment;	///< Useful for aligning dynamic descriptor sets (usually == 32 or 256)
+	VkDeviceSize				 minStorageBufferOffsetAlignment;	///< Offsets of storage buffer descriptors must be multiples of it.
 
 private:
 	// Main methods:
@@ -116,9 +162,13 @@ private:
 	void pickPhysicalDevice();				///< Look for and select a graphics card in the system that supports the features we need.
 	void createLogicalDevice();				///< Set up a logical device (describes the features we want to use) to interface with the physical device.
 	void createSwapChain();					///< Set up and create the swap chain.
+	void createOffscreenImages();			///< Headless mode: create the offscreen color images that take the place of the swap chain images.
 	void createImageViews();				///< Creates a basic image view for every image in the swap chain so that we can use them as color targets later on.
 	void createRenderPass();				///< Tells Vulkan the framebuffer attachments that will be used while rendering (color, depth, multisampled images). A render-pass denotes more explicitly how your rendering happens.
 
+	void createPipelineCache();				///< Create the pipeline cache. Initial data is loaded from disk if it was saved by the same device and driver.
+	void savePipelineCache();				///< Serialize the pipeline cache to disk (with a header for validating it later).
+	void createGlobalDescriptorSetLayout();	///< Layout for the descriptor set 0 (global UBO). Every pipeline layout starts with it, so the set is bound once per frame and stays bound across pipeline changes.
 	void createCommandPool();				///< Commands in Vulkan (drawing, memory transfers, etc.) are not executed directly using function calls, you have to record all of the operations you want to perform in command buffer objects. After setting up the drawing commands, just tell Vulkan to execute them in the main loop.
 	void createColorResources();			///< Create resources needed for MSAA (MultiSampling AntiAliasing). Create a multisampled color buffer.
 	void createDepthResources();			///< Create depth buffer.
@@ -134,8 +184,10 @@ private:
 	static VKAPI_ATTR VkBool32 VKAPI_CALL debugCallback(VkDebugUtilsMessageSeverityFlagBitsEXT messageSeverity, VkDebugUtilsMessageTypeFlagsEXT messageType, const VkDebugUtilsMessengerCallbackDataEXT* pCallbackData, void* pUserData);	///< Callback for handling ourselves the validation layer's debug messages and decide which kind of messages to see.
 	int						isDeviceSuitable(VkPhysicalDevice device, const int mode);	///< Evaluate a device and check if it is suitable for the operations we want to perform.
 	VkSampleCountFlagBits	getMaxUsableSampleCount(bool getMinimum = false);	///< Get the maximum number of samples (for MSAA) according to the physical device.
-	QueueFamilyIndices		findQueueFamilies(VkPhysicalDevice device);
 	bool					checkDeviceExtensionSupport(VkPhysicalDevice device);
+	bool					isDeviceExtensionAvailable(VkPhysicalDevice device, const char* extension);	///< Check whether an optional device extension is supported.
+	bool					supportsBindless(VkPhysicalDevice device);	///< Check the features required by bindless (Vulkan 1.2 descriptor indexing: non-uniform indexing of partially bound texture arrays updated after bind).
+	bool					supportsGpuDriven(VkPhysicalDevice device);	///< Check the features required by gpuDriven (indirect draws with firstInstance, and compute on the graphics queue).
 	SwapChainSupportDetails	querySwapChainSupport(VkPhysicalDevice device);
 	VkSurfaceFormatKHR		chooseSwapSurfaceFormat(const std::vector<VkSurfaceFormatKHR>& availableFormats);	///< Chooses the surface format (color depth) for the swap chain.
 	VkPresentModeKHR		chooseSwapPresentMode(const std::vector<VkPresentModeKHR>& availablePresentModes);	///< Chooses the presentation mode (conditions for "swapping" images to the screen) for the swap chain.
@@ -144,6 +196,7 @@ private:
 	VkFormat				findSupportedFormat(const std::vector<VkFormat>& candidates, VkImageTiling tiling, VkFormatFeatureFlags features);	///< Take a list of candidate formats in order from most desirable to least desirable, and checks which is the first one that is supported.
 	bool					hasStencilComponent(VkFormat format);
 	VkDeviceSize			getMinUniformBufferOffsetAlignment();
+	VkDeviceSize			getMinStorageBufferOffsetAlignment();
 };
 
 #endif
\ No newline at end of file
@@ -0,0 +1,48 @@
+#ifndef GEOMETRY_HPP
+#define GEOMETRY_HPP
+
+#include <vulkan/vulkan.h>
+
+#include "allocator.hpp"
+#include "uploader.hpp"
+
+
+/**
+	@brief One device local vertex buffer and one index buffer shared by every model (GPU-driven rendering).
+
+	Each model suballocates its vertices and indices from them, so the whole scene is drawn with a single vertex and index buffer binding and the draws can be generated on the GPU (indirect draws only need the ranges: vertexOffset and firstIndex).
+	Vertex ranges start at a multiple of their vertex size, so vertexOffset = offset / stride works with the buffer bound at offset 0 even when models use different vertex layouts (Vertex, PackedVertex). Indices are always 32-bit.
+	Ranges can be released and reused (RangeAllocator), so models can be added and removed at run time.
+*/
+class GeometryArena
+{
+	VkDevice			device		= VK_NULL_HANDLE;
+	MemoryAllocator*	allocator	= nullptr;
+	UploadManager*		uploader	= nullptr;
+	RangeAllocator		vertexRanges;
+	RangeAllocator		indexRanges;				///< In bytes (multiples of 4)
+
+	void			createBuffer(VkDeviceSize size, VkBufferUsageFlags usage, VkBuffer& buffer, Allocation& memory);
+
+public:
+	VkDeviceSize		vertexCapacity	= 128 * 1024 * 1024;	///< Bytes of the vertex buffer. Set before init().
+	VkDeviceSize		indexCapacity	= 64 * 1024 * 1024;		///< Bytes of the index buffer. Set before init().
+
+	VkBuffer			vertexBuffer	= VK_NULL_HANDLE;
+	Allocation			vertexMemory;
+	VkBuffer			indexBuffer		= VK_NULL_HANDLE;
+	Allocation			indexMemory;
+
+	void			init(VkDevice device, MemoryAllocator* allocator, UploadManager* uploader);
+	void			cleanup();
+
+	VkDeviceSize	addVertices(const void* data, VkDeviceSize size, VkDeviceSize stride);	///< Copy vertices into the buffer (through the uploader). Returns their offset in bytes (a multiple of stride).
+	uint32_t		addIndices(const uint32_t* indices, uint32_t count);						///< Copy indices into the buffer (through the uploader). Returns the position of the first one.
+	void			releaseVertices(VkDeviceSize offset, VkDeviceSize size);
+	void			releaseIndices(uint32_t firstIndex, uint32_t count);
+
+	VkDeviceSize	getUsedVertexBytes() const;
+	VkDeviceSize	getUsedIndexBytes() const;
+};
+
+#endif
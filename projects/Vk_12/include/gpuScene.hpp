@@ -0,0 +1,127 @@
+#ifndef GPUSCENE_HPP
+#define GPUSCENE_HPP
+
+#include <vector>
+#include <list>
+
+#include "environment.hpp"
+#include "models.hpp"
+
+
+/// Per-instance data in the instance table (std430). Read by the culling shader and the vertex shader (triangleV_gpu.vert).
+struct GpuInstance
+{
+	glm::mat4	model;				///< Matrix for the vertex shader (it includes the dequantization of packed vertices).
+	glm::vec4	sphere;				///< World space bounding sphere (center, radius), for culling and LOD selection.
+	uint32_t	firstDraw;			///< First draw command of its model (one per LOD).
+	uint32_t	lodCount;
+	uint32_t	materialIndex;		///< Bindless materials (VulkanEnvironment::bindless): material of its model.
+	uint32_t	padding;
+};
+
+/// Per-frame parameters of the culling shader (uniform buffer, std140).
+struct GpuCullParams
+{
+	alignas(16) glm::vec4	planes[6];			///< Frustum planes (world space).
+	alignas(16) glm::vec4	camPos;
+	alignas(16) glm::vec4	lodScreenSizes;		///< LOD thresholds (see Renderer::selectLod).
+	float					tanHalfFov;
+	float					lodHysteresis;
+	uint32_t				lodThresholdCount;
+	uint32_t				objectCount;
+	uint32_t				drawCount;
+	uint32_t				useCulling;
+	uint32_t				useLods;
+};
+
+/**
+	@brief GPU-driven rendering: instance table, compute culling and indirect draws (VulkanEnvironment::gpuDriven).
+
+	Every instance of every model is an entry of a storage buffer (GpuInstance), and every LOD of every model has an indirect draw command (VkDrawIndexedIndirectCommand) over the shared vertex and index buffers (e.geometry). Each frame, the command buffer:
+		- Resets the instance counts of the draws (copy from a template).
+		- Cull pass (cull.comp, one invocation per instance): frustum test, LOD selection, and atomic append of the instance to the visible list range of the draw of its LOD (draw.firstInstance is the start of that range).
+		- Compact pass (one invocation per draw): the draws with instances are moved to the front of the draws of their model and counted.
+		- One vkCmdDrawIndexedIndirectCount per model (count read from the buffer). Without VK_KHR_draw_indirect_count, one vkCmdDrawIndexedIndirect with the draws of every LOD (empty ones draw nothing).
+	The vertex shader fetches the model matrix with visible[gl_InstanceIndex].
+	Nothing of this depends on what is visible, so the command buffers are recorded once. The CPU only writes the instances whose matrix changed (setInstance()) and the culling parameters: its cost per frame doesn't grow with the number of visible objects or draws.
+	Every buffer written by the GPU has a region per swap chain image (like the uniform arena), except the LOD of each instance, which is kept between frames (for the hysteresis).
+*/
+class GpuScene
+{
+	/// Sub-ranges of a region of the frame buffer (one region per swap chain image).
+	struct FrameLayout
+	{
+		VkDeviceSize draws;			///< Draw commands (one per LOD of each model). Their instanceCount is the number of visible instances.
+		VkDeviceSize compacted;		///< Draw commands with instances, at the front of the draws of their model.
+		VkDeviceSize counts;		///< Number of compacted draws of each model.
+		VkDeviceSize visible;		///< Visible instances (index in the instance table). Each draw has a range with room for every instance of its model.
+		VkDeviceSize size;			///< Size of a region.
+	};
+
+	/// Draws of a model: [firstDraw, firstDraw + lodCount).
+	struct ModelDraws
+	{
+		uint32_t firstDraw;
+		uint32_t lodCount;
+	};
+
+	VulkanEnvironment*				e			= nullptr;
+
+	std::vector<GpuInstance>		instances;				///< CPU copy of the instance table.
+	std::vector<VkDrawIndexedIndirectCommand> drawTemplate;	///< Draw commands with instanceCount = 0.
+	std::vector<ModelDraws>			modelDraws;				///< Draws of each model (models in list order).
+	uint32_t						visibleCapacity;		///< Size of the visible list (sum of the instances of the model of each draw).
+
+	std::vector<std::vector<uint32_t>> dirtyInstances;		///< Instances changed since the instance buffer region of each swap chain image was last written.
+	std::vector<bool>				fullUpload;				///< The whole region of each swap chain image must be written.
+
+	VkDeviceSize					paramsOffset;			///< Reservation of the culling parameters in the uniform arena.
+
+	VkBuffer						templateBuffer;			///< drawTemplate (device local, copied to the draws every frame).
+	Allocation						templateMemory;
+	VkBuffer						drawInfoBuffer;			///< Model and first draw of each draw (device local), for the compact pass.
+	Allocation						drawInfoMemory;
+	VkBuffer						lodBuffer;				///< Current LOD of each instance (device local, shared by every frame).
+	Allocation						lodMemory;
+
+	FrameLayout						layout;
+	VkDeviceSize					instanceRegionSize;
+	VkBuffer						instanceBuffer;			///< Instance table (host visible, persistently mapped). A region per swap chain image.
+	Allocation						instanceMemory;
+	VkBuffer						frameBuffer;			///< Buffers written by the culling shader (device local). A region per swap chain image.
+	Allocation						frameMemory;
+
+	VkShaderModule					cullShader;
+	VkDescriptorSetLayout			descriptorSetLayout;
+	VkPipelineLayout				pipelineLayout;
+	VkPipeline						cullPipeline;			///< Specialization COMPACT = 0
+	VkPipeline						compactPipeline;		///< Specialization COMPACT = 1
+	VkDescriptorPool				descriptorPool;
+	std::vector<VkDescriptorSet>	descriptorSets;			///< One per swap chain image.
+
+	void		createBuffer(VkDeviceSize size, VkBufferUsageFlags usage, VkMemoryPropertyFlags properties, VkBuffer& buffer, Allocation& memory);
+	void		createPipelines(const char* cullShaderPath);
+	VkPipeline	createPipeline(uint32_t compact);
+	void		createDescriptorSets(uint32_t imageCount);
+	uint32_t	groupCount(size_t invocations);			///< Workgroups for a dispatch (64 invocations each, like cull.comp).
+	VkDeviceSize align(VkDeviceSize size);					///< Round up to minStorageBufferOffsetAlignment.
+
+public:
+	void	init(VulkanEnvironment& environment, std::list<modelData>& models, const char* cullShaderPath);	///< Build the instance table and the draws of the models (call it after their uploads are recorded) and the per-frame resources.
+	void	createFrameResources();					///< Per swap chain image: instance buffer, frame buffer and descriptor sets.
+	void	destroyFrameResources();
+	void	cleanup();
+
+	void	setInstance(size_t object, const glm::mat4& model, const glm::vec4& sphere);	///< New matrix and world bounding sphere of an instance (objects: instances of every model, models in list order).
+	void	update(uint32_t imageIndex, const GpuCullParams& params);					///< Write the changed instances and the culling parameters of a swap chain image (after waiting for its fence). objectCount and drawCount are filled here.
+
+	void	recordCulling(VkCommandBuffer commandBuffer, uint32_t imageIndex);			///< Record the reset, the culling and compaction passes and the barriers (outside the render pass).
+	void	recordDraws(VkCommandBuffer commandBuffer, uint32_t imageIndex, std::list<modelData>& models);	///< Record the indirect draws (inside the render pass, with the global descriptor set bound).
+
+	VkDescriptorBufferInfo getInstanceBufferInfo(uint32_t imageIndex) const;	///< Instance table of a swap chain image (global descriptor set, binding 1).
+	VkDescriptorBufferInfo getVisibleBufferInfo(uint32_t imageIndex) const;		///< Visible list of a swap chain image (global descriptor set, binding 2).
+	size_t	getObjectCount() const	{ return instances.size(); }
+	size_t	getDrawCount() const	{ return drawTemplate.size(); }
+};
+
+#endif
@@ -14,7 +14,7 @@ class Input
 public:
 	Camera cam;
 
-	Input(GLFWwindow* window);
+	Input(GLFWwindow* window);		///< window may be nullptr (headless mode): then, there are no callbacks and cam must not process input.
 
 	bool framebufferResized = false;	///< Many drivers/platforms trigger VK_ERROR_OUT_OF_DATE_KHR after window resize, but it's not guaranteed. This variable handles resizes explicitly.
 
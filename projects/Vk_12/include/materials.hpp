@@ -0,0 +1,66 @@
+#ifndef MATERIALS_HPP
+#define MATERIALS_HPP
+
+#include <vector>
+#include <unordered_map>
+#include <mutex>
+
+#include <vulkan/vulkan.h>
+#include <glm/glm.hpp>
+
+#include "allocator.hpp"
+
+
+/// Entry of the material buffer (std430). Read by the fragment shader (triangleF_bindless.frag).
+struct Material
+{
+	uint32_t	textureIndex;		///< Element of the texture array
+	uint32_t	padding[3];
+	glm::vec4	baseColor;			///< Multiplies the texture color
+};
+
+/**
+	@brief Bindless materials (VulkanEnvironment::bindless): every texture in one descriptor array, and every material in one storage buffer.
+
+	A single descriptor set (set 2 of every model pipeline layout) has a large array of combined image samplers (binding 0) and the material buffer (binding 1). It's bound once per command buffer, and shaders pick their material by index (push constant, or instance data in GPU-driven mode), so changing materials between draws costs no descriptor binds and draws with different textures can be merged.
+	It uses descriptor indexing (core in Vulkan 1.2): the array is partially bound (only the elements in use must be valid), and updated after bind (textures can be added while the set is bound in command buffers that are recorded or in flight, as long as they don't use the new elements).
+	Textures are ref-counted by image view (models sharing a texture share its element). Freed elements and materials are reused.
+*/
+class MaterialTable
+{
+	VkDevice			device		= VK_NULL_HANDLE;
+	MemoryAllocator*	allocator	= nullptr;
+	std::mutex			mtx;
+
+	VkDescriptorPool	descriptorPool;
+	VkBuffer			materialBuffer;				///< Host visible and coherent (persistently mapped): materials are written straight into it.
+	Allocation			materialMemory;
+
+	std::unordered_map<VkImageView, uint32_t> textureIndices;	///< Element of each texture
+	std::vector<VkImageView>	textureViews;		///< Texture of each element (VK_NULL_HANDLE if free)
+	std::vector<uint32_t>		textureRefs;		///< Materials using each element
+	std::vector<uint32_t>		freeTextures;
+	std::vector<Material>		materials;			///< CPU copy of the buffer
+	std::vector<uint32_t>		freeMaterials;
+	size_t						materialCount = 0;	///< Materials in use
+
+	uint32_t	addTexture(VkImageView view, VkSampler sampler);
+
+public:
+	uint32_t				maxTextures		= 4096;		///< Elements of the texture array. Set before init().
+	uint32_t				maxMaterials	= 4096;		///< Capacity of the material buffer. Set before init().
+
+	VkDescriptorSetLayout	descriptorSetLayout;
+	VkDescriptorSet			descriptorSet;
+
+	void		init(VkDevice device, MemoryAllocator* allocator);
+	void		cleanup();
+
+	uint32_t	add(VkImageView texture, VkSampler sampler, const glm::vec4& baseColor = glm::vec4(1.f));	///< New material. Returns its index. Thread safe.
+	void		release(uint32_t material);		///< The material (and its texture element, if no other material uses it) can be reused. The GPU must not be using it anymore. Thread safe.
+
+	size_t		getTextureCount() const { return textureIndices.size(); }
+	size_t		getMaterialCount() const { return materialCount; }
+};
+
+#endif
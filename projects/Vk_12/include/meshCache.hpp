@@ -0,0 +1,97 @@
+#ifndef MESHCACHE_HPP
+#define MESHCACHE_HPP
+
+#include <cstdint>
+#include <cstddef>
+#include <string>
+
+#include "meshlets.hpp"
+
+
+/// Read-only memory mapping of a whole file.
+class MappedFile
+{
+	const char*	data	= nullptr;
+	size_t		length	= 0;
+#ifdef _WIN32
+	void*		file	= nullptr;		///< HANDLE
+	void*		mapping	= nullptr;		///< HANDLE
+#endif
+
+public:
+	MappedFile() = default;
+	~MappedFile();
+	MappedFile(const MappedFile&) = delete;
+	MappedFile& operator=(const MappedFile&) = delete;
+
+	bool		open(const char* path);		///< Returns false if the file can't be opened or is empty.
+	void		close();
+	bool		isOpen() const		{ return data != nullptr; }
+	const char*	getData() const		{ return data; }
+	size_t		getSize() const		{ return length; }
+};
+
+/// Optimizations applied to the mesh stored in a cache file.
+enum MeshFileFlags : uint32_t
+{
+	MESH_VERTEX_CACHE_OPTIMIZED	= 1 << 0,		///< Triangles reordered for the post-transform cache, vertices reordered for fetch.
+	MESH_OVERDRAW_OPTIMIZED		= 1 << 1,		///< Triangle clusters sorted for less overdraw.
+	MESH_LODS					= 1 << 2,		///< Simplified LODs stored after the full resolution indices.
+	MESH_MESHLETS				= 1 << 3		///< Full resolution triangles grouped in meshlets (table stored after the LOD table).
+};
+
+/// Level of detail: range of the index blob. Every LOD indexes the same vertices.
+struct MeshLod
+{
+	uint32_t	firstIndex;
+	uint32_t	indexCount;
+};
+
+/// Header of a mesh cache file. It's followed by the vertex blob (vertexCount * vertexSize bytes), the index blob (indexCount * indexSize bytes), the LOD table (lodCount MeshLod) and the meshlet table (meshletCount Meshlet).
+struct MeshFileHeader
+{
+	uint32_t	magic;				///< "MESH"
+	uint32_t	version;
+	uint64_t	sourceHash;			///< Hash of the source file contents (the cache is rebuilt when it changes).
+	uint64_t	sourceSize;
+	uint32_t	vertexSize;			///< sizeof(Vertex) when it was written (the cache is rebuilt if the vertex layout changes).
+	uint32_t	vertexCount;
+	uint32_t	indexSize;
+	uint32_t	indexCount;
+	uint32_t	flags;				///< MeshFileFlags (optimizations applied to the mesh). The cache is rebuilt if they change.
+	uint32_t	lodCount;			///< Number of MeshLod entries (at least 1: the full resolution mesh).
+	float		boundsMin[3];		///< Axis aligned bounding box of the vertex positions.
+	float		boundsMax[3];
+	float		boundsRadius;		///< Radius of the bounding sphere centered in the bounding box (it can be tighter than the box).
+	uint32_t	meshletCount;		///< Meshlets of the full resolution mesh (0 without MESH_MESHLETS).
+};
+
+/**
+	@brief Binary mesh cache file, written next to the source model (<source>.mesh).
+
+	Parsing an OBJ file and welding its vertices is slow, so the result is saved the first time. Later runs memory-map the cache, so the vertex and index blobs can be copied straight into the staging buffer without parsing. The cache is only used if it was written from the same source contents (hash and size) with the same vertex and index sizes.
+*/
+class MeshFile
+{
+	MappedFile				file;
+	const MeshFileHeader*	header = nullptr;
+
+public:
+	static std::string	cachePath(const char* sourcePath);			///< Path of the cache file for a source model.
+	static uint64_t		hash(const char* data, size_t size);		///< FNV-1a (64 bits) over 8-byte words.
+
+	bool	open(const char* sourcePath, uint32_t vertexSize, uint32_t indexSize, uint32_t flags = 0);		///< Map the cache of this source if it's up to date (and has these flags). Returns false otherwise.
+	void	close();
+	bool	isOpen() const { return header != nullptr; }
+
+	const MeshFileHeader&	getHeader() const	{ return *header; }
+	const void*				getVertexData() const;
+	const void*				getIndexData() const;
+	const MeshLod*			getLods() const;
+	const Meshlet*			getMeshlets() const;
+
+	/// Write the cache for a source model. Returns false if it couldn't be written (example: read-only directory).
+	static bool write(const char* sourcePath, const void* vertices, uint32_t vertexSize, uint32_t vertexCount, const void* indices, uint32_t indexSize, uint32_t indexCount, const float boundsMin[3], const float boundsMax[3], float boundsRadius, uint32_t flags, const MeshLod* lods, uint32_t lodCount, const Meshlet* meshlets, uint32_t meshletCount);
+};
+
+#endif
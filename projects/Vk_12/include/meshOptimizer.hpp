@@ -0,0 +1,40 @@
+#ifndef MESHOPTIMIZER_HPP
+#define MESHOPTIMIZER_HPP
+
+#include <vector>
+#include <cstdint>
+#include <cstddef>
+
+
+/*
+	Mesh optimization for triangle lists. Usual order:
+		1. optimizeVertexCache():	Reorder triangles so that vertices are reused while they are still in the post-transform cache (Tipsify, Sander et al. 2007).
+		2. optimizeOverdraw():		[Optional] Reorder clusters of triangles so that the outer ones are drawn first (fewer fragments shaded behind others), keeping most of the cache locality.
+		3. optimizeVertexFetch():	Reorder the vertex buffer by first use (sequential memory reads during vertex fetch).
+	analyzeVertexCache() simulates a FIFO post-transform cache, so the gains can be measured without a GPU.
+*/
+
+/// Statistics of a simulated post-transform vertex cache.
+struct VertexCacheStats
+{
+	size_t	transformed;		///< Vertex shader invocations (cache misses).
+	float	acmr;				///< Average cache miss ratio: transformed / triangles (0.5 is the ideal for big regular meshes, 3 the worst).
+	float	atvr;				///< Average transformed vertex ratio: transformed / vertices (1 is the ideal).
+};
+
+/// Simulate a FIFO cache of cacheSize entries over the index buffer.
+VertexCacheStats analyzeVertexCache(const uint32_t* indices, size_t indexCount, size_t vertexCount, unsigned cacheSize = 16);
+
+/// Reorder the triangles for post-transform cache locality (Tipsify). Linear time. cacheSize: cache size the ordering is tuned for.
+void optimizeVertexCache(std::vector<uint32_t>& indices, size_t vertexCount, unsigned cacheSize = 16);
+
+/**
+	Reorder clusters of triangles to reduce overdraw. The index buffer should already be optimized for the vertex cache. It's split into clusters (where the cache goes cold and, within those, where the cluster's ACMR is <= threshold * mesh ACMR), and clusters are sorted by how much they face outwards (dot product between the cluster normal and the direction from the mesh centroid to the cluster centroid).
+	positions: xyz floats of each vertex, positionStride bytes apart. threshold: allowed ACMR increase (1.05 = 5%).
+*/
+void optimizeOverdraw(std::vector<uint32_t>& indices, const float* positions, size_t positionStride, size_t vertexCount, float threshold = 1.05f, unsigned cacheSize = 16);
+
+/// Reorder the vertices by first use in the index buffer and remap the indices. Unused vertices are removed. Returns the new vertex count.
+size_t optimizeVertexFetch(void* vertices, size_t vertexSize, size_t vertexCount, std::vector<uint32_t>& indices);
+
+#endif
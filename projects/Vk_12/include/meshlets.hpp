@@ -0,0 +1,57 @@
+#ifndef MESHLETS_HPP
+#define MESHLETS_HPP
+
+#include <vector>
+#include <cstdint>
+#include <cstddef>
+
+#include <glm/glm.hpp>
+
+#include "culling.hpp"
+
+
+/**
+	Cluster of triangles of a mesh (a range of its index buffer) and the bounds used for culling it. The layout matches std430, so an array of them can be uploaded as is to a storage buffer.
+	The normal cone contains the normal of every triangle: its half angle a is stored as sin(a) (coneCutoff). If the cone is wider than a hemisphere (or has no triangles with area), coneCutoff is 1 and the meshlet is never considered back-facing.
+*/
+struct Meshlet
+{
+	float		center[3];			///< Bounding sphere (model space)
+	float		radius;
+	float		coneAxis[3];		///< Normal cone: average direction of the triangle normals (normalized)
+	float		coneCutoff;			///< Sine of the half angle of the cone
+	uint32_t	firstIndex;			///< Triangles of the meshlet: [firstIndex, firstIndex + indexCount) in the index buffer
+	uint32_t	indexCount;
+	uint32_t	vertexCount;		///< Unique vertices used by the triangles
+	uint32_t	padding;
+};
+
+/// Range of an index buffer, for a vkCmdDrawIndexed call.
+struct DrawRange
+{
+	uint32_t	firstIndex;
+	uint32_t	indexCount;
+};
+
+/// Results of the last meshlet culling pass.
+struct MeshletCullingStats
+{
+	size_t visible		= 0;
+	size_t backFacing	= 0;		///< Meshlets culled because all their triangles face away from the camera
+	size_t outside		= 0;		///< Meshlets culled because they are outside the view frustum
+};
+
+/**
+	Split the triangles of indices[firstIndex, firstIndex + indexCount) into meshlets of at most maxVertices unique vertices and maxTriangles triangles, and reorder them so each meshlet is a contiguous range (the triangles stay the same, and other ranges of indices aren't touched).
+	Meshlets grow from a seed triangle through its neighbours (triangles sharing vertices with the meshlet, preferring the ones that add fewer new vertices and are closer to its center), so they are compact patches with tight spheres and cones. When a meshlet runs out of neighbours (disconnected parts, or texture seams), it may go on with nearby triangles facing the same way.
+	positions: xyz floats of each vertex, positionStride bytes apart.
+*/
+std::vector<Meshlet> buildMeshlets(std::vector<uint32_t>& indices, size_t firstIndex, size_t indexCount, const float* positions, size_t positionStride, size_t vertexCount, size_t maxVertices = 64, size_t maxTriangles = 124);
+
+/**
+	Append to ranges the index ranges of the meshlets that may be visible. Consecutive ones are merged into a single range, and so are ranges separated by mergeGap culled indices or less (drawing a few hidden triangles is cheaper than another draw call). Meshlets are culled if their sphere is outside the frustum, or if their normal cone shows that every triangle faces away from the camera.
+	frustum and cameraPosition must be in model space: Frustum(viewProj * modelMatrix) and inverse(modelMatrix) * camera position.
+*/
+MeshletCullingStats cullMeshlets(const Meshlet* meshlets, size_t meshletCount, const Frustum& frustum, const glm::vec3& cameraPosition, std::vector<DrawRange>& ranges, uint32_t mergeGap = 0);
+
+#endif
@@ -3,6 +3,7 @@
 
 #include <iostream>
 #include <array>
+#include <memory>
 #include <functional>						// std::function (function wrapper that stores a callable object)
 
 #define GLM_FORCE_RADIANS
@@ -13,13 +14,14 @@
 #include <glm/gtx/hash.hpp>
 
 #include "environment.hpp"
+#include "meshCache.hpp"
 
 glm::mat4 default_MM(float time);
 
 struct modelConfig
 {
 	modelConfig(const char* modelPath, const char* texturePath, const char* VSpath, const char* FSpath, glm::mat4(*ModelMatrixCallback) (float) = default_MM);
-	modelConfig(const char* modelPath, const char* texturePath, const char* VSpath, const char* FSpath, std::vector<std::function<glm::mat4(float)>>& ModelMatrixCallbacks);
+	modelConfig(const char* modelPath, const char* texturePath, const char* VSpath, const char* FSpath, std::vector<std::function<glm::mat4(float)>>& ModelMatrixCallbacks, bool instanced = false);
 	modelConfig(const modelConfig& obj);
 	~modelConfig();
 
@@ -32,6 +34,8 @@ struct modelConfig
 	const char* FSpath;
 
 	std::vector <std::function<glm::mat4(float)>> getModelMatrices;			// Contains callbacks of type:  glm::mat4(*getModelMatrix) (float time);
+	bool packedVertices;	///< If true, the vertex buffer uses PackedVertex (12 bytes per vertex instead of 32). The vertex shader must be compiled with PACKED_VERTEX defined (triangleV_packed.spv, triangleV_inst_packed.spv). Set it after construction (default: false).
+	bool instanced;		///< If true, all the model matrices are drawn with a single instanced draw call (they are passed in an instance-rate vertex buffer instead of one UBO per instance). The vertex shader must take the model matrix as input attribute (locations 3-6), like triangleV_inst.vert.
 };
 
 struct Vertex
@@ -45,22 +49,49 @@ struct Vertex
 	bool operator==(const Vertex& other) const;											///< Overriding of operator ==. Required for doing comparisons in loadModel().
 };
 
-/// Model-View-Projection matrix as a UBO (Uniform buffer object) (https://www.opengl-tutorial.org/beginners-tutorials/tutorial-3-matrices/)
-struct UniformBufferObject {
-	alignas(16) glm::mat4 model;
+/**
+	Compact vertex (12 bytes instead of the 32 of Vertex). Positions are quantized to unorm16 relative to the mesh bounding box (the dequantization is folded into the model matrix, see dequantization()). Texture coordinates are half floats (they may be out of [0, 1] for repeated textures). There's no color (loadModel always sets white, so the shaders use a constant).
+*/
+struct PackedVertex
+{
+	uint16_t pos[4];			///< xyz + padding (3-component 16-bit formats are rarely supported for vertex buffers)
+	uint16_t texCoord[2];
+
+	static VkVertexInputBindingDescription					getBindingDescription();
+	static std::array<VkVertexInputAttributeDescription, 2> getAttributeDescriptions();	///< Position (location 0) and texture coordinates (location 2).
+	static PackedVertex		pack(const Vertex& vertex, const glm::vec3& boundsMin, const glm::vec3& boundsMax);
+	static glm::mat4		dequantization(const glm::vec3& boundsMin, const glm::vec3& boundsMax);	///< Matrix that takes a quantized position ([0, 1]^3) back to model space.
+};
+
+/// Per-instance data for instanced models. It's read from a vertex buffer with VK_VERTEX_INPUT_RATE_INSTANCE (binding 1). A mat4 attribute takes 4 locations (one per column).
+struct InstanceData
+{
+	glm::mat4 model;
+
+	static VkVertexInputBindingDescription					getBindingDescription();
+	static std::array<VkVertexInputAttributeDescription, 4> getAttributeDescriptions();
+};
+
+/// Per-frame data shared by every model (descriptor set 0, binding 0). Written once per frame (https://www.opengl-tutorial.org/beginners-tutorials/tutorial-3-matrices/)
+struct GlobalUBO {
 	alignas(16) glm::mat4 view;
 	alignas(16) glm::mat4 proj;
+	alignas(16) glm::mat4 viewProj;		///< proj * view
+	alignas(16) glm::vec4 camPos;		///< Camera position (w unused)
+	alignas(16) float	  time;			///< Seconds since the start
 };
 
-/// Structure used for storing many UBOs in the same structure in order to allow us to render the same model many times.
+/// Per-object data as a UBO (Uniform buffer object) (descriptor set 1, binding 0). View and projection come from GlobalUBO.
+struct UniformBufferObject {
+	alignas(16) glm::mat4 model;
+};
+
+/// Structure used for writing many UBOs (one per instance, each one at an aligned offset) in order to allow us to render the same model many times. It doesn't own its data: it's a view into the model's reservation in the uniform arena.
 struct UBOdynamic
 {
-	UBOdynamic(size_t subUBOcount, VkDeviceSize minSizePerSubUBO);
-	~UBOdynamic();
+	UBOdynamic(size_t subUBOcount, VkDeviceSize minSizePerSubUBO, void* data);
 
 	void setModel(size_t position, const glm::mat4& matrix);
-	void setView (size_t position, const glm::mat4& matrix);
-	void setProj (size_t position, const glm::mat4& matrix);
 
 	alignas(16) size_t			UBOcount;
 	alignas(16) VkDeviceSize	sizePerUBO;
@@ -93,58 +124,107 @@ template<> struct std::hash<Vertex> {
 	size_t operator()(Vertex const& vertex) const;
 };
 
+/// Time (ms) spent in the CPU stages of loading a model (modelData::loadAssets).
+struct AssetLoadTimes
+{
+	double	texture	= 0;		///< Reading and decoding the texture (or mapping its texture cache).
+	double	mesh	= 0;		///< Mapping the mesh cache, or parsing, welding and optimizing the OBJ file.
+};
+
 class modelData
 {
 	VulkanEnvironment &e;
 	modelConfig config;
+	std::shared_ptr<MeshFile> meshFile;		///< Mesh cache, mapped by loadAssets() until createResources() copies it into the buffers (shared pointer: models are copied).
+
+	static const VkFormat textureFormat = VK_FORMAT_R8G8B8A8_SRGB;	///< Format requested for the texture (color, sRGB).
+
+	static const size_t parallelWeldingThreshold = 1 << 18;	///< Meshes with at least this number of corners (3 per triangle) are welded with multiple threads.
 
 	// Main methods:
 
 	void createDescriptorSetLayout();		///< Layout for the descriptor set (descriptor: handle or pointer into a resource (buffer, sampler, texture...))
-	void createGraphicsPipeline(const char* VSpath, const char* FSpath);///< Create the graphics pipeline.
-
-	void createTextureImage(const char* path);///< Load an image and upload it into a Vulkan object.
-	void createTextureImageView();			///< Create an image view for the texture (images are accessed through image views rather than directly).
-	void createTextureSampler();			///< Create a sampler for the textures (it applies filtering and transformations).
-	void loadModel(const char* obj_file);	///< Populate the vertices and indices members with the vertex data from the mesh (OBJ file).
-	void createVertexBuffer();				///< Vertex buffer creation.
-	void createIndexBuffer();				///< Index buffer creation
-	void createUniformBuffers();			///< Uniform buffer creation (type of descriptors that can be bound), one for each swap chain image.
+	void createShaderModules(const char* VSpath, const char* FSpath);	///< Get the shader modules (shared through e.states).
+	void createGraphicsPipeline();			///< Get the pipeline layout and the graphics pipeline from e.states (shared with every model that has the same shaders and state).
+	VkPipeline buildGraphicsPipeline();		///< Create the graphics pipeline (called by e.states only if no equal pipeline exists yet).
+
+	void createTextureImage(const char* path);///< Get the texture image and its image view from e.textures (it's loaded and uploaded only if no other model uses the same file).
+	void createTextureSampler();			///< Get a sampler for the textures from e.states (it applies filtering and transformations). Models with the same sampler state share it.
+	void loadModel(const char* obj_file);	///< Populate the vertices and indices members with the vertex data from the mesh (OBJ file), and save the mesh cache.
+	bool loadMeshCache(const char* obj_file, MeshFile& meshFile);	///< Map the mesh cache of the OBJ file (if it's up to date) instead of parsing it. Returns false if there's no valid cache.
+	uint32_t meshCacheFlags();				///< MeshFileFlags matching the environment's mesh optimization parameters.
+	void createVertexBuffer(const void* data);	///< Vertex buffer creation (data: vertexCount vertices, from the vertices member or the mesh cache).
+	void createIndexBuffer(const void* data);	///< Index buffer creation (data: indexCount indices).
+	void createMeshletBuffer();				///< Storage buffer with the meshlet table (only if the model has meshlets), so they can be culled on the GPU too.
+	void createUniformBuffers();			///< Reserve room for the UBOs in the environment's uniform arena (it has a region for each swap chain image).
+	void createInstanceBuffer();			///< Instance buffer creation (instanced models only). It has a region for each swap chain image.
 	void createDescriptorPool();			///< Descriptor pool creation (a descriptor set for each VkBuffer resource to bind it to the uniform buffer descriptor).
 	void createDescriptorSets();			///< Descriptor sets creation.
 
 	// Helper methods:
 
-	static std::vector<char>	readFile(/*const std::string& filename*/ const char* filename);	///< Read all of the bytes from the specified file and return them in a byte array managed by a std::vector.
-	VkShaderModule				createShaderModule(const std::vector<char>& code);				///< Take a buffer with the bytecode as parameter and create a VkShaderModule from it.
-	void						createBuffer(VkDeviceSize size, VkBufferUsageFlags usage, VkMemoryPropertyFlags properties, VkBuffer& buffer, VkDeviceMemory& bufferMemory);	///< Helper function for creating a buffer (VkBuffer and VkDeviceMemory).
-	void						copyBufferToImage(VkBuffer buffer, VkImage image, uint32_t width, uint32_t height);
-	void						generateMipmaps(VkImage image, VkFormat imageFormat, int32_t texWidth, int32_t texHeight, uint32_t mipLevels);
-	void						copyBuffer(VkBuffer srcBuffer, VkBuffer dstBuffer, VkDeviceSize size);
+	void						createBuffer(VkDeviceSize size, VkBufferUsageFlags usage, VkMemoryPropertyFlags properties, VkBuffer& buffer, Allocation& bufferMemory);	///< Helper function for creating a buffer (VkBuffer and its memory, suballocated from the environment's allocator).
 	void						fillDynamicOffsets();
+	glm::mat4					dequantization;			///< Packed vertices: quantized position to model space (identity otherwise).
+	bool						ownsMesh = true;		///< False once a newer version of the model took the mesh buffers (see the instance-change constructor): cleanup() leaves them.
+
+	void						createInstanceResources();	///< Per-instance state and resources: instance LODs and visibility, UBOs, instance buffer and descriptor sets.
 
 public:
-	modelData(VulkanEnvironment &environment, modelConfig config);
+	modelData(VulkanEnvironment &environment, modelConfig config, bool deferred = false);	///< deferred: only set up the model. loadAssets() and createResources() must be called later (Renderer does it to load the models in parallel).
+	modelData(modelData&& previous, const std::vector<std::function<glm::mat4(float)>>& modelMatrices);	///< New version of a model with other instances. It takes the mesh buffers of previous and shares its texture, shaders and pipeline through the caches, so nothing is read or uploaded again: only the per-instance resources are created. previous must be retired (it's destroyed before this one). Call it from the render thread.
+
+	AssetLoadTimes	loadAssets();		///< CPU stages of loading: read and decode the texture (e.textures.prepare), load the mesh (mesh cache, or OBJ file) and get the shader modules (e.states reads the SPIR-V files). Thread safe: it can run for several models at once, or in a streaming thread while rendering.
+	void			createResources();	///< GPU stages of loading: pipeline, texture image, sampler, buffers and descriptors (no file reads). The uploads are recorded in e.uploader (submitted with its next flush()). Call it from the render thread.
 
-	VkDescriptorSetLayout		 descriptorSetLayout;	///< Opaque handle to a descriptor set layout object (combines all of the descriptor bindings).
+	static constexpr float		 lodRatios[] = { 0.5f, 0.25f, 0.1f };				///< Triangles of each simplified LOD, relative to the full resolution mesh.
+	static const size_t			 maxLods = 1 + sizeof(lodRatios) / sizeof(float);	///< Full resolution mesh + simplified LODs.
+
+	VkDescriptorSetLayout		 descriptorSetLayout;	///< Opaque handle to a descriptor set layout object (combines all of the descriptor bindings). Per-object descriptor set (set 1). Set 0 is e.globalDescriptorSetLayout.
 	VkPipelineLayout			 pipelineLayout;		///< Pipeline layout. Allows to use uniform values in shaders (globals similar to dynamic state variables that can be changed at drawing at drawing time to alter the behavior of your shaders without having to recreate them).
-	VkPipeline					 graphicsPipeline;		///< Opaque handle to a pipeline object.
+	VkPipeline					 graphicsPipeline;		///< Opaque handle to a pipeline object. Shared with other models that use the same shaders and state, so consecutive models may not need to rebind it.
+	VkShaderModule				 vertShaderModule;		///< Shared vertex shader module (kept for recreating the pipeline with the swap chain).
+	VkShaderModule				 fragShaderModule;		///< Shared fragment shader module.
 
 	uint32_t					 mipLevels;				///< Number of levels (mipmaps)
-	VkImage						 textureImage;			///< Opaque handle to an image object.
-	VkDeviceMemory				 textureImageMemory;	///< Opaque handle to a device memory object.
+	VkImage						 textureImage;			///< Opaque handle to an image object. Owned by e.textures (shared with other models using the same file).
 	VkImageView					 textureImageView;		///< Image view for the texture image (images are accessed through image views rather than directly).
 	VkSampler					 textureSampler;		///< Opaque handle to a sampler object (it applies filtering and transformations to a texture). It is a distinct object that provides an interface to extract colors from a texture. It can be applied to any image you want (1D, 2D or 3D).
-
-	std::vector<Vertex>			 vertices;				///< Vertices of our model
-	std::vector<uint32_t>		 indices;				///< Indices of our model
-	VkBuffer					 vertexBuffer;			///< Opaque handle to a buffer object (here, vertex buffer).
-	VkDeviceMemory				 vertexBufferMemory;	///< Opaque handle to a device memory object (here, memory for the vertex buffer).
-	VkBuffer					 indexBuffer;			///< Opaque handle to a buffer object (here, index buffer).
-	VkDeviceMemory				 indexBufferMemory;		///< Opaque handle to a device memory object (here, memory for the index buffer).
-
-	std::vector<VkBuffer>		 uniformBuffers;		///< Opaque handle to a buffer object (here, uniform buffer). One for each swap chain image.
-	std::vector<VkDeviceMemory>	 uniformBuffersMemory;	///< Opaque handle to a device memory object (here, memory for the uniform buffer). One for each swap chain image.
+	uint32_t					 materialIndex;			///< If e.bindless, material of the model in e.materials (passed to the fragment shader as a push constant, or in the instance data if e.gpuDriven).
+
+	std::vector<Vertex>			 vertices;				///< Vertices of our model (empty if it was loaded from the mesh cache).
+	std::vector<uint32_t>		 indices;				///< Indices of our model (empty if it was loaded from the mesh cache).
+	uint32_t					 vertexCount;
+	uint32_t					 indexCount;
+	glm::vec3					 boundsMin;				///< Axis aligned bounding box (model space). Computed in loadModel (or read from the mesh cache).
+	glm::vec3					 boundsMax;
+	VkBuffer					 vertexBuffer;			///< Opaque handle to a buffer object (here, vertex buffer). If e.gpuDriven, it's e.geometry.vertexBuffer (shared).
+	Allocation					 vertexBufferMemory;	///< Memory suballocated for the vertex buffer.
+	VkIndexType					 indexType;				///< VK_INDEX_TYPE_UINT16 if the model has <= 65536 vertices (VK_INDEX_TYPE_UINT32 otherwise, or if e.gpuDriven).
+	bool						 packedVertices;		///< The vertex buffer uses PackedVertex (see modelConfig::packedVertices).
+	VkBuffer					 indexBuffer;			///< Opaque handle to a buffer object (here, index buffer). If e.gpuDriven, it's e.geometry.indexBuffer (shared).
+	Allocation					 indexBufferMemory;		///< Memory suballocated for the index buffer.
+	int32_t						 baseVertex;			///< vertexOffset of the draws: position of the first vertex of the model in vertexBuffer (0 unless it's shared).
+	uint32_t					 baseIndex;				///< Position of the first index of the model in indexBuffer (0 unless it's shared). The index ranges of lods, meshlets and drawRanges are relative to it.
+	VkDeviceSize				 vertexBufferOffset;	///< Bytes from the start of the shared vertex buffer (e.gpuDriven).
+	std::vector<MeshLod>		 lods;					///< Levels of detail: ranges of the index buffer (all of them index the same vertices). lods[0] is the full resolution mesh. indexCount is the sum of all of them.
+	glm::vec4					 boundingSphere;		///< Bounding sphere (xyz: center of the bounding box, w: radius) in model space (it's transformed by the getModelMatrix results).
+	std::vector<Meshlet>		 meshlets;				///< Meshlets of LOD 0 (ranges of the index buffer with bounds for culling). Empty if e.buildMeshlets is false.
+	VkBuffer					 meshletBuffer;			///< The meshlets in a device local storage buffer (VK_NULL_HANDLE if there are none).
+	Allocation					 meshletBufferMemory;
+	std::vector<DrawRange>		 drawRanges;			///< Single-draw models: ranges of the index buffer drawn in the current frame (the selected LOD, or its meshlets that may be visible).
+	std::vector<uint32_t>		 instanceLods;			///< Current LOD of each instance (selected by Renderer every frame, LOD 0 otherwise).
+	std::vector<uint32_t>		 lodFirstInstance;		///< Instanced models: the instances of LOD l are [lodFirstInstance[l], lodFirstInstance[l + 1]) in the instance buffer (only the visible ones, grouped by LOD).
+	std::vector<uint32_t>		 visibleInstances;		///< Instances drawn in the current frame, in increasing order (Renderer culls them every frame; all of them otherwise).
+
+	VkDeviceSize				 uniformOffset;			///< Offset of the UBOs of this model inside each region of the uniform arena (e.uniforms).
+	VkDeviceSize				 uniformSize;			///< Bytes reserved in each region of the uniform arena.
+
+	bool						 instanced;				///< All the instances are drawn with a single instanced draw call (see modelConfig::instanced).
+	bool						 dynamicUBO;			///< One UBO per instance, bound with dynamic offsets (models with many model matrices that are not instanced).
+	VkBuffer					 instanceBuffer;		///< Per-instance model matrices (host visible, persistently mapped). Only for instanced models.
+	Allocation					 instanceBufferMemory;
+	VkDeviceSize				 instanceRegionSize;	///< Bytes of the instance buffer used by each swap chain image.
 
 	VkDescriptorPool			 descriptorPool;		///< Opaque handle to a descriptor pool object.
 	std::vector<VkDescriptorSet> descriptorSets;		///< List. Opaque handle to a descriptor set object. One for each swap chain image.
@@ -152,8 +232,11 @@ public:
 	void recreateSwapChain();
 	void cleanupSwapChain();
 	void cleanup();
+	const char* getModelPath() const { return config.modelPath; }	///< Path of the model file (the profiler names its draws after it).
 	
 	std::vector <std::function<glm::mat4(float)>> getModelMatrix;	///< Callbacks required in loopManager::updateUniformBuffer() for each model to render.
+	glm::mat4 getModel(size_t i, float time);						///< Model matrix i (from getModelMatrix) to be written in the UBO or instance buffer (it includes the dequantization of packed vertices).
+	glm::mat4 getModel(const glm::mat4& modelMatrix) const;		///< Matrix to be written in the UBO or instance buffer for a model matrix already got from getModelMatrix.
 	//glm::mat4(*getModelMatrix) (float time);
 
 	//uint32_t dynamicOffsets[2] = { 0, 256 /*sizeof(UniformBufferObject)*/ }; ///< Stores the offsets for each ubo descriptor
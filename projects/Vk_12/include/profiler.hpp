@@ -0,0 +1,150 @@
+#ifndef PROFILER_HPP
+#define PROFILER_HPP
+
+#include <vector>
+#include <deque>
+#include <string>
+#include <atomic>
+#include <chrono>
+#include <unordered_set>
+
+#include "environment.hpp"
+
+
+/// Pipeline statistics of a GPU scope (VK_QUERY_TYPE_PIPELINE_STATISTICS), in the order of their VkQueryPipelineStatisticFlagBits.
+struct PipelineStats
+{
+	uint64_t	vertices				= 0;	///< Vertices read by the input assembler.
+	uint64_t	primitives				= 0;	///< Primitives assembled.
+	uint64_t	vertexInvocations		= 0;	///< Vertex shader invocations (fewer than vertices when the post-transform cache hits).
+	uint64_t	clippingInvocations		= 0;	///< Primitives that reached clipping (the rest were culled before).
+	uint64_t	clippingPrimitives		= 0;	///< Primitives output by clipping.
+	uint64_t	fragmentInvocations		= 0;	///< Fragment shader invocations (overdraw and helper invocations included).
+	uint64_t	computeInvocations		= 0;	///< Compute shader invocations.
+
+	void add(const PipelineStats& other);
+};
+
+/// Timed scope of a frame, on the CPU (render thread) or on the GPU (graphics queue).
+struct ProfileEvent
+{
+	const char*		name;
+	double			start;				///< ms since Profiler::init(). GPU events are converted to the CPU clock (see Profiler::calibrate()).
+	double			duration;			///< ms
+	uint32_t		depth;				///< Nesting level (0: outermost).
+	bool			hasStats = false;	///< GPU scope with pipeline statistics.
+	PipelineStats	stats;
+};
+
+/// What happened in a frame: CPU scopes of drawFrame() and, a few frames later (once its fence has been waited), the GPU scopes of its command buffer.
+struct FrameProfile
+{
+	uint64_t					frame		= 0;		///< Number of the frame since Profiler::init().
+	double						cpuStart	= 0;		///< ms since Profiler::init().
+	double						cpuTime		= 0;		///< ms from beginFrame() to endFrame().
+	double						gpuTime		= 0;		///< ms from the first GPU timestamp to the last one (0 until gpuReady, or if timestamps aren't supported).
+	bool						gpuReady	= false;	///< GPU results collected.
+	std::vector<ProfileEvent>	cpu;
+	std::vector<ProfileEvent>	gpu;					///< Sorted by start.
+	PipelineStats				stats;					///< Sum of the GPU scopes with statistics.
+};
+
+/**
+	@brief Frame profiler: CPU scopes (render thread) and GPU scopes (timestamp and pipeline statistics queries), with a history of recent frames that can be exported to the Chrome trace format.
+
+	GPU scopes write a timestamp before and after their commands, and optionally begin and end a pipeline statistics query. Each swap chain image has its own query pools, like the command buffers (and the uniform arena regions): the queries of an image are reset at the start of its command buffer, and read without waiting (no VK_QUERY_RESULT_WAIT_BIT) when the image is used again, after waiting for its fence (collect()). So the GPU results of a frame appear a few frames later and the CPU never stalls for them.
+	Pipeline statistics queries can't be nested (only one can be active per command buffer), so the caller chooses which scopes get them: the Renderer uses the model draws, or the passes in GPU-driven mode (where there are no model draws to measure).
+	GPU scopes can be recorded from several threads at once (the secondary command buffers of the per-frame recording mode). Everything else is for the render thread.
+	Timestamps are converted to the CPU clock with an offset measured once at init() (a timestamp written by a submission waited on the CPU). Its error is about the latency of that submission, which is enough for seeing the CPU and GPU tracks side by side.
+*/
+class Profiler
+{
+	typedef std::chrono::steady_clock clock;
+
+	/// GPU scope recorded in a command buffer.
+	struct GpuScope
+	{
+		const char*	name;
+		uint32_t	depth;
+		uint32_t	statsQuery;						///< Index of its pipeline statistics query (UINT32_MAX: none).
+	};
+
+	/// Queries of a swap chain image. The scopes are those recorded in its current command buffer.
+	struct QuerySlot
+	{
+		VkQueryPool				timestampPool	= VK_NULL_HANDLE;
+		VkQueryPool				statsPool		= VK_NULL_HANDLE;
+		std::vector<GpuScope>	scopes;							///< maxGpuScopes (scopeCount used).
+		std::atomic<uint32_t>	scopeCount{ 0 };
+		std::atomic<uint32_t>	statsCount{ 0 };
+		uint64_t				frame			= 0;			///< Frame of its last submission.
+		bool					pending			= false;		///< Submitted and not collected yet.
+	};
+
+	VulkanEnvironment*			e				= nullptr;
+	bool						enabled			= false;
+	bool						timestamps		= false;		///< The graphics queue supports timestamps (timestampValidBits > 0).
+	bool						statistics		= false;		///< The pipelineStatisticsQuery feature is enabled.
+	double						timestampPeriod	= 1;			///< ns per timestamp tick.
+	uint64_t					timestampMask	= ~0ull;		///< Valid bits of the timestamps.
+	uint64_t					calibrationTicks = 0;			///< GPU timestamp...
+	double						calibrationTime	= 0;			///< ...and CPU time (ms) of the same instant.
+	clock::time_point			origin;
+
+	std::deque<QuerySlot>		slots;							///< One per swap chain image (a deque, since QuerySlot can't be moved).
+	std::deque<FrameProfile>	frames;							///< Last historySize frames.
+	bool						inFrame			= false;
+	uint32_t					cpuDepth		= 0;
+	uint64_t					nextFrame		= 0;
+	std::unordered_set<std::string> names;						///< Interned names (intern()). Nodes don't move, so their c_str() stays valid.
+	std::vector<uint64_t>		timestampResults;				///< Query results (scratch).
+	std::vector<PipelineStats>	statsResults;
+
+	double			now() const;								///< ms since init().
+	double			gpuTime(uint64_t ticks) const;				///< Timestamp to ms since init().
+	void			calibrate();
+	FrameProfile*	findFrame(uint64_t frame);
+
+public:
+	size_t	maxGpuScopes	= 512;		///< GPU scopes per command buffer. Scopes beyond it aren't measured. Set it before createFrameResources().
+	size_t	historySize		= 600;		///< Frames kept for getFrames() and exportChromeTrace().
+
+	void	init(VulkanEnvironment& environment, bool enabled);		///< enabled == false turns every other call into a no-op.
+	void	createFrameResources(uint32_t imageCount);				///< Query pools of each swap chain image.
+	void	destroyFrameResources();								///< Collects the pending results first (the device must be idle). The frames kept stay available after it.
+
+	// CPU scopes (render thread)
+	void		beginFrame();
+	void		endFrame();											///< Also ends the scopes left open (early returns).
+	uint32_t	beginCpuScope(const char* name);					///< name must stay valid (literal or intern()). Returns the scope for endCpuScope().
+	void		endCpuScope(uint32_t scope);
+
+	// GPU scopes (recording)
+	void		resetScopes(uint32_t imageIndex);					///< Call before recording the command buffer of an image again (its last submission must have finished). Collects its pending results.
+	void		recordReset(VkCommandBuffer commandBuffer, uint32_t imageIndex);	///< Reset the queries of the image. Record it at the start of its primary command buffer (outside the render pass).
+	uint32_t	beginGpuScope(VkCommandBuffer commandBuffer, uint32_t imageIndex, const char* name, uint32_t depth, bool withStats);	///< Thread safe. name must stay valid (literal or intern()). withStats: also count pipeline statistics (no other statistics scope may be open in the command buffer). Returns the scope for endGpuScope().
+	void		endGpuScope(VkCommandBuffer commandBuffer, uint32_t imageIndex, uint32_t scope);
+
+	// Results (render thread)
+	void		submitted(uint32_t imageIndex);						///< The command buffer of this image was submitted with the current frame.
+	void		collect(uint32_t imageIndex);						///< Read the results of the last submission of this image, if any. Its fence must have been waited.
+	void		collectAll();										///< Read every pending result (the device must be idle).
+	const char*	intern(const std::string& name);					///< Stable copy of a name (for scopes of objects that may be destroyed before their results are read or exported).
+
+	const std::deque<FrameProfile>&	getFrames() const { return frames; }	///< Last historySize frames, oldest first. The GPU results of the last few ones may not be ready yet (gpuReady).
+	void	printSummary() const;									///< Average CPU and GPU time of the frames with GPU results, and of each scope.
+	bool	exportChromeTrace(const std::string& path) const;		///< Write the frames kept to a Chrome trace / Perfetto JSON file (chrome://tracing, ui.perfetto.dev). Returns false if it can't be written.
+};
+
+/// CPU scope that lasts until the end of the C++ scope.
+class ProfileScope
+{
+	Profiler&	profiler;
+	uint32_t	scope;
+
+public:
+	ProfileScope(Profiler& profiler, const char* name) : profiler(profiler), scope(profiler.beginCpuScope(name)) { }
+	~ProfileScope() { profiler.endCpuScope(scope); }
+};
+
+#endif
@@ -0,0 +1,83 @@
+#ifndef RENDERQUEUE_HPP
+#define RENDERQUEUE_HPP
+
+#include <vector>
+#include <unordered_map>
+#include <cstdint>
+#include <cstddef>
+
+
+/// A draw (or group of draws) in a RenderQueue. The queue only orders them: what model and instance mean is up to its user (see Renderer::recordDraws).
+struct DrawItem
+{
+	uint64_t	key;				///< Sort key (RenderQueue::makeKey)
+	uint32_t	model;				///< Model index
+	uint32_t	instance;			///< Instance of the model, or allInstances
+
+	static const uint32_t allInstances = UINT32_MAX;
+};
+
+/// Bind calls of a kind: issued, and skipped because the same object was already bound.
+struct BindCounter
+{
+	size_t issued  = 0;
+	size_t skipped = 0;
+
+	void count(bool changed) { if (changed) issued++; else skipped++; }
+};
+
+/// Draws and binds recorded from a RenderQueue.
+struct RenderQueueStats
+{
+	size_t		draws = 0;			///< Draw calls
+	BindCounter	pipelines;
+	BindCounter	descriptorSets;
+	BindCounter	vertexBuffers;
+	BindCounter	indexBuffers;
+	BindCounter	materials;			///< Bindless materials: material index push constants
+
+	void	add(const RenderQueueStats& other);		///< Accumulate (stats of slices recorded in parallel)
+	size_t	issued() const;
+	size_t	skipped() const;
+};
+
+/// Order of the fields in the sort keys.
+enum class SortMode
+{
+	State,			///< pass | pipeline | material | mesh | depth: fewest state changes. Draws with the same state are front to back.
+	FrontToBack		///< pass | depth | pipeline | material | mesh: nearest draws first (less overdraw with early depth testing), at the cost of more binds.
+};
+
+/**
+	@brief List of draws sorted by a 64-bit key built from their state (pass, pipeline, material, mesh) and their distance to the camera.
+
+	Recording the draws in key order groups the ones that share a pipeline, then a material (descriptor set) and then a mesh (vertex and index buffers), so the recorder can skip the binds of whatever is already bound. Inside each group, draws go front to back.
+	Pipelines, materials and meshes are identified by their handles, which are mapped to small ids (in order of appearance) so they fit in the key: 12 bits for pipelines, 16 for materials and meshes (ids that don't fit share the last one, which only makes grouping worse). Depth is the distance as a float, truncated to 18 bits (its bit pattern is monotonic for positive floats, so it's a logarithmic bucket). The pass (2 bits) goes first: passes are never mixed.
+	The keys are sorted with an LSD radix sort (8 bits per pass, skipping the passes where every key has the same digit): linear time, and faster than a comparison sort for thousands of draws.
+*/
+class RenderQueue
+{
+	std::vector<DrawItem>	items;
+	std::vector<DrawItem>	scratch;						///< Buffer of the radix sort
+	std::unordered_map<uint64_t, uint32_t> ids[3];			///< Handle -> id of pipelines, materials and meshes (kept between frames, so ids and order are stable)
+
+	uint32_t	getId(int field, uint64_t handle);
+
+public:
+	SortMode	mode = SortMode::State;
+
+	void		clear() { items.clear(); }
+	void		resetIds() { for (auto& map : ids) map.clear(); }		///< Forget the handles (call it when they are destroyed, so new objects don't grow the maps forever).
+	uint64_t	getState(uint64_t pipeline, uint64_t material, uint64_t mesh);		///< Ids of a pipeline, a material and a mesh packed for makeKey() (44 bits). Draws of the same object can reuse it.
+	uint64_t	makeKey(uint32_t pass, uint64_t state, float depth) const;			///< depth: distance to the camera (>= 0)
+	void		add(uint64_t key, uint32_t model, uint32_t instance = DrawItem::allInstances) { items.push_back(DrawItem{ key, model, instance }); }
+	void		sort();
+
+	const std::vector<DrawItem>& getItems() const { return items; }
+	size_t		size() const { return items.size(); }
+};
+
+/// Sort items[0, count) by key (stable). scratch must have room for count items. Returns the buffer with the result (items or scratch).
+DrawItem* radixSort(DrawItem* items, DrawItem* scratch, size_t count);
+
+#endif
@@ -2,12 +2,23 @@
 #define TRIANGLE_HPP
 
 #include <vector>
+#include <deque>
+#include <unordered_map>
 #include <optional>				// std::optional<uint32_t> (Wrapper that contains no value until you assign something to it. Contains member has_value())
+#include <mutex>
 
 #include "environment.hpp"
 #include "models.hpp"
 #include "input.hpp"
 #include "timer.hpp"
+#include "workers.hpp"
+#include "culling.hpp"
+#include "bvh.hpp"
+#include "meshlets.hpp"
+#include "gpuScene.hpp"
+#include "renderQueue.hpp"
+#include "sceneStreamer.hpp"
+#include "profiler.hpp"
 
 class Renderer
 {
@@ -15,21 +26,40 @@ class Renderer
 	std::list<modelData>	m;		// Models
 	Input					input;	// Input
 	TimerSet				timer;	// Time control
+	WorkerPool				workers;// Threads for loading the models' assets (startup) and recording command buffers (per-frame recording mode)
+	SceneStreamer			streamer;// Thread for loading the models added while rendering
+	Profiler				profiler;// CPU and GPU scopes of every frame
 
 	// Private parameters:
 
 	const int MAX_FRAMES_IN_FLIGHT		= 2;										// How many frames should be processed concurrently.
 	VkClearColorValue backgroundColor	= { 50/255.f, 150/255.f, 255/255.f, 1.0f };
 	int maxFPS							= 80;
+	std::vector<float> lodScreenSizes	= { 0.4f, 0.2f, 0.08f };					// LOD l is replaced by LOD l + 1 when the projected size of the instance (bounding sphere diameter / screen height) is below lodScreenSizes[l].
+	float lodHysteresis					= 0.15f;									// Relative margin around each threshold before switching LOD again (avoids popping back and forth at the boundary).
 
 	// Main methods:
 
-	void createCommandBuffers();			///< Allocates command buffers and record drawing commands in them.
+	void createGlobalDescriptorSets();		///< Descriptor pool and descriptor sets (one per swap chain image) for the global UBO (set 0).
+	void createCommandBuffers();			///< Allocates command buffers and record drawing commands in them (in per-frame recording mode, they are recorded in drawFrame()).
+		void createFrameCommandPools();		///< Per-frame recording mode: command pools (primary + one per slice, for each swap chain image) and command buffers.
+		void beginRenderPass(VkCommandBuffer commandBuffer, size_t imageIndex, VkSubpassContents contents);
+		void buildRenderQueue(bool withDepth);	///< Fill renderQueue with the draws of the visible instances and sort them (sortDraws).
+		void recordDraws(VkCommandBuffer commandBuffer, size_t imageIndex, const DrawItem* first, const DrawItem* last, RenderQueueStats& stats);	///< Record a range of renderQueue, skipping the binds of what is already bound.
 	void createSyncObjects();
 	void mainLoop();
+	void headlessLoop();						///< Headless mode: render headlessFrames frames as fast as possible, print frame time statistics and read back the last frame.
+	void checkLastFrame();						///< Headless mode: save the last frame (headlessImagePath) and compare it with the golden image (goldenImagePath). Throws if they differ.
+	void exportRequestedTrace();				///< Write the trace requested with exportTrace(), if any (between frames).
 		void drawFrame();
+			void applySceneChanges();			///< Apply the changes loaded by the streamer (create the resources of new models, retire removed ones, rebuild the per-instance resources of the changed ones) and destroy the retired models no frame in flight uses anymore. Called after waiting for the frame's fence.
+			void retireModel(std::list<modelData>::iterator model);	///< Move a model to retired (destroyed when the frames that may use it have finished).
+			void destroyRetiredModels(bool all);	///< Destroy the retired models that no frame in flight can use (all: every one, when the device is idle).
+			void rebuildCommandBuffers();		///< Record the static command buffers again (and rebuild the GPU-driven scene) after the models changed. Waits for the frames in flight.
 			void recreateSwapChain();
 			void updateUniformBuffer(uint32_t currentImage);
+				uint32_t selectLod(const modelData& model, uint32_t currentLod, const glm::mat4& modelMatrix, float tanHalfFov);	///< LOD of an instance for its projected size (with hysteresis relative to its current LOD).
+			void recordCommandBuffer(uint32_t imageIndex);		///< Per-frame recording mode: record the secondary command buffers in parallel and the primary command buffer that executes them.
 
 	void cleanup();
 	void cleanupSwapChain();
@@ -38,6 +68,15 @@ class Renderer
 
 	std::vector<VkCommandBuffer> commandBuffers;			///<<< List. Opaque handle to command buffer object. One for each swap chain framebuffer.
 
+	size_t						recordingSlices;			///< Per-frame recording mode: number of slices the models are split in (one secondary command buffer each).
+	std::vector<VkCommandPool>	primaryPools;				///< Per-frame recording mode: command pool of the primary command buffer of each swap chain image.
+	std::vector<VkCommandPool>	secondaryPools;				///< Per-frame recording mode: command pool of each slice (index: image * recordingSlices + slice). One pool per thread, since pools are externally synchronized.
+	std::vector<VkCommandBuffer> secondaryCommandBuffers;	///< Per-frame recording mode: secondary command buffer of each slice (same index as secondaryPools).
+
+	VkDeviceSize				globalUniformOffset;		///< Offset of the global UBO (GlobalUBO) inside each region of the uniform arena.
+	VkDescriptorPool			globalDescriptorPool;		///< Descriptor pool for the global descriptor sets.
+	std::vector<VkDescriptorSet> globalDescriptorSets;		///< Descriptor set 0 (global UBO). One for each swap chain image. Bound once per command buffer.
+
 	std::vector<VkSemaphore>	imageAvailableSemaphores;	///< Signals that an image has been acquired and is ready for rendering. Each frame has a semaphore for concurrent processing. Allows multiple frames to be in-flight while still bounding the amount of work that piles up. One for each possible frame in flight.
 	std::vector<VkSemaphore>	renderFinishedSemaphores;	///< Signals that rendering has finished and presentation can happen. Each frame has a semaphore for concurrent processing. Allows multiple frames to be in-flight while still bounding the amount of work that piles up. One for each possible frame in flight.
 	std::vector<VkFence>		inFlightFences;				///< Similar to semaphores, but fences actually wait in our own code. Used to perform CPU-GPU synchronization. One for each possible frame in flight.
@@ -45,11 +84,77 @@ class Renderer
 
 	size_t						currentFrame = 0;			///< Frame to process next.
 
+	CullingSet					culling;					///< World bounds of every instance of every model (object o is instance o - first of its model, models in list order).
+	std::vector<glm::mat4>		modelMatrices;				///< getModelMatrix result of every instance in the current frame (same order as culling).
+	std::vector<uint32_t>		visibleObjects;				///< Objects of culling that passed the frustum test in the current frame.
+	CullingStats				cullingStats;				///< Visible and culled instances in the last frame.
+	std::vector<glm::vec3>		worldMin, worldMax;			///< World box of every object (same order as culling).
+	Bvh							sceneBvh;					///< Hierarchy over the world boxes, used instead of the linear culling pass in big scenes (bvhMinObjects).
+	bool						sceneBvhValid = false;		///< sceneBvh was built with the current objects (false when they are added or removed).
+	MeshletCullingStats			meshletStats;				///< Meshlets drawn and culled in the last frame (all the single-draw models).
+
+	static const uint32_t		meshletMergeGap = 128 * 3;	///< Visible meshlets separated by this many culled indices or less are drawn with a single draw call.
+
+	RenderQueue					renderQueue;				///< Draws of the current frame (or of the static command buffers), sorted by state and depth.
+	std::vector<modelData*>		queueModels;				///< Models by index (DrawItem::model): models in list order.
+	std::vector<const char*>	queueNames;					///< Profiler name of each model of queueModels.
+	std::unordered_map<const modelData*, const char*> modelNames;	///< Profiler name of each model (its file name, interned so the GPU scopes keep it after the model is destroyed). Erased when the model is destroyed.
+	RenderQueueStats			queueStats;					///< Draws and binds of the last recorded command buffer.
+	std::vector<RenderQueueStats> sliceStats;				///< Per-frame recording mode: stats of each slice.
+
+	GpuScene					gpuScene;					///< GPU-driven mode (e.gpuDriven): instance table, compute culling and indirect draws.
+
+	std::unordered_map<ModelHandle, std::list<modelData>::iterator> handles;	///< Model of each handle (render thread only).
+	std::vector<ModelHandle>	startupHandles;				///< Handles of the models passed to the constructor.
+	std::list<modelData>		retired;					///< Models removed (or replaced by a new version) whose resources may still be used by frames in flight.
+	std::deque<uint64_t>		retiredFrames;				///< Frame in which each retired model was removed (same order as retired).
+	uint64_t					frameCount = 0;				///< Frames submitted.
+	std::vector<uint8_t>		lastFrame;					///< Headless mode: pixels of the last frame (RGBA8, read back after the loop).
+
+	std::mutex					traceMutex;
+	std::string					traceRequest;				///< Path of the trace requested with exportTrace() (guarded by traceMutex).
+
 public:
-	Renderer(std::vector<modelConfig> & modelConfigs);
+	// Public parameters:
+
+	bool perFrameRecording = false;		///< Record the command buffers every frame, in parallel (secondary command buffers), instead of once at startup. Needed when what is drawn changes between frames, so run() turns it on if useCulling, useLods or useMeshletCulling are set (and off in GPU-driven mode). Set it before run().
+	bool useLods = true;				///< Select a level of detail per instance every frame (it needs perFrameRecording, since the draws change with the LODs). Otherwise, LOD 0 is drawn.
+	bool useCulling = true;				///< Don't draw the instances outside the view frustum (it needs perFrameRecording, like useLods).
+	bool useMeshletCulling = true;		///< Single-draw models: draw only the meshlets of LOD 0 that may be visible (it needs perFrameRecording, like useLods).
+	bool sortDraws = true;				///< Record the draws sorted by state (pipeline, material, mesh) instead of in model order, so fewer binds are needed.
+	bool frontToBack = false;			///< Sort the draws by distance to the camera first, and then by state (less overdraw, more binds). Only with perFrameRecording (the static command buffers don't know the camera).
+	size_t bvhMinObjects = 4096;		///< Scenes with this many instances or more are culled with a BVH (refitted when the model matrices change) instead of testing every instance.
+	size_t maxSceneChangesPerFrame = 4;	///< Models added, removed or replaced per frame at most (each new model creates its resources in the render thread, so this bounds the frame time spent on them).
+	size_t headlessFrames = 300;		///< Headless mode: frames rendered by run() before it returns.
+	size_t headlessWarmupFrames = 10;	///< Headless mode: first frames left out of the frame time statistics (pipeline and cache warm-up).
+	double headlessTimeStep = 1 / 60.;	///< Headless mode: time (seconds) between frames passed to the model matrices and shaders instead of the real one, so every run (on any device) renders the same frames. The camera doesn't move.
+	std::string headlessImagePath;		///< Headless mode: if not empty, the last frame is saved to this file (binary PPM).
+	std::string goldenImagePath;		///< Headless mode: if not empty, the last frame is compared with this image (binary PPM, as saved in headlessImagePath) and run() throws if they differ.
+	int goldenTolerance = 8;			///< Headless mode: difference allowed per channel (0-255) between the last frame and the golden image.
+	double goldenMaxDiffering = 0.001;	///< Headless mode: fraction of pixels allowed above goldenTolerance (rasterization and texture filtering differ slightly between ICDs).
+	bool profiling = true;				///< Measure CPU scopes of every frame, and GPU scopes (timestamps and pipeline statistics) of the passes and model draws (see Profiler). Set it before run().
+	std::string tracePath;				///< If not empty, run() writes the profile of the last frames to this file (Chrome trace / Perfetto JSON) when the loop ends.
+	std::string cullShaderPath = "shaders/cull.spv";	///< GPU-driven mode (e.gpuDriven): culling compute shader (cull.comp). In this mode, culling and LOD selection run on the GPU (useCulling and useLods apply too) and the command buffers are recorded once. Set it before run().
+
+	Renderer(std::vector<modelConfig> & modelConfigs, bool headless = false);	///< headless: render offscreen, without window (see VulkanEnvironment::headless). run() renders headlessFrames frames and returns.
 	~Renderer();
 
 	void run();
+
+	// Scene changes while rendering. They are thread safe (call them from any thread, before or during run()) and don't wait: models are loaded by a streaming thread and appear in the first frame after they are ready.
+	ModelHandle addModel(const modelConfig& config);
+	void removeModel(ModelHandle model);									///< Its GPU resources are destroyed once the frames in flight that use it have finished.
+	void addInstance(ModelHandle model, const std::function<glm::mat4(float)>& getModelMatrix);
+	void removeInstance(ModelHandle model, size_t instance);				///< instance: index among the current instances of the model (later ones move down). Removing the last instance removes the model.
+	ModelHandle getModelHandle(size_t index) const { return startupHandles[index]; }	///< Handle of the model modelConfigs[index] passed to the constructor.
+
+	void exportTrace(const std::string& path);								///< Write the profile of the last frames (Profiler::historySize) to a Chrome trace / Perfetto JSON file. Thread safe: it's written by the render thread after the current frame.
+	const Profiler& getProfiler() const { return profiler; }				///< Per-frame CPU and GPU times (Profiler::getFrames()). Read it from the render thread or after run().
+
+	const CullingStats& getCullingStats() const { return cullingStats; }	///< Visible and culled instances in the last frame (CPU culling only: in GPU-driven mode the results stay on the GPU).
+	const MeshletCullingStats& getMeshletCullingStats() const { return meshletStats; }	///< Meshlets drawn and culled in the last frame.
+	const RenderQueueStats& getRenderQueueStats() const { return queueStats; }		///< Draw calls, and binds issued and skipped, in the last recorded command buffer.
+	const Bvh& getSceneBvh() const { return sceneBvh; }						///< World boxes of the instances (every instance of every model, models in list order), for ray picks and range queries. Only built for scenes culled with it (bvhMinObjects).
 };
 
 #endif
\ No newline at end of file
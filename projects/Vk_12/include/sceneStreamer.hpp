@@ -0,0 +1,115 @@
+#ifndef SCENESTREAMER_HPP
+#define SCENESTREAMER_HPP
+
+#include <deque>
+#include <memory>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <unordered_map>
+#include <functional>
+
+#include "models.hpp"
+
+
+typedef uint64_t ModelHandle;		///< Identifies a model of the Renderer. Handles start at 1 and are never reused.
+
+/// Change of the scene prepared by the streaming thread and applied by the render thread between frames (Renderer::applySceneChanges).
+struct SceneChange
+{
+	enum Type { Add, Remove, Instances };
+
+	Type						type;
+	ModelHandle					handle;
+	std::unique_ptr<modelData>	model;		///< Add: model with its assets loaded (modelData::loadAssets), waiting for createResources().
+	std::vector<std::function<glm::mat4(float)>> modelMatrices;	///< Instances: new model matrices of the model (one per instance).
+};
+
+/**
+	@brief Ring buffer for one producer thread and one consumer thread, without locks: push() and pop() never wait.
+
+	Each index is written by one side only (tail by the producer, head by the consumer). The release store of an index publishes the slot written (or read) before it to the other side, which loads it with acquire. Capacity must be a power of 2.
+*/
+template<typename T, size_t Capacity>
+class SpscQueue
+{
+	static_assert((Capacity & (Capacity - 1)) == 0, "SpscQueue capacity must be a power of 2");
+
+	T								slots[Capacity];
+	alignas(64) std::atomic<size_t>	head{ 0 };		///< Next slot to pop (written by the consumer)
+	alignas(64) std::atomic<size_t>	tail{ 0 };		///< Next slot to push (written by the producer). In its own cache line, so both sides don't invalidate each other's index.
+
+public:
+	bool push(const T& value)						///< Producer. Returns false if the queue is full.
+	{
+		size_t t = tail.load(std::memory_order_relaxed);
+		if (t - head.load(std::memory_order_acquire) == Capacity) return false;
+		slots[t & (Capacity - 1)] = value;
+		tail.store(t + 1, std::memory_order_release);
+		return true;
+	}
+
+	bool pop(T& value)								///< Consumer. Returns false if the queue is empty.
+	{
+		size_t h = head.load(std::memory_order_relaxed);
+		if (h == tail.load(std::memory_order_acquire)) return false;
+		value = slots[h & (Capacity - 1)];
+		head.store(h + 1, std::memory_order_release);
+		return true;
+	}
+};
+
+/**
+	@brief Streaming thread that adds and removes models (and instances) while the Renderer renders.
+
+	Requests can be made from any thread. They are queued and processed in order by the streaming thread, which does the CPU stages of loading (modelData::loadAssets: file reads, image decoding, mesh parsing) and hands the result to the render thread through a lock-free queue (SpscQueue). The render thread only polls that queue between frames (poll()), so it never waits for the disk: the streaming thread reads files outside the locks of the shared caches (StateCache, TextureCache), which it only holds for lookups. It creates the GPU resources itself (modelData::createResources), since the uploader and the caches are recorded from it.
+	Changing the instances of a model changes its per-instance resources (UBOs, instance buffer, descriptor sets, even the pipeline if it switches to dynamic UBOs or back), which frames in flight may still be using. So the streaming thread only sends the new model matrices (Instances), and the render thread builds a new version of the model from the current one that replaces it: the mesh buffers are moved to it, and the texture, shaders and pipeline are shared through the caches, so nothing is read or uploaded again (see modelData's instance-change constructor).
+*/
+class SceneStreamer
+{
+	/// Request made through the API, processed by the streaming thread.
+	struct Request
+	{
+		enum Type { Track, Add, Remove, AddInstance, RemoveInstance };
+
+		Type								type		= Track;
+		ModelHandle							handle		= 0;
+		std::unique_ptr<modelConfig>		config;					///< Track, Add
+		std::function<glm::mat4(float)>		getModelMatrix;			///< AddInstance
+		size_t								instance	= 0;		///< RemoveInstance
+	};
+
+	VulkanEnvironment*				e			= nullptr;
+	std::thread						thread;
+	std::mutex						mtx;
+	std::condition_variable			requestReady;
+	std::deque<Request>				requests;				///< Requests not processed yet (guarded by mtx).
+	std::atomic<bool>				stopping{ false };
+	std::atomic<ModelHandle>		nextHandle{ 1 };
+
+	std::unordered_map<ModelHandle, std::unique_ptr<modelConfig>> configs;	///< Current configuration of every model (streaming thread only).
+	SpscQueue<SceneChange*, 256>	ready;					///< Changes for the render thread (producer: streaming thread, consumer: render thread).
+
+	void			run();										///< Streaming thread loop.
+	void			enqueue(Request&& request);
+	void			process(Request& request);
+	SceneChange*	load(ModelHandle handle, const modelConfig& config);	///< Add change with the new model and its assets loaded (nullptr if loading failed).
+	void			send(SceneChange* change);					///< Push a change to the render thread. If the queue is full, the streaming thread waits (the render thread never does).
+
+public:
+	~SceneStreamer();
+
+	void		start(VulkanEnvironment& environment);
+	void		stop();			///< Finish the streaming thread. Requests not processed and changes not polled are dropped (their shader modules stay in e.states until its cleanup).
+
+	ModelHandle	track(const modelConfig& config);			///< Register a model loaded by other means (the Renderer's startup models), so its instances can be changed. Returns its handle.
+	ModelHandle	add(const modelConfig& config);				///< Load a model. Returns its handle right away.
+	void		remove(ModelHandle model);
+	void		addInstance(ModelHandle model, const std::function<glm::mat4(float)>& getModelMatrix);
+	void		removeInstance(ModelHandle model, size_t instance);		///< Instance index among the model's current instances (later ones move down). Removing the last instance removes the model.
+
+	SceneChange* poll();		///< Render thread: next change ready, or nullptr (never blocks). The caller owns the change.
+};
+
+#endif
@@ -0,0 +1,17 @@
+#ifndef SIMPLIFIER_HPP
+#define SIMPLIFIER_HPP
+
+#include <vector>
+#include <cstdint>
+#include <cstddef>
+
+
+/**
+	Simplify a triangle list with quadric error metrics (Garland & Heckbert 1997) until it has targetIndexCount indices or less (or no more edges can be collapsed).
+	Edges are collapsed onto one of their existing vertices (half-edge collapse), so the result indexes the same vertex buffer as the input: a LOD chain can share the vertex buffer and store its index lists one after another in the same index buffer.
+	Vertices on borders only slide along the border, and vertices on attribute seams (several vertices with the same position but different attributes, like texture coordinates) only slide along the seam (all of them at once), so the silhouette of open meshes and the texture mapping are kept. Seam corners and non-manifold vertices don't move. Collapses that flip triangles are rejected.
+	positions: xyz floats of each vertex, positionStride bytes apart.
+*/
+std::vector<uint32_t> simplifyMesh(const std::vector<uint32_t>& indices, const float* positions, size_t positionStride, size_t vertexCount, size_t targetIndexCount);
+
+#endif
@@ -0,0 +1,136 @@
+#ifndef STATECACHE_HPP
+#define STATECACHE_HPP
+
+#include <vector>
+#include <string>
+#include <unordered_map>
+#include <functional>
+#include <mutex>
+
+#include <vulkan/vulkan.h>
+
+
+/// Fixed-function state and handles that define a graphics pipeline. Models with equal PipelineState share the same VkPipeline.
+struct PipelineState
+{
+	VkShaderModule		vertexShader	= VK_NULL_HANDLE;
+	VkShaderModule		fragmentShader	= VK_NULL_HANDLE;
+	VkPipelineLayout	layout			= VK_NULL_HANDLE;
+	VkRenderPass		renderPass		= VK_NULL_HANDLE;
+	VkExtent2D			extent			= { 0, 0 };								///< Viewport and scissor size (they are not dynamic state).
+	VkSampleCountFlagBits samples		= VK_SAMPLE_COUNT_1_BIT;
+	bool				sampleShading	= false;
+	bool				instanced		= false;								///< Vertex input has the per-instance binding (InstanceData).
+	bool				packedVertices	= false;								///< Vertex input uses PackedVertex instead of Vertex.
+	VkPrimitiveTopology	topology		= VK_PRIMITIVE_TOPOLOGY_TRIANGLE_LIST;
+	VkPolygonMode		polygonMode		= VK_POLYGON_MODE_FILL;
+	VkCullModeFlags		cullMode		= VK_CULL_MODE_BACK_BIT;
+	bool				depthTest		= true;
+	bool				depthWrite		= true;
+	bool				blend			= false;
+
+	std::string			key() const;											///< Bytes of every field, used as hash key.
+};
+
+/**
+	@brief Ref-counted handles stored by key. acquire() creates the object only the first time a key is requested; release() destroys it when the last user releases it.
+*/
+template<typename Handle>
+class SharedHandles
+{
+	struct Entry
+	{
+		Handle		handle;
+		unsigned	refCount;
+	};
+
+	std::unordered_map<std::string, Entry>	entries;
+	std::unordered_map<Handle, std::string>	keys;		///< Reverse lookup for release()
+
+public:
+	size_t requests	= 0;		///< Number of acquire() calls
+	size_t created	= 0;		///< Number of objects created (requests - created == requests served from the cache)
+
+	Handle acquire(const std::string& key, const std::function<Handle()>& create)
+	{
+		requests++;
+		auto it = entries.find(key);
+		if (it != entries.end())
+		{
+			it->second.refCount++;
+			return it->second.handle;
+		}
+
+		Handle handle = create();
+		created++;
+		entries[key] = { handle, 1 };
+		keys[handle] = key;
+		return handle;
+	}
+
+	/// Returns true if this was the last reference (the caller must destroy the handle).
+	bool release(Handle handle)
+	{
+		auto keyIt = keys.find(handle);
+		if (keyIt == keys.end()) return false;
+
+		auto it = entries.find(keyIt->second);
+		if (--it->second.refCount) return false;
+
+		entries.erase(it);
+		keys.erase(keyIt);
+		return true;
+	}
+
+	size_t size() const { return entries.size(); }
+
+	bool contains(const std::string& key) const { return entries.count(key) != 0; }
+
+	/// Call destroy for every handle still alive and empty the cache.
+	void clear(const std::function<void(Handle)>& destroy)
+	{
+		for (auto& entry : entries)
+			destroy(entry.second.handle);
+		entries.clear();
+		keys.clear();
+	}
+};
+
+/**
+	@brief Shared shader modules, descriptor set layouts, pipeline layouts, graphics pipelines and samplers.
+
+	Objects are hashed by what defines them (shader path, layout bindings, set layouts, pipeline state) and ref-counted, so models that use the same shaders and state share a single object instead of creating their own copy. Each get...() must be paired with its release...(). All methods are thread safe.
+*/
+class StateCache
+{
+	VkDevice								device = VK_NULL_HANDLE;
+	std::mutex								mtx;
+
+	SharedHandles<VkShaderModule>			shaderModules;
+	SharedHandles<VkDescriptorSetLayout>	setLayouts;
+	SharedHandles<VkPipelineLayout>			pipelineLayouts;
+	SharedHandles<VkPipeline>				pipelines;
+	SharedHandles<VkSampler>				samplers;
+
+	static std::vector<char>	readFile(const char* filename);		///< Read all of the bytes from the specified file and return them in a byte array managed by a std::vector.
+
+public:
+	void					init(VkDevice device);
+
+	VkShaderModule			getShaderModule(const char* path);												///< Shader module from a SPIR-V file (the file is read only the first time, outside the lock).
+	VkDescriptorSetLayout	getDescriptorSetLayout(const std::vector<VkDescriptorSetLayoutBinding>& bindings);	///< Bindings with immutable samplers are not supported.
+	VkPipelineLayout		getPipelineLayout(const std::vector<VkDescriptorSetLayout>& layouts, const std::vector<VkPushConstantRange>& pushConstants = {});
+	VkPipeline				getPipeline(const PipelineState& state, const std::function<VkPipeline()>& create);	///< create() is called only if there's no pipeline with this state yet.
+	VkSampler				getSampler(const VkSamplerCreateInfo& samplerInfo);							///< Sampler with this filter, address, anisotropy and lod state (pNext chains are not supported).
+
+	void					releaseShaderModule(VkShaderModule module);
+	void					releaseDescriptorSetLayout(VkDescriptorSetLayout layout);
+	void					releasePipelineLayout(VkPipelineLayout layout);
+	void					releasePipeline(VkPipeline pipeline);
+	void					releaseSampler(VkSampler sampler);
+
+	void					printStats();		///< Print how many objects were requested and how many were actually created.
+	void					cleanup();			///< Destroy everything that was not released.
+};
+
+#endif
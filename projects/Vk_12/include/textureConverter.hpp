@@ -0,0 +1,69 @@
+#ifndef TEXTURECONVERTER_HPP
+#define TEXTURECONVERTER_HPP
+
+#include <vector>
+#include <cstdint>
+#include <cstddef>
+
+class WorkerPool;
+
+
+/// How texels are stored: uncompressed, or in 4x4 blocks with a fixed size (block compression, sampled directly by the GPU).
+enum class TextureEncoding : uint32_t
+{
+	RGBA8,		///< Uncompressed, 4 bytes per texel.
+	BC1,		///< RGB, 8 bytes per block (8:1). Opaque color textures.
+	BC3,		///< RGBA, 16 bytes per block (4:1): BC1 color + BC4 alpha. Textures with smooth alpha.
+	BC5,		///< RG, 16 bytes per block (2:1 of RG8): two BC4 channels. Normal maps (xy) and other 2-channel data.
+	BC7			///< RGBA, 16 bytes per block (4:1). Better quality than BC1/BC3 (only mode 6 is encoded: one RGBA line per block).
+};
+
+/// Filter used for downsampling each mip level from the previous one.
+enum class MipFilter : uint32_t
+{
+	Box,		///< Average of the texels covered (2x2). Fast, slightly blurry.
+	Kaiser		///< Windowed sinc (Kaiser window, 2 lobes). Sharper mipmaps with less aliasing than the box.
+};
+
+/// Mip level of a ConvertedImage.
+struct ImageLevel
+{
+	uint32_t	width;
+	uint32_t	height;
+	uint64_t	offset;				///< Bytes from the start of the data (multiple of 16)
+	uint64_t	size;
+};
+
+/// Mip chain of an image (largest level first, down to 1x1) encoded in a single blob, ready to be copied into a VkImage.
+struct ConvertedImage
+{
+	TextureEncoding			encoding	= TextureEncoding::RGBA8;
+	bool					srgb		= false;
+	std::vector<ImageLevel>	levels;
+	std::vector<uint8_t>	data;
+};
+
+uint32_t		getBlockBytes(TextureEncoding encoding);			///< Bytes per 4x4 block (per texel for RGBA8).
+uint64_t		getLevelBytes(TextureEncoding encoding, uint32_t width, uint32_t height);
+TextureEncoding	chooseEncoding(const uint8_t* rgba, size_t texelCount, bool highQuality);	///< BC1 if every texel is opaque, BC3 otherwise (BC7 for both if highQuality).
+
+/**
+	Mip chain of an RGBA8 image, down to 1x1 (each level is max(1, size / 2) of the previous one). levels[0] is a copy of the image.
+	Filtering is done in linear space with floats: if srgb, texels are converted from sRGB first and back after filtering (averaging sRGB values directly darkens the mipmaps). Alpha is always linear. Each level is filtered from the float version of the previous one (no rounding accumulates).
+	The filter is separable (a horizontal and a vertical pass), with SSE (a texel per register) when it's available.
+*/
+void buildMipChain(const uint8_t* rgba, uint32_t width, uint32_t height, bool srgb, MipFilter filter, std::vector<std::vector<uint8_t>>& levels);
+
+/// Build the mip chain of an RGBA8 image and encode every level. Blocks are encoded in parallel if workers are provided.
+ConvertedImage convertImage(const uint8_t* rgba, uint32_t width, uint32_t height, TextureEncoding encoding, bool srgb, MipFilter filter, WorkerPool* workers = nullptr);
+
+// Block encoders and decoders. A block is 4x4 RGBA8 texels, row major (64 bytes).
+
+void	encodeBC1(const uint8_t* block, uint8_t* out);					///< 8 bytes. Endpoints from the principal axis of the colors (4-color mode).
+void	encodeBC4(const uint8_t* block, int channel, uint8_t* out);	///< 8 bytes. One channel (8-value mode).
+void	encodeBC3(const uint8_t* block, uint8_t* out);					///< 16 bytes (BC4 alpha, BC1 color).
+void	encodeBC5(const uint8_t* block, uint8_t* out);					///< 16 bytes (BC4 red, BC4 green).
+void	encodeBC7(const uint8_t* block, uint8_t* out);					///< 16 bytes. Mode 6 (7-bit RGBA endpoints with a p-bit, 4-bit indices).
+void	decodeBlock(TextureEncoding encoding, const uint8_t* in, uint8_t* block);	///< For measuring the error. BC7: only mode 6. Missing channels are 0 (BC5: blue) or 255 (alpha).
+
+#endif
@@ -0,0 +1,60 @@
+#ifndef TEXTUREFILE_HPP
+#define TEXTUREFILE_HPP
+
+#include <cstdint>
+#include <string>
+
+#include "meshCache.hpp"
+#include "textureConverter.hpp"
+
+
+/// Conversion settings of a texture cache file. The cache is rebuilt if they change.
+enum TextureFileFlags : uint32_t
+{
+	TEXTURE_SRGB		= 1 << 0,		///< Color texture: mipmaps filtered in linear space, levels encoded as sRGB.
+	TEXTURE_KAISER		= 1 << 1,		///< Mipmaps filtered with MipFilter::Kaiser (MipFilter::Box otherwise).
+	TEXTURE_BC7			= 1 << 2,		///< Colors encoded as BC7 (BC1 if opaque, BC3 otherwise, if not set).
+	TEXTURE_RG			= 1 << 3		///< 2-channel data (normal maps...) encoded as BC5.
+};
+
+/// Header of a texture cache file, laid out like a KTX2 header: it's followed by the level index (levelCount ImageLevel, largest level first, offsets from the start of the file) and the level data.
+struct TextureFileHeader
+{
+	uint32_t	magic;				///< "TEXC"
+	uint32_t	version;
+	uint64_t	sourceHash;			///< Hash of the source image file (the cache is rebuilt when it changes).
+	uint64_t	sourceSize;
+	uint32_t	flags;				///< TextureFileFlags
+	uint32_t	encoding;			///< TextureEncoding of every level
+	uint32_t	width;
+	uint32_t	height;
+	uint32_t	levelCount;			///< Full mip chain (down to 1x1)
+	uint32_t	padding;
+};
+
+/**
+	@brief Texture cache file, written next to the source image (<source>.tex) by texconv or the first time a texture is loaded.
+
+	Decoding a PNG/JPG, generating its mipmaps and compressing them is slow, so it's done once. The file keeps the whole mip chain already block compressed, so later runs map it and copy the levels straight into the staging buffer: no decoding, no blits, and 4 to 8 times less memory than RGBA8. The cache is only used if it was converted from the same source contents (hash and size) with the same settings (flags).
+*/
+class TextureFile
+{
+	MappedFile					file;
+	const TextureFileHeader*	header = nullptr;
+
+public:
+	static std::string	cachePath(const char* sourcePath);		///< Path of the cache file for a source image.
+
+	bool	open(const char* sourcePath, uint32_t flags);		///< Map the cache of this source if it's up to date (and was converted with these flags). Returns false otherwise.
+	void	close();
+	bool	isOpen() const { return header != nullptr; }
+
+	const TextureFileHeader&	getHeader() const	{ return *header; }
+	const ImageLevel*			getLevels() const;
+	const char*					getData() const		{ return file.getData(); }		///< Start of the file (level offsets are relative to it).
+
+	/// Write the cache for a source image. Returns false if it couldn't be written (example: read-only directory).
+	static bool write(const char* sourcePath, const ConvertedImage& image, uint32_t flags);
+};
+
+#endif
@@ -0,0 +1,99 @@
+#ifndef TEXTURES_HPP
+#define TEXTURES_HPP
+
+#include <unordered_map>
+#include <mutex>
+#include <memory>
+#include <exception>
+
+#include <vulkan/vulkan.h>
+
+#include "allocator.hpp"
+#include "uploader.hpp"
+#include "stateCache.hpp"
+#include "textureConverter.hpp"
+#include "textureFile.hpp"
+
+
+/// Texture loaded in device local memory (with its mipmaps), ready to be sampled.
+struct Texture
+{
+	VkImage		image		= VK_NULL_HANDLE;
+	Allocation	memory;
+	VkImageView	view		= VK_NULL_HANDLE;
+	VkFormat	format		= VK_FORMAT_UNDEFINED;
+	uint32_t	width		= 0;
+	uint32_t	height		= 0;
+	uint32_t	mipLevels	= 1;
+};
+
+/// Texture file read on the CPU (decoded, or mapped from its texture cache), ready to be copied into an image.
+struct TextureData
+{
+	VkFormat					format		= VK_FORMAT_UNDEFINED;	///< Format of the image (the requested one, or a block compressed one).
+	uint32_t					width		= 0;
+	uint32_t					height		= 0;
+	uint32_t					mipLevels	= 1;
+	bool						blitMipmaps	= false;				///< Only the level 0 is in data: the uploader generates the rest.
+	const char*					data		= nullptr;				///< Level data (owned by pixels, converted or file).
+	VkDeviceSize				size		= 0;
+	std::vector<VkDeviceSize>	levelOffsets;						///< Start of each level in data (if !blitMipmaps).
+
+	std::shared_ptr<uint8_t>	pixels;								///< Decoded image (uncompressed textures).
+	ConvertedImage				converted;							///< Image converted now (compressed textures without an up to date cache).
+	TextureFile					file;								///< Texture cache (compressed textures).
+};
+
+/**
+	@brief Shared textures. Each texture file is loaded, uploaded and mipmapped only once per format, and models using the same file get the same image view (ref-counted: it's destroyed when the last model releases it).
+
+	Loading has a CPU part (reading and decoding the file) and a GPU part (creating the image and recording its upload). prepare() does only the CPU part and can be called from many threads at once, so a later get() only has the GPU part left.
+	If compression is enabled (init()), RGBA8 and RG8 textures are loaded block compressed (BC1/BC3/BC7, BC5 for RG8) with mipmaps computed on the CPU, from their texture cache file (TextureFile). If the cache is missing or outdated, the image is decoded and converted once and the cache is written for the next runs. The image format is the compressed one (Texture::format), not the requested one.
+*/
+class TextureCache
+{
+	VkDevice			device		= VK_NULL_HANDLE;
+	MemoryAllocator*	allocator	= nullptr;
+	UploadManager*		uploader	= nullptr;
+	std::mutex			mtx;
+
+	SharedHandles<VkImageView>					views;
+	std::unordered_map<VkImageView, Texture>	textures;		///< Image, memory and properties of each view.
+
+	/// Texture read by prepare(), waiting for get() to create its image.
+	struct PendingTexture
+	{
+		std::once_flag		once;				///< The file is read only once, even if several threads prepare it.
+		TextureData			data;
+		std::exception_ptr	error;				///< Thrown by the read (rethrown to every caller).
+		double				readTime = 0;
+	};
+	std::unordered_map<std::string, std::shared_ptr<PendingTexture>> pending;	///< By key (path and format).
+
+	VkDeviceSize		bytesRequested	= 0;	///< Memory that every request would have used without sharing.
+	VkDeviceSize		bytesAllocated	= 0;	///< Memory actually allocated for textures.
+	size_t				compressedCount	= 0;	///< Textures loaded block compressed.
+	double				readTime		= 0;	///< Time (ms) spent reading textures (decoding or converting), summed over threads.
+	double				uploadTime		= 0;	///< Time (ms) spent creating images and recording their uploads.
+	bool				compress		= false;
+
+	static std::string	makeKey(const char* path, VkFormat format);
+	void				read(const char* path, VkFormat format, TextureData& data);		///< CPU part: decode the image file (mipmaps are generated by the uploader), or map (or convert and write) its texture cache if compressed. No Vulkan calls.
+	void				readCompressed(const char* path, uint32_t flags, TextureData& data);	///< flags: TextureFileFlags.
+	void				readPending(PendingTexture& entry, const char* path, VkFormat format);	///< Read the entry if no thread did it yet (waits if another one is doing it). Rethrows its error.
+	Texture				create(VkFormat format, uint32_t width, uint32_t height, uint32_t mipLevels, VkImageUsageFlags usage);	///< Image, memory and view (the content is uploaded later).
+	Texture				upload(const TextureData& data);		///< GPU part: create the image and record the copy of the data (and the mipmaps generation).
+
+public:
+	MipFilter	mipFilter	= MipFilter::Kaiser;	///< Filter for the mipmaps of compressed textures (it's applied when they are converted).
+	bool		highQuality	= false;				///< Encode compressed color textures as BC7 instead of BC1/BC3 (twice the size of BC1 for opaque textures).
+
+	void		init(VkDevice device, MemoryAllocator* allocator, UploadManager* uploader, bool compress = false);	///< compress: load textures block compressed (the device must support textureCompressionBC).
+	void		prepare(const char* path, VkFormat format = VK_FORMAT_R8G8B8A8_SRGB);	///< Read the file of a texture that will be requested with get(). Thread safe: different files are read in parallel. It's read even if the texture is loaded, since it may be released before get() is called (models streamed while others are removed).
+	Texture		get(const char* path, VkFormat format = VK_FORMAT_R8G8B8A8_SRGB);	///< Texture for a file (loaded only the first time it's requested with this format; the file is read now unless it was prepared).
+	void		release(VkImageView view);
+	void		printStats();		///< Print number of textures, requests, memory saved by sharing, and loading times.
+	void		cleanup();			///< Destroy every texture not released yet.
+};
+
+#endif
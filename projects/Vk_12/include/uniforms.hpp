@@ -0,0 +1,41 @@
+#ifndef UNIFORMS_HPP
+#define UNIFORMS_HPP
+
+#include <vulkan/vulkan.h>
+
+#include "allocator.hpp"
+
+
+/**
+	@brief Persistently mapped uniform buffer shared by every model.
+
+	The buffer is split into one region per swap chain image (the command buffers and descriptor sets are per swap chain image, and the imagesInFlight fences guarantee that the GPU is not reading a region while the CPU writes to it). Each model reserves a sub-range (same offset inside every region) once, and then writes its uniforms straight into the mapped memory every frame: no vkMapMemory/vkUnmapMemory, no staging copies and no heap allocations.
+	The reservations survive swap chain recreation (only the buffer is recreated, because it depends on the number of swap chain images).
+*/
+class UniformArena
+{
+	VkDevice			device		= VK_NULL_HANDLE;
+	MemoryAllocator*	allocator	= nullptr;
+	VkDeviceSize		alignment;					///< Offsets are multiples of minUniformBufferOffsetAlignment.
+	RangeAllocator		ranges;						///< Bookkeeping of the reservations (inside a region).
+	uint32_t			regionCount	= 0;
+
+public:
+	VkDeviceSize		regionSize	= 4 * 1024 * 1024;	///< Bytes per swap chain image (room for ~16k UBOs of 256 bytes). Set before init().
+
+	VkBuffer			buffer		= VK_NULL_HANDLE;	///< Uniform buffer containing every region.
+	Allocation			memory;							///< Host visible & coherent, persistently mapped.
+
+	void			init(VkDevice device, MemoryAllocator* allocator, VkDeviceSize minUniformBufferOffsetAlignment);
+	void			createBuffer(uint32_t swapChainImagesCount);	///< Create the buffer with a region per swap chain image.
+	void			destroyBuffer();
+
+	VkDeviceSize	reserve(VkDeviceSize size);						///< Reserve an aligned sub-range in every region. Returns its offset inside a region.
+	void			release(VkDeviceSize offset, VkDeviceSize size);
+
+	VkDeviceSize	getOffset(uint32_t imageIndex, VkDeviceSize offset);	///< Offset in the buffer of a reservation for a swap chain image (for descriptor sets).
+	void*			getMapped(uint32_t imageIndex, VkDeviceSize offset);	///< Host address of a reservation for a swap chain image.
+	VkDeviceSize	getAlignment();
+};
+
+#endif
@@ -0,0 +1,68 @@
+#ifndef UPLOADER_HPP
+#define UPLOADER_HPP
+
+#include <vector>
+#include <deque>
+
+#include <vulkan/vulkan.h>
+
+#include "allocator.hpp"
+
+
+/**
+	@brief Batches transfers to device local memory (buffer copies, image copies, layout transitions and mipmap generation).
+
+	Source data is copied into a persistently mapped staging ring buffer and the transfer commands are recorded in a command buffer. flush() submits all the recorded commands at once with a fence, so the caller can keep working while the uploads are in flight (no vkQueueWaitIdle). Staging space is reused once the fence of the batch that used it is signaled. Later submissions to the same queue (like rendering) are ordered after the uploads by the barriers recorded here.
+*/
+class UploadManager
+{
+	struct Batch
+	{
+		uint64_t				id;
+		VkCommandBuffer			commandBuffer;
+		VkFence					fence;
+		VkDeviceSize			ringEnd;			///< Position of the ring head when the batch was submitted (the ring space before it can be reused once this batch completes).
+		std::vector<VkBuffer>	tempBuffers;		///< Staging buffers for uploads that didn't fit in the ring.
+		std::vector<Allocation>	tempMemory;
+	};
+
+	VkDevice			device			= VK_NULL_HANDLE;
+	VkPhysicalDevice	physicalDevice	= VK_NULL_HANDLE;
+	VkQueue				queue			= VK_NULL_HANDLE;
+	MemoryAllocator*	allocator		= nullptr;
+
+	VkCommandPool		commandPool;					///< Own command pool (command buffers are reset and reused).
+	VkBuffer			stagingBuffer;					///< Staging ring buffer (host visible & coherent, persistently mapped).
+	Allocation			stagingMemory;
+	VkDeviceSize		head;							///< Next free position in the ring.
+	VkDeviceSize		tail;							///< Start of the oldest staging data still in use by the GPU.
+
+	Batch				recording;						///< Batch currently being recorded.
+	bool				recordingActive;				///< The command buffer of the recording batch has begun.
+	std::deque<Batch>	inFlight;						///< Submitted batches (oldest first).
+	std::vector<Batch>	freeBatches;					///< Retired batches (command buffer & fence ready to be reused).
+	uint64_t			nextBatchId;
+	uint64_t			lastCompleted;
+
+	VkCommandBuffer		getCommandBuffer();			///< Command buffer of the recording batch (begins it if needed).
+	bool				allocateRing(VkDeviceSize size, VkDeviceSize alignment, VkDeviceSize& offset);
+	void*				allocateStaging(VkDeviceSize size, VkDeviceSize alignment, VkBuffer& buffer, VkDeviceSize& offset);	///< Get staging memory (ring, or temporary buffer if it's too big). Waits for old batches if the ring is full.
+	void				retire(bool wait);				///< Release the staging space of completed batches (if wait, wait for the oldest one).
+	bool				isRingEmpty();
+	void				generateMipmaps(VkCommandBuffer commandBuffer, VkImage image, VkFormat imageFormat, int32_t texWidth, int32_t texHeight, uint32_t mipLevels);
+
+public:
+	VkDeviceSize		stagingCapacity = 32 * 1024 * 1024;	///< Size of the staging ring buffer.
+
+	void		init(VkPhysicalDevice physicalDevice, VkDevice device, VkQueue queue, uint32_t queueFamily, MemoryAllocator* allocator);
+	void		uploadBuffer(VkBuffer dstBuffer, const void* data, VkDeviceSize size, VkDeviceSize dstOffset = 0);	///< Record a copy of data to a buffer (it must have been created with VK_BUFFER_USAGE_TRANSFER_DST_BIT).
+	void		uploadImage(VkImage image, VkFormat format, const void* pixels, VkDeviceSize size, uint32_t width, uint32_t height, uint32_t mipLevels);	///< Record the transition, the copy of the level 0, and the mipmaps generation. The image ends in VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL.
+	void		uploadImageLevels(VkImage image, const void* data, VkDeviceSize size, uint32_t width, uint32_t height, uint32_t mipLevels, const VkDeviceSize* levelOffsets);	///< Record the copy of every level, already computed (no blits: works for block compressed formats). levelOffsets: start of each level in data (multiples of 16). The image ends in VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL.
+	uint64_t	flush();							///< Submit all the recorded uploads in one batch. Returns the batch ID (0 if there was nothing to submit).
+	bool		isComplete(uint64_t batchId);		///< Check (without blocking) whether a batch has finished.
+	void		wait(uint64_t batchId);				///< Block until a batch has finished.
+	void		waitIdle();							///< Flush and block until every upload has finished.
+	void		cleanup();
+};
+
+#endif
@@ -0,0 +1,170 @@
+#ifndef WELDER_HPP
+#define WELDER_HPP
+
+#include <vector>
+#include <cstdint>
+#include <cstring>
+#include <algorithm>
+#include <type_traits>
+
+#include "workers.hpp"
+
+
+/**
+	@brief Open addressing hash set of vertex ids (linear probing, power of 2 capacity, load factor <= 0.5).
+
+	Slots only store the vertex id and 32 bits of its hash (8 bytes per slot). Vertices are compared against the vertex array they index, so the key is never duplicated. V must be trivially copyable, made of floats only.
+	Vertices are welded only if they are exactly equal, like the std::unordered_map<Vertex, uint32_t> path this replaces (Vertex::operator==): the key is the bit pattern of every float, with -0.0f taken as 0.0f. Keys aren't quantized, since snapping nearly equal vertices together would change the meshes loaded so far (and a grid splits near values that fall in different cells anyway). NaNs are compared by bit pattern.
+*/
+template<typename V>
+class FlatVertexMap
+{
+	static_assert(std::is_trivially_copyable<V>::value && sizeof(V) % 4 == 0, "Vertices are hashed and compared as 32-bit words");
+
+	static const uint64_t EMPTY = ~0ull;
+	std::vector<uint64_t>	slots;				///< (hash >> 32) << 32 | id
+	size_t					count = 0;
+	size_t					mask  = 0;
+
+	void grow(const std::vector<V>& vertices)
+	{
+		std::vector<uint64_t> old(std::max<size_t>(16, slots.size() * 2), EMPTY);
+		old.swap(slots);
+		mask = slots.size() - 1;
+
+		for (uint64_t slot : old)
+			if (slot != EMPTY)
+			{
+				size_t i = hash(vertices[(uint32_t)slot]) & mask;
+				while (slots[i] != EMPTY) i = (i + 1) & mask;
+				slots[i] = slot;
+			}
+	}
+
+	static const size_t WORDS = sizeof(V) / 4;
+
+	/// Bit pattern of the vertex's floats, with -0.0f turned into 0.0f (they are equal floats).
+	static void key(const V& vertex, uint32_t (&words)[WORDS])
+	{
+		memcpy(words, &vertex, sizeof(V));
+		for (uint32_t& word : words)
+			if (word == 0x80000000u) word = 0;
+	}
+
+public:
+	static bool equal(const V& a, const V& b)
+	{
+		uint32_t keyA[WORDS], keyB[WORDS];
+		key(a, keyA);
+		key(b, keyB);
+		return memcmp(keyA, keyB, sizeof(keyA)) == 0;
+	}
+
+	static uint64_t hash(const V& vertex)
+	{
+		uint32_t words[WORDS];
+		key(vertex, words);
+
+		uint64_t h = 0x9E3779B97F4A7C15ull;
+		for (uint32_t word : words)
+			h = (h ^ word) * 0xBF58476D1CE4E5B9ull;
+		return h ^ (h >> 29);
+	}
+
+	void reserve(size_t vertexCount, const std::vector<V>& vertices)
+	{
+		while (vertexCount * 2 > slots.size()) grow(vertices);
+	}
+
+	/// Id of the vertex in vertices. If it's not there yet, it's appended.
+	uint32_t insert(const V& vertex, std::vector<V>& vertices)
+	{
+		if ((count + 1) * 2 > slots.size()) grow(vertices);
+
+		uint64_t h		= hash(vertex);
+		uint64_t tag	= h & 0xFFFFFFFF00000000ull;
+		size_t i		= h & mask;
+
+		while (true)
+		{
+			uint64_t slot = slots[i];
+			if (slot == EMPTY)
+			{
+				uint32_t id = static_cast<uint32_t>(vertices.size());
+				slots[i] = tag | id;
+				vertices.push_back(vertex);
+				count++;
+				return id;
+			}
+			if ((slot & 0xFFFFFFFF00000000ull) == tag && equal(vertices[(uint32_t)slot], vertex))
+				return (uint32_t)slot;
+			i = (i + 1) & mask;
+		}
+	}
+};
+
+/**
+	Weld (deduplicate) the vertices of a triangle list. getVertex(k) returns the vertex of the k-th corner. Output: unique vertices (in order of first appearance) and one index per corner.
+	The corners are split in contiguous chunks that are welded in parallel (each one with its own flat hash map). Then the chunks' unique vertices are merged in chunk order and the indices are remapped (in parallel too). The output is the same as welding serially, whatever the number of threads.
+	pool == nullptr: weld in the calling thread only.
+*/
+template<typename V, typename GetVertex>
+void weldVertices(size_t cornerCount, const GetVertex& getVertex, std::vector<V>& vertices, std::vector<uint32_t>& indices, WorkerPool* pool, size_t minChunkSize = 1 << 16)
+{
+	size_t chunkCount = pool ? std::min(pool->size() * 4, (cornerCount + minChunkSize - 1) / minChunkSize) : 1;
+	if (chunkCount == 0) chunkCount = 1;
+	size_t chunkSize = (cornerCount + chunkCount - 1) / chunkCount;
+
+	vertices.clear();
+	indices.resize(cornerCount);
+
+	if (chunkCount == 1)
+	{
+		FlatVertexMap<V> map;
+		for (size_t k = 0; k < cornerCount; k++)
+			indices[k] = map.insert(getVertex(k), vertices);
+		return;
+	}
+
+	// 1. Weld each chunk (indices are local to the chunk)
+	std::vector<std::vector<V>> chunkVertices(chunkCount);
+
+	pool->run(chunkCount, [&](size_t c)
+	{
+		size_t begin	= c * chunkSize;
+		size_t end		= std::min(cornerCount, begin + chunkSize);
+		FlatVertexMap<V> map;
+
+		for (size_t k = begin; k < end; k++)
+			indices[k] = map.insert(getVertex(k), chunkVertices[c]);
+	});
+
+	// 2. Merge the unique vertices of every chunk, in chunk order (deterministic)
+	size_t total = 0;
+	for (const std::vector<V>& chunk : chunkVertices) total += chunk.size();
+
+	FlatVertexMap<V> map;
+	map.reserve(total, vertices);
+	vertices.reserve(total);
+
+	std::vector<std::vector<uint32_t>> remap(chunkCount);
+	for (size_t c = 0; c < chunkCount; c++)
+	{
+		remap[c].resize(chunkVertices[c].size());
+		for (size_t j = 0; j < chunkVertices[c].size(); j++)
+			remap[c][j] = map.insert(chunkVertices[c][j], vertices);
+		std::vector<V>().swap(chunkVertices[c]);		// Release memory as soon as possible
+	}
+
+	// 3. Local to global indices
+	pool->run(chunkCount, [&](size_t c)
+	{
+		size_t begin	= c * chunkSize;
+		size_t end		= std::min(cornerCount, begin + chunkSize);
+
+		for (size_t k = begin; k < end; k++)
+			indices[k] = remap[c][indices[k]];
+	});
+}
+
+#endif
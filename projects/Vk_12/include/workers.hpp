@@ -0,0 +1,46 @@
+#ifndef WORKERS_HPP
+#define WORKERS_HPP
+
+#include <vector>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
+#include <exception>
+
+
+/**
+	@brief Persistent worker threads for running parallel loops.
+
+	run(count, task) calls task(i) for every i in [0, count) spread among the workers (the calling thread works too) and returns once all of them have finished. Threads are created once, so it's cheap enough to be used every frame.
+	run() can be called from several threads (the jobs run one after another), but not from inside a task of the same pool.
+*/
+class WorkerPool
+{
+	std::vector<std::thread>		threads;
+	std::mutex						mtx;
+	std::mutex						runMtx;			///< Held by run() for the whole job, so the callers of different threads take turns.
+	std::condition_variable			workReady;		///< Signals workers that there's a new job (or that they must stop).
+	std::condition_variable			workDone;		///< Signals run() that every task has finished.
+
+	const std::function<void(size_t)>* task;		///< Current job
+	size_t							taskCount;
+	size_t							nextTask;		///< Next index to hand out
+	size_t							pendingTasks;	///< Tasks not finished yet
+	std::exception_ptr				error;			///< First exception thrown by a task (rethrown by run())
+	bool							stop;
+
+	void	workerLoop();
+	void	execute(std::unique_lock<std::mutex>& lock);	///< Take a task index and run it (lock is released while the task runs).
+
+public:
+	WorkerPool(size_t threadCount = 0);				///< threadCount == 0: one thread per hardware thread (minus the calling one).
+	~WorkerPool();
+	WorkerPool(const WorkerPool&) = delete;
+	WorkerPool& operator=(const WorkerPool&) = delete;
+
+	size_t	size() const;							///< Number of threads working in run() (workers + calling thread).
+	void	run(size_t count, const std::function<void(size_t)>& task);	///< Parallel loop. Blocks until every task has finished. Rethrows the first exception thrown by a task.
+};
+
+#endif
@@ -1,3 +1,11 @@
 C:\VulkanSDK\1.2.170.0\Bin32\glslc.exe triangleV.vert -o triangleV.spv
 C:\VulkanSDK\1.2.170.0\Bin32\glslc.exe triangleF.frag -o triangleF.spv
+C:\VulkanSDK\1.2.170.0\Bin32\glslc.exe triangleV_inst.vert -o triangleV_inst.spv
+C:\VulkanSDK\1.2.170.0\Bin32\glslc.exe -DPACKED_VERTEX triangleV.vert -o triangleV_packed.spv
+C:\VulkanSDK\1.2.170.0\Bin32\glslc.exe -DPACKED_VERTEX triangleV_inst.vert -o triangleV_inst_packed.spv
+C:\VulkanSDK\1.2.170.0\Bin32\glslc.exe triangleV_gpu.vert -o triangleV_gpu.spv
+C:\VulkanSDK\1.2.170.0\Bin32\glslc.exe -DPACKED_VERTEX triangleV_gpu.vert -o triangleV_gpu_packed.spv
+C:\VulkanSDK\1.2.170.0\Bin32\glslc.exe cull.comp -o cull.spv
+C:\VulkanSDK\1.2.170.0\Bin32\glslc.exe --target-env=vulkan1.2 triangleF_bindless.frag -o triangleF_bindless.spv
+C:\VulkanSDK\1.2.170.0\Bin32\glslc.exe --target-env=vulkan1.2 -DINSTANCE_MATERIAL triangleF_bindless.frag -o triangleF_bindless_gpu.spv
 pause
\ No newline at end of file
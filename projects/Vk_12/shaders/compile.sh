@@ -2,4 +2,12 @@
 
 /home/user/VulkanSDK/1.2.170.0/x86_64/bin/glslc triangleV.vert -o triangleV.spv
 /home/user/VulkanSDK/1.2.170.0/x86_64/bin/glslc triangleF.frag -o triangleF.spv
+/home/user/VulkanSDK/1.2.170.0/x86_64/bin/glslc triangleV_inst.vert -o triangleV_inst.spv
+/home/user/VulkanSDK/1.2.170.0/x86_64/bin/glslc -DPACKED_VERTEX triangleV.vert -o triangleV_packed.spv
+/home/user/VulkanSDK/1.2.170.0/x86_64/bin/glslc -DPACKED_VERTEX triangleV_inst.vert -o triangleV_inst_packed.spv
+/home/user/VulkanSDK/1.2.170.0/x86_64/bin/glslc triangleV_gpu.vert -o triangleV_gpu.spv
+/home/user/VulkanSDK/1.2.170.0/x86_64/bin/glslc -DPACKED_VERTEX triangleV_gpu.vert -o triangleV_gpu_packed.spv
+/home/user/VulkanSDK/1.2.170.0/x86_64/bin/glslc cull.comp -o cull.spv
+/home/user/VulkanSDK/1.2.170.0/x86_64/bin/glslc --target-env=vulkan1.2 triangleF_bindless.frag -o triangleF_bindless.spv
+/home/user/VulkanSDK/1.2.170.0/x86_64/bin/glslc --target-env=vulkan1.2 -DINSTANCE_MATERIAL triangleF_bindless.frag -o triangleF_bindless_gpu.spv
 pause
\ No newline at end of file
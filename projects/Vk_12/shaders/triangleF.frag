@@ -1,7 +1,7 @@
 #version 450
 #extension GL_ARB_separate_shader_objects : enable
 
-layout(binding  = 1) uniform sampler2D texSampler;		// sampler1D, sampler2D, sampler3D
+layout(set = 1, binding = 1) uniform sampler2D texSampler;		// sampler1D, sampler2D, sampler3D
 
 layout(location = 0) in vec3 fragColor;
 layout(location = 1) in vec2 fragTexCoord;
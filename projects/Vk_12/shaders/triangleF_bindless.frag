@@ -0,0 +1,44 @@
+#version 450
+#extension GL_ARB_separate_shader_objects : enable
+#extension GL_EXT_nonuniform_qualifier : enable
+
+struct Material {
+    uint textureIndex;
+    uint padding0, padding1, padding2;
+    vec4 baseColor;
+};
+
+layout(set = 2, binding = 0) uniform sampler2D textures[];										// Every texture (partially bound: only the ones in use are valid)
+layout(std430, set = 2, binding = 1) readonly buffer Materials { Material materials[]; };
+
+#ifdef INSTANCE_MATERIAL
+layout(location = 2) flat in uint fragMaterial;		// From the instance data (triangleV_gpu.vert)
+#else
+layout(push_constant) uniform PushConstants {
+    uint materialIndex;								// Set per draw
+} push;
+#endif
+
+layout(location = 0) in vec3 fragColor;
+layout(location = 1) in vec2 fragTexCoord;
+
+layout(location = 0) out vec4 outColor;
+
+void main()
+{
+#ifdef INSTANCE_MATERIAL
+	Material material = materials[fragMaterial];
+#else
+	Material material = materials[push.materialIndex];
+#endif
+	vec4 texColor = texture(textures[nonuniformEXT(material.textureIndex)], fragTexCoord);
+	outColor = vec4(fragColor * texColor.rgb * material.baseColor.rgb, 1.0);
+}
+
+
+/*
+	Notes:
+		- Used for bindless materials (VulkanEnvironment::bindless). Set 2 has every texture and every material (MaterialTable), and it's bound once per command buffer.
+		- The material index comes from a push constant (triangleF_bindless.spv) or from the instance data (triangleF_bindless_gpu.spv, for GPU-driven rendering, where a draw may have instances of different models).
+		- nonuniformEXT: the index may differ between invocations of a draw (GPU-driven draws), which requires the shaderSampledImageArrayNonUniformIndexing feature.
+*/
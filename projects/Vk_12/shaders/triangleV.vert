@@ -1,22 +1,34 @@
 #version 450
 #extension GL_ARB_separate_shader_objects : enable
 
-layout(binding = 0) uniform UniformBufferObject {
-    mat4 model;
+layout(set = 0, binding = 0) uniform GlobalUBO {
     mat4 view;
     mat4 proj;
+    mat4 viewProj;
+    vec4 camPos;
+    float time;
+} global;
+
+layout(set = 1, binding = 0) uniform UniformBufferObject {
+    mat4 model;
 } ubo;
 
+#ifdef PACKED_VERTEX
+layout(location = 0) in vec3 inPosition;	// unorm16 in [0, 1], relative to the mesh bounding box (the model matrix includes the dequantization)
+layout(location = 2) in vec2 inTexCoord;	// half floats
+const vec3 inColor = vec3(1.0);				// The packed layout has no color
+#else
 layout(location = 0) in vec3 inPosition;
 layout(location = 1) in vec3 inColor;
 layout(location = 2) in vec2 inTexCoord;
+#endif
 
 layout(location = 0) out vec3 fragColor;
 layout(location = 1) out vec2 fragTexCoord;
 
 void main()
 {
-	gl_Position  = ubo.proj * ubo.view * ubo.model * vec4(inPosition, 1.0);
+	gl_Position  = global.viewProj * ubo.model * vec4(inPosition, 1.0);
 	fragColor    = inColor;
 	fragTexCoord = inTexCoord;
 }
@@ -0,0 +1,53 @@
+#version 450
+#extension GL_ARB_separate_shader_objects : enable
+
+layout(set = 0, binding = 0) uniform GlobalUBO {
+    mat4 view;
+    mat4 proj;
+    mat4 viewProj;
+    vec4 camPos;
+    float time;
+} global;
+
+struct Instance {
+    mat4 model;			// Includes the dequantization of packed vertices
+    vec4 sphere;
+    uint firstDraw;
+    uint lodCount;
+    uint materialIndex;	// Bindless materials (VulkanEnvironment::bindless)
+    uint padding;
+};
+
+layout(std430, set = 0, binding = 1) readonly buffer Instances { Instance instances[]; };	// Every instance of every model
+layout(std430, set = 0, binding = 2) readonly buffer Visible   { uint visible[]; };		// Visible instances, written by cull.comp (each indirect draw reads its own range)
+
+#ifdef PACKED_VERTEX
+layout(location = 0) in vec3 inPosition;	// unorm16 in [0, 1], relative to the mesh bounding box (the model matrix includes the dequantization)
+layout(location = 2) in vec2 inTexCoord;	// half floats
+const vec3 inColor = vec3(1.0);				// The packed layout has no color
+#else
+layout(location = 0) in vec3 inPosition;
+layout(location = 1) in vec3 inColor;
+layout(location = 2) in vec2 inTexCoord;
+#endif
+
+layout(location = 0) out vec3 fragColor;
+layout(location = 1) out vec2 fragTexCoord;
+layout(location = 2) flat out uint fragMaterial;	// Read by triangleF_bindless_gpu.spv (ignored by other fragment shaders)
+
+void main()
+{
+	Instance instance = instances[visible[gl_InstanceIndex]];
+	gl_Position  = global.viewProj * instance.model * vec4(inPosition, 1.0);
+	fragColor    = inColor;
+	fragTexCoord = inTexCoord;
+	fragMaterial = instance.materialIndex;
+}
+
+
+/*
+	Notes:
+		- Used for GPU-driven rendering (VulkanEnvironment::gpuDriven). Every model is drawn with indirect draws generated by cull.comp, one per LOD.
+		  gl_InstanceIndex includes the firstInstance of the draw, which is the start of its range in the visible list, so visible[gl_InstanceIndex] is the instance to draw.
+		- Requires the drawIndirectFirstInstance feature.
+*/
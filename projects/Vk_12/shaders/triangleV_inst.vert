@@ -0,0 +1,38 @@
+#version 450
+#extension GL_ARB_separate_shader_objects : enable
+
+layout(set = 0, binding = 0) uniform GlobalUBO {
+    mat4 view;
+    mat4 proj;
+    mat4 viewProj;
+    vec4 camPos;
+    float time;
+} global;
+
+#ifdef PACKED_VERTEX
+layout(location = 0) in vec3 inPosition;	// unorm16 in [0, 1], relative to the mesh bounding box (the model matrix includes the dequantization)
+layout(location = 2) in vec2 inTexCoord;	// half floats
+const vec3 inColor = vec3(1.0);				// The packed layout has no color
+#else
+layout(location = 0) in vec3 inPosition;
+layout(location = 1) in vec3 inColor;
+layout(location = 2) in vec2 inTexCoord;
+#endif
+layout(location = 3) in mat4 inModel;		// Per-instance model matrix (instance-rate vertex buffer). A mat4 takes 4 locations (3-6).
+
+layout(location = 0) out vec3 fragColor;
+layout(location = 1) out vec2 fragTexCoord;
+
+void main()
+{
+	gl_Position  = global.viewProj * inModel * vec4(inPosition, 1.0);
+	fragColor    = inColor;
+	fragTexCoord = inTexCoord;
+}
+
+
+/*
+	Notes:
+		- Used for instanced models (modelConfig::instanced). All the instances are drawn with a single vkCmdDrawIndexed (instanceCount = number of model matrices).
+		  gl_InstanceIndex selects the instance, and the vertex input fetches its model matrix from binding 1 (VK_VERTEX_INPUT_RATE_INSTANCE).
+*/
@@ -0,0 +1,306 @@
+#include <iostream>
+#include <stdexcept>
+#include <algorithm>			// std::max
+#include <iterator>				// std::prev
+
+#include "allocator.hpp"
+
+// RangeAllocator ----------------------------------------------------------------------------------
+
+RangeAllocator::RangeAllocator(VkDeviceSize capacity)
+	: capacity(capacity), used(0)
+{
+	if (capacity) freeRanges[0] = capacity;
+}
+
+bool RangeAllocator::allocate(VkDeviceSize size, VkDeviceSize alignment, VkDeviceSize& offset)
+{
+	if (size == 0) return false;
+	if (alignment == 0) alignment = 1;
+
+	// Best fit: free range with the smallest remainder after the aligned sub-range (the alignment padding stays free, so it isn't waste).
+	std::map<VkDeviceSize, VkDeviceSize>::iterator best = freeRanges.end();
+	VkDeviceSize bestWaste = ~VkDeviceSize(0);
+
+	for (auto it = freeRanges.begin(); it != freeRanges.end(); it++)
+	{
+		VkDeviceSize aligned = (it->first + alignment - 1) / alignment * alignment;
+		if (aligned + size > it->first + it->second) continue;
+
+		VkDeviceSize waste = (it->first + it->second) - (aligned + size);
+		if (waste < bestWaste)
+		{
+			best = it;
+			bestWaste = waste;
+			if (waste == 0) break;
+		}
+	}
+
+	if (best == freeRanges.end()) return false;
+
+	// Split the free range: [padding][allocation][remainder]. Padding and remainder stay in the free list.
+	VkDeviceSize rangeStart = best->first;
+	VkDeviceSize rangeEnd	= best->first + best->second;
+	offset					= (rangeStart + alignment - 1) / alignment * alignment;
+
+	freeRanges.erase(best);
+	if (offset > rangeStart)		freeRanges[rangeStart] = offset - rangeStart;
+	if (offset + size < rangeEnd)	freeRanges[offset + size] = rangeEnd - (offset + size);
+
+	used += size;
+	return true;
+}
+
+void RangeAllocator::free(VkDeviceSize offset, VkDeviceSize size)
+{
+	if (size == 0) return;
+
+	used -= size;
+	VkDeviceSize start	= offset;
+	VkDeviceSize end	= offset + size;
+
+	// Merge with the next free range
+	auto next = freeRanges.lower_bound(start);
+	if (next != freeRanges.end() && next->first == end)
+	{
+		end += next->second;
+		next = freeRanges.erase(next);
+	}
+
+	// Merge with the previous free range
+	if (next != freeRanges.begin())
+	{
+		auto prev = std::prev(next);
+		if (prev->first + prev->second == start)
+		{
+			prev->second = end - prev->first;
+			return;
+		}
+	}
+
+	freeRanges[start] = end - start;
+}
+
+void RangeAllocator::reset()
+{
+	freeRanges.clear();
+	if (capacity) freeRanges[0] = capacity;
+	used = 0;
+}
+
+VkDeviceSize RangeAllocator::getCapacity() const { return capacity; }
+
+VkDeviceSize RangeAllocator::getUsed() const { return used; }
+
+size_t RangeAllocator::getFreeRangeCount() const { return freeRanges.size(); }
+
+VkDeviceSize RangeAllocator::getLargestFreeRange() const
+{
+	VkDeviceSize largest = 0;
+	for (auto& range : freeRanges)
+		largest = std::max(largest, range.second);
+	return largest;
+}
+
+// MemoryAllocator ---------------------------------------------------------------------------------
+
+void MemoryAllocator::init(VkPhysicalDevice physicalDevice, VkDevice device)
+{
+	this->physicalDevice	= physicalDevice;
+	this->device			= device;
+	deviceAllocations		= 0;
+
+	vkGetPhysicalDeviceMemoryProperties(physicalDevice, &memProperties);
+
+	VkPhysicalDeviceProperties deviceProperties;
+	vkGetPhysicalDeviceProperties(physicalDevice, &deviceProperties);
+	nonCoherentAtomSize = deviceProperties.limits.nonCoherentAtomSize;
+
+	pools.resize(2 * memProperties.memoryTypeCount);
+}
+
+/**
+*	Graphic cards can offer different types of memory to allocate from. Each type of memory varies in terms of allowed operations and performance characteristics.
+*	@param typeFilter Specifies the bit field of memory types that are suitable.
+*	@param properties Specifies the bit field of the desired properties of such memory types.
+*	@return Index of a memory type suitable for the resource that also has all of the properties we need.
+*/
+uint32_t MemoryAllocator::findMemoryType(uint32_t typeFilter, VkMemoryPropertyFlags properties)
+{
+	for (uint32_t i = 0; i < memProperties.memoryTypeCount; i++)
+		if (typeFilter & (1 << i) && (memProperties.memoryTypes[i].propertyFlags & properties) == properties)
+			return i;
+
+	throw std::runtime_error("Failed to find suitable memory type!");
+}
+
+/// Small heaps (example: 256 MB of host visible VRAM) get smaller blocks, so a few blocks don't fill them up.
+VkDeviceSize MemoryAllocator::getBlockSize(uint32_t memoryType)
+{
+	VkDeviceSize heapSize = memProperties.memoryHeaps[memProperties.memoryTypes[memoryType].heapIndex].size;
+	return std::min(preferredBlockSize, heapSize / 8);
+}
+
+MemoryBlock& MemoryAllocator::createBlock(uint32_t memoryType, bool linear, VkDeviceSize size, bool dedicated)
+{
+	VkMemoryAllocateInfo allocInfo{};
+	allocInfo.sType				= VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
+	allocInfo.allocationSize	= size;
+	allocInfo.memoryTypeIndex	= memoryType;
+
+	VkDeviceMemory memory;
+	if (vkAllocateMemory(device, &allocInfo, nullptr, &memory) != VK_SUCCESS)
+		throw std::runtime_error("Failed to allocate device memory block!");
+	deviceAllocations++;
+
+	std::list<MemoryBlock>& pool = pools[2 * memoryType + (linear ? 0 : 1)];
+	pool.push_back(MemoryBlock());
+
+	MemoryBlock& block	= pool.back();
+	block.memory		= memory;
+	block.size			= size;
+	block.memoryType	= memoryType;
+	block.linear		= linear;
+	block.dedicated		= dedicated;
+	block.ranges		= RangeAllocator(size);
+
+	if (memProperties.memoryTypes[memoryType].propertyFlags & VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT)		// Persistent mapping (a memory object can only be mapped once at a time)
+		if (vkMapMemory(device, memory, 0, VK_WHOLE_SIZE, 0, &block.mapped) != VK_SUCCESS)
+			throw std::runtime_error("Failed to map device memory block!");
+
+	return block;
+}
+
+void MemoryAllocator::destroyBlock(MemoryBlock& block)
+{
+	if (block.mapped) vkUnmapMemory(device, block.memory);
+	vkFreeMemory(device, block.memory, nullptr);
+	deviceAllocations--;
+
+	std::list<MemoryBlock>& pool = pools[2 * block.memoryType + (block.linear ? 0 : 1)];
+	for (auto it = pool.begin(); it != pool.end(); it++)
+		if (&(*it) == &block) { pool.erase(it); break; }
+}
+
+/**
+*	@param requirements Memory requirements of the resource (vkGetBufferMemoryRequirements, vkGetImageMemoryRequirements)
+*	@param properties Desired properties of the memory (device local, host visible...)
+*	@param linear True for buffers and VK_IMAGE_TILING_LINEAR images. False for VK_IMAGE_TILING_OPTIMAL images.
+*	@return Allocation. Bind the resource to allocation.memory at allocation.offset.
+*/
+Allocation MemoryAllocator::allocate(const VkMemoryRequirements& requirements, VkMemoryPropertyFlags properties, bool linear)
+{
+	uint32_t memoryType = findMemoryType(requirements.memoryTypeBits, properties);
+
+	VkDeviceSize alignment = requirements.alignment;
+	VkMemoryPropertyFlags flags = memProperties.memoryTypes[memoryType].propertyFlags;
+	if ((flags & VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT) && !(flags & VK_MEMORY_PROPERTY_HOST_COHERENT_BIT))
+		alignment = std::max(alignment, nonCoherentAtomSize);		// Ranges must be flushable without touching neighbour allocations.
+
+	Allocation allocation;
+	VkDeviceSize blockSize = getBlockSize(memoryType);
+
+	// Big resources get their own block
+	if (requirements.size > blockSize / 2)
+	{
+		MemoryBlock& block = createBlock(memoryType, linear, requirements.size, true);
+		block.ranges.allocate(requirements.size, alignment, allocation.offset);
+		allocation.block = &block;
+	}
+	else
+	{
+		// Look for room in existing blocks
+		for (MemoryBlock& block : pools[2 * memoryType + (linear ? 0 : 1)])
+			if (!block.dedicated && block.ranges.allocate(requirements.size, alignment, allocation.offset))
+			{
+				allocation.block = &block;
+				break;
+			}
+
+		// Create a new block if there was no room
+		if (!allocation.block)
+		{
+			MemoryBlock& block = createBlock(memoryType, linear, blockSize, false);
+			block.ranges.allocate(requirements.size, alignment, allocation.offset);
+			allocation.block = &block;
+		}
+	}
+
+	allocation.block->allocationCount++;
+	allocation.memory	= allocation.block->memory;
+	allocation.size		= requirements.size;
+	allocation.mapped	= allocation.block->mapped ? (char*)allocation.block->mapped + allocation.offset : nullptr;
+
+	return allocation;
+}
+
+void MemoryAllocator::free(Allocation& allocation)
+{
+	MemoryBlock* block = allocation.block;
+	if (!block) return;
+
+	block->ranges.free(allocation.offset, allocation.size);
+	block->allocationCount--;
+	allocation = Allocation();
+
+	// Release empty blocks (keep the last one of each pool to avoid allocation churn)
+	if (block->allocationCount == 0)
+	{
+		std::list<MemoryBlock>& pool = pools[2 * block->memoryType + (block->linear ? 0 : 1)];
+		if (block->dedicated || pool.size() > 1)
+			destroyBlock(*block);
+	}
+}
+
+void MemoryAllocator::printStats()
+{
+	size_t totalAllocations = 0;
+	VkDeviceSize totalReserved = 0, totalUsed = 0;
+
+	std::cout << "Memory allocator stats:" << std::endl;
+
+	for (size_t i = 0; i < pools.size(); i++)
+	{
+		if (pools[i].empty()) continue;
+
+		size_t allocations = 0, freeRanges = 0;
+		VkDeviceSize reserved = 0, used = 0, largestFree = 0;
+
+		for (MemoryBlock& block : pools[i])
+		{
+			allocations	+= block.allocationCount;
+			reserved	+= block.size;
+			used		+= block.ranges.getUsed();
+			freeRanges	+= block.ranges.getFreeRangeCount();
+			largestFree	 = std::max(largestFree, block.ranges.getLargestFreeRange());
+		}
+
+		std::cout	<< "\t- Memory type " << i / 2 << (i % 2 ? " (optimal)" : " (linear) ")
+					<< ": " << pools[i].size() << " blocks, "
+					<< allocations << " allocations, "
+					<< used / 1024 << " / " << reserved / 1024 << " KB used, "
+					<< freeRanges << " free ranges (largest: " << largestFree / 1024 << " KB)" << std::endl;
+
+		totalAllocations	+= allocations;
+		totalReserved		+= reserved;
+		totalUsed			+= used;
+	}
+
+	std::cout	<< "\t- Total: " << totalAllocations << " allocations in " << deviceAllocations << " vkAllocateMemory calls, "
+				<< totalUsed / 1024 << " / " << totalReserved / 1024 << " KB used" << std::endl;
+}
+
+void MemoryAllocator::cleanup()
+{
+	for (std::list<MemoryBlock>& pool : pools)
+	{
+		for (MemoryBlock& block : pool)
+		{
+			if (block.mapped) vkUnmapMemory(device, block.memory);
+			vkFreeMemory(device, block.memory, nullptr);
+		}
+		pool.clear();
+	}
+
+	deviceAllocations = 0;
+}
@@ -0,0 +1,534 @@
+#include <algorithm>
+#include <numeric>
+#include <functional>
+#include <cfloat>
+#include <cmath>
+
+#include "bvh.hpp"
+
+
+namespace
+{
+	const int		maxDepth	= 64;			///< Deeper nodes become leaves (bounds the traversal stacks)
+	const float		traversalCost = 1.f;		///< SAH cost of visiting a node, relative to testing an object
+
+	float area(const glm::vec3& boxMin, const glm::vec3& boxMax)
+	{
+		glm::vec3 d = glm::max(boxMax - boxMin, glm::vec3(0.f));
+		return d.x * d.y + d.y * d.z + d.z * d.x;		// Half the surface area (only ratios are used)
+	}
+
+	glm::vec3 nodeMin(const BvhNode& node) { return glm::vec3(node.boundsMin[0], node.boundsMin[1], node.boundsMin[2]); }
+	glm::vec3 nodeMax(const BvhNode& node) { return glm::vec3(node.boundsMax[0], node.boundsMax[1], node.boundsMax[2]); }
+
+	void setNodeBounds(BvhNode& node, const glm::vec3& boxMin, const glm::vec3& boxMax)
+	{
+		for (int k = 0; k < 3; k++)
+		{
+			node.boundsMin[k] = boxMin[k];
+			node.boundsMax[k] = boxMax[k];
+		}
+	}
+
+	/// 0: box outside the frustum, 1: intersecting it, 2: fully inside.
+	int classify(const Frustum& frustum, const glm::vec3& boxMin, const glm::vec3& boxMax)
+	{
+		glm::vec3 center = (boxMin + boxMax) * 0.5f;
+		glm::vec3 extent = (boxMax - boxMin) * 0.5f;
+		int result = 2;
+
+		for (const glm::vec4& plane : frustum.planes)
+		{
+			float distance	= glm::dot(glm::vec3(plane), center) + plane.w;
+			float radius	= glm::dot(glm::abs(glm::vec3(plane)), extent);
+			if (distance + radius < 0.f) return 0;
+			if (distance - radius < 0.f) result = 1;
+		}
+		return result;
+	}
+
+	/// Slab test. Returns the entry distance, or a negative value if the ray misses the box within [0, maxT].
+	float intersect(const glm::vec3& origin, const glm::vec3& invDirection, const glm::vec3& boxMin, const glm::vec3& boxMax, float maxT)
+	{
+		glm::vec3 t0 = (boxMin - origin) * invDirection;
+		glm::vec3 t1 = (boxMax - origin) * invDirection;
+		glm::vec3 tNear = glm::min(t0, t1), tFar = glm::max(t0, t1);
+		float entry = std::max(std::max(tNear.x, tNear.y), std::max(tNear.z, 0.f));
+		float exit	= std::min(std::min(tFar.x, tFar.y), std::min(tFar.z, maxT));
+		return entry <= exit ? entry : -1.f;
+	}
+}
+
+// Build -----------------------------------------------------------------------------------------
+
+void Bvh::clear()
+{
+	nodes.clear();
+	objects.clear();
+	objectMin.clear();
+	objectMax.clear();
+	parents.clear();
+	objectLeaf.clear();
+	dirtyObjects.clear();
+	dirtyNodes.clear();
+}
+
+/**
+*	The calling thread splits the nodes until they are small enough (objectCount / (4 * threads) objects) and leaves them pending. Then, each pending subtree is built by a worker into its own node array, and the arrays are appended to the main one. Subtrees own disjoint ranges of objects, so they can be sorted in place concurrently.
+*/
+void Bvh::build(const glm::vec3* boxMin, const glm::vec3* boxMax, size_t objectCount, WorkerPool* workers)
+{
+	clear();
+	if (objectCount == 0) return;
+
+	objectMin.assign(boxMin, boxMin + objectCount);
+	objectMax.assign(boxMax, boxMax + objectCount);
+	objects.resize(objectCount);
+	std::iota(objects.begin(), objects.end(), 0);
+
+	nodes.reserve(2 * objectCount / maxLeafSize + 1);
+	nodes.push_back(BvhNode());
+
+	if (!workers || workers->size() < 2)
+	{
+		buildNode(nodes, 0, 0, static_cast<uint32_t>(objectCount), 0, nullptr, 0);
+		linkNodes();
+		return;
+	}
+
+	std::vector<BuildTask> pending;
+	buildNode(nodes, 0, 0, static_cast<uint32_t>(objectCount), 0, &pending, objectCount / (4 * workers->size()) + 1);
+
+	std::vector<std::vector<BvhNode>> subtrees(pending.size());
+	workers->run(pending.size(), [&](size_t t)
+	{
+		subtrees[t].push_back(BvhNode());
+		buildNode(subtrees[t], 0, pending[t].begin, pending[t].end, pending[t].depth, nullptr, 0);
+	});
+
+	for (size_t t = 0; t < pending.size(); t++)
+	{
+		// Local node 0 replaces the pending node, and local node k (k > 0) is appended at offset + k - 1.
+		uint32_t offset = static_cast<uint32_t>(nodes.size()) - 1;
+		for (BvhNode& node : subtrees[t])
+			if (!node.isLeaf()) node.first += offset;
+
+		nodes[pending[t].node] = subtrees[t][0];
+		nodes.insert(nodes.end(), subtrees[t].begin() + 1, subtrees[t].end());
+	}
+
+	linkNodes();
+}
+
+/**
+*	Nodes with pending != nullptr leave their children pending if they have pendingLimit objects or less. Children are always allocated after their parent, so a reverse sweep of the array visits children before parents (used by refit()).
+*/
+void Bvh::buildNode(std::vector<BvhNode>& out, uint32_t node, uint32_t begin, uint32_t end, int depth, std::vector<BuildTask>* pending, size_t pendingLimit)
+{
+	glm::vec3 boundsMin(FLT_MAX), boundsMax(-FLT_MAX);
+	for (uint32_t i = begin; i < end; i++)
+	{
+		boundsMin = glm::min(boundsMin, objectMin[objects[i]]);
+		boundsMax = glm::max(boundsMax, objectMax[objects[i]]);
+	}
+	setNodeBounds(out[node], boundsMin, boundsMax);
+
+	uint32_t middle;
+	if (depth + 1 >= maxDepth || !split(boundsMin, boundsMax, begin, end, middle))
+	{
+		out[node].first = begin;
+		out[node].count = end - begin;
+		return;
+	}
+
+	uint32_t left = static_cast<uint32_t>(out.size());
+	out[node].first = left;
+	out[node].count = 0;
+	out.resize(out.size() + 2);
+
+	const uint32_t ranges[2][2] = { { begin, middle }, { middle, end } };
+	for (int c = 0; c < 2; c++)
+	{
+		if (pending && ranges[c][1] - ranges[c][0] <= pendingLimit)
+			pending->push_back({ left + c, ranges[c][0], ranges[c][1], depth + 1 });
+		else
+			buildNode(out, left + c, ranges[c][0], ranges[c][1], depth + 1, pending, pendingLimit);
+	}
+}
+
+/**
+*	Binned SAH (Wald 2007): the centroids are distributed in binCount bins along each axis, and the cost of each plane between bins is area(left) * count(left) + area(right) * count(right), computed with a sweep from each side.
+*	If no plane is cheaper than a leaf, the node becomes a leaf, unless it has more than maxLeafSize objects. Then, or if all centroids are in the same point, the objects are split in 2 halves along the largest axis.
+*/
+bool Bvh::split(const glm::vec3& boundsMin, const glm::vec3& boundsMax, uint32_t begin, uint32_t end, uint32_t& middle)
+{
+	uint32_t count = end - begin;
+	if (count < 2) return false;
+
+	glm::vec3 centroidMin(FLT_MAX), centroidMax(-FLT_MAX);
+	for (uint32_t i = begin; i < end; i++)
+	{
+		glm::vec3 centroid = (objectMin[objects[i]] + objectMax[objects[i]]) * 0.5f;
+		centroidMin = glm::min(centroidMin, centroid);
+		centroidMax = glm::max(centroidMax, centroid);
+	}
+
+	struct Bin { glm::vec3 boundsMin = glm::vec3(FLT_MAX), boundsMax = glm::vec3(-FLT_MAX); uint32_t count = 0; };
+
+	float bestCost	= FLT_MAX;
+	int bestAxis	= -1;
+	uint32_t bestPlane = 0;		// Bins [0, bestPlane] go to the left child
+
+	for (int axis = 0; axis < 3; axis++)
+	{
+		float extent = centroidMax[axis] - centroidMin[axis];
+		if (extent <= 0.f) continue;
+		float scale = binCount / extent;
+
+		Bin bins[binCount];
+		for (uint32_t i = begin; i < end; i++)
+		{
+			uint32_t object = objects[i];
+			float centroid	= (objectMin[object][axis] + objectMax[object][axis]) * 0.5f;
+			Bin& bin		= bins[std::min(binCount - 1, static_cast<uint32_t>((centroid - centroidMin[axis]) * scale))];
+			bin.boundsMin	= glm::min(bin.boundsMin, objectMin[object]);
+			bin.boundsMax	= glm::max(bin.boundsMax, objectMax[object]);
+			bin.count++;
+		}
+
+		float rightCost[binCount];			// rightCost[p]: cost of bins (p, binCount)
+		glm::vec3 sweepMin(FLT_MAX), sweepMax(-FLT_MAX);
+		uint32_t sweepCount = 0;
+		for (uint32_t p = binCount - 1; p > 0; p--)
+		{
+			sweepMin = glm::min(sweepMin, bins[p].boundsMin);
+			sweepMax = glm::max(sweepMax, bins[p].boundsMax);
+			sweepCount += bins[p].count;
+			rightCost[p - 1] = sweepCount ? area(sweepMin, sweepMax) * sweepCount : FLT_MAX;
+		}
+
+		sweepMin = glm::vec3(FLT_MAX); sweepMax = glm::vec3(-FLT_MAX);
+		sweepCount = 0;
+		for (uint32_t p = 0; p < binCount - 1; p++)
+		{
+			sweepMin = glm::min(sweepMin, bins[p].boundsMin);
+			sweepMax = glm::max(sweepMax, bins[p].boundsMax);
+			sweepCount += bins[p].count;
+			if (sweepCount == 0 || sweepCount == count) continue;
+
+			float cost = area(sweepMin, sweepMax) * sweepCount + rightCost[p];
+			if (cost < bestCost)
+			{
+				bestCost	= cost;
+				bestAxis	= axis;
+				bestPlane	= p;
+			}
+		}
+	}
+
+	float nodeArea	= area(boundsMin, boundsMax);
+	bool useSah		= bestAxis >= 0 && (nodeArea <= 0.f || traversalCost + bestCost / nodeArea < count);
+
+	if (!useSah && count <= maxLeafSize) return false;
+
+	uint32_t* first = objects.data() + begin;
+	uint32_t* last	= objects.data() + end;
+
+	if (useSah)
+	{
+		float scale = binCount / (centroidMax[bestAxis] - centroidMin[bestAxis]);
+		middle = begin + static_cast<uint32_t>(std::partition(first, last, [&](uint32_t object)
+		{
+			float centroid = (objectMin[object][bestAxis] + objectMax[object][bestAxis]) * 0.5f;
+			return std::min(binCount - 1, static_cast<uint32_t>((centroid - centroidMin[bestAxis] ) * scale)) <= bestPlane;
+		}) - first);
+	}
+	else
+	{
+		glm::vec3 size	= centroidMax - centroidMin;
+		int axis		= size.x > size.y ? (size.x > size.z ? 0 : 2) : (size.y > size.z ? 1 : 2);
+		middle			= begin + count / 2;
+		std::nth_element(first, objects.data() + middle, last, [&](uint32_t a, uint32_t b)
+		{
+			return objectMin[a][axis] + objectMax[a][axis] < objectMin[b][axis] + objectMax[b][axis];
+		});
+	}
+	return true;
+}
+
+void Bvh::linkNodes()
+{
+	parents.assign(nodes.size(), UINT32_MAX);
+	objectLeaf.resize(objects.size());
+	dirtyNodes.assign(nodes.size(), 0);
+
+	for (uint32_t n = 0; n < nodes.size(); n++)
+	{
+		const BvhNode& node = nodes[n];
+		if (node.isLeaf())
+			for (uint32_t i = node.first; i < node.first + node.count; i++)
+				objectLeaf[objects[i]] = n;
+		else
+			parents[node.first] = parents[node.first + 1] = n;
+	}
+}
+
+int Bvh::depth() const
+{
+	if (nodes.empty()) return 0;
+
+	std::vector<int> nodeDepth(nodes.size(), 1);
+	int result = 1;
+	for (uint32_t n = 0; n < nodes.size(); n++)		// Parents come before their children
+		if (!nodes[n].isLeaf())
+			nodeDepth[nodes[n].first] = nodeDepth[nodes[n].first + 1] = nodeDepth[n] + 1;
+		else
+			result = std::max(result, nodeDepth[n]);
+	return result;
+}
+
+// Refit -----------------------------------------------------------------------------------------
+
+void Bvh::update(uint32_t object, const glm::vec3& boxMin, const glm::vec3& boxMax)
+{
+	objectMin[object] = boxMin;
+	objectMax[object] = boxMax;
+	dirtyObjects.push_back(object);
+}
+
+void Bvh::setBounds(uint32_t n)
+{
+	BvhNode& node = nodes[n];
+	glm::vec3 boundsMin(FLT_MAX), boundsMax(-FLT_MAX);
+
+	if (node.isLeaf())
+		for (uint32_t i = node.first; i < node.first + node.count; i++)
+		{
+			boundsMin = glm::min(boundsMin, objectMin[objects[i]]);
+			boundsMax = glm::max(boundsMax, objectMax[objects[i]]);
+		}
+	else
+		for (uint32_t child = node.first; child < node.first + 2; child++)
+		{
+			boundsMin = glm::min(boundsMin, nodeMin(nodes[child]));
+			boundsMax = glm::max(boundsMax, nodeMax(nodes[child]));
+		}
+
+	setNodeBounds(node, boundsMin, boundsMax);
+}
+
+/**
+*	The leaves of the updated objects and their ancestors are marked and recomputed children first (in decreasing index order, since children come after their parents). If more than ~3% of the objects moved, a sweep over the whole array is cheaper than sorting the marked nodes.
+*/
+void Bvh::refit()
+{
+	if (dirtyObjects.empty()) return;
+
+	if (dirtyObjects.size() * 32 > objects.size())
+	{
+		for (size_t n = nodes.size(); n-- > 0; )
+			setBounds(static_cast<uint32_t>(n));
+		dirtyObjects.clear();
+		return;
+	}
+
+	std::vector<uint32_t> marked;
+	for (uint32_t object : dirtyObjects)
+		for (uint32_t n = objectLeaf[object]; n != UINT32_MAX && !dirtyNodes[n]; n = parents[n])
+		{
+			dirtyNodes[n] = 1;
+			marked.push_back(n);
+		}
+
+	std::sort(marked.begin(), marked.end(), std::greater<uint32_t>());
+	for (uint32_t n : marked)
+	{
+		setBounds(n);
+		dirtyNodes[n] = 0;
+	}
+	dirtyObjects.clear();
+}
+
+// Queries ---------------------------------------------------------------------------------------
+
+void Bvh::subtreeObjects(uint32_t n, std::vector<uint32_t>& result) const
+{
+	// The objects of a subtree are contiguous: from the first object of its leftmost leaf to the last one of its rightmost leaf.
+	uint32_t leftmost = n, rightmost = n;
+	while (!nodes[leftmost].isLeaf())  leftmost  = nodes[leftmost].first;
+	while (!nodes[rightmost].isLeaf()) rightmost = nodes[rightmost].first + 1;
+
+	result.insert(result.end(), objects.begin() + nodes[leftmost].first, objects.begin() + nodes[rightmost].first + nodes[rightmost].count);
+}
+
+void Bvh::frustumTraverse(const Frustum& frustum, uint32_t root, std::vector<uint32_t>& result) const
+{
+	uint32_t stack[maxDepth + 1];
+	int top = 0;
+	stack[top++] = root;
+
+	while (top > 0)
+	{
+		uint32_t n = stack[--top];
+		const BvhNode& node = nodes[n];
+
+		int inside = classify(frustum, nodeMin(node), nodeMax(node));
+		if (inside == 0) continue;
+		if (inside == 2) { subtreeObjects(n, result); continue; }
+
+		if (node.isLeaf())
+		{
+			for (uint32_t i = node.first; i < node.first + node.count; i++)
+				if (classify(frustum, objectMin[objects[i]], objectMax[objects[i]]))
+					result.push_back(objects[i]);
+		}
+		else
+		{
+			stack[top++] = node.first + 1;
+			stack[top++] = node.first;
+		}
+	}
+}
+
+/**
+*	Parallel version: the top of the tree is expanded breadth first (culled nodes dropped, nodes fully inside output directly) until there are 4 subtrees per thread, and then each subtree is traversed by a worker into its own list.
+*/
+void Bvh::queryFrustum(const Frustum& frustum, std::vector<uint32_t>& result, WorkerPool* workers) const
+{
+	if (nodes.empty()) return;
+
+	if (!workers || workers->size() < 2)
+	{
+		frustumTraverse(frustum, 0, result);
+		return;
+	}
+
+	std::vector<uint32_t> roots(1, 0), next;
+	while (!roots.empty() && roots.size() < 4 * workers->size())
+	{
+		next.clear();
+		bool expanded = false;
+		for (uint32_t n : roots)
+		{
+			const BvhNode& node = nodes[n];
+			if (node.isLeaf()) { next.push_back(n); continue; }
+
+			int inside = classify(frustum, nodeMin(node), nodeMax(node));
+			if (inside == 2) subtreeObjects(n, result);
+			else if (inside == 1)
+			{
+				next.push_back(node.first);
+				next.push_back(node.first + 1);
+				expanded = true;
+			}
+		}
+		roots.swap(next);
+		if (!expanded) break;
+	}
+
+	std::vector<std::vector<uint32_t>> partial(roots.size());
+	workers->run(roots.size(), [&](size_t r) { frustumTraverse(frustum, roots[r], partial[r]); });
+
+	for (const std::vector<uint32_t>& list : partial)
+		result.insert(result.end(), list.begin(), list.end());
+}
+
+/**
+*	Front to back traversal: of the 2 children, the closest one is visited first, and nodes farther than the closest hit found so far are skipped.
+*/
+BvhHit Bvh::queryRay(const glm::vec3& origin, const glm::vec3& direction, float maxT) const
+{
+	BvhHit hit;
+	if (nodes.empty()) return hit;
+
+	glm::vec3 invDirection = 1.f / direction;		// Infinite for 0 components (the slab test still works)
+	float closest = maxT;
+
+	uint32_t stack[maxDepth + 1];
+	int top = 0;
+	if (intersect(origin, invDirection, nodeMin(nodes[0]), nodeMax(nodes[0]), closest) >= 0.f)
+		stack[top++] = 0;
+
+	while (top > 0)
+	{
+		const BvhNode& node = nodes[stack[--top]];
+
+		if (node.isLeaf())
+		{
+			for (uint32_t i = node.first; i < node.first + node.count; i++)
+			{
+				float t = intersect(origin, invDirection, objectMin[objects[i]], objectMax[objects[i]], closest);
+				if (t >= 0.f && (t < closest || hit.object == UINT32_MAX))
+				{
+					closest		= t;
+					hit.object	= objects[i];
+					hit.t		= t;
+				}
+			}
+			continue;
+		}
+
+		uint32_t near = node.first, far = node.first + 1;
+		float tNear = intersect(origin, invDirection, nodeMin(nodes[near]), nodeMax(nodes[near]), closest);
+		float tFar	= intersect(origin, invDirection, nodeMin(nodes[far]),  nodeMax(nodes[far]),  closest);
+		if (tFar >= 0.f && (tNear < 0.f || tFar < tNear))
+		{
+			std::swap(near, far);
+			std::swap(tNear, tFar);
+		}
+
+		if (tFar  >= 0.f) stack[top++] = far;
+		if (tNear >= 0.f) stack[top++] = near;
+	}
+	return hit;
+}
+
+void Bvh::queryRays(const glm::vec3* origins, const glm::vec3* directions, BvhHit* hits, size_t rayCount, float maxT, WorkerPool* workers) const
+{
+	const size_t batch = 256;		// Rays per task
+
+	if (!workers || workers->size() < 2 || rayCount <= batch)
+	{
+		for (size_t r = 0; r < rayCount; r++)
+			hits[r] = queryRay(origins[r], directions[r], maxT);
+		return;
+	}
+
+	workers->run((rayCount + batch - 1) / batch, [&](size_t b)
+	{
+		for (size_t r = b * batch; r < std::min(rayCount, (b + 1) * batch); r++)
+			hits[r] = queryRay(origins[r], directions[r], maxT);
+	});
+}
+
+void Bvh::queryBox(const glm::vec3& boxMin, const glm::vec3& boxMax, std::vector<uint32_t>& result) const
+{
+	if (nodes.empty()) return;
+
+	auto overlaps = [&](const glm::vec3& otherMin, const glm::vec3& otherMax)
+	{
+		return glm::all(glm::lessThanEqual(otherMin, boxMax)) && glm::all(glm::lessThanEqual(boxMin, otherMax));
+	};
+
+	uint32_t stack[maxDepth + 1];
+	int top = 0;
+	stack[top++] = 0;
+
+	while (top > 0)
+	{
+		const BvhNode& node = nodes[stack[--top]];
+		if (!overlaps(nodeMin(node), nodeMax(node))) continue;
+
+		if (node.isLeaf())
+		{
+			for (uint32_t i = node.first; i < node.first + node.count; i++)
+				if (overlaps(objectMin[objects[i]], objectMax[objects[i]]))
+					result.push_back(objects[i]);
+		}
+		else
+		{
+			stack[top++] = node.first + 1;
+			stack[top++] = node.first;
+		}
+	}
+}
@@ -0,0 +1,169 @@
+#include <algorithm>
+#include <cmath>
+
+#if defined(__AVX__)
+	#include <immintrin.h>
+#elif defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+	#include <emmintrin.h>
+	#define CULLING_SSE
+#endif
+
+#include "culling.hpp"
+
+
+// Frustum ---------------------------------------------------------------------------------------
+
+/**
+*	Each plane is a combination of the rows of the matrix (glm is column major: row i is (m[0][i], m[1][i], m[2][i], m[3][i])). A clip space point is inside if -w <= x, y <= w and -w <= z <= w.
+*	The near plane uses the OpenGL depth range (-w <= z). With the Vulkan range (0 <= z), that plane is a bit behind the real near plane, which is conservative (nothing visible is culled).
+*/
+Frustum::Frustum(const glm::mat4& m)
+{
+	glm::vec4 row[4];
+	for (int i = 0; i < 4; i++)
+		row[i] = glm::vec4(m[0][i], m[1][i], m[2][i], m[3][i]);
+
+	planes[0] = row[3] + row[0];		// Left
+	planes[1] = row[3] - row[0];		// Right
+	planes[2] = row[3] + row[1];		// Bottom
+	planes[3] = row[3] - row[1];		// Top
+	planes[4] = row[3] + row[2];		// Near
+	planes[5] = row[3] - row[2];		// Far
+
+	for (glm::vec4& plane : planes)
+		plane /= glm::length(glm::vec3(plane));
+}
+
+void transformBox(const glm::vec3& boxMin, const glm::vec3& boxMax, const glm::mat4& m, glm::vec3& worldMin, glm::vec3& worldMax)
+{
+	glm::vec3 center = glm::vec3(m * glm::vec4((boxMin + boxMax) * 0.5f, 1.f));
+	glm::mat3 a		 = glm::mat3(glm::abs(glm::vec3(m[0])), glm::abs(glm::vec3(m[1])), glm::abs(glm::vec3(m[2])));
+	glm::vec3 extent = a * ((boxMax - boxMin) * 0.5f);
+
+	worldMin = center - extent;
+	worldMax = center + extent;
+}
+
+// CullingSet ------------------------------------------------------------------------------------
+
+void CullingSet::resize(size_t objectCount)
+{
+	count = objectCount;
+	size_t padded = (objectCount + width - 1) / width * width;
+
+	for (std::vector<float>* component : { &centerX, &centerY, &centerZ, &extentX, &extentY, &extentZ })
+		component->assign(padded, 0.f);
+	radius.assign(padded, -1e30f);		// Padding: always behind every plane
+}
+
+void CullingSet::set(size_t i, const glm::vec3& boxMin, const glm::vec3& boxMax, float sphereRadius, const glm::mat4& m)
+{
+	glm::vec3 center = glm::vec3(m * glm::vec4((boxMin + boxMax) * 0.5f, 1.f));
+	glm::vec3 extent = (boxMax - boxMin) * 0.5f;
+	glm::mat3 a		 = glm::mat3(glm::abs(glm::vec3(m[0])), glm::abs(glm::vec3(m[1])), glm::abs(glm::vec3(m[2])));
+	glm::vec3 world  = a * extent;
+	float scale		 = std::max(glm::length(glm::vec3(m[0])), std::max(glm::length(glm::vec3(m[1])), glm::length(glm::vec3(m[2]))));
+
+	centerX[i] = center.x;	extentX[i] = world.x;
+	centerY[i] = center.y;	extentY[i] = world.y;
+	centerZ[i] = center.z;	extentZ[i] = world.z;
+	radius[i]  = sphereRadius * scale;
+}
+
+size_t CullingSet::cullScalar(const Frustum& frustum, uint32_t* visible) const
+{
+	size_t visibleCount = 0;
+	for (size_t i = 0; i < count; i++)
+	{
+		bool inside = true;
+		for (int p = 0; p < 6 && inside; p++)
+		{
+			const glm::vec4& plane = frustum.planes[p];
+			float distance	= (plane.x * centerX[i] + plane.y * centerY[i]) + (plane.z * centerZ[i] + plane.w);		// Same operation order as the SIMD version
+			float boxRadius	= std::abs(plane.x) * extentX[i] + std::abs(plane.y) * extentY[i] + std::abs(plane.z) * extentZ[i];
+			inside = distance + std::min(boxRadius, radius[i]) >= 0.f;
+		}
+		if (inside) visible[visibleCount++] = static_cast<uint32_t>(i);
+	}
+	return visibleCount;
+}
+
+#if defined(__AVX__)
+
+size_t CullingSet::cull(const Frustum& frustum, uint32_t* visible) const
+{
+	__m256 px[6], py[6], pz[6], pw[6], ax[6], ay[6], az[6];
+	for (int p = 0; p < 6; p++)
+	{
+		const glm::vec4& plane = frustum.planes[p];
+		px[p] = _mm256_set1_ps(plane.x);			ax[p] = _mm256_set1_ps(std::abs(plane.x));
+		py[p] = _mm256_set1_ps(plane.y);			ay[p] = _mm256_set1_ps(std::abs(plane.y));
+		pz[p] = _mm256_set1_ps(plane.z);			az[p] = _mm256_set1_ps(std::abs(plane.z));
+		pw[p] = _mm256_set1_ps(plane.w);
+	}
+
+	size_t visibleCount = 0;
+	for (size_t i = 0; i < count; i += 8)
+	{
+		__m256 cx = _mm256_loadu_ps(&centerX[i]), cy = _mm256_loadu_ps(&centerY[i]), cz = _mm256_loadu_ps(&centerZ[i]);
+		__m256 ex = _mm256_loadu_ps(&extentX[i]), ey = _mm256_loadu_ps(&extentY[i]), ez = _mm256_loadu_ps(&extentZ[i]);
+		__m256 r  = _mm256_loadu_ps(&radius[i]);
+		__m256 inside = _mm256_castsi256_ps(_mm256_set1_epi32(-1));
+
+		for (int p = 0; p < 6; p++)
+		{
+			__m256 distance	 = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(px[p], cx), _mm256_mul_ps(py[p], cy)), _mm256_add_ps(_mm256_mul_ps(pz[p], cz), pw[p]));
+			__m256 boxRadius = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(ax[p], ex), _mm256_mul_ps(ay[p], ey)), _mm256_mul_ps(az[p], ez));
+			__m256 minRadius = _mm256_min_ps(boxRadius, r);
+			inside = _mm256_and_ps(inside, _mm256_cmp_ps(_mm256_add_ps(distance, minRadius), _mm256_setzero_ps(), _CMP_GE_OQ));
+		}
+
+		int mask = _mm256_movemask_ps(inside);		// Bit k: object i + k is visible
+		for (int k = 0; k < 8; k++)
+			if (mask & (1 << k)) visible[visibleCount++] = static_cast<uint32_t>(i + k);
+	}
+	return visibleCount;
+}
+
+#elif defined(CULLING_SSE)
+
+size_t CullingSet::cull(const Frustum& frustum, uint32_t* visible) const
+{
+	__m128 px[6], py[6], pz[6], pw[6], ax[6], ay[6], az[6];
+	for (int p = 0; p < 6; p++)
+	{
+		const glm::vec4& plane = frustum.planes[p];
+		px[p] = _mm_set1_ps(plane.x);			ax[p] = _mm_set1_ps(std::abs(plane.x));
+		py[p] = _mm_set1_ps(plane.y);			ay[p] = _mm_set1_ps(std::abs(plane.y));
+		pz[p] = _mm_set1_ps(plane.z);			az[p] = _mm_set1_ps(std::abs(plane.z));
+		pw[p] = _mm_set1_ps(plane.w);
+	}
+
+	size_t visibleCount = 0;
+	for (size_t i = 0; i < count; i += 4)
+	{
+		__m128 cx = _mm_loadu_ps(&centerX[i]), cy = _mm_loadu_ps(&centerY[i]), cz = _mm_loadu_ps(&centerZ[i]);
+		__m128 ex = _mm_loadu_ps(&extentX[i]), ey = _mm_loadu_ps(&extentY[i]), ez = _mm_loadu_ps(&extentZ[i]);
+		__m128 r  = _mm_loadu_ps(&radius[i]);
+		__m128 inside = _mm_castsi128_ps(_mm_set1_epi32(-1));
+
+		for (int p = 0; p < 6; p++)
+		{
+			__m128 distance	 = _mm_add_ps(_mm_add_ps(_mm_mul_ps(px[p], cx), _mm_mul_ps(py[p], cy)), _mm_add_ps(_mm_mul_ps(pz[p], cz), pw[p]));
+			__m128 boxRadius = _mm_add_ps(_mm_add_ps(_mm_mul_ps(ax[p], ex), _mm_mul_ps(ay[p], ey)), _mm_mul_ps(az[p], ez));
+			__m128 minRadius = _mm_min_ps(boxRadius, r);
+			inside = _mm_and_ps(inside, _mm_cmpge_ps(_mm_add_ps(distance, minRadius), _mm_setzero_ps()));
+		}
+
+		int mask = _mm_movemask_ps(inside);		// Bit k: object i + k is visible
+		for (int k = 0; k < 4; k++)
+			if (mask & (1 << k)) visible[visibleCount++] = static_cast<uint32_t>(i + k);
+	}
+	return visibleCount;
+}
+
+#else
+
+size_t CullingSet::cull(const Frustum& frustum, uint32_t* visible) const { return cullScalar(frustum, visible); }
+
+#endif
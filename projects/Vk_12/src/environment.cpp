@@ -5,6 +5,9 @@
 #include <map>					// std::multimap<key, value>
 #include <set>					// std::set<uint32_t>
 #include <array>
+#include <fstream>
+#include <chrono>
+#include <cstring>				// memcmp()
 //#include <cstring>			// strcmp()
 
 #include "environment.hpp"
@@ -15,26 +18,39 @@ bool QueueFamilyIndices::isComplete()
 		presentFamily.has_value();
 }
 
-VulkanEnvironment::VulkanEnvironment()
+VulkanEnvironment::VulkanEnvironment(bool headless)
+	: headless(headless)
 {
-	initWindow();
+	if (!headless) initWindow();
 
 	createInstance();
 	setupDebugMessenger();
-	createSurface();
+	if (!headless) createSurface();
 	pickPhysicalDevice();
 	createLogicalDevice();
-	createSwapChain();
+	memAllocator.init(physicalDevice, device);
+	createPipelineCache();
+	states.init(device);
+	if (headless) createOffscreenImages();
+	else createSwapChain();
 	createImageViews();
 	createRenderPass();
+	createGlobalDescriptorSetLayout();
 
 	createCommandPool();
+	uploader.init(physicalDevice, device, graphicsQueue, findQueueFamilies(physicalDevice).graphicsFamily.value(), &memAllocator);
+	textures.init(device, &memAllocator, &uploader, textureCompressionBC);
+	if (gpuDriven) geometry.init(device, &memAllocator, &uploader);
+	if (bindless) materials.init(device, &memAllocator);
 	if (add_MSAA) createColorResources();
 	createDepthResources();
 	createFramebuffers();
 
 	// Others
 	minUniformBufferOffsetAlignment = getMinUniformBufferOffsetAlignment();
+	minStorageBufferOffsetAlignment = getMinStorageBufferOffsetAlignment();
+	uniforms.init(device, &memAllocator, minUniformBufferOffsetAlignment);
+	uniforms.createBuffer(static_cast<uint32_t>(swapChainImages.size()));
 }
 
 void VulkanEnvironment::initWindow()
@@ -66,7 +82,7 @@ void VulkanEnvironment::createInstance()
 	appInfo.applicationVersion = VK_MAKE_VERSION(1, 0, 0);
 	appInfo.pEngineName = "No Engine";
 	appInfo.engineVersion = VK_MAKE_VERSION(1, 0, 0);
-	appInfo.apiVersion = VK_API_VERSION_1_0;
+	appInfo.apiVersion = bindless ? VK_API_VERSION_1_2 : VK_API_VERSION_1_0;	// Descriptor indexing is core in Vulkan 1.2
 	appInfo.pNext = nullptr;					// pointer to extension information
 
 	// Not optional. Tell the compiler the global extensions and validation layers we will use (applicable to the entire program, not a specific device)
@@ -200,10 +216,11 @@ VKAPI_ATTR VkBool32 VKAPI_CALL VulkanEnvironment::debugCallback(VkDebugUtilsMess
 /// Get a list of required extensions (based on whether validation layers are enabled or not)
 std::vector<const char*> VulkanEnvironment::getRequiredExtensions()
 {
-	// Get required extensions (glfwExtensions)
-	const char** glfwExtensions;
+	// Get required extensions (glfwExtensions). Headless mode doesn't need them (no surface).
+	const char** glfwExtensions = nullptr;
 	uint32_t glfwExtensionCount = 0;
-	glfwExtensions = glfwGetRequiredInstanceExtensions(&glfwExtensionCount);
+	if (!headless)
+		glfwExtensions = glfwGetRequiredInstanceExtensions(&glfwExtensionCount);
 
 	// Store them in a vector
 	std::vector<const char*> extensions(glfwExtensions, glfwExtensions + glfwExtensionCount);
@@ -395,8 +412,8 @@ int VulkanEnvironment::isDeviceSuitable(VkPhysicalDevice device, const int mode)
 	// Get queue families
 	QueueFamilyIndices indices = findQueueFamilies(device);
 
-	// Check whether required device extensions are supported 
-	bool extensionsSupported = checkDeviceExtensionSupport(device);
+	// Check whether required device extensions are supported (headless mode requires none)
+	bool extensionsSupported = headless || checkDeviceExtensionSupport(device);
 
 	if (printInfo)
 	{
@@ -410,8 +427,8 @@ int VulkanEnvironment::isDeviceSuitable(VkPhysicalDevice device, const int mode)
 	}
 
 	// Check whether swap chain extension is compatible with the window surface (adequate supported)
-	bool swapChainAdequate = false;
-	if (extensionsSupported)
+	bool swapChainAdequate = headless;		// Headless mode: no swap chain
+	if (extensionsSupported && !headless)
 	{
 		SwapChainSupportDetails swapChainSupport = querySwapChainSupport(device);
 		swapChainAdequate = !swapChainSupport.formats.empty() && !swapChainSupport.presentModes.empty();	// Adequate if there's at least one supported image format and one supported presentation mode.
@@ -425,7 +442,9 @@ int VulkanEnvironment::isDeviceSuitable(VkPhysicalDevice device, const int mode)
 		return	indices.isComplete() &&				// There should exist the queue families we want.
 			extensionsSupported &&				// The required device extensions should be supported.
 			swapChainAdequate &&				// Swap chain extension support should be adequate (compatible with window surface)
-			deviceFeatures.samplerAnisotropy;	// Physical device should support anisotropic filtering
+			deviceFeatures.samplerAnisotropy &&	// Physical device should support anisotropic filtering
+			(!gpuDriven || supportsGpuDriven(device)) &&	// Indirect draws generated by compute shaders
+			(!bindless || supportsBindless(device));		// Texture arrays indexed by material
 		break;
 		// Check for dedicated GPU supporting geometry shaders:
 	case 2:
@@ -478,12 +497,15 @@ QueueFamilyIndices VulkanEnvironment::findQueueFamilies(VkPhysicalDevice device)
 	{
 		// Check queue families capable of presenting to our window surface
 		VkBool32 presentSupport = false;
-		vkGetPhysicalDeviceSurfaceSupportKHR(device, i, surface, &presentSupport);
+		if (!headless) vkGetPhysicalDeviceSurfaceSupportKHR(device, i, surface, &presentSupport);
 		if (presentSupport) indices.presentFamily = i;
 
 		// Check queue families capable of computer graphics
 		if (queueFamily.queueFlags & VK_QUEUE_GRAPHICS_BIT)
+		{
 			indices.graphicsFamily = i;
+			if (headless) indices.presentFamily = i;		// Nothing is presented: presentQueue is the graphics queue
+		}
 
 		if (indices.isComplete()) break;
 		i++;
@@ -513,6 +535,80 @@ bool VulkanEnvironment::checkDeviceExtensionSupport(VkPhysicalDevice device)
 	return requiredExtensions.empty();
 }
 
+bool VulkanEnvironment::isDeviceExtensionAvailable(VkPhysicalDevice device, const char* extension)
+{
+	uint32_t extensionCount;
+	vkEnumerateDeviceExtensionProperties(device, nullptr, &extensionCount, nullptr);
+
+	std::vector<VkExtensionProperties> availableExtensions(extensionCount);
+	vkEnumerateDeviceExtensionProperties(device, nullptr, &extensionCount, availableExtensions.data());
+
+	for (const auto& available : availableExtensions)
+		if (std::strcmp(available.extensionName, extension) == 0) return true;
+
+	return false;
+}
+
+/**
+	GPU-driven rendering needs:
+		- drawIndirectFirstInstance: each indirect draw starts at its own range of the visible instance list (firstInstance).
+		- A graphics queue that supports compute, so culling and drawing are recorded in the same command buffer (the spec guarantees that at least one queue family supports both).
+	multiDrawIndirect and VK_KHR_draw_indirect_count are used if available (otherwise, draws are issued one by one).
+*/
+bool VulkanEnvironment::supportsGpuDriven(VkPhysicalDevice device)
+{
+	VkPhysicalDeviceFeatures deviceFeatures;
+	vkGetPhysicalDeviceFeatures(device, &deviceFeatures);
+
+	QueueFamilyIndices indices = findQueueFamilies(device);
+	if (!indices.graphicsFamily.has_value()) return false;
+
+	uint32_t queueFamilyCount = 0;
+	vkGetPhysicalDeviceQueueFamilyProperties(device, &queueFamilyCount, nullptr);
+	std::vector<VkQueueFamilyProperties> queueFamilies(queueFamilyCount);
+	vkGetPhysicalDeviceQueueFamilyProperties(device, &queueFamilyCount, queueFamilies.data());
+
+	return	deviceFeatures.drawIndirectFirstInstance &&
+			(queueFamilies[indices.graphicsFamily.value()].queueFlags & VK_QUEUE_COMPUTE_BIT);
+}
+
+/**
+	Bindless materials need Vulkan 1.2 and these descriptor indexing features:
+		- shaderSampledImageArrayNonUniformIndexing: the texture index may differ between invocations of a draw (GPU-driven draws with several materials).
+		- runtimeDescriptorArray and descriptorBindingPartiallyBound: only the elements in use must be valid.
+		- descriptorBindingSampledImageUpdateAfterBind: textures are added while the set is bound in recorded command buffers.
+	The texture array must also fit in the per-stage limit for update-after-bind samplers.
+*/
+bool VulkanEnvironment::supportsBindless(VkPhysicalDevice device)
+{
+	VkPhysicalDeviceProperties deviceProperties;
+	vkGetPhysicalDeviceProperties(device, &deviceProperties);
+	if (deviceProperties.apiVersion < VK_API_VERSION_1_2) return false;
+
+	VkPhysicalDeviceDescriptorIndexingFeatures indexingFeatures{};
+	indexingFeatures.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_DESCRIPTOR_INDEXING_FEATURES;
+
+	VkPhysicalDeviceFeatures2 features{};
+	features.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_FEATURES_2;
+	features.pNext = &indexingFeatures;
+	vkGetPhysicalDeviceFeatures2(device, &features);
+
+	VkPhysicalDeviceDescriptorIndexingProperties indexingProperties{};
+	indexingProperties.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_DESCRIPTOR_INDEXING_PROPERTIES;
+
+	VkPhysicalDeviceProperties2 properties{};
+	properties.sType = VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_PROPERTIES_2;
+	properties.pNext = &indexingProperties;
+	vkGetPhysicalDeviceProperties2(device, &properties);
+
+	return	indexingFeatures.shaderSampledImageArrayNonUniformIndexing &&
+			indexingFeatures.runtimeDescriptorArray &&
+			indexingFeatures.descriptorBindingPartiallyBound &&
+			indexingFeatures.descriptorBindingSampledImageUpdateAfterBind &&
+			indexingProperties.maxPerStageDescriptorUpdateAfterBindSamplers >= materials.maxTextures &&
+			indexingProperties.maxPerStageDescriptorUpdateAfterBindSampledImages >= materials.maxTextures;
+}
+
 SwapChainSupportDetails VulkanEnvironment::querySwapChainSupport(VkPhysicalDevice device)
 {
 	SwapChainSupportDetails details;
@@ -586,14 +682,52 @@ void VulkanEnvironment::createLogicalDevice()
 	deviceFeatures.samplerAnisotropy = VK_TRUE;							// Anisotropic filtering is an optional device feature (most modern graphics cards support it, but we should check it in isDeviceSuitable)
 	deviceFeatures.sampleRateShading = (add_SS ? VK_TRUE : VK_FALSE);	// Enable sample shading feature for the device
 
+	// Block compressed textures, if available (otherwise, textures are loaded uncompressed)
+	VkPhysicalDeviceFeatures availableFeatures;
+	vkGetPhysicalDeviceFeatures(physicalDevice, &availableFeatures);
+	textureCompressionBC				= compressTextures && availableFeatures.textureCompressionBC;
+	deviceFeatures.textureCompressionBC	= textureCompressionBC ? VK_TRUE : VK_FALSE;
+
+	// Pipeline statistics queries (profiling), if available
+	pipelineStatisticsQuery					= availableFeatures.pipelineStatisticsQuery == VK_TRUE;
+	deviceFeatures.pipelineStatisticsQuery	= availableFeatures.pipelineStatisticsQuery;
+
+	// GPU-driven rendering: indirect draws (checked in isDeviceSuitable) and, if available, several of them per call with the count read from a buffer.
+	std::vector<const char*> deviceExtensions;
+	if (!headless) deviceExtensions = requiredDeviceExtensions;		// Headless mode doesn't use the swap chain extension
+	bool drawIndirectCountAvailable = false;
+	if (gpuDriven)
+	{
+		VkPhysicalDeviceFeatures supportedFeatures;
+		vkGetPhysicalDeviceFeatures(physicalDevice, &supportedFeatures);
+
+		deviceFeatures.drawIndirectFirstInstance	= VK_TRUE;
+		deviceFeatures.multiDrawIndirect			= supportedFeatures.multiDrawIndirect;
+		multiDrawIndirect							= supportedFeatures.multiDrawIndirect == VK_TRUE;
+
+		drawIndirectCountAvailable = multiDrawIndirect && isDeviceExtensionAvailable(physicalDevice, VK_KHR_DRAW_INDIRECT_COUNT_EXTENSION_NAME);
+		if (drawIndirectCountAvailable)
+			deviceExtensions.push_back(VK_KHR_DRAW_INDIRECT_COUNT_EXTENSION_NAME);
+	}
+	else multiDrawIndirect = false;
+
+	// Bindless materials: descriptor indexing features (checked in isDeviceSuitable)
+	VkPhysicalDeviceDescriptorIndexingFeatures indexingFeatures{};
+	indexingFeatures.sType										= VK_STRUCTURE_TYPE_PHYSICAL_DEVICE_DESCRIPTOR_INDEXING_FEATURES;
+	indexingFeatures.shaderSampledImageArrayNonUniformIndexing	= VK_TRUE;
+	indexingFeatures.runtimeDescriptorArray						= VK_TRUE;
+	indexingFeatures.descriptorBindingPartiallyBound			= VK_TRUE;
+	indexingFeatures.descriptorBindingSampledImageUpdateAfterBind = VK_TRUE;
+
 	// Describe queue parameters
 	VkDeviceCreateInfo createInfo{};
 	createInfo.sType = VK_STRUCTURE_TYPE_DEVICE_CREATE_INFO;
+	createInfo.pNext = bindless ? &indexingFeatures : nullptr;
 	createInfo.pQueueCreateInfos = queueCreateInfos.data();
 	createInfo.queueCreateInfoCount = static_cast<uint32_t>(queueCreateInfos.size());
 	createInfo.pEnabledFeatures = &deviceFeatures;
-	createInfo.enabledExtensionCount = static_cast<uint32_t>(requiredDeviceExtensions.size());
-	createInfo.ppEnabledExtensionNames = requiredDeviceExtensions.data();
+	createInfo.enabledExtensionCount = static_cast<uint32_t>(deviceExtensions.size());
+	createInfo.ppEnabledExtensionNames = deviceExtensions.data();
 	if (enableValidationLayers) {
 		createInfo.enabledLayerCount = static_cast<uint32_t>(requiredValidationLayers.size());
 		createInfo.ppEnabledLayerNames = requiredValidationLayers.data();
@@ -608,6 +742,10 @@ void VulkanEnvironment::createLogicalDevice()
 	// Retrieve queue handles for each queue family (in this case, we created a single queue from each family, so we simply use index 0)
 	vkGetDeviceQueue(device, indices.graphicsFamily.value(), 0, &graphicsQueue);
 	vkGetDeviceQueue(device, indices.presentFamily.value(), 0, &presentQueue);
+
+	// Extension functions need to be explicitly loaded.
+	if (drawIndirectCountAvailable)
+		vkCmdDrawIndexedIndirectCount = (PFN_vkCmdDrawIndexedIndirectCountKHR)vkGetDeviceProcAddr(device, "vkCmdDrawIndexedIndirectCountKHR");
 }
 
 // (6)
@@ -674,6 +812,23 @@ void VulkanEnvironment::createSwapChain()
 	swapChainExtent = extent;
 }
 
+/**
+*	Headless mode: offscreen color images take the place of the swap chain images, so the image views, render pass and framebuffers are created the same way.
+*	They use the sRGB color space of the swap chain (chooseSwapSurfaceFormat) with RGBA order, which is what readOffscreenImage() returns. The render pass leaves them in VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL.
+*/
+void VulkanEnvironment::createOffscreenImages()
+{
+	swapChainImageFormat	= VK_FORMAT_R8G8B8A8_SRGB;
+	swapChainExtent			= { WIDTH, HEIGHT };
+
+	swapChainImages.resize(offscreenImageCount);
+	offscreenImageMemory.resize(offscreenImageCount);
+	for (uint32_t i = 0; i < offscreenImageCount; i++)
+		createImage(WIDTH, HEIGHT, 1, VK_SAMPLE_COUNT_1_BIT, swapChainImageFormat, VK_IMAGE_TILING_OPTIMAL, VK_IMAGE_USAGE_COLOR_ATTACHMENT_BIT | VK_IMAGE_USAGE_TRANSFER_SRC_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, swapChainImages[i], offscreenImageMemory[i]);
+
+	if (printInfo) std::cout << "Offscreen images: " << swapChainImages.size() << std::endl;
+}
+
 VkSurfaceFormatKHR VulkanEnvironment::chooseSwapSurfaceFormat(const std::vector<VkSurfaceFormatKHR>& availableFormats)
 {
 	// Return our favourite surface format, if it exists
@@ -762,7 +917,7 @@ void VulkanEnvironment::createRenderPass()
 	if (add_MSAA)
 		colorAttachment.finalLayout = VK_IMAGE_LAYOUT_COLOR_ATTACHMENT_OPTIMAL;	// Layout to automatically transition after the render pass finishes. VK_IMAGE_LAYOUT_ ... UNDEFINED (we don't care what previous layout the image was in, and the contents of the image are not guaranteed to be preserved), COLOR_ATTACHMENT_OPTIMAL (images used as color attachment), PRESENT_SRC_KHR (images to be presented in the swap chain), TRANSFER_DST_OPTIMAL (Images to be used as destination for a memory copy operation).
 	else
-		colorAttachment.finalLayout = VK_IMAGE_LAYOUT_PRESENT_SRC_KHR;
+		colorAttachment.finalLayout = headless ? VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL : VK_IMAGE_LAYOUT_PRESENT_SRC_KHR;	// Headless mode: offscreen images are read back with a copy instead of presented.
 
 	VkAttachmentReference colorAttachmentRef{};
 	colorAttachmentRef.attachment = 0;										// Specify which attachment to reference by its index in the attachment descriptions array.
@@ -792,7 +947,7 @@ void VulkanEnvironment::createRenderPass()
 	colorAttachmentResolve.stencilLoadOp = VK_ATTACHMENT_LOAD_OP_DONT_CARE;
 	colorAttachmentResolve.stencilStoreOp = VK_ATTACHMENT_STORE_OP_DONT_CARE;
 	colorAttachmentResolve.initialLayout = VK_IMAGE_LAYOUT_UNDEFINED;
-	colorAttachmentResolve.finalLayout = VK_IMAGE_LAYOUT_PRESENT_SRC_KHR;
+	colorAttachmentResolve.finalLayout = headless ? VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL : VK_IMAGE_LAYOUT_PRESENT_SRC_KHR;
 
 	VkAttachmentReference colorAttachmentResolveRef{};
 	colorAttachmentResolveRef.attachment = 2;
@@ -836,7 +991,7 @@ void VulkanEnvironment::createRenderPass()
 		throw std::runtime_error("Failed to create render pass!");
 }
 
-void VulkanEnvironment::createImage(uint32_t width, uint32_t height, uint32_t mipLevels, VkSampleCountFlagBits numSamples, VkFormat format, VkImageTiling tiling, VkImageUsageFlags usage, VkMemoryPropertyFlags properties, VkImage& image, VkDeviceMemory& imageMemory)
+void VulkanEnvironment::createImage(uint32_t width, uint32_t height, uint32_t mipLevels, VkSampleCountFlagBits numSamples, VkFormat format, VkImageTiling tiling, VkImageUsageFlags usage, VkMemoryPropertyFlags properties, VkImage& image, Allocation& imageMemory)
 {
 	// Create image objects for letting the shader access the pixel values (better option than setting up the shader to access the pixel values in the buffer). Pixels within an image object are known as texels.
 	VkImageCreateInfo imageInfo{};
@@ -858,19 +1013,13 @@ void VulkanEnvironment::createImage(uint32_t width, uint32_t height, uint32_t mi
 	if (vkCreateImage(device, &imageInfo, nullptr, &image) != VK_SUCCESS)
 		throw std::runtime_error("Failed to create image!");
 
-	// Allocate memory for the image
+	// Suballocate memory for the image
 	VkMemoryRequirements memRequirements;
 	vkGetImageMemoryRequirements(device, image, &memRequirements);
 
-	VkMemoryAllocateInfo allocInfo{};
-	allocInfo.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
-	allocInfo.allocationSize = memRequirements.size;
-	allocInfo.memoryTypeIndex = findMemoryType(memRequirements.memoryTypeBits, properties);
-
-	if (vkAllocateMemory(device, &allocInfo, nullptr, &imageMemory) != VK_SUCCESS)
-		throw std::runtime_error("Failed to allocate image memory!");
+	imageMemory = memAllocator.allocate(memRequirements, properties, tiling == VK_IMAGE_TILING_LINEAR);
 
-	vkBindImageMemory(device, image, imageMemory, 0);
+	vkBindImageMemory(device, image, imageMemory.memory, imageMemory.offset);
 }
 
 VkImageView VulkanEnvironment::createImageView(VkImage image, VkFormat format, VkImageAspectFlags aspectFlags, uint32_t mipLevels)
@@ -917,19 +1066,7 @@ VkFormat VulkanEnvironment::findDepthFormat()
 */
 uint32_t VulkanEnvironment::findMemoryType(uint32_t typeFilter, VkMemoryPropertyFlags properties)
 {
-	// Query info about the available types of memory.
-	VkPhysicalDeviceMemoryProperties memProperties;				// This struct has 2 arrays memoryTypes and memoryHeaps (this one are distinct memory resources, like dedicated VRAM and swap space in RAM for when VRAM runs out). Right now we'll concern with the type of memory and not the heap it comes from.
-	vkGetPhysicalDeviceMemoryProperties(physicalDevice, &memProperties);
-
-	// Find a memory type suitable for the buffer, and to .
-	for (uint32_t i = 0; i < memProperties.memoryTypeCount; i++)
-	{
-		if (typeFilter & (1 << i) &&													// Find the index of a suitable memory type for our buffer by iterating over the memory types and checking if the corresponding bit is set to 1.
-			(memProperties.memoryTypes[i].propertyFlags & properties) == properties)	// Check that the memory type has some properties.
-			return i;
-	}
-
-	throw std::runtime_error("Failed to find suitable memory type!");
+	return memAllocator.findMemoryType(typeFilter, properties);
 }
 
 /**
@@ -954,6 +1091,225 @@ VkFormat VulkanEnvironment::findSupportedFormat(const std::vector<VkFormat>& can
 	throw std::runtime_error("Failed to find supported format!");
 }
 
+/// Header written before the pipeline cache data. Vulkan's own cache header has the vendor, device and pipelineCacheUUID, but not the driver version, and nothing checks whether the file is truncated or corrupt.
+struct PipelineCacheFileHeader
+{
+	uint32_t	magic;						///< "PLCH"
+	uint32_t	vendorID;
+	uint32_t	deviceID;
+	uint32_t	driverVersion;
+	uint8_t		pipelineCacheUUID[VK_UUID_SIZE];
+	uint64_t	dataSize;
+	uint64_t	dataHash;					///< FNV-1a hash of the data
+};
+
+static uint64_t fnv1a(const char* data, size_t size)
+{
+	uint64_t hash = 14695981039346656037ull;
+	for (size_t i = 0; i < size; i++)
+		hash = (hash ^ (uint8_t)data[i]) * 1099511628211ull;
+	return hash;
+}
+
+void VulkanEnvironment::createPipelineCache()
+{
+	pipelineCache			= VK_NULL_HANDLE;
+	pipelineCacheWarm		= false;
+	pipelinesCreated		= 0;
+	pipelineCreationTime	= 0;
+	if (!usePipelineCache) return;
+
+	VkPhysicalDeviceProperties properties;
+	vkGetPhysicalDeviceProperties(physicalDevice, &properties);
+
+	// Load the cache file (if it exists and was created with this device and driver)
+	std::vector<char> data;
+	std::ifstream file(pipelineCacheFile, std::ios::binary | std::ios::ate);		// ate: the position is the file size
+	PipelineCacheFileHeader header;
+	uint64_t fileSize = file.is_open() ? (uint64_t)file.tellg() : 0;
+	file.seekg(0);
+
+	if (file.is_open() && file.read((char*)&header, sizeof(header)))
+	{
+		if (header.magic			== 0x48434C50 &&
+			header.vendorID			== properties.vendorID &&
+			header.deviceID			== properties.deviceID &&
+			header.driverVersion	== properties.driverVersion &&
+			memcmp(header.pipelineCacheUUID, properties.pipelineCacheUUID, VK_UUID_SIZE) == 0)
+		{
+			if (header.dataSize == fileSize - sizeof(header))		// Checked before allocating: a truncated file or a corrupt header is rejected instead of asking for a huge buffer
+			{
+				data.resize((size_t)header.dataSize);
+				if (!file.read(data.data(), data.size()) || fnv1a(data.data(), data.size()) != header.dataHash)
+					data.clear();		// Corrupt
+			}
+			else if (printInfo) std::cout << "Pipeline cache file discarded (truncated or corrupt)" << std::endl;
+		}
+		else if (printInfo) std::cout << "Pipeline cache file discarded (different device or driver)" << std::endl;
+	}
+
+	// Create the cache (empty if there was no valid data)
+	VkPipelineCacheCreateInfo cacheInfo{};
+	cacheInfo.sType				= VK_STRUCTURE_TYPE_PIPELINE_CACHE_CREATE_INFO;
+	cacheInfo.initialDataSize	= data.size();
+	cacheInfo.pInitialData		= data.size() ? data.data() : nullptr;
+
+	if (vkCreatePipelineCache(device, &cacheInfo, nullptr, &pipelineCache) != VK_SUCCESS)
+	{
+		// The driver may still reject the data: start with an empty cache
+		cacheInfo.initialDataSize	= 0;
+		cacheInfo.pInitialData		= nullptr;
+		data.clear();
+		if (vkCreatePipelineCache(device, &cacheInfo, nullptr, &pipelineCache) != VK_SUCCESS)
+			throw std::runtime_error("Failed to create pipeline cache!");
+	}
+
+	pipelineCacheWarm = data.size() > 0;
+}
+
+void VulkanEnvironment::savePipelineCache()
+{
+	if (pipelineCache == VK_NULL_HANDLE) return;
+
+	size_t size;
+	vkGetPipelineCacheData(device, pipelineCache, &size, nullptr);
+	std::vector<char> data(size);
+	if (vkGetPipelineCacheData(device, pipelineCache, &size, data.data()) != VK_SUCCESS) return;
+
+	VkPhysicalDeviceProperties properties;
+	vkGetPhysicalDeviceProperties(physicalDevice, &properties);
+
+	PipelineCacheFileHeader header{};
+	header.magic			= 0x48434C50;
+	header.vendorID			= properties.vendorID;
+	header.deviceID			= properties.deviceID;
+	header.driverVersion	= properties.driverVersion;
+	memcpy(header.pipelineCacheUUID, properties.pipelineCacheUUID, VK_UUID_SIZE);
+	header.dataSize			= size;
+	header.dataHash			= fnv1a(data.data(), size);
+
+	std::ofstream file(pipelineCacheFile, std::ios::binary | std::ios::trunc);
+	if (!file.is_open())
+	{
+		std::cerr << "Failed to save pipeline cache (" << pipelineCacheFile << ")" << std::endl;
+		return;
+	}
+	file.write((const char*)&header, sizeof(header));
+	file.write(data.data(), size);
+}
+
+VkPipeline VulkanEnvironment::createGraphicsPipeline(const VkGraphicsPipelineCreateInfo& pipelineInfo)
+{
+	VkPipeline pipeline;
+
+	auto start = std::chrono::high_resolution_clock::now();
+	if (vkCreateGraphicsPipelines(device, pipelineCache, 1, &pipelineInfo, nullptr, &pipeline) != VK_SUCCESS)
+		throw std::runtime_error("Failed to create graphics pipeline!");
+	auto end = std::chrono::high_resolution_clock::now();
+
+	pipelinesCreated++;
+	pipelineCreationTime += std::chrono::duration<double, std::milli>(end - start).count();
+
+	return pipeline;
+}
+
+void VulkanEnvironment::printPipelineStats()
+{
+	std::cout	<< "Pipelines: " << pipelinesCreated << " created in " << pipelineCreationTime << " ms ("
+				<< (pipelineCache == VK_NULL_HANDLE ? "no pipeline cache" : (pipelineCacheWarm ? "warm pipeline cache" : "cold pipeline cache")) << ")" << std::endl;
+}
+
+void VulkanEnvironment::readOffscreenImage(uint32_t imageIndex, std::vector<uint8_t>& pixels)
+{
+	VkDeviceSize size = (VkDeviceSize)swapChainExtent.width * swapChainExtent.height * 4;
+
+	// Host visible buffer (persistently mapped by memAllocator)
+	VkBufferCreateInfo bufferInfo{};
+	bufferInfo.sType		= VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
+	bufferInfo.size			= size;
+	bufferInfo.usage		= VK_BUFFER_USAGE_TRANSFER_DST_BIT;
+	bufferInfo.sharingMode	= VK_SHARING_MODE_EXCLUSIVE;
+
+	VkBuffer buffer;
+	if (vkCreateBuffer(device, &bufferInfo, nullptr, &buffer) != VK_SUCCESS)
+		throw std::runtime_error("Failed to create readback buffer!");
+
+	VkMemoryRequirements memRequirements;
+	vkGetBufferMemoryRequirements(device, buffer, &memRequirements);
+	Allocation memory = memAllocator.allocate(memRequirements, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT);
+	vkBindBufferMemory(device, buffer, memory.memory, memory.offset);
+
+	// Copy the image (rows tightly packed). Barriers: color attachment writes of the render pass -> copy -> host read.
+	VkCommandBuffer commandBuffer = beginSingleTimeCommands();
+
+	VkImageMemoryBarrier barrier{};
+	barrier.sType							= VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
+	barrier.srcAccessMask					= VK_ACCESS_COLOR_ATTACHMENT_WRITE_BIT;
+	barrier.dstAccessMask					= VK_ACCESS_TRANSFER_READ_BIT;
+	barrier.oldLayout						= VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL;		// Final layout of the render pass in headless mode
+	barrier.newLayout						= VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL;
+	barrier.srcQueueFamilyIndex				= VK_QUEUE_FAMILY_IGNORED;
+	barrier.dstQueueFamilyIndex				= VK_QUEUE_FAMILY_IGNORED;
+	barrier.image							= swapChainImages[imageIndex];
+	barrier.subresourceRange.aspectMask		= VK_IMAGE_ASPECT_COLOR_BIT;
+	barrier.subresourceRange.levelCount		= 1;
+	barrier.subresourceRange.layerCount		= 1;
+	vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT, 0, 0, nullptr, 0, nullptr, 1, &barrier);
+
+	VkBufferImageCopy region{};
+	region.imageSubresource.aspectMask	= VK_IMAGE_ASPECT_COLOR_BIT;
+	region.imageSubresource.layerCount	= 1;
+	region.imageExtent					= { swapChainExtent.width, swapChainExtent.height, 1 };
+	vkCmdCopyImageToBuffer(commandBuffer, swapChainImages[imageIndex], VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL, buffer, 1, &region);
+
+	VkMemoryBarrier hostBarrier{};
+	hostBarrier.sType			= VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+	hostBarrier.srcAccessMask	= VK_ACCESS_TRANSFER_WRITE_BIT;
+	hostBarrier.dstAccessMask	= VK_ACCESS_HOST_READ_BIT;
+	vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_HOST_BIT, 0, 1, &hostBarrier, 0, nullptr, 0, nullptr);
+
+	endSingleTimeCommands(commandBuffer);		// Waits for the copy
+
+	pixels.resize((size_t)size);
+	std::memcpy(pixels.data(), memory.mapped, (size_t)size);
+
+	vkDestroyBuffer(device, buffer, nullptr);
+	memAllocator.free(memory);
+}
+
+void VulkanEnvironment::createGlobalDescriptorSetLayout()
+{
+	VkDescriptorSetLayoutBinding uboLayoutBinding{};
+	uboLayoutBinding.binding			= 0;
+	uboLayoutBinding.descriptorType		= VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER;
+	uboLayoutBinding.descriptorCount	= 1;
+	uboLayoutBinding.stageFlags			= VK_SHADER_STAGE_VERTEX_BIT | VK_SHADER_STAGE_FRAGMENT_BIT;	// Camera data may be used for shading too
+	uboLayoutBinding.pImmutableSamplers	= nullptr;
+
+	std::vector<VkDescriptorSetLayoutBinding> bindings = { uboLayoutBinding };
+
+	// GPU-driven rendering: the vertex shader takes the model matrices from the instance table (binding 1) through the list of visible instances written by the culling shader (binding 2).
+	if (gpuDriven)
+		for (uint32_t binding = 1; binding <= 2; binding++)
+		{
+			VkDescriptorSetLayoutBinding storageBinding{};
+			storageBinding.binding				= binding;
+			storageBinding.descriptorType		= VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+			storageBinding.descriptorCount		= 1;
+			storageBinding.stageFlags			= VK_SHADER_STAGE_VERTEX_BIT;
+			storageBinding.pImmutableSamplers	= nullptr;
+			bindings.push_back(storageBinding);
+		}
+
+	VkDescriptorSetLayoutCreateInfo layoutInfo{};
+	layoutInfo.sType		= VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO;
+	layoutInfo.bindingCount	= static_cast<uint32_t>(bindings.size());
+	layoutInfo.pBindings	= bindings.data();
+
+	if (vkCreateDescriptorSetLayout(device, &layoutInfo, nullptr, &globalDescriptorSetLayout) != VK_SUCCESS)
+		throw std::runtime_error("Failed to create global descriptor set layout!");
+}
+
 // (11) <<<
 void VulkanEnvironment::createCommandPool()
 {
@@ -1152,7 +1508,7 @@ VkCommandBuffer VulkanEnvironment::beginSingleTimeCommands()
 }
 
 /**
-*	Stop recording a command buffer and submit it to the queue.
+*	Stop recording a command buffer, submit it to the queue and wait for it (with a fence) to complete. For batching many transfers without blocking, use uploader instead.
 */
 void VulkanEnvironment::endSingleTimeCommands(VkCommandBuffer commandBuffer)
 {
@@ -1164,10 +1520,18 @@ void VulkanEnvironment::endSingleTimeCommands(VkCommandBuffer commandBuffer)
 	submitInfo.commandBufferCount = 1;
 	submitInfo.pCommandBuffers = &commandBuffer;
 
-	vkQueueSubmit(graphicsQueue, 1, &submitInfo, VK_NULL_HANDLE);
-	vkQueueWaitIdle(graphicsQueue);			// Wait to this transfer to complete. Two ways to do this: vkQueueWaitIdle (Wait for the transfer queue to become idle. Execute one transfer at a time) or vkWaitForFences (Use a fence. Allows to schedule multiple transfers simultaneously and wait for all of them complete. It may give the driver more opportunities to optimize).
+	VkFenceCreateInfo fenceInfo{};
+	fenceInfo.sType = VK_STRUCTURE_TYPE_FENCE_CREATE_INFO;
+
+	VkFence fence;
+	if (vkCreateFence(device, &fenceInfo, nullptr, &fence) != VK_SUCCESS)
+		throw std::runtime_error("Failed to create fence!");
+
+	vkQueueSubmit(graphicsQueue, 1, &submitInfo, fence);
+	vkWaitForFences(device, 1, &fence, VK_TRUE, UINT64_MAX);	// Wait to this transfer to complete. Two ways to do this: vkQueueWaitIdle (Wait for the queue to become idle, including unrelated work, like in-flight frames or uploads) or vkWaitForFences (Wait only for this submission).
 
 	// Clean up the command buffer used.
+	vkDestroyFence(device, fence, nullptr);
 	vkFreeCommandBuffers(device, commandPool, 1, &commandBuffer);
 }
 
@@ -1212,7 +1576,8 @@ void VulkanEnvironment::createFramebuffers()
 
 void VulkanEnvironment::recreateSwapChain()
 {
-	createSwapChain();					// Recreate the swap chain.
+	if (headless) createOffscreenImages();
+	else createSwapChain();				// Recreate the swap chain.
 	createImageViews();					// Recreate image views because they are based directly on the swap chain images.
 	createRenderPass();					// Recreate render pass because it depends on the format of the swap chain images.
 
@@ -1220,6 +1585,7 @@ void VulkanEnvironment::recreateSwapChain()
 		createColorResources();			// Recreate MSAA resources
 	createDepthResources();				// Recreate depth resources
 	createFramebuffers();				// Framebuffers directly depend on the swap chain images.
+	uniforms.createBuffer(static_cast<uint32_t>(swapChainImages.size()));	// The uniform arena has a region per swap chain image (models keep their reservations).
 }
 
 void VulkanEnvironment::cleanupSwapChain()
@@ -1228,13 +1594,13 @@ void VulkanEnvironment::cleanupSwapChain()
 	if (add_MSAA) {
 		vkDestroyImageView(device, colorImageView, nullptr);				// MSAA buffer		(VkImageView)
 		vkDestroyImage(device, colorImage, nullptr);						// MSAA buffer		(VkImage)
-		vkFreeMemory(device, colorImageMemory, nullptr);					// MSAA buffer		(VkDeviceMemory)
+		memAllocator.free(colorImageMemory);								// MSAA buffer		(Allocation)
 	}
 
 	// Depth buffer
 	vkDestroyImageView(device, depthImageView, nullptr);					// Depth buffer		(VkImageView)
 	vkDestroyImage(device, depthImage, nullptr);							// Depth buffer		(VkImage)
-	vkFreeMemory(device, depthImageMemory, nullptr);						// Depth buffer		(VkDeviceMemory)
+	memAllocator.free(depthImageMemory);									// Depth buffer		(Allocation)
 
 	// Framebuffer
 	for (auto framebuffer : swapChainFramebuffers)
@@ -1254,8 +1620,21 @@ void VulkanEnvironment::cleanupSwapChain()
 	for (auto imageView : swapChainImageViews)
 		vkDestroyImageView(device, imageView, nullptr);
 
-	// Swap chain
-	vkDestroySwapchainKHR(device, swapChain, nullptr);
+	// Swap chain (or offscreen images)
+	if (headless)
+	{
+		for (size_t i = 0; i < swapChainImages.size(); i++)
+		{
+			vkDestroyImage(device, swapChainImages[i], nullptr);
+			memAllocator.free(offscreenImageMemory[i]);
+		}
+		offscreenImageMemory.clear();
+	}
+	else
+		vkDestroySwapchainKHR(device, swapChain, nullptr);
+
+	// Uniform arena
+	uniforms.destroyBuffer();
 
 	// Uniform buffers & memory
 	//for (size_t i = 0; i < swapChainImages.size(); i++) {
@@ -1283,16 +1662,33 @@ void VulkanEnvironment::DestroyDebugUtilsMessengerEXT(VkInstance instance, VkDeb
 
 void VulkanEnvironment::cleanup()
 {
+	uploader.cleanup();														// Upload command pool, fences & staging ring
+	states.cleanup();														// Shared pipelines, layouts, shader modules & samplers (whatever the models didn't release)
+	textures.cleanup();														// Shared textures
+	if (gpuDriven) geometry.cleanup();										// Shared vertex & index buffer
+	if (bindless) materials.cleanup();										// Texture array & material buffer
+	vkDestroyDescriptorSetLayout(device, globalDescriptorSetLayout, nullptr);	// Global descriptor set layout
+	savePipelineCache();
+	if (pipelineCache != VK_NULL_HANDLE)
+		vkDestroyPipelineCache(device, pipelineCache, nullptr);				// Pipeline cache
 	vkDestroyCommandPool(device, commandPool, nullptr);						// Command pool
+
+	if (printInfo) memAllocator.printStats();
+	memAllocator.cleanup();													// Device memory blocks
 	vkDestroyDevice(device, nullptr);										// Logical device & device queues
 
 	if (enableValidationLayers)												// Debug messenger
 		DestroyDebugUtilsMessengerEXT(instance, debugMessenger, nullptr);
 
-	vkDestroySurfaceKHR(instance, surface, nullptr);						// Surface KHR
+	if (!headless)
+		vkDestroySurfaceKHR(instance, surface, nullptr);					// Surface KHR
 	vkDestroyInstance(instance, nullptr);									// Instance
-	glfwDestroyWindow(window);												// GLFW window
-	glfwTerminate();														// GLFW
+
+	if (!headless)
+	{
+		glfwDestroyWindow(window);											// GLFW window
+		glfwTerminate();													// GLFW
+	}
 }
 
 // Independent methods ----------------------------------------------
@@ -1304,3 +1700,10 @@ VkDeviceSize VulkanEnvironment::getMinUniformBufferOffsetAlignment()
 	return deviceProperties.limits.minUniformBufferOffsetAlignment;
 }
 
+VkDeviceSize VulkanEnvironment::getMinStorageBufferOffsetAlignment()
+{
+	VkPhysicalDeviceProperties deviceProperties;
+	vkGetPhysicalDeviceProperties(physicalDevice, &deviceProperties);
+	return deviceProperties.limits.minStorageBufferOffsetAlignment;
+}
+
@@ -0,0 +1,70 @@
+#include <stdexcept>
+
+#include "geometry.hpp"
+
+void GeometryArena::init(VkDevice device, MemoryAllocator* allocator, UploadManager* uploader)
+{
+	this->device	= device;
+	this->allocator	= allocator;
+	this->uploader	= uploader;
+	vertexRanges	= RangeAllocator(vertexCapacity);
+	indexRanges		= RangeAllocator(indexCapacity);
+
+	// Storage usage too, so compute shaders can read the meshes.
+	createBuffer(vertexCapacity, VK_BUFFER_USAGE_VERTEX_BUFFER_BIT | VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT, vertexBuffer, vertexMemory);
+	createBuffer(indexCapacity,  VK_BUFFER_USAGE_INDEX_BUFFER_BIT  | VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT, indexBuffer,  indexMemory);
+}
+
+void GeometryArena::createBuffer(VkDeviceSize size, VkBufferUsageFlags usage, VkBuffer& buffer, Allocation& memory)
+{
+	VkBufferCreateInfo bufferInfo{};
+	bufferInfo.sType		= VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
+	bufferInfo.size			= size;
+	bufferInfo.usage		= usage;
+	bufferInfo.sharingMode	= VK_SHARING_MODE_EXCLUSIVE;
+
+	if (vkCreateBuffer(device, &bufferInfo, nullptr, &buffer) != VK_SUCCESS)
+		throw std::runtime_error("Failed to create geometry buffer!");
+
+	VkMemoryRequirements memRequirements;
+	vkGetBufferMemoryRequirements(device, buffer, &memRequirements);
+	memory = allocator->allocate(memRequirements, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
+	vkBindBufferMemory(device, buffer, memory.memory, memory.offset);
+}
+
+void GeometryArena::cleanup()
+{
+	vkDestroyBuffer(device, vertexBuffer, nullptr);
+	allocator->free(vertexMemory);
+	vkDestroyBuffer(device, indexBuffer, nullptr);
+	allocator->free(indexMemory);
+	vertexBuffer = indexBuffer = VK_NULL_HANDLE;
+}
+
+VkDeviceSize GeometryArena::addVertices(const void* data, VkDeviceSize size, VkDeviceSize stride)
+{
+	VkDeviceSize offset;
+	if (!vertexRanges.allocate(size, stride, offset))
+		throw std::runtime_error("Geometry arena is full (vertices)!");
+
+	uploader->uploadBuffer(vertexBuffer, data, size, offset);
+	return offset;
+}
+
+uint32_t GeometryArena::addIndices(const uint32_t* indices, uint32_t count)
+{
+	VkDeviceSize offset;
+	if (!indexRanges.allocate(count * sizeof(uint32_t), sizeof(uint32_t), offset))
+		throw std::runtime_error("Geometry arena is full (indices)!");
+
+	uploader->uploadBuffer(indexBuffer, indices, count * sizeof(uint32_t), offset);
+	return static_cast<uint32_t>(offset / sizeof(uint32_t));
+}
+
+void GeometryArena::releaseVertices(VkDeviceSize offset, VkDeviceSize size) { vertexRanges.free(offset, size); }
+
+void GeometryArena::releaseIndices(uint32_t firstIndex, uint32_t count) { indexRanges.free(firstIndex * sizeof(uint32_t), count * sizeof(uint32_t)); }
+
+VkDeviceSize GeometryArena::getUsedVertexBytes() const { return vertexRanges.getUsed(); }
+
+VkDeviceSize GeometryArena::getUsedIndexBytes() const { return indexRanges.getUsed(); }
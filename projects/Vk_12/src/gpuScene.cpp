@@ -0,0 +1,385 @@
+#include <stdexcept>
+#include <algorithm>
+#include <cstring>
+#include <array>
+
+#include "gpuScene.hpp"
+
+void GpuScene::init(VulkanEnvironment& environment, std::list<modelData>& models, const char* cullShaderPath)
+{
+	e = &environment;
+
+	// Draws: one per LOD of each model, over the ranges of the shared buffers. Each one gets a range of the visible list with room for every instance of its model.
+	instances.clear();
+	drawTemplate.clear();
+	modelDraws.clear();
+	std::vector<uint32_t> drawInfo;		// (model, first draw of the model) of each draw
+	visibleCapacity = 0;
+
+	uint32_t modelIndex = 0;
+	for (std::list<modelData>::iterator it = models.begin(); it != models.end(); it++, modelIndex++)
+	{
+		ModelDraws draws{ static_cast<uint32_t>(drawTemplate.size()), static_cast<uint32_t>(it->lods.size()) };
+		uint32_t instanceCount = static_cast<uint32_t>(it->getModelMatrix.size());
+
+		for (const MeshLod& lod : it->lods)
+		{
+			VkDrawIndexedIndirectCommand draw{};
+			draw.indexCount		= lod.indexCount;
+			draw.instanceCount	= 0;						// Counted by the cull pass
+			draw.firstIndex		= it->baseIndex + lod.firstIndex;
+			draw.vertexOffset	= it->baseVertex;
+			draw.firstInstance	= visibleCapacity;			// gl_InstanceIndex starts here (requires drawIndirectFirstInstance)
+			drawTemplate.push_back(draw);
+
+			drawInfo.push_back(modelIndex);
+			drawInfo.push_back(draws.firstDraw);
+			visibleCapacity += instanceCount;
+		}
+		modelDraws.push_back(draws);
+
+		GpuInstance instance{};						// Matrix and sphere are set by setInstance()
+		instance.firstDraw	= draws.firstDraw;
+		instance.lodCount	= draws.lodCount;
+		instance.materialIndex = e->bindless ? it->materialIndex : 0;
+		instances.insert(instances.end(), instanceCount, instance);
+	}
+
+	// Static buffers (device local)
+	VkDeviceSize templateSize = std::max<VkDeviceSize>(sizeof(VkDrawIndexedIndirectCommand) * drawTemplate.size(), 4);
+	createBuffer(templateSize, VK_BUFFER_USAGE_TRANSFER_SRC_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, templateBuffer, templateMemory);
+	if (!drawTemplate.empty())
+		e->uploader.uploadBuffer(templateBuffer, drawTemplate.data(), sizeof(VkDrawIndexedIndirectCommand) * drawTemplate.size());
+
+	VkDeviceSize drawInfoSize = std::max<VkDeviceSize>(sizeof(uint32_t) * drawInfo.size(), 4);
+	createBuffer(drawInfoSize, VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, drawInfoBuffer, drawInfoMemory);
+	if (!drawInfo.empty())
+		e->uploader.uploadBuffer(drawInfoBuffer, drawInfo.data(), sizeof(uint32_t) * drawInfo.size());
+
+	std::vector<uint32_t> lods(std::max<size_t>(instances.size(), 1), 0);		// Every instance starts at LOD 0
+	createBuffer(sizeof(uint32_t) * lods.size(), VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, lodBuffer, lodMemory);
+	e->uploader.uploadBuffer(lodBuffer, lods.data(), sizeof(uint32_t) * lods.size());
+
+	e->uploader.flush();		// Rendering is submitted to the same queue, so it's ordered after these uploads.
+
+	// Per-frame data
+	paramsOffset = e->uniforms.reserve(sizeof(GpuCullParams));
+
+	layout.draws		= 0;
+	layout.compacted	= layout.draws		+ align(sizeof(VkDrawIndexedIndirectCommand) * drawTemplate.size());
+	layout.counts		= layout.compacted	+ align(sizeof(VkDrawIndexedIndirectCommand) * drawTemplate.size());
+	layout.visible		= layout.counts		+ align(sizeof(uint32_t) * modelDraws.size());
+	layout.size			= layout.visible	+ align(sizeof(uint32_t) * visibleCapacity);
+	instanceRegionSize	= align(sizeof(GpuInstance) * instances.size());
+
+	createPipelines(cullShaderPath);
+	createFrameResources();
+}
+
+VkDeviceSize GpuScene::align(VkDeviceSize size)
+{
+	VkDeviceSize alignment = std::max<VkDeviceSize>(e->minStorageBufferOffsetAlignment, 4);
+	return (std::max<VkDeviceSize>(size, 4) + alignment - 1) / alignment * alignment;		// Never empty (zero-sized descriptor ranges are not allowed)
+}
+
+uint32_t GpuScene::groupCount(size_t invocations) { return static_cast<uint32_t>((invocations + 63) / 64); }
+
+void GpuScene::createBuffer(VkDeviceSize size, VkBufferUsageFlags usage, VkMemoryPropertyFlags properties, VkBuffer& buffer, Allocation& memory)
+{
+	VkBufferCreateInfo bufferInfo{};
+	bufferInfo.sType		= VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
+	bufferInfo.size			= size;
+	bufferInfo.usage		= usage;
+	bufferInfo.sharingMode	= VK_SHARING_MODE_EXCLUSIVE;
+
+	if (vkCreateBuffer(e->device, &bufferInfo, nullptr, &buffer) != VK_SUCCESS)
+		throw std::runtime_error("Failed to create GPU scene buffer!");
+
+	VkMemoryRequirements memRequirements;
+	vkGetBufferMemoryRequirements(e->device, buffer, &memRequirements);
+	memory = e->memAllocator.allocate(memRequirements, properties);
+	vkBindBufferMemory(e->device, buffer, memory.memory, memory.offset);
+}
+
+void GpuScene::createPipelines(const char* cullShaderPath)
+{
+	cullShader = e->states.getShaderModule(cullShaderPath);
+
+	// Binding 0: culling parameters (uniform buffer). Bindings 1-7: instances, draws, visible list, LODs, draw info, compacted draws, counts (storage buffers). See cull.comp.
+	std::vector<VkDescriptorSetLayoutBinding> bindings(8);
+	for (uint32_t b = 0; b < bindings.size(); b++)
+	{
+		bindings[b].binding				= b;
+		bindings[b].descriptorType		= b == 0 ? VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER : VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+		bindings[b].descriptorCount		= 1;
+		bindings[b].stageFlags			= VK_SHADER_STAGE_COMPUTE_BIT;
+		bindings[b].pImmutableSamplers	= nullptr;
+	}
+
+	descriptorSetLayout	= e->states.getDescriptorSetLayout(bindings);
+	pipelineLayout		= e->states.getPipelineLayout({ descriptorSetLayout });
+	cullPipeline		= createPipeline(0);
+	compactPipeline		= createPipeline(1);
+}
+
+/// Both passes are in cull.comp. The specialization constant COMPACT (constant_id 0) selects one of them when the pipeline is created.
+VkPipeline GpuScene::createPipeline(uint32_t compact)
+{
+	VkSpecializationMapEntry specializationEntry{};
+	specializationEntry.constantID	= 0;
+	specializationEntry.offset		= 0;
+	specializationEntry.size		= sizeof(uint32_t);
+
+	VkSpecializationInfo specializationInfo{};
+	specializationInfo.mapEntryCount	= 1;
+	specializationInfo.pMapEntries		= &specializationEntry;
+	specializationInfo.dataSize			= sizeof(uint32_t);
+	specializationInfo.pData			= &compact;
+
+	VkComputePipelineCreateInfo pipelineInfo{};
+	pipelineInfo.sType						= VK_STRUCTURE_TYPE_COMPUTE_PIPELINE_CREATE_INFO;
+	pipelineInfo.stage.sType				= VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
+	pipelineInfo.stage.stage				= VK_SHADER_STAGE_COMPUTE_BIT;
+	pipelineInfo.stage.module				= cullShader;
+	pipelineInfo.stage.pName				= "main";
+	pipelineInfo.stage.pSpecializationInfo	= &specializationInfo;
+	pipelineInfo.layout						= pipelineLayout;
+
+	VkPipeline pipeline;
+	if (vkCreateComputePipelines(e->device, e->pipelineCache, 1, &pipelineInfo, nullptr, &pipeline) != VK_SUCCESS)
+		throw std::runtime_error("Failed to create compute pipeline!");
+
+	return pipeline;
+}
+
+void GpuScene::createFrameResources()
+{
+	uint32_t imageCount = static_cast<uint32_t>(e->swapChainImages.size());
+
+	// The instance table is rewritten by the CPU (only what changed), so it stays in host visible memory. The rest is only touched by the GPU.
+	createBuffer(instanceRegionSize * imageCount, VK_BUFFER_USAGE_STORAGE_BUFFER_BIT, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT, instanceBuffer, instanceMemory);
+	createBuffer(layout.size * imageCount, VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_INDIRECT_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, frameBuffer, frameMemory);
+
+	dirtyInstances.assign(imageCount, std::vector<uint32_t>());
+	fullUpload.assign(imageCount, true);		// New regions: write every instance
+
+	createDescriptorSets(imageCount);
+}
+
+void GpuScene::createDescriptorSets(uint32_t imageCount)
+{
+	std::array<VkDescriptorPoolSize, 2> poolSizes{};
+	poolSizes[0].type				= VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER;
+	poolSizes[0].descriptorCount	= imageCount;
+	poolSizes[1].type				= VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+	poolSizes[1].descriptorCount	= 7 * imageCount;
+
+	VkDescriptorPoolCreateInfo poolInfo{};
+	poolInfo.sType			= VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO;
+	poolInfo.poolSizeCount	= static_cast<uint32_t>(poolSizes.size());
+	poolInfo.pPoolSizes		= poolSizes.data();
+	poolInfo.maxSets		= imageCount;
+
+	if (vkCreateDescriptorPool(e->device, &poolInfo, nullptr, &descriptorPool) != VK_SUCCESS)
+		throw std::runtime_error("Failed to create GPU scene descriptor pool!");
+
+	std::vector<VkDescriptorSetLayout> layouts(imageCount, descriptorSetLayout);
+
+	VkDescriptorSetAllocateInfo allocInfo{};
+	allocInfo.sType					= VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO;
+	allocInfo.descriptorPool		= descriptorPool;
+	allocInfo.descriptorSetCount	= imageCount;
+	allocInfo.pSetLayouts			= layouts.data();
+
+	descriptorSets.resize(imageCount);
+	if (vkAllocateDescriptorSets(e->device, &allocInfo, descriptorSets.data()) != VK_SUCCESS)
+		throw std::runtime_error("Failed to allocate GPU scene descriptor sets!");
+
+	for (uint32_t i = 0; i < imageCount; i++)
+	{
+		VkDeviceSize region = i * layout.size;
+		std::array<VkDescriptorBufferInfo, 8> bufferInfos = { {
+			{ e->uniforms.buffer,	e->uniforms.getOffset(i, paramsOffset),	sizeof(GpuCullParams) },
+			getInstanceBufferInfo(i),
+			{ frameBuffer,			region + layout.draws,		layout.compacted - layout.draws },
+			getVisibleBufferInfo(i),
+			{ lodBuffer,			0,							VK_WHOLE_SIZE },
+			{ drawInfoBuffer,		0,							VK_WHOLE_SIZE },
+			{ frameBuffer,			region + layout.compacted,	layout.counts - layout.compacted },
+			{ frameBuffer,			region + layout.counts,		layout.visible - layout.counts }
+		} };
+
+		std::array<VkWriteDescriptorSet, 8> descriptorWrites{};
+		for (uint32_t b = 0; b < descriptorWrites.size(); b++)
+		{
+			descriptorWrites[b].sType			= VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+			descriptorWrites[b].dstSet			= descriptorSets[i];
+			descriptorWrites[b].dstBinding		= b;
+			descriptorWrites[b].dstArrayElement	= 0;
+			descriptorWrites[b].descriptorType	= b == 0 ? VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER : VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+			descriptorWrites[b].descriptorCount	= 1;
+			descriptorWrites[b].pBufferInfo		= &bufferInfos[b];
+		}
+
+		vkUpdateDescriptorSets(e->device, static_cast<uint32_t>(descriptorWrites.size()), descriptorWrites.data(), 0, nullptr);
+	}
+}
+
+void GpuScene::destroyFrameResources()
+{
+	vkDestroyDescriptorPool(e->device, descriptorPool, nullptr);		// Descriptor sets are freed with the pool
+
+	vkDestroyBuffer(e->device, instanceBuffer, nullptr);
+	e->memAllocator.free(instanceMemory);
+	vkDestroyBuffer(e->device, frameBuffer, nullptr);
+	e->memAllocator.free(frameMemory);
+}
+
+void GpuScene::cleanup()
+{
+	vkDestroyPipeline(e->device, cullPipeline, nullptr);
+	vkDestroyPipeline(e->device, compactPipeline, nullptr);
+	e->states.releasePipelineLayout(pipelineLayout);
+	e->states.releaseDescriptorSetLayout(descriptorSetLayout);
+	e->states.releaseShaderModule(cullShader);
+
+	e->uniforms.release(paramsOffset, sizeof(GpuCullParams));
+
+	vkDestroyBuffer(e->device, templateBuffer, nullptr);
+	e->memAllocator.free(templateMemory);
+	vkDestroyBuffer(e->device, drawInfoBuffer, nullptr);
+	e->memAllocator.free(drawInfoMemory);
+	vkDestroyBuffer(e->device, lodBuffer, nullptr);
+	e->memAllocator.free(lodMemory);
+}
+
+void GpuScene::setInstance(size_t object, const glm::mat4& model, const glm::vec4& sphere)
+{
+	instances[object].model		= model;
+	instances[object].sphere	= sphere;
+
+	// Remember it for the region of every swap chain image. When many instances change, the whole region is written instead.
+	for (size_t i = 0; i < dirtyInstances.size(); i++)
+	{
+		if (fullUpload[i]) continue;
+
+		if (dirtyInstances[i].size() >= instances.size() / 4)
+		{
+			fullUpload[i] = true;
+			dirtyInstances[i].clear();
+		}
+		else dirtyInstances[i].push_back(static_cast<uint32_t>(object));
+	}
+}
+
+void GpuScene::update(uint32_t imageIndex, const GpuCullParams& params)
+{
+	GpuCullParams* mappedParams	= (GpuCullParams*)e->uniforms.getMapped(imageIndex, paramsOffset);
+	*mappedParams				= params;
+	mappedParams->objectCount	= static_cast<uint32_t>(instances.size());
+	mappedParams->drawCount		= static_cast<uint32_t>(drawTemplate.size());
+
+	GpuInstance* region = (GpuInstance*)((char*)instanceMemory.mapped + imageIndex * instanceRegionSize);
+	if (fullUpload[imageIndex])
+		std::memcpy(region, instances.data(), sizeof(GpuInstance) * instances.size());
+	else
+		for (uint32_t object : dirtyInstances[imageIndex])
+			region[object] = instances[object];
+
+	dirtyInstances[imageIndex].clear();
+	fullUpload[imageIndex] = false;
+}
+
+void GpuScene::recordCulling(VkCommandBuffer commandBuffer, uint32_t imageIndex)
+{
+	VkDeviceSize region = imageIndex * layout.size;
+
+	// Reset the draws (instanceCount = 0) and the counts of compacted draws
+	if (!drawTemplate.empty())
+	{
+		VkBufferCopy copyRegion{};
+		copyRegion.srcOffset	= 0;
+		copyRegion.dstOffset	= region + layout.draws;
+		copyRegion.size			= sizeof(VkDrawIndexedIndirectCommand) * drawTemplate.size();
+		vkCmdCopyBuffer(commandBuffer, templateBuffer, frameBuffer, 1, &copyRegion);
+	}
+	vkCmdFillBuffer(commandBuffer, frameBuffer, region + layout.counts, layout.visible - layout.counts, 0);
+
+	// The cull pass reads and writes what the transfers wrote, and the LODs written by the previous frame (barriers cover every command submitted before them to the queue).
+	VkMemoryBarrier barrier{};
+	barrier.sType			= VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+	barrier.srcAccessMask	= VK_ACCESS_TRANSFER_WRITE_BIT | VK_ACCESS_SHADER_WRITE_BIT;
+	barrier.dstAccessMask	= VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_SHADER_WRITE_BIT;
+	vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_TRANSFER_BIT | VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, 0, 1, &barrier, 0, nullptr, 0, nullptr);
+
+	vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, pipelineLayout, 0, 1, &descriptorSets[imageIndex], 0, nullptr);
+	vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, cullPipeline);
+	if (!instances.empty())
+		vkCmdDispatch(commandBuffer, groupCount(instances.size()), 1, 1);
+
+	// Compaction (only needed by vkCmdDrawIndexedIndirectCount)
+	if (e->vkCmdDrawIndexedIndirectCount && !drawTemplate.empty())
+	{
+		barrier.srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT;
+		vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, 0, 1, &barrier, 0, nullptr, 0, nullptr);
+
+		vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_COMPUTE, compactPipeline);
+		vkCmdDispatch(commandBuffer, groupCount(drawTemplate.size()), 1, 1);
+	}
+
+	// The draws read the commands and counts (indirect) and the visible list (vertex shader)
+	barrier.srcAccessMask	= VK_ACCESS_SHADER_WRITE_BIT;
+	barrier.dstAccessMask	= VK_ACCESS_INDIRECT_COMMAND_READ_BIT | VK_ACCESS_SHADER_READ_BIT;
+	vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT, VK_PIPELINE_STAGE_DRAW_INDIRECT_BIT | VK_PIPELINE_STAGE_VERTEX_SHADER_BIT, 0, 1, &barrier, 0, nullptr, 0, nullptr);
+}
+
+void GpuScene::recordDraws(VkCommandBuffer commandBuffer, uint32_t imageIndex, std::list<modelData>& models)
+{
+	// Every model is in the shared buffers, so they are bound once (each pipeline reads the vertices with its own stride).
+	VkDeviceSize offset = 0;
+	vkCmdBindVertexBuffers(commandBuffer, 0, 1, &e->geometry.vertexBuffer, &offset);
+	vkCmdBindIndexBuffer(commandBuffer, e->geometry.indexBuffer, 0, VK_INDEX_TYPE_UINT32);
+
+	const uint32_t	stride	= sizeof(VkDrawIndexedIndirectCommand);
+	VkDeviceSize	region	= imageIndex * layout.size;
+	VkPipeline		boundPipeline = VK_NULL_HANDLE;
+	VkPipelineLayout boundLayout = VK_NULL_HANDLE;
+	size_t			k		= 0;
+
+	for (std::list<modelData>::iterator it = models.begin(); it != models.end(); it++, k++)
+	{
+		const ModelDraws& draws = modelDraws[k];
+		if (draws.lodCount == 0) continue;
+
+		if (it->graphicsPipeline != boundPipeline)
+		{
+			vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, it->graphicsPipeline);
+			boundPipeline = it->graphicsPipeline;
+		}
+		if (!e->bindless)
+			vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, it->pipelineLayout, 1, 1, &it->descriptorSets[imageIndex], 0, nullptr);	// Texture (set 1)
+		else if (it->pipelineLayout != boundLayout)		// Every texture and material (set 2). The material index is in the instance data, so nothing is bound per model.
+		{
+			vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, it->pipelineLayout, 2, 1, &e->materials.descriptorSet, 0, nullptr);
+			boundLayout = it->pipelineLayout;
+		}
+
+		if (e->vkCmdDrawIndexedIndirectCount)		// Only the draws with instances
+			e->vkCmdDrawIndexedIndirectCount(commandBuffer, frameBuffer, region + layout.compacted + draws.firstDraw * stride, frameBuffer, region + layout.counts + k * sizeof(uint32_t), draws.lodCount, stride);
+		else if (e->multiDrawIndirect)				// Every LOD (the ones without instances draw nothing)
+			vkCmdDrawIndexedIndirect(commandBuffer, frameBuffer, region + layout.draws + draws.firstDraw * stride, draws.lodCount, stride);
+		else
+			for (uint32_t lod = 0; lod < draws.lodCount; lod++)
+				vkCmdDrawIndexedIndirect(commandBuffer, frameBuffer, region + layout.draws + (draws.firstDraw + lod) * stride, 1, stride);
+	}
+}
+
+VkDescriptorBufferInfo GpuScene::getInstanceBufferInfo(uint32_t imageIndex) const
+{
+	return VkDescriptorBufferInfo{ instanceBuffer, imageIndex * instanceRegionSize, instanceRegionSize };
+}
+
+VkDescriptorBufferInfo GpuScene::getVisibleBufferInfo(uint32_t imageIndex) const
+{
+	return VkDescriptorBufferInfo{ frameBuffer, imageIndex * layout.size + layout.visible, layout.size - layout.visible };
+}
@@ -7,6 +7,8 @@
 Input::Input(GLFWwindow* window)
 	: window(window), cam(Camera(window))
 {
+	if (!window) return;		// Headless mode (no window, no input)
+
 	glfwSetWindowUserPointer(window, this);				// Set this class as windowUserPointer (for making it accessible from callbacks)
 	glfwSetFramebufferSizeCallback(window, framebufferResizeCallback);	// Set callback (signals famebuffer resizing)
 	glfwSetScrollCallback(window, mouseScroll_callback);				// Set callback (get mouse scrolling)
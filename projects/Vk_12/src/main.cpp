@@ -45,6 +45,7 @@
 #include <stdexcept>
 #include <cstdlib>				// EXIT_SUCCESS, EXIT_FAILURE
 #include <functional>
+#include <cstring>				// std::strcmp
 
 #include "renderer.hpp"
 
@@ -130,7 +131,9 @@ modelConfig room(
 	(SHADERS_DIR  + "triangleV.spv"  ).c_str(),
 	(SHADERS_DIR  + "triangleF.spv"  ).c_str(),
 	room_MM
-);
+);	// Instanced alternative (one draw call for every room): vertex shader "triangleV_inst.spv" and "room_MM, true"
+	// Packed vertices alternative (12 bytes per vertex instead of 32): vertex shader "triangleV_packed.spv" (or "triangleV_inst_packed.spv") and "room.packedVertices = true" in main() before grouping the models.
+	// Bindless materials alternative (VulkanEnvironment::bindless): fragment shader "triangleF_bindless.spv" ("triangleF_bindless_gpu.spv" with gpuDriven) for every model.
 
 // Group your models together --------------------
 
@@ -138,20 +141,83 @@ std::vector<modelConfig> models = { cottage, room};	// <<< commandBuffer & unifo
 
 // Send them to the renderer --------------------
 
+glm::mat4 cottage2_MM(float time)
+{
+	glm::mat4 model = glm::mat4(1.0f);
+	model = glm::translate(model, glm::vec3(0.0f, 40.0f, 0.0f));
+	model = glm::rotate(model, glm::radians(90.0f), glm::vec3(1.0f, 0.0f, 0.0f));
+	model = glm::rotate(model, time * glm::radians(-20.0f), glm::vec3(0.0f, 1.0f, 0.0f));
+
+	return model;
+}
+
+glm::mat4 room5_MM(float time)
+{
+	glm::mat4 model = glm::mat4(1.0f);
+	model = glm::translate(model, glm::vec3(60.0f, -80.0f, 3.0f));
+	model = glm::scale(model, glm::vec3(20.0f, 20.0f, 20.0f));
+
+	return model;
+}
+
+// Change the scene while rendering (models are loaded in the background, the render loop doesn't wait for them) --------------------
+
 void parallelOps(Renderer& app)
 {
 	std::this_thread::sleep_for(std::chrono::seconds(5));
 
 	std::cout << "Second thread active" << std::endl;
 
+	modelConfig cottage2(
+		(MODELS_DIR + "cottage_obj.obj").c_str(),
+		(TEXTURES_DIR + "cottage/cottage_diffuse.png").c_str(),
+		(SHADERS_DIR + "triangleV.spv").c_str(),
+		(SHADERS_DIR + "triangleF.spv").c_str(),
+		cottage2_MM
+	);
+
+	ModelHandle newCottage	= app.addModel(cottage2);		// New model
+	ModelHandle rooms		= app.getModelHandle(1);		// One more instance of a model already loaded
+	app.addInstance(rooms, room5_MM);
 
+	std::this_thread::sleep_for(std::chrono::seconds(5));
+
+	app.removeInstance(rooms, 4);
+	app.removeModel(newCottage);
 }
 
+/*
+	Headless mode (benchmarks and CI, no window): renders a fixed number of frames offscreen and prints frame time statistics.
+		--headless N		Render N frames.
+		--image <file>		Save the last frame (binary PPM).
+		--golden <file>		Compare the last frame with a golden image (binary PPM) and fail if they differ.
+	Any ICD can be used, including software ones (set VK_ICD_FILENAMES to the JSON manifest of lavapipe or SwiftShader).
+	Profiling (any mode):
+		--trace <file>		Write the CPU and GPU scopes of the last frames to a Chrome trace / Perfetto JSON file at exit (Renderer::exportTrace() writes one while running).
+*/
 int main(int argc, char* argv[])
 {
-	Renderer app(models);
+	bool headless = false;
+	size_t headlessFrames = 0;
+	std::string imagePath, goldenPath, tracePath;
+
+	for (int a = 1; a < argc; a++)
+	{
+		if		(!std::strcmp(argv[a], "--headless") && a + 1 < argc)	{ headless = true; headlessFrames = std::strtoul(argv[++a], nullptr, 10); }
+		else if (!std::strcmp(argv[a], "--image") && a + 1 < argc)		imagePath = argv[++a];
+		else if (!std::strcmp(argv[a], "--golden") && a + 1 < argc)		goldenPath = argv[++a];
+		else if (!std::strcmp(argv[a], "--trace") && a + 1 < argc)		tracePath = argv[++a];
+	}
+
+	Renderer app(models, headless);
+	app.cullShaderPath = SHADERS_DIR + "cull.spv";		// GPU-driven mode (VulkanEnvironment::gpuDriven): every model needs the vertex shader "triangleV_gpu.spv" (or "triangleV_gpu_packed.spv").
+	app.headlessFrames		= headlessFrames;
+	app.headlessImagePath	= imagePath;
+	app.goldenImagePath		= goldenPath;
+	app.tracePath			= tracePath;
 
-	std::thread t2(parallelOps, app);
+	std::thread t2;
+	if (!headless) t2 = std::thread(parallelOps, std::ref(app));		// Headless runs render the same frames every time (no scene changes)
 
 	try {
 		app.run();
@@ -163,6 +229,6 @@ int main(int argc, char* argv[])
 
 	if (t2.joinable()) t2.join();
 
-	system("pause");
+	if (!headless) system("pause");
 	return EXIT_SUCCESS;
 }
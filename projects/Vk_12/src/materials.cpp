@@ -0,0 +1,197 @@
+#include <stdexcept>
+#include <array>
+
+#include "materials.hpp"
+
+void MaterialTable::init(VkDevice device, MemoryAllocator* allocator)
+{
+	this->device	= device;
+	this->allocator	= allocator;
+
+	// Descriptor set layout: texture array (partially bound, updated after bind) and material buffer
+	std::array<VkDescriptorSetLayoutBinding, 2> bindings{};
+	bindings[0].binding				= 0;
+	bindings[0].descriptorType		= VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+	bindings[0].descriptorCount		= maxTextures;
+	bindings[0].stageFlags			= VK_SHADER_STAGE_FRAGMENT_BIT;
+	bindings[1].binding				= 1;
+	bindings[1].descriptorType		= VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+	bindings[1].descriptorCount		= 1;
+	bindings[1].stageFlags			= VK_SHADER_STAGE_FRAGMENT_BIT;
+
+	std::array<VkDescriptorBindingFlags, 2> bindingFlags = { VK_DESCRIPTOR_BINDING_PARTIALLY_BOUND_BIT | VK_DESCRIPTOR_BINDING_UPDATE_AFTER_BIND_BIT, 0 };
+
+	VkDescriptorSetLayoutBindingFlagsCreateInfo flagsInfo{};
+	flagsInfo.sType			= VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_BINDING_FLAGS_CREATE_INFO;
+	flagsInfo.bindingCount	= static_cast<uint32_t>(bindingFlags.size());
+	flagsInfo.pBindingFlags	= bindingFlags.data();
+
+	VkDescriptorSetLayoutCreateInfo layoutInfo{};
+	layoutInfo.sType		= VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO;
+	layoutInfo.pNext		= &flagsInfo;
+	layoutInfo.flags		= VK_DESCRIPTOR_SET_LAYOUT_CREATE_UPDATE_AFTER_BIND_POOL_BIT;
+	layoutInfo.bindingCount	= static_cast<uint32_t>(bindings.size());
+	layoutInfo.pBindings	= bindings.data();
+
+	if (vkCreateDescriptorSetLayout(device, &layoutInfo, nullptr, &descriptorSetLayout) != VK_SUCCESS)
+		throw std::runtime_error("Failed to create bindless descriptor set layout!");
+
+	// Descriptor pool and set (a single set, shared by every swap chain image: it's only updated in elements that are not in use)
+	std::array<VkDescriptorPoolSize, 2> poolSizes{};
+	poolSizes[0].type				= VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+	poolSizes[0].descriptorCount	= maxTextures;
+	poolSizes[1].type				= VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+	poolSizes[1].descriptorCount	= 1;
+
+	VkDescriptorPoolCreateInfo poolInfo{};
+	poolInfo.sType			= VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO;
+	poolInfo.flags			= VK_DESCRIPTOR_POOL_CREATE_UPDATE_AFTER_BIND_BIT;
+	poolInfo.poolSizeCount	= static_cast<uint32_t>(poolSizes.size());
+	poolInfo.pPoolSizes		= poolSizes.data();
+	poolInfo.maxSets		= 1;
+
+	if (vkCreateDescriptorPool(device, &poolInfo, nullptr, &descriptorPool) != VK_SUCCESS)
+		throw std::runtime_error("Failed to create bindless descriptor pool!");
+
+	VkDescriptorSetAllocateInfo allocInfo{};
+	allocInfo.sType					= VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO;
+	allocInfo.descriptorPool		= descriptorPool;
+	allocInfo.descriptorSetCount	= 1;
+	allocInfo.pSetLayouts			= &descriptorSetLayout;
+
+	if (vkAllocateDescriptorSets(device, &allocInfo, &descriptorSet) != VK_SUCCESS)
+		throw std::runtime_error("Failed to allocate bindless descriptor set!");
+
+	// Material buffer
+	VkBufferCreateInfo bufferInfo{};
+	bufferInfo.sType		= VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
+	bufferInfo.size			= sizeof(Material) * maxMaterials;
+	bufferInfo.usage		= VK_BUFFER_USAGE_STORAGE_BUFFER_BIT;
+	bufferInfo.sharingMode	= VK_SHARING_MODE_EXCLUSIVE;
+
+	if (vkCreateBuffer(device, &bufferInfo, nullptr, &materialBuffer) != VK_SUCCESS)
+		throw std::runtime_error("Failed to create material buffer!");
+
+	VkMemoryRequirements memRequirements;
+	vkGetBufferMemoryRequirements(device, materialBuffer, &memRequirements);
+	materialMemory = allocator->allocate(memRequirements, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT);
+	vkBindBufferMemory(device, materialBuffer, materialMemory.memory, materialMemory.offset);
+
+	VkDescriptorBufferInfo materialInfo{ materialBuffer, 0, VK_WHOLE_SIZE };
+
+	VkWriteDescriptorSet descriptorWrite{};
+	descriptorWrite.sType			= VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+	descriptorWrite.dstSet			= descriptorSet;
+	descriptorWrite.dstBinding		= 1;
+	descriptorWrite.dstArrayElement	= 0;
+	descriptorWrite.descriptorType	= VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+	descriptorWrite.descriptorCount	= 1;
+	descriptorWrite.pBufferInfo		= &materialInfo;
+
+	vkUpdateDescriptorSets(device, 1, &descriptorWrite, 0, nullptr);
+}
+
+void MaterialTable::cleanup()
+{
+	vkDestroyDescriptorPool(device, descriptorPool, nullptr);		// The descriptor set is freed with the pool
+	vkDestroyDescriptorSetLayout(device, descriptorSetLayout, nullptr);
+	vkDestroyBuffer(device, materialBuffer, nullptr);
+	allocator->free(materialMemory);
+
+	textureIndices.clear();
+	textureViews.clear();
+	textureRefs.clear();
+	freeTextures.clear();
+	materials.clear();
+	freeMaterials.clear();
+	materialCount = 0;
+}
+
+uint32_t MaterialTable::addTexture(VkImageView view, VkSampler sampler)
+{
+	std::unordered_map<VkImageView, uint32_t>::iterator it = textureIndices.find(view);
+	if (it != textureIndices.end())
+	{
+		textureRefs[it->second]++;
+		return it->second;
+	}
+
+	uint32_t index;
+	if (!freeTextures.empty())
+	{
+		index = freeTextures.back();
+		freeTextures.pop_back();
+	}
+	else
+	{
+		if (textureViews.size() == maxTextures)
+			throw std::runtime_error("Bindless texture array is full!");
+		index = static_cast<uint32_t>(textureViews.size());
+		textureViews.push_back(VK_NULL_HANDLE);
+		textureRefs.push_back(0);
+	}
+
+	textureIndices[view]	= index;
+	textureViews[index]		= view;
+	textureRefs[index]		= 1;
+
+	VkDescriptorImageInfo imageInfo{};
+	imageInfo.imageLayout	= VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+	imageInfo.imageView		= view;
+	imageInfo.sampler		= sampler;
+
+	VkWriteDescriptorSet descriptorWrite{};
+	descriptorWrite.sType			= VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+	descriptorWrite.dstSet			= descriptorSet;
+	descriptorWrite.dstBinding		= 0;
+	descriptorWrite.dstArrayElement	= index;
+	descriptorWrite.descriptorType	= VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
+	descriptorWrite.descriptorCount	= 1;
+	descriptorWrite.pImageInfo		= &imageInfo;
+
+	vkUpdateDescriptorSets(device, 1, &descriptorWrite, 0, nullptr);		// Allowed while the set is bound (update after bind), since no command uses this element yet.
+	return index;
+}
+
+uint32_t MaterialTable::add(VkImageView texture, VkSampler sampler, const glm::vec4& baseColor)
+{
+	std::lock_guard<std::mutex> lock(mtx);
+
+	uint32_t index;
+	if (!freeMaterials.empty())
+	{
+		index = freeMaterials.back();
+		freeMaterials.pop_back();
+	}
+	else
+	{
+		if (materials.size() == maxMaterials)
+			throw std::runtime_error("Material buffer is full!");
+		index = static_cast<uint32_t>(materials.size());
+		materials.push_back(Material());
+	}
+
+	Material& material		= materials[index];
+	material.textureIndex	= addTexture(texture, sampler);
+	material.baseColor		= baseColor;
+	((Material*)materialMemory.mapped)[index] = material;
+
+	materialCount++;
+	return index;
+}
+
+void MaterialTable::release(uint32_t material)
+{
+	std::lock_guard<std::mutex> lock(mtx);
+
+	uint32_t texture = materials[material].textureIndex;
+	if (--textureRefs[texture] == 0)
+	{
+		textureIndices.erase(textureViews[texture]);
+		textureViews[texture] = VK_NULL_HANDLE;
+		freeTextures.push_back(texture);			// The element keeps its old descriptor until it's reused (partially bound: never read meanwhile)
+	}
+
+	freeMaterials.push_back(material);
+	materialCount--;
+}
@@ -0,0 +1,190 @@
+#include <fstream>
+#include <cstring>
+#include <thread>
+#include <functional>		// std::hash
+#include <cstdio>			// std::rename, std::remove
+
+#ifdef _WIN32
+	#define WIN32_LEAN_AND_MEAN
+	#define NOMINMAX
+	#include <windows.h>
+#else
+	#include <fcntl.h>
+	#include <unistd.h>
+	#include <sys/mman.h>
+	#include <sys/stat.h>
+#endif
+
+#include "meshCache.hpp"
+
+#define MESH_MAGIC		0x4853454D		// "MESH"
+#define MESH_VERSION	5
+
+// MappedFile ----------------------------------------------------------------------------------
+
+MappedFile::~MappedFile() { close(); }
+
+bool MappedFile::open(const char* path)
+{
+	close();
+
+#ifdef _WIN32
+	HANDLE fileHandle = CreateFileA(path, GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, nullptr);
+	if (fileHandle == INVALID_HANDLE_VALUE) return false;
+
+	LARGE_INTEGER size;
+	if (!GetFileSizeEx(fileHandle, &size) || size.QuadPart == 0) { CloseHandle(fileHandle); return false; }
+
+	HANDLE mappingHandle = CreateFileMappingA(fileHandle, nullptr, PAGE_READONLY, 0, 0, nullptr);
+	if (!mappingHandle) { CloseHandle(fileHandle); return false; }
+
+	void* view = MapViewOfFile(mappingHandle, FILE_MAP_READ, 0, 0, 0);
+	if (!view) { CloseHandle(mappingHandle); CloseHandle(fileHandle); return false; }
+
+	file	= fileHandle;
+	mapping	= mappingHandle;
+	data	= (const char*)view;
+	length	= (size_t)size.QuadPart;
+#else
+	int fd = ::open(path, O_RDONLY);
+	if (fd < 0) return false;
+
+	struct stat st;
+	if (fstat(fd, &st) != 0 || st.st_size == 0) { ::close(fd); return false; }
+
+	void* view = mmap(nullptr, (size_t)st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	::close(fd);						// The mapping keeps the file referenced
+	if (view == MAP_FAILED) return false;
+
+	madvise(view, (size_t)st.st_size, MADV_SEQUENTIAL);
+	data	= (const char*)view;
+	length	= (size_t)st.st_size;
+#endif
+
+	return true;
+}
+
+void MappedFile::close()
+{
+	if (!data) return;
+
+#ifdef _WIN32
+	UnmapViewOfFile(data);
+	CloseHandle((HANDLE)mapping);
+	CloseHandle((HANDLE)file);
+	file = mapping = nullptr;
+#else
+	munmap((void*)data, length);
+#endif
+
+	data	= nullptr;
+	length	= 0;
+}
+
+// MeshFile ------------------------------------------------------------------------------------
+
+std::string MeshFile::cachePath(const char* sourcePath) { return std::string(sourcePath) + ".mesh"; }
+
+uint64_t MeshFile::hash(const char* data, size_t size)
+{
+	uint64_t hash = 14695981039346656037ull;
+	size_t i = 0;
+
+	for (; i + 8 <= size; i += 8)
+	{
+		uint64_t word;
+		memcpy(&word, data + i, 8);
+		hash = (hash ^ word) * 1099511628211ull;
+	}
+	for (; i < size; i++)
+		hash = (hash ^ (uint8_t)data[i]) * 1099511628211ull;
+
+	return hash;
+}
+
+bool MeshFile::open(const char* sourcePath, uint32_t vertexSize, uint32_t indexSize, uint32_t flags)
+{
+	close();
+
+	// Hash the source (it's mapped, not parsed)
+	MappedFile source;
+	if (!source.open(sourcePath)) return false;
+	uint64_t sourceHash = hash(source.getData(), source.getSize());
+
+	// Map the cache and validate it
+	if (!file.open(cachePath(sourcePath).c_str())) return false;
+	if (file.getSize() < sizeof(MeshFileHeader)) { file.close(); return false; }
+
+	const MeshFileHeader* h = (const MeshFileHeader*)file.getData();
+	uint64_t expectedSize = sizeof(MeshFileHeader) + (uint64_t)h->vertexCount * h->vertexSize + (uint64_t)h->indexCount * h->indexSize + (uint64_t)h->lodCount * sizeof(MeshLod) + (uint64_t)h->meshletCount * sizeof(Meshlet);
+
+	if (h->magic		!= MESH_MAGIC		||
+		h->version		!= MESH_VERSION		||
+		h->sourceHash	!= sourceHash		||
+		h->sourceSize	!= source.getSize()	||
+		h->vertexSize	!= vertexSize		||
+		h->indexSize	!= indexSize		||
+		h->flags		!= flags			||
+		h->lodCount		== 0				||
+		file.getSize()	!= expectedSize)
+	{
+		file.close();
+		return false;
+	}
+
+	header = h;
+	return true;
+}
+
+void MeshFile::close()
+{
+	file.close();
+	header = nullptr;
+}
+
+const void* MeshFile::getVertexData() const { return file.getData() + sizeof(MeshFileHeader); }
+
+const void* MeshFile::getIndexData() const { return file.getData() + sizeof(MeshFileHeader) + (size_t)header->vertexCount * header->vertexSize; }
+
+const MeshLod* MeshFile::getLods() const { return (const MeshLod*)((const char*)getIndexData() + (size_t)header->indexCount * header->indexSize); }
+
+const Meshlet* MeshFile::getMeshlets() const { return (const Meshlet*)(getLods() + header->lodCount); }
+
+bool MeshFile::write(const char* sourcePath, const void* vertices, uint32_t vertexSize, uint32_t vertexCount, const void* indices, uint32_t indexSize, uint32_t indexCount, const float boundsMin[3], const float boundsMax[3], float boundsRadius, uint32_t flags, const MeshLod* lods, uint32_t lodCount, const Meshlet* meshlets, uint32_t meshletCount)
+{
+	MappedFile source;
+	if (!source.open(sourcePath)) return false;
+
+	MeshFileHeader header{};
+	header.magic		= MESH_MAGIC;
+	header.version		= MESH_VERSION;
+	header.sourceHash	= hash(source.getData(), source.getSize());
+	header.sourceSize	= source.getSize();
+	header.vertexSize	= vertexSize;
+	header.vertexCount	= vertexCount;
+	header.indexSize	= indexSize;
+	header.indexCount	= indexCount;
+	header.flags		= flags;
+	header.lodCount		= lodCount;
+	memcpy(header.boundsMin, boundsMin, sizeof(header.boundsMin));
+	memcpy(header.boundsMax, boundsMax, sizeof(header.boundsMax));
+	header.boundsRadius	= boundsRadius;
+	header.meshletCount	= meshletCount;
+
+	// Write to a temporary file and rename it, so a reader never maps a half-written cache. The temporary name is unique per thread (models sharing a source can be loaded in parallel).
+	std::string path	= cachePath(sourcePath);
+	std::string tmpPath	= path + "." + std::to_string(std::hash<std::thread::id>()(std::this_thread::get_id())) + ".tmp";
+	{
+		std::ofstream out(tmpPath, std::ios::binary | std::ios::trunc);
+		if (!out.is_open()) return false;
+		out.write((const char*)&header, sizeof(header));
+		out.write((const char*)vertices, (std::streamsize)vertexCount * vertexSize);
+		out.write((const char*)indices, (std::streamsize)indexCount * indexSize);
+		out.write((const char*)lods, (std::streamsize)lodCount * sizeof(MeshLod));
+		out.write((const char*)meshlets, (std::streamsize)meshletCount * sizeof(Meshlet));
+		if (!out) { out.close(); std::remove(tmpPath.c_str()); return false; }
+	}
+
+	std::remove(path.c_str());			// std::rename doesn't replace existing files on Windows
+	return std::rename(tmpPath.c_str(), path.c_str()) == 0;
+}
@@ -0,0 +1,269 @@
+#include <algorithm>
+#include <cstring>
+#include <cmath>
+
+#include "meshOptimizer.hpp"
+
+
+namespace
+{
+	/// Triangles adjacent to each vertex (CSR layout: triangles of vertex v are triangles[offsets[v]] ... triangles[offsets[v + 1] - 1]).
+	struct Adjacency
+	{
+		std::vector<uint32_t> offsets;
+		std::vector<uint32_t> triangles;
+
+		Adjacency(const std::vector<uint32_t>& indices, size_t vertexCount)
+			: offsets(vertexCount + 1, 0), triangles(indices.size())
+		{
+			for (uint32_t index : indices) offsets[index + 1]++;
+			for (size_t v = 0; v < vertexCount; v++) offsets[v + 1] += offsets[v];
+
+			std::vector<uint32_t> fill(offsets.begin(), offsets.end() - 1);
+			for (size_t i = 0; i < indices.size(); i++)
+				triangles[fill[indices[i]]++] = static_cast<uint32_t>(i / 3);
+		}
+	};
+
+	/// FIFO post-transform cache. Vertex v is in the cache if it was inserted less than cacheSize misses ago.
+	struct FifoCache
+	{
+		std::vector<size_t>	insertedAt;		///< Miss counter when the vertex was inserted (0: never)
+		size_t				misses = 0;
+		unsigned			size;
+
+		FifoCache(size_t vertexCount, unsigned cacheSize) : insertedAt(vertexCount, 0), size(cacheSize) { }
+
+		bool access(uint32_t v)				///< Returns true on a miss.
+		{
+			if (insertedAt[v] && misses + 1 - insertedAt[v] <= size) return false;
+			insertedAt[v] = ++misses;
+			return true;
+		}
+	};
+}
+
+VertexCacheStats analyzeVertexCache(const uint32_t* indices, size_t indexCount, size_t vertexCount, unsigned cacheSize)
+{
+	FifoCache cache(vertexCount, cacheSize);
+	for (size_t i = 0; i < indexCount; i++)
+		cache.access(indices[i]);
+
+	VertexCacheStats stats;
+	stats.transformed	= cache.misses;
+	stats.acmr			= indexCount  ? float(cache.misses) / (indexCount / 3) : 0.f;
+	stats.atvr			= vertexCount ? float(cache.misses) / vertexCount : 0.f;
+	return stats;
+}
+
+/*
+	Tipsify: fan around a vertex (emitting all its remaining triangles), then move to the oldest vertex of the fan that will still be in the cache after emitting its remaining triangles (or any vertex of the fan with triangles left). If there's none, take a vertex from the dead-end stack (recently emitted) or, at last, the next vertex in input order.
+*/
+void optimizeVertexCache(std::vector<uint32_t>& indices, size_t vertexCount, unsigned cacheSize)
+{
+	size_t triangleCount = indices.size() / 3;
+	if (triangleCount == 0 || vertexCount == 0) return;
+
+	Adjacency adjacency(indices, vertexCount);
+
+	std::vector<uint32_t>	live(vertexCount);				// Remaining (not emitted) triangles of each vertex
+	for (size_t v = 0; v < vertexCount; v++) live[v] = adjacency.offsets[v + 1] - adjacency.offsets[v];
+
+	std::vector<size_t>		cacheTime(vertexCount, 0);		// Time stamp of the vertex in the simulated cache
+	std::vector<bool>		emitted(triangleCount, false);
+	std::vector<uint32_t>	deadEnd;						// Vertices of the emitted triangles, newest on top
+	std::vector<uint32_t>	candidates;
+	std::vector<uint32_t>	output;
+	output.reserve(indices.size());
+
+	size_t	 time	= cacheSize + 1;
+	size_t	 cursor	= 0;									// Next vertex in input order for restarting
+	int64_t	 fan	= indices[0];
+
+	while (fan >= 0)
+	{
+		candidates.clear();
+
+		// Emit the remaining triangles around the fanning vertex
+		for (uint32_t k = adjacency.offsets[fan]; k < adjacency.offsets[fan + 1]; k++)
+		{
+			uint32_t t = adjacency.triangles[k];
+			if (emitted[t]) continue;
+
+			for (int c = 0; c < 3; c++)
+			{
+				uint32_t v = indices[3 * t + c];
+				output.push_back(v);
+				deadEnd.push_back(v);
+				candidates.push_back(v);
+				live[v]--;
+
+				if (time - cacheTime[v] > cacheSize)		// Not in cache: it's inserted now
+					cacheTime[v] = time++;
+			}
+			emitted[t] = true;
+		}
+
+		// Next fanning vertex: the oldest candidate that stays in the cache while its remaining triangles are emitted
+		int64_t	 best			= -1;
+		size_t	 bestPriority	= 0;
+		for (uint32_t v : candidates)
+		{
+			if (live[v] == 0) continue;
+
+			size_t priority = 0;
+			if (time - cacheTime[v] + 2 * live[v] <= cacheSize)
+				priority = time - cacheTime[v];
+
+			if (best < 0 || priority > bestPriority)
+			{
+				best			= v;
+				bestPriority	= priority;
+			}
+		}
+
+		// Dead end: last emitted vertex with triangles left, or the next one in input order
+		if (best < 0)
+		{
+			while (!deadEnd.empty() && best < 0)
+			{
+				uint32_t v = deadEnd.back();
+				deadEnd.pop_back();
+				if (live[v] > 0) best = v;
+			}
+
+			while (best < 0 && cursor < vertexCount)
+			{
+				if (live[cursor] > 0) best = cursor;
+				cursor++;
+			}
+		}
+
+		fan = best;
+	}
+
+	indices.swap(output);
+}
+
+void optimizeOverdraw(std::vector<uint32_t>& indices, const float* positions, size_t positionStride, size_t vertexCount, float threshold, unsigned cacheSize)
+{
+	size_t triangleCount = indices.size() / 3;
+	if (triangleCount == 0) return;
+
+	auto position = [&](uint32_t v) { return (const float*)((const char*)positions + v * positionStride); };
+
+	// 1. Hard boundaries: triangles where the cache is cold (all 3 vertices missed). Splitting there costs nothing.
+	std::vector<size_t> hard;
+	{
+		FifoCache cache(vertexCount, cacheSize);
+		for (size_t t = 0; t < triangleCount; t++)
+		{
+			int misses = cache.access(indices[3 * t]) + cache.access(indices[3 * t + 1]) + cache.access(indices[3 * t + 2]);
+			if (misses == 3 || t == 0) hard.push_back(t);
+		}
+		hard.push_back(triangleCount);
+	}
+
+	// 2. Soft boundaries: split each hard cluster where the ACMR so far is low enough (<= threshold * mesh ACMR), so reordering the clusters keeps the cache efficiency.
+	float meshAcmr = analyzeVertexCache(indices.data(), indices.size(), vertexCount, cacheSize).acmr;
+	std::vector<size_t> clusters;
+	{
+		FifoCache cache(vertexCount, cacheSize);
+		for (size_t h = 0; h + 1 < hard.size(); h++)
+		{
+			cache.misses += cacheSize;										// Every cluster starts with a cold cache (the previous one may not precede it after sorting)
+			size_t start		= hard[h];
+			size_t startMisses	= cache.misses;
+			clusters.push_back(start);
+
+			for (size_t t = start; t < hard[h + 1]; t++)
+			{
+				cache.access(indices[3 * t]);
+				cache.access(indices[3 * t + 1]);
+				cache.access(indices[3 * t + 2]);
+
+				size_t count = t + 1 - start;
+				if (t + 1 < hard[h + 1] && count >= 8 && float(cache.misses - startMisses) / count <= threshold * meshAcmr)
+				{
+					cache.misses += cacheSize;
+					start		= t + 1;
+					startMisses	= cache.misses;
+					clusters.push_back(start);
+				}
+			}
+		}
+		clusters.push_back(triangleCount);
+	}
+
+	// 3. Sort the clusters by how much they face outwards (outer surfaces first: they occlude the inner ones)
+	float meshCentroid[3] = { 0.f, 0.f, 0.f };
+	for (size_t i = 0; i < indices.size(); i++)
+		for (int c = 0; c < 3; c++) meshCentroid[c] += position(indices[i])[c];
+	for (int c = 0; c < 3; c++) meshCentroid[c] /= indices.size();
+
+	size_t clusterCount = clusters.size() - 1;
+	std::vector<float> sortKey(clusterCount);
+
+	for (size_t k = 0; k < clusterCount; k++)
+	{
+		float centroid[3] = { 0.f, 0.f, 0.f }, normal[3] = { 0.f, 0.f, 0.f }, area = 0.f;
+
+		for (size_t t = clusters[k]; t < clusters[k + 1]; t++)
+		{
+			const float* a = position(indices[3 * t]);
+			const float* b = position(indices[3 * t + 1]);
+			const float* c = position(indices[3 * t + 2]);
+
+			float e1[3] = { b[0] - a[0], b[1] - a[1], b[2] - a[2] };
+			float e2[3] = { c[0] - a[0], c[1] - a[1], c[2] - a[2] };
+			float n[3]  = { e1[1] * e2[2] - e1[2] * e2[1], e1[2] * e2[0] - e1[0] * e2[2], e1[0] * e2[1] - e1[1] * e2[0] };		// Length: 2 * area
+			float w		= std::sqrt(n[0] * n[0] + n[1] * n[1] + n[2] * n[2]);
+
+			for (int i = 0; i < 3; i++)
+			{
+				centroid[i]	+= (a[i] + b[i] + c[i]) / 3.f * w;
+				normal[i]	+= n[i];
+			}
+			area += w;
+		}
+
+		float length = std::sqrt(normal[0] * normal[0] + normal[1] * normal[1] + normal[2] * normal[2]);
+		if (area > 0.f && length > 0.f)
+			sortKey[k] = ((centroid[0] / area - meshCentroid[0]) * normal[0] +
+						  (centroid[1] / area - meshCentroid[1]) * normal[1] +
+						  (centroid[2] / area - meshCentroid[2]) * normal[2]) / length;
+		else
+			sortKey[k] = 0.f;
+	}
+
+	std::vector<uint32_t> order(clusterCount);
+	for (size_t k = 0; k < clusterCount; k++) order[k] = static_cast<uint32_t>(k);
+	std::stable_sort(order.begin(), order.end(), [&](uint32_t a, uint32_t b) { return sortKey[a] > sortKey[b]; });
+
+	std::vector<uint32_t> output;
+	output.reserve(indices.size());
+	for (uint32_t k : order)
+		output.insert(output.end(), indices.begin() + 3 * clusters[k], indices.begin() + 3 * clusters[k + 1]);
+
+	indices.swap(output);
+}
+
+size_t optimizeVertexFetch(void* vertices, size_t vertexSize, size_t vertexCount, std::vector<uint32_t>& indices)
+{
+	const uint32_t UNUSED = ~0u;
+	std::vector<uint32_t> remap(vertexCount, UNUSED);
+	uint32_t next = 0;
+
+	for (uint32_t& index : indices)
+	{
+		if (remap[index] == UNUSED) remap[index] = next++;
+		index = remap[index];
+	}
+
+	std::vector<char> old((char*)vertices, (char*)vertices + vertexCount * vertexSize);
+	for (size_t v = 0; v < vertexCount; v++)
+		if (remap[v] != UNUSED)
+			memcpy((char*)vertices + remap[v] * vertexSize, old.data() + v * vertexSize, vertexSize);
+
+	return next;
+}
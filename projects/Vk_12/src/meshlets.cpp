@@ -0,0 +1,237 @@
+#include <algorithm>
+#include <cmath>
+
+#include "meshlets.hpp"
+
+
+namespace
+{
+	glm::vec3 getPosition(const float* positions, size_t stride, uint32_t vertex)
+	{
+		const float* p = (const float*)((const char*)positions + vertex * stride);
+		return glm::vec3(p[0], p[1], p[2]);
+	}
+
+	/// Unit normal of a triangle (0 if it's degenerate).
+	glm::vec3 triangleNormal(const float* positions, size_t stride, const uint32_t* corners)
+	{
+		glm::vec3 a = getPosition(positions, stride, corners[0]);
+		glm::vec3 normal = glm::cross(getPosition(positions, stride, corners[1]) - a, getPosition(positions, stride, corners[2]) - a);
+		float length = glm::length(normal);
+		return length > 0.f ? normal / length : glm::vec3(0.f);
+	}
+
+	/// Bounding sphere (centered in the bounding box of the vertices) and normal cone of the triangles of a meshlet.
+	void computeBounds(Meshlet& meshlet, const uint32_t* indices, const float* positions, size_t stride)
+	{
+		glm::vec3 boxMin(getPosition(positions, stride, indices[0])), boxMax(boxMin);
+		for (uint32_t k = 1; k < meshlet.indexCount; k++)
+		{
+			glm::vec3 p = getPosition(positions, stride, indices[k]);
+			boxMin = glm::min(boxMin, p);
+			boxMax = glm::max(boxMax, p);
+		}
+
+		glm::vec3 center = (boxMin + boxMax) * 0.5f;
+		float radius = 0.f;
+		for (uint32_t k = 0; k < meshlet.indexCount; k++)
+			radius = std::max(radius, glm::length(getPosition(positions, stride, indices[k]) - center));
+
+		// Normal cone: the axis is the average of the unit normals, and the half angle is the largest angle between it and a normal.
+		std::vector<glm::vec3> normals;
+		glm::vec3 axis(0.f);
+		for (uint32_t k = 0; k < meshlet.indexCount; k += 3)
+		{
+			glm::vec3 normal = triangleNormal(positions, stride, indices + k);
+			if (normal == glm::vec3(0.f)) continue;		// Degenerate triangles have no facing
+
+			normals.push_back(normal);
+			axis += normal;
+		}
+
+		float cutoff	= 1.f;
+		float length	= glm::length(axis);
+		if (length > 1e-6f)
+		{
+			axis /= length;
+			float minDot = 1.f;
+			for (const glm::vec3& normal : normals)
+				minDot = std::min(minDot, glm::dot(axis, normal));
+			if (minDot > 0.f)
+				cutoff = std::sqrt(std::max(0.f, 1.f - minDot * minDot));
+		}
+
+		for (int c = 0; c < 3; c++)
+		{
+			meshlet.center[c]	= center[c];
+			meshlet.coneAxis[c]	= axis[c];
+		}
+		meshlet.radius		= radius;
+		meshlet.coneCutoff	= cutoff;
+	}
+}
+
+std::vector<Meshlet> buildMeshlets(std::vector<uint32_t>& indices, size_t firstIndex, size_t indexCount, const float* positions, size_t positionStride, size_t vertexCount, size_t maxVertices, size_t maxTriangles)
+{
+	std::vector<Meshlet> meshlets;
+	size_t triangleCount = indexCount / 3;
+	if (triangleCount == 0) return meshlets;
+
+	const uint32_t* source = indices.data() + firstIndex;
+
+	// Triangles of each vertex: adjacency[offsets[v], offsets[v + 1])
+	std::vector<uint32_t> offsets(vertexCount + 1, 0), adjacency(triangleCount * 3);
+	for (size_t k = 0; k < triangleCount * 3; k++)
+		offsets[source[k] + 1]++;
+	for (size_t v = 0; v < vertexCount; v++)
+		offsets[v + 1] += offsets[v];
+
+	std::vector<uint32_t> cursor(offsets.begin(), offsets.end() - 1);
+	for (size_t k = 0; k < triangleCount * 3; k++)
+		adjacency[cursor[source[k]]++] = static_cast<uint32_t>(k / 3);
+
+	std::vector<uint8_t>	emitted(triangleCount, 0);
+	std::vector<uint32_t>	owner(vertexCount, UINT32_MAX);		// Last meshlet that used each vertex
+	std::vector<uint32_t>	result;								// New order of the triangles
+	std::vector<uint32_t>	candidates;							// Triangles adjacent to the current meshlet (may be emitted already, or repeated)
+	result.reserve(triangleCount * 3);
+
+	size_t seed = 0;
+	while (true)
+	{
+		// Each meshlet starts with the first triangle not emitted yet (so the original order, optimized for the vertex cache, is roughly kept).
+		while (seed < triangleCount && emitted[seed]) seed++;
+		if (seed == triangleCount) break;
+
+		uint32_t id = static_cast<uint32_t>(meshlets.size());
+		Meshlet meshlet{};
+		meshlet.firstIndex = static_cast<uint32_t>(firstIndex + result.size());
+
+		candidates.clear();
+		glm::vec3 positionSum(0.f), normalSum(0.f);
+		uint32_t triangle = static_cast<uint32_t>(seed);
+
+		while (true)
+		{
+			emitted[triangle] = 1;
+			normalSum += triangleNormal(positions, positionStride, source + 3 * triangle);
+			for (int c = 0; c < 3; c++)
+			{
+				uint32_t v = source[3 * triangle + c];
+				result.push_back(v);
+				if (owner[v] == id) continue;
+
+				owner[v] = id;
+				meshlet.vertexCount++;
+				positionSum += getPosition(positions, positionStride, v);
+				candidates.insert(candidates.end(), adjacency.begin() + offsets[v], adjacency.begin() + offsets[v + 1]);
+			}
+			meshlet.indexCount += 3;
+			if (meshlet.indexCount / 3 == maxTriangles) break;
+
+			// Next triangle: the neighbour that adds fewer vertices (and, among those, the closest one to the center of the meshlet).
+			glm::vec3 center	= positionSum / float(meshlet.vertexCount);
+			uint32_t best		= UINT32_MAX;
+			uint32_t bestNew	= 4;
+			float bestDistance	= 0.f;
+			size_t kept			= 0;
+
+			for (uint32_t t : candidates)
+			{
+				if (emitted[t]) continue;
+				candidates[kept++] = t;
+
+				const uint32_t* corners = source + 3 * t;
+				uint32_t newVertices = (owner[corners[0]] != id) + (owner[corners[1]] != id) + (owner[corners[2]] != id);
+				if (meshlet.vertexCount + newVertices > maxVertices || newVertices > bestNew) continue;
+
+				glm::vec3 centroid = getPosition(positions, positionStride, corners[0]) + getPosition(positions, positionStride, corners[1]) + getPosition(positions, positionStride, corners[2]);
+				glm::vec3 offset   = centroid / 3.f - center;
+				float distance	   = glm::dot(offset, offset);
+				if (newVertices < bestNew || distance < bestDistance)
+				{
+					best			= t;
+					bestNew			= newVertices;
+					bestDistance	= distance;
+				}
+			}
+			candidates.resize(kept);
+
+			// No neighbours left (disconnected parts, or texture seams that split the vertices): continue with one of the next triangles in order if it's close to the meshlet and faces the same way (so the cone stays narrow).
+			if (best == UINT32_MAX && candidates.empty())
+			{
+				float radius2 = 0.f;
+				for (size_t k = meshlet.firstIndex - firstIndex; k < result.size(); k++)
+				{
+					glm::vec3 offset = getPosition(positions, positionStride, result[k]) - center;
+					radius2 = std::max(radius2, glm::dot(offset, offset));
+				}
+
+				for (size_t t = seed; t < triangleCount && t < seed + 64; t++)
+				{
+					if (emitted[t]) continue;
+					const uint32_t* corners = source + 3 * t;
+					uint32_t newVertices = (owner[corners[0]] != id) + (owner[corners[1]] != id) + (owner[corners[2]] != id);
+					glm::vec3 offset = (getPosition(positions, positionStride, corners[0]) + getPosition(positions, positionStride, corners[1]) + getPosition(positions, positionStride, corners[2])) / 3.f - center;
+					float facing	 = glm::dot(triangleNormal(positions, positionStride, corners), normalSum);
+					if (meshlet.vertexCount + newVertices <= maxVertices && glm::dot(offset, offset) <= 4.f * radius2 && facing >= 0.7f * glm::length(normalSum))
+					{
+						best = static_cast<uint32_t>(t);
+						break;
+					}
+				}
+			}
+
+			if (best == UINT32_MAX) break;		// Vertex limit reached, or no triangles close enough
+			triangle = best;
+		}
+
+		meshlets.push_back(meshlet);
+	}
+
+	std::copy(result.begin(), result.end(), indices.begin() + firstIndex);
+
+	for (Meshlet& meshlet : meshlets)
+		computeBounds(meshlet, indices.data() + meshlet.firstIndex, positions, positionStride);
+
+	return meshlets;
+}
+
+/**
+*	Back-facing test: a triangle with normal n faces away from a camera at C if dot(n, p - C) >= 0 for its points p. That holds for every normal inside the cone (half angle a) if the angle between the axis and p - C is 90 - a or less: dot(p - C, axis) >= sin(a) * |p - C|.
+*	For every point p of the bounding sphere (center c, radius r), it's enough that dot(c - C, axis) >= sin(a) * |c - C| + r * (1 + sin(a)).
+*/
+MeshletCullingStats cullMeshlets(const Meshlet* meshlets, size_t meshletCount, const Frustum& frustum, const glm::vec3& cameraPosition, std::vector<DrawRange>& ranges, uint32_t mergeGap)
+{
+	MeshletCullingStats stats;
+
+	for (size_t i = 0; i < meshletCount; i++)
+	{
+		const Meshlet& meshlet = meshlets[i];
+		glm::vec3 center(meshlet.center[0], meshlet.center[1], meshlet.center[2]);
+
+		bool outside = false;
+		for (const glm::vec4& plane : frustum.planes)
+			outside = outside || glm::dot(glm::vec3(plane), center) + plane.w < -meshlet.radius;
+		if (outside) { stats.outside++; continue; }
+
+		if (meshlet.coneCutoff < 1.f)
+		{
+			glm::vec3 view = center - cameraPosition;
+			glm::vec3 axis(meshlet.coneAxis[0], meshlet.coneAxis[1], meshlet.coneAxis[2]);
+			if (glm::dot(view, axis) >= meshlet.coneCutoff * glm::length(view) + meshlet.radius * (1.f + meshlet.coneCutoff))
+			{
+				stats.backFacing++;
+				continue;
+			}
+		}
+
+		stats.visible++;
+		if (!ranges.empty() && meshlet.firstIndex - (ranges.back().firstIndex + ranges.back().indexCount) <= mergeGap)
+			ranges.back().indexCount = meshlet.firstIndex + meshlet.indexCount - ranges.back().firstIndex;
+		else
+			ranges.push_back(DrawRange{ meshlet.firstIndex, meshlet.indexCount });
+	}
+
+	return stats;
+}
@@ -4,7 +4,17 @@
 #define TINYOBJLOADER_IMPLEMENTATION
 #include "tiny_obj_loader.h"
 
+#include <memory>
+#include <chrono>
+#include <sstream>
+
+#include <glm/gtc/packing.hpp>				// glm::packHalf1x16
+
 #include "models.hpp"
+#include "welder.hpp"
+#include "meshOptimizer.hpp"
+#include "simplifier.hpp"
+#include "meshlets.hpp"
 
 VkVertexInputBindingDescription Vertex::getBindingDescription()
 {
@@ -38,6 +48,80 @@ std::array<VkVertexInputAttributeDescription, 3> Vertex::getAttributeDescription
 	return attributeDescriptions;
 }
 
+VkVertexInputBindingDescription InstanceData::getBindingDescription()
+{
+	VkVertexInputBindingDescription bindingDescription{};
+	bindingDescription.binding		= 1;								// Binding 0 is used by the vertex data.
+	bindingDescription.stride		= sizeof(InstanceData);
+	bindingDescription.inputRate	= VK_VERTEX_INPUT_RATE_INSTANCE;	// Move to the next data entry after each instance.
+
+	return bindingDescription;
+}
+
+std::array<VkVertexInputAttributeDescription, 4> InstanceData::getAttributeDescriptions()
+{
+	std::array<VkVertexInputAttributeDescription, 4> attributeDescriptions{};
+
+	for (uint32_t i = 0; i < 4; i++)										// One vec4 per column of the model matrix
+	{
+		attributeDescriptions[i].binding	= 1;
+		attributeDescriptions[i].location	= 3 + i;						// Locations 0-2 are used by the vertex data.
+		attributeDescriptions[i].format		= VK_FORMAT_R32G32B32A32_SFLOAT;
+		attributeDescriptions[i].offset		= offsetof(InstanceData, model) + i * sizeof(glm::vec4);
+	}
+
+	return attributeDescriptions;
+}
+
+VkVertexInputBindingDescription PackedVertex::getBindingDescription()
+{
+	VkVertexInputBindingDescription bindingDescription{};
+	bindingDescription.binding		= 0;
+	bindingDescription.stride		= sizeof(PackedVertex);
+	bindingDescription.inputRate	= VK_VERTEX_INPUT_RATE_VERTEX;
+
+	return bindingDescription;
+}
+
+std::array<VkVertexInputAttributeDescription, 2> PackedVertex::getAttributeDescriptions()
+{
+	std::array<VkVertexInputAttributeDescription, 2> attributeDescriptions{};
+
+	attributeDescriptions[0].binding	= 0;
+	attributeDescriptions[0].location	= 0;
+	attributeDescriptions[0].format		= VK_FORMAT_R16G16B16A16_UNORM;	// Read as vec3 in [0, 1] (the shader ignores the 4th component)
+	attributeDescriptions[0].offset		= offsetof(PackedVertex, pos);
+
+	attributeDescriptions[1].binding	= 0;
+	attributeDescriptions[1].location	= 2;								// Same location as in Vertex (location 1, color, is not used)
+	attributeDescriptions[1].format		= VK_FORMAT_R16G16_SFLOAT;
+	attributeDescriptions[1].offset		= offsetof(PackedVertex, texCoord);
+
+	return attributeDescriptions;
+}
+
+PackedVertex PackedVertex::pack(const Vertex& vertex, const glm::vec3& boundsMin, const glm::vec3& boundsMax)
+{
+	glm::vec3 extent	= boundsMax - boundsMin;
+	glm::vec3 relative	= glm::vec3(extent.x ? (vertex.pos.x - boundsMin.x) / extent.x : 0.f,
+									extent.y ? (vertex.pos.y - boundsMin.y) / extent.y : 0.f,
+									extent.z ? (vertex.pos.z - boundsMin.z) / extent.z : 0.f);
+
+	PackedVertex packed;
+	for (int i = 0; i < 3; i++)
+		packed.pos[i] = static_cast<uint16_t>(glm::clamp(relative[i], 0.f, 1.f) * 65535.f + 0.5f);
+	packed.pos[3]		= 0;
+	packed.texCoord[0]	= glm::packHalf1x16(vertex.texCoord.x);
+	packed.texCoord[1]	= glm::packHalf1x16(vertex.texCoord.y);
+
+	return packed;
+}
+
+glm::mat4 PackedVertex::dequantization(const glm::vec3& boundsMin, const glm::vec3& boundsMax)
+{
+	return glm::scale(glm::translate(glm::mat4(1.0f), boundsMin), boundsMax - boundsMin);
+}
+
 bool Vertex::operator==(const Vertex& other) const {
 	return	pos == other.pos &&
 			color == other.color &&
@@ -76,9 +160,11 @@ modelConfig::modelConfig(const char* modelPath, const char* texturePath, const c
 
 	getModelMatrices.clear();
 	getModelMatrices.push_back(ModelMatrixCallback);
+	instanced = false;
+	packedVertices = false;
 }
 
-modelConfig::modelConfig(const char* modelPath, const char* texturePath, const char* VSpath, const char* FSpath, std::vector<std::function<glm::mat4(float)>>& ModelMatrixCallbacks)
+modelConfig::modelConfig(const char* modelPath, const char* texturePath, const char* VSpath, const char* FSpath, std::vector<std::function<glm::mat4(float)>>& ModelMatrixCallbacks, bool instanced)
 {
 	char* address;
 	size_t siz;
@@ -105,6 +191,8 @@ modelConfig::modelConfig(const char* modelPath, const char* texturePath, const c
 
 	getModelMatrices.clear();
 	getModelMatrices = ModelMatrixCallbacks;
+	this->instanced = instanced;
+	packedVertices = false;
 }
 
 modelConfig::modelConfig(const modelConfig& obj)
@@ -134,6 +222,8 @@ modelConfig::modelConfig(const modelConfig& obj)
 
 	getModelMatrices.clear();
 	getModelMatrices = obj.getModelMatrices;
+	instanced = obj.instanced;
+	packedVertices = obj.packedVertices;
 }
 
 modelConfig::~modelConfig()
@@ -147,13 +237,8 @@ modelConfig::~modelConfig()
 
 // Uniform Buffer Object Dynamic -----------------------------------------------------------------
 
-UBOdynamic::UBOdynamic(size_t UBOcount, VkDeviceSize sizePerUBO)
-	: UBOcount(UBOcount), sizePerUBO(sizePerUBO), totalBytes(sizePerUBO * UBOcount), data(nullptr)
-{
-	data = new char[totalBytes];
-}
-
-UBOdynamic::~UBOdynamic() { delete[] data; }
+UBOdynamic::UBOdynamic(size_t UBOcount, VkDeviceSize sizePerUBO, void* data)
+	: UBOcount(UBOcount), sizePerUBO(sizePerUBO), totalBytes(sizePerUBO * UBOcount), data((char*)data) { }
 
 void UBOdynamic::setModel(size_t position, const glm::mat4& matrix)
 { 
@@ -161,18 +246,6 @@ void UBOdynamic::setModel(size_t position, const glm::mat4& matrix)
 	*original = matrix;					// Equivalent to:   memcpy((void*)original, (void*)&matrix, sizeof(glm::mat4));
 }
 
-void UBOdynamic::setView(size_t position, const glm::mat4& matrix)
-{ 
-	glm::mat4* original = (glm::mat4*) &data[position * sizePerUBO + 1 * sizeof(glm::mat4)];
-	*original = matrix;
-}
-
-void UBOdynamic::setProj(size_t position, const glm::mat4& matrix)
-{ 
-	glm::mat4* original = (glm::mat4*) &data[position * sizePerUBO + 2 * sizeof(glm::mat4)];
-	*original = matrix;
-}
-
 // modelData ----------------------------------------------------------------------------------
 
 /// Function for computing the model matrix (MM). Used by default as callback in the modelData constructor.
@@ -186,22 +259,89 @@ glm::mat4 default_MM(float time)
 	return model;
 }
 
-modelData::modelData(VulkanEnvironment &environment, modelConfig config)
+modelData::modelData(VulkanEnvironment &environment, modelConfig config, bool deferred)
 	: e(environment), config(config)
 {
-	getModelMatrix = config.getModelMatrices;
-	if (getModelMatrix.size() > 1) fillDynamicOffsets();
+	getModelMatrix	= config.getModelMatrices;
+	instanced		= config.instanced && !e.gpuDriven;				// GPU-driven rendering draws every model with instances (the model matrices come from a storage buffer)
+	packedVertices	= config.packedVertices;
+	dynamicUBO		= getModelMatrix.size() > 1 && !instanced && !e.gpuDriven;
+	if (dynamicUBO) fillDynamicOffsets();
+
+	if (!deferred)
+	{
+		loadAssets();
+		createResources();
+	}
+}
+
+AssetLoadTimes modelData::loadAssets()
+{
+	AssetLoadTimes times;
+	auto start = std::chrono::high_resolution_clock::now();
+
+	e.textures.prepare(config.texturePath, textureFormat);		// The image is created from the decoded data in createTextureImage()
+	auto textureEnd = std::chrono::high_resolution_clock::now();
 
+	meshFile = std::make_shared<MeshFile>();					// Mesh cache (mapped only until the buffers are filled)
+	if (!loadMeshCache(config.modelPath, *meshFile))
+		loadModel(config.modelPath);
+	auto meshEnd = std::chrono::high_resolution_clock::now();
+
+	createShaderModules(config.VSpath, config.FSpath);			// Last: if loading fails, nothing was acquired from e.states
+
+	times.texture	= std::chrono::duration<double, std::milli>(textureEnd - start).count();
+	times.mesh		= std::chrono::duration<double, std::milli>(meshEnd - textureEnd).count();
+	return times;
+}
+
+void modelData::createResources()
+{
 	createDescriptorSetLayout();
-	createGraphicsPipeline(config.VSpath, config.FSpath);
+	createGraphicsPipeline();
 
 	createTextureImage(config.texturePath);
-	createTextureImageView();
 	createTextureSampler();
-	loadModel(config.modelPath);
-	createVertexBuffer();
-	createIndexBuffer();
+	if (e.bindless) materialIndex = e.materials.add(textureImageView, textureSampler);	// Texture in the shared texture array
+	createVertexBuffer(meshFile->isOpen() ? meshFile->getVertexData() : vertices.data());
+	createIndexBuffer (meshFile->isOpen() ? meshFile->getIndexData()  : indices.data());
+	meshFile.reset();
+	createMeshletBuffer();
+	drawRanges.assign(1, DrawRange{ lods[0].firstIndex, lods[0].indexCount });
+	createInstanceResources();
+}
+
+modelData::modelData(modelData&& previous, const std::vector<std::function<glm::mat4(float)>>& modelMatrices)
+	: modelData(std::move(previous))		// Mesh, texture, shaders and pipeline handles, LODs, meshlets...
+{
+	previous.ownsMesh		= false;		// The mesh buffers belong to this version now (previous is retired first, so it's destroyed first)
+
+	config.getModelMatrices	= modelMatrices;
+	getModelMatrix			= modelMatrices;
+	dynamicUBO				= getModelMatrix.size() > 1 && !instanced && !e.gpuDriven;
+	dynamicOffsets.clear();
+	if (dynamicUBO) fillDynamicOffsets();
+
+	// Shared resources: this version takes its own references. They are in the caches, so no file is read again. The pipeline only changes if the model switched to dynamic UBOs or back.
+	createShaderModules(config.VSpath, config.FSpath);
+	createDescriptorSetLayout();
+	createGraphicsPipeline();
+	createTextureImage(config.texturePath);
+	createTextureSampler();
+	if (e.bindless) materialIndex = e.materials.add(textureImageView, textureSampler);
+
+	createInstanceResources();
+}
+
+void modelData::createInstanceResources()
+{
+	instanceLods.assign(getModelMatrix.size(), 0);
+	lodFirstInstance.assign(lods.size() + 1, static_cast<uint32_t>(getModelMatrix.size()));		// Every instance in LOD 0
+	lodFirstInstance[0] = 0;
+	visibleInstances.clear();
+	for (uint32_t i = 0; i < getModelMatrix.size(); i++) visibleInstances.push_back(i);
 	createUniformBuffers();
+	if (instanced) createInstanceBuffer();
 	createDescriptorPool();
 	createDescriptorSets();
 }
@@ -213,7 +353,7 @@ void modelData::createDescriptorSetLayout()
 	//	- Uniform buffer descriptor
 	VkDescriptorSetLayoutBinding uboLayoutBinding{};
 	uboLayoutBinding.binding			= 0;
-	if (getModelMatrix.size() == 1)
+	if (!dynamicUBO)
 		uboLayoutBinding.descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER;
 	else
 		uboLayoutBinding.descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC;
@@ -229,16 +369,18 @@ void modelData::createDescriptorSetLayout()
 	samplerLayoutBinding.stageFlags			= VK_SHADER_STAGE_FRAGMENT_BIT;			// We want to use the combined image sampler descriptor in the fragment shader. It's possible to use texture sampling in the vertex shader (example: to dynamically deform a grid of vertices by a heightmap).
 	samplerLayoutBinding.pImmutableSamplers	= nullptr;
 	
-	std::array<VkDescriptorSetLayoutBinding, 2> bindings = { uboLayoutBinding, samplerLayoutBinding };
+	std::vector<VkDescriptorSetLayoutBinding> bindings = { uboLayoutBinding };
+	if (!e.bindless) bindings.push_back(samplerLayoutBinding);		// Bindless: the texture is in the material set (e.materials)
 
-	// Create a descriptor set layout (combines all of the descriptor bindings)
-	VkDescriptorSetLayoutCreateInfo layoutInfo{};
-	layoutInfo.sType		= VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO;
-	layoutInfo.bindingCount	= static_cast<uint32_t>(bindings.size());
-	layoutInfo.pBindings	= bindings.data();
+	// Get a descriptor set layout (combines all of the descriptor bindings). Models with the same bindings share it.
+	descriptorSetLayout = e.states.getDescriptorSetLayout(bindings);
+}
 
-	if (vkCreateDescriptorSetLayout(e.device, &layoutInfo, nullptr, &descriptorSetLayout) != VK_SUCCESS)
-		throw std::runtime_error("Failed to create descriptor set layout!");
+void modelData::createShaderModules(const char* VSpath, const char* FSpath)
+{
+	// Shader modules are shared by every model that uses the same SPIR-V file (each file is read only once).
+	vertShaderModule = e.states.getShaderModule(VSpath);
+	fragShaderModule = e.states.getShaderModule(FSpath);
 }
 
 // (10)
@@ -258,26 +400,31 @@ void modelData::createDescriptorSetLayout()
 	Some programmable stages are optional (example: tessellation and geometry stages).
 	In Vulkan, the graphics pipeline is almost completely immutable. You will have to create a number of pipelines representing all of the different combinations of states you want to use.
 */
-void modelData::createGraphicsPipeline(const char* VSpath, const char* FSpath)
+void modelData::createGraphicsPipeline()
 {
-	// Create pipeline layout   <<< sameMod
-	VkPipelineLayoutCreateInfo pipelineLayoutInfo{};
-	pipelineLayoutInfo.sType = VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO;
-	pipelineLayoutInfo.setLayoutCount = 1;						// Optional
-	pipelineLayoutInfo.pSetLayouts = &descriptorSetLayout;		// Optional	 <<<<<
-	pipelineLayoutInfo.pushConstantRangeCount = 0;				// Optional. <<< Push constants are another way of passing dynamic values to shaders.
-	pipelineLayoutInfo.pPushConstantRanges = nullptr;			// Optional
-
-	if (vkCreatePipelineLayout(e.device, &pipelineLayoutInfo, nullptr, &pipelineLayout) != VK_SUCCESS)
-		throw std::runtime_error("Failed to create pipeline layout!");
-
-	// Read shader files
-	std::vector<char> vertShaderCode = readFile(VSpath);
-	std::vector<char> fragShaderCode = readFile(FSpath);
-
-	VkShaderModule vertShaderModule	= createShaderModule(vertShaderCode);
-	VkShaderModule fragShaderModule = createShaderModule(fragShaderCode);
+	// Get the pipeline layout (shared by every model with the same set layouts). Set 0: global (per frame). Set 1: per object. <<< Push constants are another way of passing dynamic values to shaders.
+	if (!e.bindless)
+		pipelineLayout = e.states.getPipelineLayout({ e.globalDescriptorSetLayout, descriptorSetLayout });
+	else		// Set 2: textures and materials (shared by every model). Push constant: material index (fragment shader).
+		pipelineLayout = e.states.getPipelineLayout({ e.globalDescriptorSetLayout, descriptorSetLayout, e.materials.descriptorSetLayout }, { VkPushConstantRange{ VK_SHADER_STAGE_FRAGMENT_BIT, 0, sizeof(uint32_t) } });
+
+	// Get the pipeline. It's only built if no other model has created one with the same shaders and state (otherwise, it's shared).
+	PipelineState state;
+	state.vertexShader		= vertShaderModule;
+	state.fragmentShader	= fragShaderModule;
+	state.layout			= pipelineLayout;
+	state.renderPass		= e.renderPass;
+	state.extent			= e.swapChainExtent;
+	state.samples			= e.msaaSamples;
+	state.sampleShading		= e.add_SS;
+	state.instanced			= instanced;
+	state.packedVertices	= packedVertices;
+
+	graphicsPipeline = e.states.getPipeline(state, [this]() { return buildGraphicsPipeline(); });
+}
 
+VkPipeline modelData::buildGraphicsPipeline()
+{
 	// Configure Vertex shader
 	VkPipelineShaderStageCreateInfo vertShaderStageInfo{};
 	vertShaderStageInfo.sType				= VK_STRUCTURE_TYPE_PIPELINE_SHADER_STAGE_CREATE_INFO;
@@ -299,10 +446,28 @@ void modelData::createGraphicsPipeline(const char* VSpath, const char* FSpath)
 	// Vertex input: Describes format of the vertex data that will be passed to the vertex shader.
 	VkPipelineVertexInputStateCreateInfo vertexInputInfo{};
 	vertexInputInfo.sType							= VK_STRUCTURE_TYPE_PIPELINE_VERTEX_INPUT_STATE_CREATE_INFO;
-	auto bindingDescription							= Vertex::getBindingDescription();
-	vertexInputInfo.vertexBindingDescriptionCount	= 1;
-	vertexInputInfo.pVertexBindingDescriptions		= &bindingDescription;							// Optional
-	auto attributeDescriptions						= Vertex::getAttributeDescriptions();
+	std::vector<VkVertexInputBindingDescription>	bindingDescriptions;
+	std::vector<VkVertexInputAttributeDescription>	attributeDescriptions;
+	if (!packedVertices)
+	{
+		auto vertexAttributes = Vertex::getAttributeDescriptions();
+		bindingDescriptions.push_back(Vertex::getBindingDescription());
+		attributeDescriptions.assign(vertexAttributes.begin(), vertexAttributes.end());
+	}
+	else																							// Packed layout (the vertex shader must be compiled with PACKED_VERTEX)
+	{
+		auto vertexAttributes = PackedVertex::getAttributeDescriptions();
+		bindingDescriptions.push_back(PackedVertex::getBindingDescription());
+		attributeDescriptions.assign(vertexAttributes.begin(), vertexAttributes.end());
+	}
+	if (instanced)																					// Instanced models also take the model matrix per instance (binding 1)
+	{
+		bindingDescriptions.push_back(InstanceData::getBindingDescription());
+		auto instanceAttributes = InstanceData::getAttributeDescriptions();
+		attributeDescriptions.insert(attributeDescriptions.end(), instanceAttributes.begin(), instanceAttributes.end());
+	}
+	vertexInputInfo.vertexBindingDescriptionCount	= static_cast<uint32_t>(bindingDescriptions.size());
+	vertexInputInfo.pVertexBindingDescriptions		= bindingDescriptions.data();					// Optional
 	vertexInputInfo.vertexAttributeDescriptionCount	= static_cast<uint32_t>(attributeDescriptions.size());
 	vertexInputInfo.pVertexAttributeDescriptions	= attributeDescriptions.data();					// Optional
 
@@ -445,49 +610,10 @@ void modelData::createGraphicsPipeline(const char* VSpath, const char* FSpath)
 	pipelineInfo.basePipelineHandle		= VK_NULL_HANDLE;	// [Optional] Specify the handle of an existing pipeline.
 	pipelineInfo.basePipelineIndex		= -1;				// [Optional] Reference another pipeline that is about to be created by index.
 
-	if (vkCreateGraphicsPipelines(e.device, VK_NULL_HANDLE, 1, &pipelineInfo, nullptr, &graphicsPipeline) != VK_SUCCESS)
-		throw std::runtime_error("Failed to create graphics pipeline!");
-
-	// Cleanup
-	vkDestroyShaderModule(e.device, fragShaderModule, nullptr);
-	vkDestroyShaderModule(e.device, vertShaderModule, nullptr);
-}
-
-std::vector<char> modelData::readFile(/*const std::string& filename*/ const char* filename)
-{
-	// Open file
-	std::ifstream file(filename, std::ios::ate | std::ios::binary);		// ate: Start reading at the end of the of the file  /  binary: Read file as binary file (avoid text transformations)
-	if (!file.is_open())
-		throw std::runtime_error("Failed to open file!");
-
-	// Allocate the buffer
-	size_t fileSize = (size_t)file.tellg();
-	std::vector<char> buffer(fileSize);
-
-	// Read data
-	file.seekg(0);
-	file.read(buffer.data(), fileSize);
-
-	// Close file
-	file.close();
-	return buffer;
+	return e.createGraphicsPipeline(pipelineInfo);		// Created through the environment's pipeline cache
 }
 
-VkShaderModule modelData::createShaderModule(const std::vector<char>& code)
-{
-	VkShaderModuleCreateInfo createInfo{};
-	createInfo.sType = VK_STRUCTURE_TYPE_SHADER_MODULE_CREATE_INFO;
-	createInfo.codeSize = code.size();
-	createInfo.pCode = reinterpret_cast<const uint32_t*>(code.data());	// The default allocator from std::vector ensures that the data satisfies the alignment requirements of `uint32_t`.
-
-	VkShaderModule shaderModule;
-	if (vkCreateShaderModule(e.device, &createInfo, nullptr, &shaderModule) != VK_SUCCESS)
-		throw std::runtime_error("Failed to create shader module!");
-
-	return shaderModule;
-}
-
-void modelData::createBuffer(VkDeviceSize size, VkBufferUsageFlags usage, VkMemoryPropertyFlags properties, VkBuffer& buffer, VkDeviceMemory& bufferMemory)
+void modelData::createBuffer(VkDeviceSize size, VkBufferUsageFlags usage, VkMemoryPropertyFlags properties, VkBuffer& buffer, Allocation& bufferMemory)
 {
 	// Create buffer.
 	VkBufferCreateInfo bufferInfo{};
@@ -504,203 +630,20 @@ void modelData::createBuffer(VkDeviceSize size, VkBufferUsageFlags usage, VkMemo
 	VkMemoryRequirements memRequirements;		// Members: size (amount of memory in bytes. May differ from bufferInfo.size), alignment (offset in bytes where the buffer begins in the allocated region. Depends on bufferInfo.usage and bufferInfo.flags), memoryTypeBits (bit field of the memory types that are suitable for the buffer).
 	vkGetBufferMemoryRequirements(e.device, buffer, &memRequirements);
 
-	// Allocate memory for the buffer.
-	VkMemoryAllocateInfo allocInfo{};
-	allocInfo.sType = VK_STRUCTURE_TYPE_MEMORY_ALLOCATE_INFO;
-	allocInfo.allocationSize = memRequirements.size;
-	allocInfo.memoryTypeIndex = e.findMemoryType(memRequirements.memoryTypeBits, properties);		// Properties parameter: We need to be able to write our vertex data to that memory. The properties define special features of the memory, like being able to map it so we can write to it from the CPU.
-
-	if (vkAllocateMemory(e.device, &allocInfo, nullptr, &bufferMemory) != VK_SUCCESS)
-		throw std::runtime_error("Failed to allocate buffer memory!");
+	// Suballocate memory for the buffer (the allocator takes it from a bigger memory block).
+	bufferMemory = e.memAllocator.allocate(memRequirements, properties);		// Properties parameter: We need to be able to write our vertex data to that memory. The properties define special features of the memory, like being able to map it so we can write to it from the CPU.
 
-	vkBindBufferMemory(e.device, buffer, bufferMemory, 0);	// Associate this memory with the buffer. If the offset (4th parameter) is non-zero, it's required to be divisible by memRequirements.alignment.
+	vkBindBufferMemory(e.device, buffer, bufferMemory.memory, bufferMemory.offset);	// Associate this memory with the buffer. The offset is required to be divisible by memRequirements.alignment (the allocator takes care of it).
 }
 
 // (15)
-/// Load a texture > Copy it to a buffer > Copy it to an image > Cleanup the buffer
+/// Load a texture > Copy it to a buffer > Copy it to an image > Cleanup the buffer. This is done by e.textures only the first time a file is requested; later requests share the same image and image view.
 void modelData::createTextureImage(const char* path)
 {
-	// Load an image
-	int texWidth, texHeight, texChannels;
-	stbi_uc* pixels = stbi_load(path, &texWidth, &texHeight, &texChannels, STBI_rgb_alpha);		// Returns a pointer to an array of pixel values. STBI_rgb_alpha forces the image to be loaded with an alpha channel, even if it doesn't have one.
-	if (!pixels)
-		throw std::runtime_error("Failed to load texture image!");
-
-	VkDeviceSize imageSize = texWidth * texHeight * 4;												// 4 bytes per rgba pixel
-	mipLevels = static_cast<uint32_t>(std::floor(std::log2(std::max(texWidth, texHeight)))) + 1;	// Calculate the number levels (mipmaps)
-
-	// Create a staging buffer (temporary buffer in host visible memory so that we can use vkMapMemory and copy the pixels to it)
-	VkBuffer	   stagingBuffer;
-	VkDeviceMemory stagingBufferMemory;
-
-	createBuffer(imageSize,
-		VK_BUFFER_USAGE_TRANSFER_SRC_BIT,
-		VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
-		stagingBuffer,
-		stagingBufferMemory);
-
-	// Copy directly the pixel values from the image we loaded to the staging-buffer.
-	void* data;
-	vkMapMemory(e.device, stagingBufferMemory, 0, imageSize, 0, &data);	// vkMapMemory retrieves a host virtual address pointer (data) to a region of a mappable memory object (stagingBufferMemory). We have to provide the logical device that owns the memory (e.device).
-	memcpy(data, pixels, static_cast<size_t>(imageSize));				// Copies a number of bytes (imageSize) from a source (pixels) to a destination (data).
-	vkUnmapMemory(e.device, stagingBufferMemory);						// Unmap a previously mapped memory object (stagingBufferMemory).
-
-	stbi_image_free(pixels);	// Clean up the original pixel array
-
-	// Create the texture image
-	e.createImage(	texWidth,
-					texHeight,
-					mipLevels,
-					VK_SAMPLE_COUNT_1_BIT,
-					VK_FORMAT_R8G8B8A8_SRGB,
-					VK_IMAGE_TILING_OPTIMAL,
-					VK_IMAGE_USAGE_TRANSFER_SRC_BIT | VK_IMAGE_USAGE_TRANSFER_DST_BIT | VK_IMAGE_USAGE_SAMPLED_BIT,
-					VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT,
-					textureImage,
-					textureImageMemory );
-
-	// Copy the staging buffer to the texture image
-	e.transitionImageLayout(textureImage, VK_FORMAT_R8G8B8A8_SRGB, VK_IMAGE_LAYOUT_UNDEFINED, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, mipLevels);					// Transition the texture image to VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL
-	copyBufferToImage(stagingBuffer, textureImage, static_cast<uint32_t>(texWidth), static_cast<uint32_t>(texHeight));											// Execute the buffer to image copy operation
-	// Transitioned to VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL while generating mipmaps
-	// transitionImageLayout(textureImage, VK_FORMAT_R8G8B8A8_SRGB, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL, mipLevels);	// To be able to start sampling from the texture image in the shader, we need one last transition to prepare it for shader access
-	generateMipmaps(textureImage, VK_FORMAT_R8G8B8A8_SRGB, texWidth, texHeight, mipLevels);
-
-	// Cleanup the staging buffer and its memory
-	vkDestroyBuffer(e.device, stagingBuffer, nullptr);
-	vkFreeMemory(e.device, stagingBufferMemory, nullptr);
-}
-
-void modelData::copyBufferToImage(VkBuffer buffer, VkImage image, uint32_t width, uint32_t height)
-{
-	VkCommandBuffer commandBuffer = e.beginSingleTimeCommands();
-
-	// Specify which part of the buffer is going to be copied to which part of the image
-	VkBufferImageCopy region{};
-	region.bufferOffset = 0;							// Byte offset in the buffer at which the pixel values start
-	region.bufferRowLength = 0;							// How the pixels are laid out in memory. 0 indicates that the pixels are thightly packed. Otherwise, you could have some padding bytes between rows of the image, for example. 
-	region.bufferImageHeight = 0;							// How the pixels are laid out in memory. 0 indicates that the pixels are thightly packed. Otherwise, you could have some padding bytes between rows of the image, for example.
-	region.imageSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;	// imageSubresource indicate to which part of the image we want to copy the pixels
-	region.imageSubresource.mipLevel = 0;
-	region.imageSubresource.baseArrayLayer = 0;
-	region.imageSubresource.layerCount = 1;
-	region.imageOffset = { 0, 0, 0 };					// Indicate to which part of the image we want to copy the pixels
-	region.imageExtent = { width, height, 1 };			// Indicate to which part of the image we want to copy the pixels
-
-	// Enqueue buffer to image copy operations
-	vkCmdCopyBufferToImage(commandBuffer,
-		buffer,
-		image,
-		VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,			// Layout the image is currently using
-		1,
-		&region);
-
-	e.endSingleTimeCommands(commandBuffer);
-}
-
-void modelData::generateMipmaps(VkImage image, VkFormat imageFormat, int32_t texWidth, int32_t texHeight, uint32_t mipLevels)
-{
-	// Check if the image format supports linear blitting. We are using vkCmdBlitImage, but it's not guaranteed to be supported on all platforms bacause it requires our texture image format to support linear filtering, so we check it with vkGetPhysicalDeviceFormatProperties.
-	VkFormatProperties formatProperties;
-	vkGetPhysicalDeviceFormatProperties(e.physicalDevice, imageFormat, &formatProperties);
-	if (!(formatProperties.optimalTilingFeatures & VK_FORMAT_FEATURE_SAMPLED_IMAGE_FILTER_LINEAR_BIT))
-	{
-		throw std::runtime_error("Texture image format does not support linear blitting!");
-		// Two alternatives:
-		//		- Implement a function that searches common texture image formats for one that does support linear blitting.
-		//		- Implement the mipmap generation in software with a library like stb_image_resize. Each mip level can then be loaded into the image in the same way that you loaded the original image.
-		// It's uncommon to generate the mipmap levels at runtime anyway. Usually they are pregenerated and stored in the texture file alongside the base level to improve loading speed. <<<<<
-	}
-
-	VkCommandBuffer commandBuffer = e.beginSingleTimeCommands();
-
-	// Specify the barriers
-	VkImageMemoryBarrier barrier{};
-	barrier.sType = VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
-	barrier.image = image;
-	barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
-	barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
-	barrier.subresourceRange.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
-	barrier.subresourceRange.baseArrayLayer = 0;
-	barrier.subresourceRange.layerCount = 1;
-	barrier.subresourceRange.levelCount = 1;
-
-	int32_t mipWidth = texWidth;
-	int32_t mipHeight = texHeight;
-
-	for (uint32_t i = 1; i < mipLevels; i++)	// This loop records each of the VkCmdBlitImage commands. The source mip level is i - 1 and the destination mip level is i.
-	{
-		barrier.subresourceRange.baseMipLevel = i - 1;
-		barrier.oldLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
-		barrier.newLayout = VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL;	// We transition level i - 1 to VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL. This transition will wait for level i - 1 to be filled, either from the previous blit command, or from vkCmdCopyBufferToImage. The current blit command will wait on this transition.
-		barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
-		barrier.dstAccessMask = VK_ACCESS_TRANSFER_READ_BIT;
-
-		// Record a barrier (we transition level i - 1 to VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL. This transition will wait for level i - 1 to be filled, either from the previous blit command, or from vkCmdCopyBufferToImage. The current blit command will wait on this transition).
-		vkCmdPipelineBarrier(commandBuffer,
-			VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT, 0,
-			0, nullptr,
-			0, nullptr,
-			1, &barrier);
-
-		// Specify the regions that will be used in the blit operation
-		VkImageBlit blit{};
-		blit.srcOffsets[0] = { 0, 0, 0 };						// srcOffsets determine the 3D regions ...
-		blit.srcOffsets[1] = { mipWidth, mipHeight, 1 };		// ... that data will be blitted from.
-		blit.srcSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
-		blit.srcSubresource.mipLevel = i - 1;
-		blit.srcSubresource.baseArrayLayer = 0;
-		blit.srcSubresource.layerCount = 1;
-		blit.dstOffsets[0] = { 0, 0, 0 };																	// dstOffsets determine the 3D region ...
-		blit.dstOffsets[1] = { mipWidth > 1 ? mipWidth / 2 : 1,  mipHeight > 1 ? mipHeight / 2 : 1,  1 };	// ... that data will be blitted to.
-		blit.dstSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
-		blit.dstSubresource.mipLevel = i;
-		blit.dstSubresource.baseArrayLayer = 0;
-		blit.dstSubresource.layerCount = 1;
-
-		// Record a blit command. Beware if you are using a dedicated transfer queue: vkCmdBlitImage must be submitted to a queue with graphics capability.
-		vkCmdBlitImage(commandBuffer,
-			image, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL,		// The textureImage is used for both the srcImage and dstImage parameter ...
-			image, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,		// ...  because we're blitting between different levels of the same image.
-			1, &blit,
-			VK_FILTER_LINEAR);									// Enable interpolation
-
-		barrier.oldLayout = VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL;
-		barrier.newLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
-		barrier.srcAccessMask = VK_ACCESS_TRANSFER_READ_BIT;
-		barrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT;
-
-		// Record a barrier (This barrier transitions mip level i - 1 to VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL. This transition waits on the current blit command to finish. All sampling operations will wait on this transition to finish).
-		vkCmdPipelineBarrier(commandBuffer,
-			VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT, 0,
-			0, nullptr,
-			0, nullptr,
-			1, &barrier);
-
-		if (mipWidth > 1) mipWidth /= 2;
-		if (mipHeight > 1) mipHeight /= 2;
-	}
-
-	barrier.subresourceRange.baseMipLevel = mipLevels - 1;
-	barrier.oldLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
-	barrier.newLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
-	barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
-	barrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT;
-
-	// Record a barrier (This barrier transitions the last mip level from VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL to VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL. This wasn't handled by the loop, since the last mip level is never blitted from).
-	vkCmdPipelineBarrier(commandBuffer,
-		VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT, 0,
-		0, nullptr,
-		0, nullptr,
-		1, &barrier);
-
-	e.endSingleTimeCommands(commandBuffer);
-}
-
-// (16)
-void modelData::createTextureImageView()
-{
-	textureImageView = e.createImageView(textureImage, VK_FORMAT_R8G8B8A8_SRGB, VK_IMAGE_ASPECT_COLOR_BIT, mipLevels);
+	Texture texture		= e.textures.get(path, textureFormat);	// The uploader copies the pixels and generates the mipmaps in the next batch (we don't wait here).
+	textureImage		= texture.image;
+	textureImageView	= texture.view;
+	mipLevels			= texture.mipLevels;
 }
 
 // (17)
@@ -734,11 +677,10 @@ void modelData::createTextureSampler()
 
 	samplerInfo.mipmapMode = VK_SAMPLER_MIPMAP_MODE_LINEAR;	// VK_SAMPLER_MIPMAP_MODE_ ... NEAREST (lod selects the mip level to sample from), LINEAR (lod selects 2 mip levels to be sampled, and the results are linearly blended)
 	samplerInfo.minLod = 0.0f;								// minLod=0 & maxLod=mipLevels allow the full range of mip levels to be used
-	samplerInfo.maxLod = static_cast<float>(mipLevels);	// lod: Level Of Detail
+	samplerInfo.maxLod = VK_LOD_CLAMP_NONE;				// lod: Level Of Detail. No upper clamp (the image's mipLevels clamps it), so textures with different mip counts share the sampler.
 	samplerInfo.mipLodBias = 0.0f;								// Used for changing the lod value. It forces to use lower "lod" and "level" than it would normally use
 
-	if (vkCreateSampler(e.device, &samplerInfo, nullptr, &textureSampler) != VK_SUCCESS)
-		throw std::runtime_error("Failed to create texture sampler!");
+	textureSampler = e.states.getSampler(samplerInfo);			// Shared with every model using the same sampler state
 	/*
 	* VkImage holds the mipmap data. VkSampler controls how that data is read while rendering.
 	* The sampler selects a mip level according to this pseudocode:
@@ -770,72 +712,180 @@ void modelData::loadModel(const char* obj_file)
 	std::vector<tinyobj::shape_t>		 shapes;			// Holds all of the separate objects and their faces. Each face consists of an array of vertices. Each vertex contains the indices of the position, normal and texture coordinate attributes.
 	std::vector<tinyobj::material_t>	 materials;			// OBJ models can also define a material and texture per face, but we will ignore those.
 	std::string							 warn, err;			// Errors and warnings that occur while loading the file.
-	std::unordered_map<Vertex, uint32_t> uniqueVertices{};	// Keeps track of the unique vertices and the respective indices, avoiding duplicated vertices (not indices).
 
 	// Load model
 	if (!tinyobj::LoadObj(&attrib, &shapes, &materials, &warn, &err, obj_file))
 		throw std::runtime_error(warn + err);
 
-	// Combine all the faces in the file into a single model
+	// Combine all the faces in the file into a single model. Corner k of the model belongs to the shape s such that shapeStart[s] <= k < shapeStart[s + 1].
+	std::vector<size_t> shapeStart(1, 0);
 	for (const auto& shape : shapes)
-		for (const auto& index : shape.mesh.indices)
-		{
-			Vertex vertex{};
+		shapeStart.push_back(shapeStart.back() + shape.mesh.indices.size());
+
+	auto getVertex = [&](size_t k)
+	{
+		size_t s = std::upper_bound(shapeStart.begin(), shapeStart.end(), k) - shapeStart.begin() - 1;
+		const tinyobj::index_t& index = shapes[s].mesh.indices[k - shapeStart[s]];
+		Vertex vertex{};
+
+		vertex.pos = {
+			attrib.vertices[3 * index.vertex_index + 0],			// attrib.vertices is an array of floats, so we need to multiply the index by 3 and add offsets for accessing XYZ components.
+			attrib.vertices[3 * index.vertex_index + 1],
+			attrib.vertices[3 * index.vertex_index + 2]
+		};
+
+		vertex.texCoord = {
+				   attrib.texcoords[2 * index.texcoord_index + 0],	// attrib.texcoords is an array of floats, so we need to multiply the index by 3 and add offsets for accessing UV components.
+			1.0f - attrib.texcoords[2 * index.texcoord_index + 1]	// Flip vertical component of texture coordinates: OBJ format assumes Y axis go up, but Vulkan has top-to-bottom orientation. 
+		};
+
+		vertex.color = { 1.0f, 1.0f, 1.0f };
+		return vertex;
+	};
+
+	// Weld the vertices (avoids duplicated vertices, not indices). Each unique vertex is saved once, and each corner gets the index of its vertex. Big meshes are welded in parallel (same result as welding serially).
+	size_t cornerCount = shapeStart.back();
+	weldVertices(cornerCount, getVertex, vertices, indices, cornerCount >= parallelWeldingThreshold ? &e.meshWorkers : nullptr);
+
+	// Optimize the mesh for the GPU: triangle order for the post-transform vertex cache (and, optionally, less overdraw), then vertex order for fetch locality.
+	if (e.optimizeMeshes && !indices.empty())
+	{
+		VertexCacheStats before = analyzeVertexCache(indices.data(), indices.size(), vertices.size());
 
-			vertex.pos = {
-				attrib.vertices[3 * index.vertex_index + 0],			// attrib.vertices is an array of floats, so we need to multiply the index by 3 and add offsets for accessing XYZ components.
-				attrib.vertices[3 * index.vertex_index + 1],
-				attrib.vertices[3 * index.vertex_index + 2]
-			};
+		optimizeVertexCache(indices, vertices.size());
+		if (e.reduceOverdraw)
+			optimizeOverdraw(indices, &vertices[0].pos.x, sizeof(Vertex), vertices.size());
+		vertices.resize(optimizeVertexFetch(vertices.data(), sizeof(Vertex), vertices.size(), indices));
 
-			vertex.texCoord = {
-					   attrib.texcoords[2 * index.texcoord_index + 0],	// attrib.texcoords is an array of floats, so we need to multiply the index by 3 and add offsets for accessing UV components.
-				1.0f - attrib.texcoords[2 * index.texcoord_index + 1]	// Flip vertical component of texture coordinates: OBJ format assumes Y axis go up, but Vulkan has top-to-bottom orientation. 
-			};
+		VertexCacheStats after = analyzeVertexCache(indices.data(), indices.size(), vertices.size());
+		if (e.printInfo)		// Written at once (see the LODs line)
+		{
+			std::ostringstream line;
+			line << "Mesh optimized (" << obj_file << "): ACMR " << before.acmr << " -> " << after.acmr << ", ATVR " << before.atvr << " -> " << after.atvr << '\n';
+			std::cout << line.str() << std::flush;
+		}
+	}
 
-			vertex.color = { 1.0f, 1.0f, 1.0f };
+	// Levels of detail: simplified versions of the mesh (they reuse its vertices), appended to the index list. Each one is simplified from the previous one. The chain stops when the mesh can't be reduced enough (example: most vertices are on seams).
+	lods.assign(1, MeshLod{ 0, static_cast<uint32_t>(indices.size()) });
+	if (e.generateLods && !indices.empty())
+	{
+		std::vector<uint32_t> previous = indices;
+		for (float ratio : lodRatios)
+		{
+			size_t target = static_cast<size_t>(lods[0].indexCount * ratio) / 3 * 3;
+			std::vector<uint32_t> lod = simplifyMesh(previous, &vertices[0].pos.x, sizeof(Vertex), vertices.size(), target);
+			if (lod.empty() || lod.size() > previous.size() * 0.8) break;
+
+			optimizeVertexCache(lod, vertices.size());
+			lods.push_back(MeshLod{ static_cast<uint32_t>(indices.size()), static_cast<uint32_t>(lod.size()) });
+			indices.insert(indices.end(), lod.begin(), lod.end());
+			previous.swap(lod);
+		}
 
-			if (uniqueVertices.count(vertex) == 0)	// Check if we have already seen this vertex. Using a user-defined type (Vertex struct) as key in a hash table requires us to implement two functions: equality test (override operator ==) and hash calculation (implement a hash function for Vertex).
-			{
-				uniqueVertices[vertex] = static_cast<uint32_t>(vertices.size());	// Set new index for this vertex
-				vertices.push_back(vertex);											// Save vertex
-			}
+		if (e.printInfo)		// Built first and written at once, so the lines of models loaded by different threads don't interleave
+		{
+			std::ostringstream line;
+			line << "LODs (" << obj_file << "): triangles";
+			for (const MeshLod& lod : lods) line << ' ' << lod.indexCount / 3;
+			line << '\n';
+			std::cout << line.str() << std::flush;
+		}
+	}
 
-			indices.push_back(uniqueVertices[vertex]);								// Save index
+	// Meshlets of the full resolution mesh: its triangles are regrouped so each meshlet is a range of the index buffer (the LODs aren't touched). Renderer culls them by visibility and facing.
+	meshlets.clear();
+	if (e.buildMeshlets && !indices.empty())
+	{
+		meshlets = buildMeshlets(indices, lods[0].firstIndex, lods[0].indexCount, &vertices[0].pos.x, sizeof(Vertex), vertices.size());
+		if (e.printInfo)		// Written at once (see the LODs line)
+		{
+			std::ostringstream line;
+			line << "Meshlets (" << obj_file << "): " << meshlets.size() << " (" << lods[0].indexCount / 3.f / meshlets.size() << " triangles on average)\n";
+			std::cout << line.str() << std::flush;
 		}
+	}
+
+	vertexCount	= static_cast<uint32_t>(vertices.size());
+	indexCount	= static_cast<uint32_t>(indices.size());
+
+	// Bounding box
+	boundsMin = boundsMax = vertices.size() ? vertices[0].pos : glm::vec3(0.f);
+	for (const Vertex& vertex : vertices)
+	{
+		boundsMin = glm::min(boundsMin, vertex.pos);
+		boundsMax = glm::max(boundsMax, vertex.pos);
+	}
+
+	// Bounding sphere centered in the box (its radius is the distance to the farthest vertex, which may be less than half the diagonal of the box)
+	boundingSphere = glm::vec4((boundsMin + boundsMax) * 0.5f, 0.f);
+	for (const Vertex& vertex : vertices)
+		boundingSphere.w = std::max(boundingSphere.w, glm::length(vertex.pos - glm::vec3(boundingSphere)));
+
+	// Save the mesh cache, so next runs don't need to parse the OBJ file
+	if (e.useMeshCache)
+		if (!MeshFile::write(obj_file, vertices.data(), sizeof(Vertex), vertexCount, indices.data(), sizeof(uint32_t), indexCount, &boundsMin.x, &boundsMax.x, boundingSphere.w, meshCacheFlags(), lods.data(), static_cast<uint32_t>(lods.size()), meshlets.data(), static_cast<uint32_t>(meshlets.size())))
+			std::cerr << "Failed to write the mesh cache (" << MeshFile::cachePath(obj_file) << ")" << std::endl;
+}
+
+uint32_t modelData::meshCacheFlags()
+{
+	uint32_t flags = 0;
+	if (e.optimizeMeshes)						flags |= MESH_VERTEX_CACHE_OPTIMIZED;
+	if (e.optimizeMeshes && e.reduceOverdraw)	flags |= MESH_OVERDRAW_OPTIMIZED;
+	if (e.generateLods)							flags |= MESH_LODS;
+	if (e.buildMeshlets)						flags |= MESH_MESHLETS;
+	return flags;
+}
+
+bool modelData::loadMeshCache(const char* obj_file, MeshFile& meshFile)
+{
+	if (!e.useMeshCache || !meshFile.open(obj_file, sizeof(Vertex), sizeof(uint32_t), meshCacheFlags()))
+		return false;
+
+	const MeshFileHeader& header = meshFile.getHeader();
+	vertexCount	= header.vertexCount;
+	indexCount	= header.indexCount;
+	boundsMin	= glm::vec3(header.boundsMin[0], header.boundsMin[1], header.boundsMin[2]);
+	boundsMax	= glm::vec3(header.boundsMax[0], header.boundsMax[1], header.boundsMax[2]);
+	boundingSphere	= glm::vec4((boundsMin + boundsMax) * 0.5f, header.boundsRadius);
+	lods.assign(meshFile.getLods(), meshFile.getLods() + header.lodCount);
+	meshlets.assign(meshFile.getMeshlets(), meshFile.getMeshlets() + header.meshletCount);
+	return true;
 }
 
 // (19)
-void modelData::createVertexBuffer()
+void modelData::createVertexBuffer(const void* data)
 {
-	// Create a staging buffer (host visible buffer used as temporary buffer for mapping and copying the vertex data)
-	VkDeviceSize   bufferSize = sizeof(vertices[0]) * vertices.size();
-	VkBuffer	   stagingBuffer;
-	VkDeviceMemory stagingBufferMemory;
+	// Packed layout: quantize the positions relative to the bounding box (the dequantization is folded into the model matrix) and convert the texture coordinates to half floats.
+	std::vector<PackedVertex> packed;
+	if (packedVertices)
+	{
+		const Vertex* source = (const Vertex*)data;
+		packed.resize(vertexCount);
+		for (uint32_t i = 0; i < vertexCount; i++)
+			packed[i] = PackedVertex::pack(source[i], boundsMin, boundsMax);
 
-	createBuffer(bufferSize,
-		VK_BUFFER_USAGE_TRANSFER_SRC_BIT, 											// VK_BUFFER_USAGE_ ... TRANSFER_SRC_BIT / TRANSFER_DST_BIT (buffer can be used as source/destination in a memory transfer operation).
-		VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
-		stagingBuffer,
-		stagingBufferMemory);
+		data			= packed.data();
+		dequantization	= PackedVertex::dequantization(boundsMin, boundsMax);
+	}
+	else dequantization = glm::mat4(1.0f);
 
-	// Fill the staging buffer (by mapping the buffer memory into CPU accessible memory: https://en.wikipedia.org/wiki/Memory-mapped_I/O)
-	void* data;
-	vkMapMemory(e.device, stagingBufferMemory, 0, bufferSize, 0, &data);	// Access a memory region. Use VK_WHOLE_SIZE to map all of the memory.
-	memcpy(data, vertices.data(), (size_t)bufferSize);						// Copy the vertex data to the mapped memory.
-	vkUnmapMemory(e.device, stagingBufferMemory);								// Unmap memory.
+	VkDeviceSize stride		= packedVertices ? sizeof(PackedVertex) : sizeof(Vertex);
+	VkDeviceSize bufferSize	= stride * vertexCount;
 
-	/*
-		Note:
-		The driver may not immediately copy the data into the buffer memory (example: because of caching).
-		It is also possible that writes to the buffer are not visible in the mapped memory yet. Two ways to deal with that problem:
-		  - (Our option) Coherent memory heap: Use a memory heap that is host coherent, indicated with VK_MEMORY_PROPERTY_HOST_COHERENT_BIT. This ensures that the mapped memory always matches the contents of the allocated memory (this may lead to slightly worse performance than explicit flushing, but this doesn't matter since we will use a staging buffer).
-		  - Flushing memory: Call vkFlushMappedMemoryRanges after writing to the mapped memory, and call vkInvalidateMappedMemoryRanges before reading from the mapped memory.
-		Either option means that the driver will be aware of our writes to the buffer, but it doesn't mean that they are actually visible on the GPU yet.
-		The transfer of data to the GPU happens in the background and the specification simply tells us that it is guaranteed to be complete as of the next call to vkQueueSubmit.
-	*/
+	// GPU-driven rendering: the vertices go to the shared vertex buffer, at a multiple of the vertex size (so the draws address them with vertexOffset).
+	if (e.gpuDriven)
+	{
+		vertexBufferOffset	= e.geometry.addVertices(data, bufferSize, stride);
+		vertexBuffer		= e.geometry.vertexBuffer;
+		baseVertex			= static_cast<int32_t>(vertexBufferOffset / stride);
+		return;
+	}
+	baseVertex			= 0;
+	vertexBufferOffset	= 0;
 
-	// Create the actual vertex buffer (Device local buffer used as actual vertex buffer. Generally it doesn't allow to use vkMapMemory, but we can copy from stagingBuffer to vertexBuffer, though you need to specify the transfer source flag for stagingBuffer and the transfer destination flag for vertexBuffer).
+	// Create the actual vertex buffer (Device local buffer used as actual vertex buffer. Generally it doesn't allow to use vkMapMemory, but we can copy from a staging buffer to it, though you need to specify the transfer destination flag for vertexBuffer).
 	// This makes vertex data to be loaded from high performance memory.
 	createBuffer(bufferSize,
 		VK_BUFFER_USAGE_TRANSFER_DST_BIT | VK_BUFFER_USAGE_VERTEX_BUFFER_BIT,
@@ -843,83 +893,83 @@ void modelData::createVertexBuffer()
 		vertexBuffer,
 		vertexBufferMemory);
 
-	// Move the vertex data to the device local buffer
-	copyBuffer(stagingBuffer, vertexBuffer, bufferSize);
-
-	// Clean up
-	vkDestroyBuffer(e.device, stagingBuffer, nullptr);
-	vkFreeMemory(e.device, stagingBufferMemory, nullptr);
+	// Move the vertex data to the device local buffer (through the uploader's staging ring, which is host visible & coherent and persistently mapped).
+	e.uploader.uploadBuffer(vertexBuffer, data, bufferSize);
 }
 
-/**
-*	Memory transfer operations are executed using command buffers (like drawing commands), so we allocate a temporary command buffer. You may wish to create a separate command pool for these kinds of short-lived buffers, because the implementation could apply memory allocation optimizations. You should use the VK_COMMAND_POOL_CREATE_TRANSIENT_BIT flag during command pool generation in that case.
-*/
-void modelData::copyBuffer(VkBuffer srcBuffer, VkBuffer dstBuffer, VkDeviceSize size)
+// (20)
+void modelData::createIndexBuffer(const void* data)
 {
-	VkCommandBuffer commandBuffer = e.beginSingleTimeCommands();
-
-	// Specify buffers and the size of the contents you will transfer (it's not possible to specify VK_WHOLE_SIZE here, unlike vkMapMemory command).
-	VkBufferCopy copyRegion{};
-	copyRegion.size = size;
-	copyRegion.srcOffset = 0;	// Optional
-	copyRegion.dstOffset = 0;	// Optional
-
-	vkCmdCopyBuffer(commandBuffer, srcBuffer, dstBuffer, 1, &copyRegion);
+	// GPU-driven rendering: the indices go to the shared index buffer (always 32-bit, since every model is drawn with the same binding).
+	if (e.gpuDriven)
+	{
+		baseIndex	= e.geometry.addIndices((const uint32_t*)data, indexCount);
+		indexBuffer	= e.geometry.indexBuffer;
+		indexType	= VK_INDEX_TYPE_UINT32;
+		return;
+	}
+	baseIndex = 0;
 
-	e.endSingleTimeCommands(commandBuffer);
-}
+	// Use 16-bit indices when every vertex can be addressed with them (half the memory and bandwidth).
+	std::vector<uint16_t> indices16;
+	if (vertexCount <= 65536)
+	{
+		const uint32_t* source = (const uint32_t*)data;
+		indices16.assign(source, source + indexCount);
+		data		= indices16.data();
+		indexType	= VK_INDEX_TYPE_UINT16;
+	}
+	else indexType	= VK_INDEX_TYPE_UINT32;
 
-// (20)
-void modelData::createIndexBuffer()
-{
-	// Create a staging buffer
-	VkDeviceSize   bufferSize = sizeof(indices[0]) * indices.size();
-	VkBuffer	   stagingBuffer;
-	VkDeviceMemory stagingBufferMemory;
+	VkDeviceSize bufferSize = (indexType == VK_INDEX_TYPE_UINT16 ? sizeof(uint16_t) : sizeof(uint32_t)) * indexCount;
 
-	createBuffer(bufferSize,
-		VK_BUFFER_USAGE_TRANSFER_SRC_BIT,
-		VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
-		stagingBuffer,
-		stagingBufferMemory);
-
-	// Fill the staging buffer
-	void* data;
-	vkMapMemory(e.device, stagingBufferMemory, 0, bufferSize, 0, &data);
-	memcpy(data, indices.data(), (size_t)bufferSize);
-	vkUnmapMemory(e.device, stagingBufferMemory);
-
-	// Create the vertex buffer
+	// Create the index buffer
 	createBuffer(bufferSize,
 		VK_BUFFER_USAGE_TRANSFER_DST_BIT | VK_BUFFER_USAGE_INDEX_BUFFER_BIT,
 		VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT,
 		indexBuffer,
 		indexBufferMemory);
 
-	// Move the vertex data to the device local buffer
-	copyBuffer(stagingBuffer, indexBuffer, bufferSize);
+	// Move the index data to the device local buffer
+	e.uploader.uploadBuffer(indexBuffer, data, bufferSize);
+}
+
+void modelData::createMeshletBuffer()
+{
+	meshletBuffer = VK_NULL_HANDLE;
+	if (meshlets.empty()) return;
 
-	// Clean up
-	vkDestroyBuffer(e.device, stagingBuffer, nullptr);
-	vkFreeMemory(e.device, stagingBufferMemory, nullptr);
+	// Meshlet has the std430 layout, so the table is uploaded as is (readable from shaders as an array of structs).
+	VkDeviceSize bufferSize = sizeof(Meshlet) * meshlets.size();
+
+	createBuffer(bufferSize,
+		VK_BUFFER_USAGE_TRANSFER_DST_BIT | VK_BUFFER_USAGE_STORAGE_BUFFER_BIT,
+		VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT,
+		meshletBuffer,
+		meshletBufferMemory);
+
+	e.uploader.uploadBuffer(meshletBuffer, meshlets.data(), bufferSize);
 }
 
 // (21)
 void modelData::createUniformBuffers()
 {
-	VkDeviceSize bufferSize;
-	if (getModelMatrix.size() == 1)	bufferSize = sizeof(UniformBufferObject);
-	else							bufferSize = getModelMatrix.size() * dynamicOffsets[1];		// dynamicOffsets[1] == individual UBO size
+	if (!dynamicUBO)	uniformSize = sizeof(UniformBufferObject);									// Not used by instanced models (the model matrices come from the instance buffer)
+	else				uniformSize = getModelMatrix.size() * dynamicOffsets[1];		// dynamicOffsets[1] == individual UBO size
 
-	uniformBuffers.resize(e.swapChainImages.size());
-	uniformBuffersMemory.resize(e.swapChainImages.size());
+	uniformOffset = e.uniforms.reserve(uniformSize);		// Same offset in the region of every swap chain image
+}
 
-	for (size_t i = 0; i < e.swapChainImages.size(); i++)
-		createBuffer(	bufferSize,
-						VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT,
-						VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
-						uniformBuffers[i],
-						uniformBuffersMemory[i] );
+void modelData::createInstanceBuffer()
+{
+	instanceRegionSize = getModelMatrix.size() * sizeof(InstanceData);
+
+	// Host visible and persistently mapped, since the model matrices are rewritten every frame (the GPU reads them once per frame, so there's no benefit in copying them to device local memory).
+	createBuffer(	instanceRegionSize * e.swapChainImages.size(),
+					VK_BUFFER_USAGE_VERTEX_BUFFER_BIT,
+					VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
+					instanceBuffer,
+					instanceBufferMemory );
 }
  
 // (22)
@@ -927,7 +977,7 @@ void modelData::createDescriptorPool()
 {
 	// Describe our descriptor sets.
 	std::array<VkDescriptorPoolSize, 2> poolSizes{};
-	if (getModelMatrix.size() == 1)	poolSizes[0].type = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER;
+	if (!dynamicUBO)				poolSizes[0].type = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER;
 	else							poolSizes[0].type = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC;
 	poolSizes[0].descriptorCount	= static_cast<uint32_t>(e.swapChainImages.size());	// Number of descriptors of this type to allocate
 	poolSizes[1].type				= VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER;
@@ -936,7 +986,7 @@ void modelData::createDescriptorPool()
 	// Allocate one of these descriptors for every frame.
 	VkDescriptorPoolCreateInfo poolInfo{};
 	poolInfo.sType = VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO;
-	poolInfo.poolSizeCount = static_cast<uint32_t>(poolSizes.size());
+	poolInfo.poolSizeCount = e.bindless ? 1 : static_cast<uint32_t>(poolSizes.size());	// Bindless: no texture descriptor
 	poolInfo.pPoolSizes = poolSizes.data();
 	poolInfo.maxSets = static_cast<uint32_t>(e.swapChainImages.size());	// Max. number of individual descriptor sets that may be allocated
 	poolInfo.flags = 0;												// Determine if individual descriptor sets can be freed (VK_DESCRIPTOR_POOL_CREATE_FREE_DESCRIPTOR_SET_BIT) or not (0). Since we aren't touching the descriptor set after its creation, we put 0 (default).
@@ -966,10 +1016,10 @@ void modelData::createDescriptorSets()
 	for (size_t i = 0; i < e.swapChainImages.size(); i++)
 	{
 		VkDescriptorBufferInfo bufferInfo{};
-		bufferInfo.buffer = uniformBuffers[i];
-		bufferInfo.offset = 0;
-		if (getModelMatrix.size() == 1)	bufferInfo.range = sizeof(UniformBufferObject);	// If you're overwriting the whole buffer, like we are in this case, it's possible to use VK_WHOLE_SIZE here. 
-		else							bufferInfo.range = dynamicOffsets[1];			// dynamicOffsets[1] == individual UBO size.  Another option: VK_WHOLE_SIZE
+		bufferInfo.buffer = e.uniforms.buffer;
+		bufferInfo.offset = e.uniforms.getOffset(static_cast<uint32_t>(i), uniformOffset);
+		if (!dynamicUBO)				bufferInfo.range = sizeof(UniformBufferObject);	// The buffer is shared with other models, so VK_WHOLE_SIZE can't be used here.
+		else							bufferInfo.range = dynamicOffsets[1];			// dynamicOffsets[1] == individual UBO size.
 
 		VkDescriptorImageInfo imageInfo{};
 		imageInfo.imageLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
@@ -982,7 +1032,7 @@ void modelData::createDescriptorSets()
 		descriptorWrites[0].dstSet = descriptorSets[i];						// Descriptor set to update
 		descriptorWrites[0].dstBinding = 0;										// Binding
 		descriptorWrites[0].dstArrayElement = 0;										// First index in the array (if you want to update multiple descriptors at once in an array)
-		if (getModelMatrix.size() == 1)
+		if (!dynamicUBO)
 			descriptorWrites[0].descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER;		// Type of descriptor
 		else
 			descriptorWrites[0].descriptorType = VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER_DYNAMIC;
@@ -999,10 +1049,19 @@ void modelData::createDescriptorSets()
 		descriptorWrites[1].descriptorCount = 1;
 		descriptorWrites[1].pImageInfo = &imageInfo;
 
-		vkUpdateDescriptorSets(e.device, static_cast<uint32_t>(descriptorWrites.size()), descriptorWrites.data(), 0, nullptr);	// Accepts 2 kinds of arrays as parameters: VkWriteDescriptorSet, VkCopyDescriptorSet.
+		uint32_t writeCount = e.bindless ? 1 : static_cast<uint32_t>(descriptorWrites.size());		// Bindless: only the UBO
+		vkUpdateDescriptorSets(e.device, writeCount, descriptorWrites.data(), 0, nullptr);	// Accepts 2 kinds of arrays as parameters: VkWriteDescriptorSet, VkCopyDescriptorSet.
 	}
 }
 
+glm::mat4 modelData::getModel(size_t i, float time) { return getModel(getModelMatrix[i](time)); }
+
+glm::mat4 modelData::getModel(const glm::mat4& modelMatrix) const
+{
+	if (!packedVertices) return modelMatrix;
+	return modelMatrix * dequantization;
+}
+
 void modelData::fillDynamicOffsets()
 {
 	size_t minSize = e.minUniformBufferOffsetAlignment * (1 + sizeof(UniformBufferObject) / e.minUniformBufferOffsetAlignment);	// Minimun descriptor set size, depending on the existing minimum uniform buffer offset alignment.
@@ -1013,23 +1072,23 @@ void modelData::fillDynamicOffsets()
 
 void modelData::recreateSwapChain()
 {
-	createGraphicsPipeline(config.VSpath, config.FSpath);	// Recreate graphics pipeline because viewport and scissor rectangle size is specified during graphics pipeline creation (this can be avoided by using dynamic state for the viewport and scissor rectangles).
+	createGraphicsPipeline();	// Recreate graphics pipeline because viewport and scissor rectangle size is specified during graphics pipeline creation (this can be avoided by using dynamic state for the viewport and scissor rectangles).
 	
-	createUniformBuffers();				// Uniform buffers depend on the number of swap chain images.
+	if (instanced) createInstanceBuffer();	// Instance buffer has a region per swap chain image.
 	createDescriptorPool();				// Descriptor pool depends on the swap chain images.
 	createDescriptorSets();				// Descriptor sets
 }
 
 void modelData::cleanupSwapChain()
 {
-	// Graphics pipeline
-	vkDestroyPipeline(e.device, graphicsPipeline, nullptr);
-	vkDestroyPipelineLayout(e.device, pipelineLayout, nullptr);
-
-	// Uniform buffers & memory
-	for (size_t i = 0; i < e.swapChainImages.size(); i++) {
-		vkDestroyBuffer(e.device, uniformBuffers[i], nullptr);
-		vkFreeMemory(e.device, uniformBuffersMemory[i], nullptr);
+	// Graphics pipeline (destroyed when the last model using it releases it)
+	e.states.releasePipeline(graphicsPipeline);
+	e.states.releasePipelineLayout(pipelineLayout);
+
+	// Instance buffer & memory
+	if (instanced) {
+		vkDestroyBuffer(e.device, instanceBuffer, nullptr);
+		e.memAllocator.free(instanceBufferMemory);
 	}
 
 	// Descriptor pool & Descriptor set
@@ -1038,20 +1097,41 @@ void modelData::cleanupSwapChain()
 
 void modelData::cleanup()
 {
-	// Texture
-	vkDestroySampler(e.device, textureSampler, nullptr);				
-	vkDestroyImageView(e.device, textureImageView, nullptr);			
-	vkDestroyImage(e.device, textureImage, nullptr);					
-	vkFreeMemory(e.device, textureImageMemory, nullptr);				
+	// Texture (shared: destroyed when the last model using it releases it)
+	if (e.bindless) e.materials.release(materialIndex);
+	e.states.releaseSampler(textureSampler);
+	e.textures.release(textureImageView);
+
+	// Descriptor set layout & shader modules (shared)
+	e.states.releaseDescriptorSetLayout(descriptorSetLayout);
+	e.states.releaseShaderModule(vertShaderModule);
+	e.states.releaseShaderModule(fragShaderModule);
+
+	// Uniforms (reservation in the uniform arena)
+	e.uniforms.release(uniformOffset, uniformSize);
+
+	if (!ownsMesh) return;		// A newer version of the model destroys the mesh
 
-	// Descriptor set layout
-	vkDestroyDescriptorSetLayout(e.device, descriptorSetLayout, nullptr);
+	// Meshlets
+	if (meshletBuffer != VK_NULL_HANDLE)
+	{
+		vkDestroyBuffer(e.device, meshletBuffer, nullptr);
+		e.memAllocator.free(meshletBufferMemory);
+	}
+
+	// Vertices & indices in the shared buffers
+	if (e.gpuDriven)
+	{
+		e.geometry.releaseIndices(baseIndex, indexCount);
+		e.geometry.releaseVertices(vertexBufferOffset, (packedVertices ? sizeof(PackedVertex) : sizeof(Vertex)) * vertexCount);
+		return;
+	}
 
 	// Index
 	vkDestroyBuffer(e.device, indexBuffer, nullptr);					
-	vkFreeMemory(e.device, indexBufferMemory, nullptr);					
+	e.memAllocator.free(indexBufferMemory);
 
 	// Vertex
 	vkDestroyBuffer(e.device, vertexBuffer, nullptr);					
-	vkFreeMemory(e.device, vertexBufferMemory, nullptr);				
+	e.memAllocator.free(vertexBufferMemory);
 }
\ No newline at end of file
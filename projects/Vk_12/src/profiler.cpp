@@ -0,0 +1,430 @@
+#include <iostream>
+#include <iomanip>
+#include <fstream>
+#include <algorithm>
+#include <cstring>
+#include <stdexcept>
+
+#include "profiler.hpp"
+
+/// Statistics counted by the pipeline statistics queries. Results are written in the order of the bits, which is the order of PipelineStats.
+static const VkQueryPipelineStatisticFlags statisticFlags =
+	VK_QUERY_PIPELINE_STATISTIC_INPUT_ASSEMBLY_VERTICES_BIT |
+	VK_QUERY_PIPELINE_STATISTIC_INPUT_ASSEMBLY_PRIMITIVES_BIT |
+	VK_QUERY_PIPELINE_STATISTIC_VERTEX_SHADER_INVOCATIONS_BIT |
+	VK_QUERY_PIPELINE_STATISTIC_CLIPPING_INVOCATIONS_BIT |
+	VK_QUERY_PIPELINE_STATISTIC_CLIPPING_PRIMITIVES_BIT |
+	VK_QUERY_PIPELINE_STATISTIC_FRAGMENT_SHADER_INVOCATIONS_BIT |
+	VK_QUERY_PIPELINE_STATISTIC_COMPUTE_SHADER_INVOCATIONS_BIT;
+
+static_assert(sizeof(PipelineStats) == 7 * sizeof(uint64_t), "PipelineStats must match the query results");
+
+void PipelineStats::add(const PipelineStats& other)
+{
+	vertices				+= other.vertices;
+	primitives				+= other.primitives;
+	vertexInvocations		+= other.vertexInvocations;
+	clippingInvocations		+= other.clippingInvocations;
+	clippingPrimitives		+= other.clippingPrimitives;
+	fragmentInvocations		+= other.fragmentInvocations;
+	computeInvocations		+= other.computeInvocations;
+}
+
+void Profiler::init(VulkanEnvironment& environment, bool enabled)
+{
+	e				= &environment;
+	this->enabled	= enabled;
+	origin			= clock::now();
+	if (!enabled) return;
+
+	VkPhysicalDeviceProperties properties;
+	vkGetPhysicalDeviceProperties(e->physicalDevice, &properties);
+	timestampPeriod = properties.limits.timestampPeriod;
+
+	// Timestamps are supported by a queue if its family has valid bits
+	uint32_t familyCount = 0;
+	vkGetPhysicalDeviceQueueFamilyProperties(e->physicalDevice, &familyCount, nullptr);
+	std::vector<VkQueueFamilyProperties> families(familyCount);
+	vkGetPhysicalDeviceQueueFamilyProperties(e->physicalDevice, &familyCount, families.data());
+	uint32_t validBits = families[e->findQueueFamilies(e->physicalDevice).graphicsFamily.value()].timestampValidBits;
+
+	timestamps		= validBits > 0;
+	timestampMask	= validBits >= 64 ? ~0ull : (1ull << validBits) - 1;
+	statistics		= e->pipelineStatisticsQuery;
+
+	if (timestamps) calibrate();
+	else std::cout << "Profiler: the graphics queue doesn't support timestamps (GPU scopes aren't timed)" << std::endl;
+}
+
+/// Write a timestamp in a submission that the CPU waits for. The CPU time of that instant is taken as the middle of the submission.
+void Profiler::calibrate()
+{
+	VkQueryPoolCreateInfo poolInfo{};
+	poolInfo.sType		= VK_STRUCTURE_TYPE_QUERY_POOL_CREATE_INFO;
+	poolInfo.queryType	= VK_QUERY_TYPE_TIMESTAMP;
+	poolInfo.queryCount	= 1;
+
+	VkQueryPool pool;
+	if (vkCreateQueryPool(e->device, &poolInfo, nullptr, &pool) != VK_SUCCESS)
+		throw std::runtime_error("Failed to create query pool!");
+
+	VkCommandBuffer commandBuffer = e->beginSingleTimeCommands();
+	vkCmdResetQueryPool(commandBuffer, pool, 0, 1);
+	vkCmdWriteTimestamp(commandBuffer, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, pool, 0);
+	double before = now();
+	e->endSingleTimeCommands(commandBuffer);
+	double after = now();
+
+	uint64_t ticks = 0;
+	vkGetQueryPoolResults(e->device, pool, 0, 1, sizeof(ticks), &ticks, sizeof(ticks), VK_QUERY_RESULT_64_BIT | VK_QUERY_RESULT_WAIT_BIT);
+	vkDestroyQueryPool(e->device, pool, nullptr);
+
+	calibrationTicks	= ticks & timestampMask;
+	calibrationTime		= (before + after) / 2;
+}
+
+double Profiler::now() const { return std::chrono::duration<double, std::milli>(clock::now() - origin).count(); }
+
+double Profiler::gpuTime(uint64_t ticks) const { return calibrationTime + ((ticks - calibrationTicks) & timestampMask) * timestampPeriod / 1e6; }
+
+void Profiler::createFrameResources(uint32_t imageCount)
+{
+	if (!enabled) return;
+
+	VkQueryPoolCreateInfo timestampInfo{};
+	timestampInfo.sType					= VK_STRUCTURE_TYPE_QUERY_POOL_CREATE_INFO;
+	timestampInfo.queryType				= VK_QUERY_TYPE_TIMESTAMP;
+	timestampInfo.queryCount			= static_cast<uint32_t>(2 * maxGpuScopes);		// Begin and end of each scope
+
+	VkQueryPoolCreateInfo statsInfo{};
+	statsInfo.sType						= VK_STRUCTURE_TYPE_QUERY_POOL_CREATE_INFO;
+	statsInfo.queryType					= VK_QUERY_TYPE_PIPELINE_STATISTICS;
+	statsInfo.queryCount				= static_cast<uint32_t>(maxGpuScopes);
+	statsInfo.pipelineStatistics		= statisticFlags;
+
+	for (uint32_t i = 0; i < imageCount; i++)
+	{
+		slots.emplace_back();
+		QuerySlot& slot = slots.back();
+		slot.scopes.resize(maxGpuScopes);
+
+		if (timestamps && vkCreateQueryPool(e->device, &timestampInfo, nullptr, &slot.timestampPool) != VK_SUCCESS)
+			throw std::runtime_error("Failed to create timestamp query pool!");
+		if (statistics && vkCreateQueryPool(e->device, &statsInfo, nullptr, &slot.statsPool) != VK_SUCCESS)
+			throw std::runtime_error("Failed to create pipeline statistics query pool!");
+	}
+}
+
+void Profiler::destroyFrameResources()
+{
+	collectAll();
+
+	for (QuerySlot& slot : slots)
+	{
+		if (slot.timestampPool != VK_NULL_HANDLE) vkDestroyQueryPool(e->device, slot.timestampPool, nullptr);
+		if (slot.statsPool != VK_NULL_HANDLE) vkDestroyQueryPool(e->device, slot.statsPool, nullptr);
+	}
+	slots.clear();
+}
+
+void Profiler::beginFrame()
+{
+	if (!enabled) return;
+	if (inFrame) endFrame();
+
+	// The oldest frame is reused (its vectors keep their capacity)
+	if (!frames.empty() && frames.size() >= std::max(historySize, (size_t)1))
+	{
+		frames.push_back(std::move(frames.front()));
+		frames.pop_front();
+	}
+	else frames.emplace_back();
+
+	FrameProfile& frame	= frames.back();
+	frame.frame			= nextFrame++;
+	frame.cpuStart		= now();
+	frame.cpuTime		= 0;
+	frame.gpuTime		= 0;
+	frame.gpuReady		= false;
+	frame.stats			= PipelineStats();
+	frame.cpu.clear();
+	frame.gpu.clear();
+
+	inFrame		= true;
+	cpuDepth	= 0;
+}
+
+void Profiler::endFrame()
+{
+	if (!enabled || !inFrame) return;
+
+	FrameProfile& frame = frames.back();
+	double end = now();
+	for (ProfileEvent& event : frame.cpu)
+		if (event.duration < 0) event.duration = end - event.start;		// Still open
+
+	frame.cpuTime	= end - frame.cpuStart;
+	inFrame			= false;
+}
+
+uint32_t Profiler::beginCpuScope(const char* name)
+{
+	if (!enabled || !inFrame) return UINT32_MAX;
+
+	ProfileEvent event;
+	event.name		= name;
+	event.start		= now();
+	event.duration	= -1;
+	event.depth		= cpuDepth++;
+	frames.back().cpu.push_back(event);
+	return static_cast<uint32_t>(frames.back().cpu.size() - 1);
+}
+
+void Profiler::endCpuScope(uint32_t scope)
+{
+	if (!enabled || !inFrame || scope >= frames.back().cpu.size()) return;
+
+	ProfileEvent& event	= frames.back().cpu[scope];
+	event.duration		= now() - event.start;
+	cpuDepth			= event.depth;
+}
+
+void Profiler::resetScopes(uint32_t imageIndex)
+{
+	if (!enabled || imageIndex >= slots.size()) return;
+
+	collect(imageIndex);
+	slots[imageIndex].scopeCount = 0;
+	slots[imageIndex].statsCount = 0;
+}
+
+void Profiler::recordReset(VkCommandBuffer commandBuffer, uint32_t imageIndex)
+{
+	if (!enabled || imageIndex >= slots.size()) return;
+
+	if (timestamps)	vkCmdResetQueryPool(commandBuffer, slots[imageIndex].timestampPool, 0, static_cast<uint32_t>(2 * maxGpuScopes));
+	if (statistics)	vkCmdResetQueryPool(commandBuffer, slots[imageIndex].statsPool, 0, static_cast<uint32_t>(maxGpuScopes));
+}
+
+uint32_t Profiler::beginGpuScope(VkCommandBuffer commandBuffer, uint32_t imageIndex, const char* name, uint32_t depth, bool withStats)
+{
+	if (!enabled || imageIndex >= slots.size()) return UINT32_MAX;
+
+	QuerySlot& slot = slots[imageIndex];
+	uint32_t scope = slot.scopeCount.fetch_add(1);
+	if (scope >= maxGpuScopes) return UINT32_MAX;
+
+	GpuScope& gpuScope	= slot.scopes[scope];
+	gpuScope.name		= name;
+	gpuScope.depth		= depth;
+	gpuScope.statsQuery	= UINT32_MAX;
+
+	if (timestamps)
+		vkCmdWriteTimestamp(commandBuffer, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, slot.timestampPool, 2 * scope);		// When the previous commands have started (the scope starts)
+
+	if (withStats && statistics)
+	{
+		gpuScope.statsQuery = slot.statsCount.fetch_add(1);
+		vkCmdBeginQuery(commandBuffer, slot.statsPool, gpuScope.statsQuery, 0);
+	}
+
+	return scope;
+}
+
+void Profiler::endGpuScope(VkCommandBuffer commandBuffer, uint32_t imageIndex, uint32_t scope)
+{
+	if (!enabled || imageIndex >= slots.size() || scope >= maxGpuScopes) return;
+
+	QuerySlot& slot = slots[imageIndex];
+	if (slot.scopes[scope].statsQuery != UINT32_MAX)
+		vkCmdEndQuery(commandBuffer, slot.statsPool, slot.scopes[scope].statsQuery);
+
+	if (timestamps)
+		vkCmdWriteTimestamp(commandBuffer, VK_PIPELINE_STAGE_BOTTOM_OF_PIPE_BIT, slot.timestampPool, 2 * scope + 1);	// When the commands of the scope have finished
+}
+
+void Profiler::submitted(uint32_t imageIndex)
+{
+	if (!enabled || !inFrame || imageIndex >= slots.size()) return;
+
+	slots[imageIndex].frame		= frames.back().frame;
+	slots[imageIndex].pending	= true;
+}
+
+FrameProfile* Profiler::findFrame(uint64_t frame)
+{
+	if (frames.empty() || frame < frames.front().frame || frame > frames.back().frame) return nullptr;
+	return &frames[(size_t)(frame - frames.front().frame)];		// Frame numbers are consecutive
+}
+
+void Profiler::collect(uint32_t imageIndex)
+{
+	if (!enabled || imageIndex >= slots.size() || !slots[imageIndex].pending) return;
+
+	QuerySlot& slot = slots[imageIndex];
+	slot.pending = false;
+
+	FrameProfile* frame = findFrame(slot.frame);
+	if (!frame) return;					// Not kept anymore
+
+	uint32_t scopeCount = std::min(slot.scopeCount.load(), static_cast<uint32_t>(maxGpuScopes));
+	uint32_t statsCount = slot.statsCount.load();
+
+	// Results without waiting: the fence of the submission was waited, so they are available (otherwise, VK_NOT_READY and the frame has no GPU results)
+	timestampResults.resize(2 * scopeCount);
+	if (timestamps && scopeCount &&
+		vkGetQueryPoolResults(e->device, slot.timestampPool, 0, 2 * scopeCount, timestampResults.size() * sizeof(uint64_t), timestampResults.data(), sizeof(uint64_t), VK_QUERY_RESULT_64_BIT) != VK_SUCCESS)
+		return;
+
+	statsResults.resize(statsCount);
+	if (statistics && statsCount &&
+		vkGetQueryPoolResults(e->device, slot.statsPool, 0, statsCount, statsResults.size() * sizeof(PipelineStats), statsResults.data(), sizeof(PipelineStats), VK_QUERY_RESULT_64_BIT) != VK_SUCCESS)
+		return;
+
+	frame->gpu.clear();
+	frame->stats = PipelineStats();
+	double first = 0, last = 0;
+
+	for (uint32_t s = 0; s < scopeCount; s++)
+	{
+		const GpuScope& scope = slot.scopes[s];
+
+		ProfileEvent event;
+		event.name		= scope.name;
+		event.depth		= scope.depth;
+		event.start		= timestamps ? gpuTime(timestampResults[2 * s]) : 0;
+		event.duration	= timestamps ? ((timestampResults[2 * s + 1] - timestampResults[2 * s]) & timestampMask) * timestampPeriod / 1e6 : 0;
+
+		if (scope.statsQuery != UINT32_MAX)
+		{
+			event.hasStats	= true;
+			event.stats		= statsResults[scope.statsQuery];
+			frame->stats.add(event.stats);
+		}
+
+		first	= s ? std::min(first, event.start) : event.start;
+		last	= s ? std::max(last, event.start + event.duration) : event.start + event.duration;
+		frame->gpu.push_back(event);
+	}
+
+	std::sort(frame->gpu.begin(), frame->gpu.end(), [](const ProfileEvent& a, const ProfileEvent& b) { return a.start < b.start || (a.start == b.start && a.depth < b.depth); });
+	frame->gpuTime	= last - first;
+	frame->gpuReady	= true;
+}
+
+void Profiler::collectAll()
+{
+	for (uint32_t i = 0; i < slots.size(); i++)
+		collect(i);
+}
+
+const char* Profiler::intern(const std::string& name) { return names.insert(name).first->c_str(); }
+
+/// Add a duration to the total of a name (scopes are few, so a linear search is enough).
+static void accumulate(std::vector<std::pair<const char*, double>>& totals, const char* name, double duration)
+{
+	for (std::pair<const char*, double>& total : totals)
+		if (!std::strcmp(total.first, name))
+		{
+			total.second += duration;
+			return;
+		}
+	totals.push_back({ name, duration });
+}
+
+void Profiler::printSummary() const
+{
+	if (!enabled) return;
+
+	size_t count = 0;
+	double cpuTime = 0, gpuTime = 0;
+	PipelineStats stats;
+	std::vector<std::pair<const char*, double>> cpuScopes, gpuScopes;
+
+	for (const FrameProfile& frame : frames)
+	{
+		if (!frame.gpuReady) continue;
+		count++;
+		cpuTime += frame.cpuTime;
+		gpuTime += frame.gpuTime;
+		stats.add(frame.stats);
+		for (const ProfileEvent& event : frame.cpu) accumulate(cpuScopes, event.name, event.duration);
+		for (const ProfileEvent& event : frame.gpu) accumulate(gpuScopes, event.name, event.duration);
+	}
+	if (!count) return;
+
+	std::cout << "Profile (average of the last " << count << " frames): CPU " << cpuTime / count << " ms, GPU " << gpuTime / count << " ms" << std::endl;
+	for (const std::pair<const char*, double>& scope : cpuScopes)
+		std::cout << "   CPU " << scope.first << ": " << scope.second / count << " ms" << std::endl;
+	for (const std::pair<const char*, double>& scope : gpuScopes)
+		std::cout << "   GPU " << scope.first << ": " << scope.second / count << " ms" << std::endl;
+	if (statistics)
+		std::cout << "   Per frame: " << stats.primitives / count << " primitives (" << stats.clippingPrimitives / count << " after clipping), "
+				  << stats.vertexInvocations / count << " vertex shader, " << stats.fragmentInvocations / count << " fragment shader and "
+				  << stats.computeInvocations / count << " compute shader invocations" << std::endl;
+}
+
+/// Name as a JSON string (quoted and escaped: Windows paths have backslashes).
+static std::string jsonString(const char* text)
+{
+	std::string result = "\"";
+	for (const char* c = text; *c; c++)
+	{
+		if (*c == '"' || *c == '\\')	{ result += '\\'; result += *c; }
+		else if ((unsigned char)*c < 0x20)	result += ' ';
+		else							result += *c;
+	}
+	return result + "\"";
+}
+
+/**
+*	Chrome trace event format: complete events ("ph":"X", microseconds) on two tracks of one process: the render thread (tid 1) and the graphics queue (tid 2). Events of a track nest by time.
+*	GPU events with pipeline statistics have them as arguments (shown when the event is selected).
+*/
+bool Profiler::exportChromeTrace(const std::string& path) const
+{
+	std::ofstream out(path, std::ios::trunc);
+	if (!out.is_open()) return false;
+
+	out << std::fixed << std::setprecision(3);
+	out << "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n"
+		<< "{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":1,\"tid\":1,\"args\":{\"name\":\"Renderer\"}},\n"
+		<< "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":1,\"args\":{\"name\":\"CPU (render thread)\"}},\n"
+		<< "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":2,\"args\":{\"name\":\"GPU (graphics queue)\"}}";
+
+	auto write = [&out](const std::string& name, const char* category, int tid, double start, double duration)
+	{
+		out << ",\n{\"name\":" << name << ",\"cat\":\"" << category << "\",\"ph\":\"X\",\"pid\":1,\"tid\":" << tid
+			<< ",\"ts\":" << start * 1000. << ",\"dur\":" << duration * 1000.;
+	};
+
+	for (const FrameProfile& frame : frames)
+	{
+		std::string frameName = "\"Frame " + std::to_string(frame.frame) + "\"";
+
+		write(frameName, "cpu", 1, frame.cpuStart, frame.cpuTime);
+		out << "}";
+		for (const ProfileEvent& event : frame.cpu)
+		{
+			write(jsonString(event.name), "cpu", 1, event.start, event.duration);
+			out << "}";
+		}
+
+		if (!frame.gpuReady || !timestamps || frame.gpu.empty()) continue;
+
+		write(frameName, "gpu", 2, frame.gpu.front().start, frame.gpuTime);
+		out << "}";
+		for (const ProfileEvent& event : frame.gpu)
+		{
+			write(jsonString(event.name), "gpu", 2, event.start, event.duration);
+			if (event.hasStats)
+				out << ",\"args\":{\"primitives\":" << event.stats.primitives << ",\"clipped primitives\":" << event.stats.clippingPrimitives
+					<< ",\"vertex shader invocations\":" << event.stats.vertexInvocations << ",\"fragment shader invocations\":" << event.stats.fragmentInvocations
+					<< ",\"compute shader invocations\":" << event.stats.computeInvocations << "}";
+			out << "}";
+		}
+	}
+
+	out << "\n]}\n";
+	return (bool)out;
+}
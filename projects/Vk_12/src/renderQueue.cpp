@@ -0,0 +1,111 @@
+#include <algorithm>
+#include <cstring>
+
+#include "renderQueue.hpp"
+
+
+// RenderQueueStats ------------------------------------------------------------------------------
+
+void RenderQueueStats::add(const RenderQueueStats& other)
+{
+	draws					+= other.draws;
+	pipelines.issued		+= other.pipelines.issued;
+	pipelines.skipped		+= other.pipelines.skipped;
+	descriptorSets.issued	+= other.descriptorSets.issued;
+	descriptorSets.skipped	+= other.descriptorSets.skipped;
+	vertexBuffers.issued	+= other.vertexBuffers.issued;
+	vertexBuffers.skipped	+= other.vertexBuffers.skipped;
+	indexBuffers.issued		+= other.indexBuffers.issued;
+	indexBuffers.skipped	+= other.indexBuffers.skipped;
+	materials.issued		+= other.materials.issued;
+	materials.skipped		+= other.materials.skipped;
+}
+
+size_t RenderQueueStats::issued() const { return pipelines.issued + descriptorSets.issued + vertexBuffers.issued + indexBuffers.issued + materials.issued; }
+
+size_t RenderQueueStats::skipped() const { return pipelines.skipped + descriptorSets.skipped + vertexBuffers.skipped + indexBuffers.skipped + materials.skipped; }
+
+
+// RenderQueue -----------------------------------------------------------------------------------
+
+uint32_t RenderQueue::getId(int field, uint64_t handle)
+{
+	std::unordered_map<uint64_t, uint32_t>::iterator it = ids[field].find(handle);
+	if (it != ids[field].end()) return it->second;
+
+	uint32_t id = static_cast<uint32_t>(ids[field].size());
+	ids[field][handle] = id;
+	return id;
+}
+
+uint64_t RenderQueue::getState(uint64_t pipeline, uint64_t material, uint64_t mesh)
+{
+	uint64_t pipelineId	= std::min<uint32_t>(getId(0, pipeline), 0xFFF);
+	uint64_t materialId	= std::min<uint32_t>(getId(1, material), 0xFFFF);
+	uint64_t meshId		= std::min<uint32_t>(getId(2, mesh), 0xFFFF);
+
+	return (pipelineId << 32) | (materialId << 16) | meshId;
+}
+
+uint64_t RenderQueue::makeKey(uint32_t pass, uint64_t state, float depth) const
+{
+	uint32_t depthBits;
+	depth = std::max(depth, 0.f);
+	std::memcpy(&depthBits, &depth, sizeof(depthBits));
+	uint64_t depthBucket = depthBits >> 13;								// Exponent and 10 bits of mantissa (18 bits)
+
+	uint64_t key = mode == SortMode::State
+		? (state << 18) | depthBucket
+		: (depthBucket << 44) | state;
+
+	return (uint64_t(pass & 3) << 62) | key;
+}
+
+void RenderQueue::sort()
+{
+	scratch.resize(items.size());
+	DrawItem* sorted = radixSort(items.data(), scratch.data(), items.size());
+	if (sorted != items.data()) items.swap(scratch);
+}
+
+
+// Radix sort ------------------------------------------------------------------------------------
+
+/**
+*	LSD radix sort: 8 passes of 8 bits, from the lowest digit to the highest, each one a stable counting sort. The histograms of every digit are computed in a single read of the keys.
+*	A pass where every key has the same digit wouldn't change the order, so it's skipped (common here: most keys share the pass bits and the high bits of the ids).
+*/
+DrawItem* radixSort(DrawItem* items, DrawItem* scratch, size_t count)
+{
+	if (count == 0) return items;
+
+	const int digits = sizeof(uint64_t);
+	std::vector<size_t> histograms(digits * 256, 0);
+
+	for (size_t i = 0; i < count; i++)
+		for (int d = 0; d < digits; d++)
+			histograms[d * 256 + ((items[i].key >> (d * 8)) & 0xFF)]++;
+
+	DrawItem* src = items;
+	DrawItem* dst = scratch;
+	for (int d = 0; d < digits; d++)
+	{
+		size_t* histogram = &histograms[d * 256];
+		if (histogram[(src[0].key >> (d * 8)) & 0xFF] == count) continue;	// Same digit in every key
+
+		size_t offset = 0;					// Histogram -> first position of each digit value
+		for (int v = 0; v < 256; v++)
+		{
+			size_t n = histogram[v];
+			histogram[v] = offset;
+			offset += n;
+		}
+
+		for (size_t i = 0; i < count; i++)
+			dst[histogram[(src[i].key >> (d * 8)) & 0xFF]++] = src[i];
+
+		std::swap(src, dst);
+	}
+
+	return src;
+}
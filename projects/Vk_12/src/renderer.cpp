@@ -13,37 +13,211 @@
 #include <cstdlib>				// EXIT_SUCCESS, EXIT_FAILURE
 
 #include <cstdint>				// UINT32_MAX
-#include <algorithm>			// std::min / std::max
+#include <algorithm>			// std::min / std::max / std::sort
+#include <cmath>				// std::tan
 #include <fstream>
+#include <limits>				// std::numeric_limits
 #include <chrono>
+#include <memory>				// std::unique_ptr
+#include <iterator>				// std::prev
 #include <unordered_map>		// For storing unique vertices from the model
 
 #include "renderer.hpp"
 
-Renderer::Renderer(std::vector<modelConfig>& modelConfigs)
-	: input(e.window)
+Renderer::Renderer(std::vector<modelConfig>& modelConfigs, bool headless)
+	: e(headless), input(e.window)
 { 
-	// Get the models data
+	// Reserve the global UBO (per-frame data shared by every model)
+	globalUniformOffset = e.uniforms.reserve(sizeof(GlobalUBO));
+
+	auto start = std::chrono::high_resolution_clock::now();
+
+	// Get the models data (their assets are loaded below)
+	std::vector<modelData*> models;
 	for (size_t i = 0; i < modelConfigs.size(); i++)
-		m.push_back(modelData(e, modelConfigs[i]));
+	{
+		m.push_back(modelData(e, modelConfigs[i], true));
+		models.push_back(&m.back());
+	}
+
+	// CPU stages (file reads, image decoding, mesh parsing and welding) of every model in parallel. Models sharing a texture decode it once (TextureCache::prepare).
+	std::vector<AssetLoadTimes> loadTimes(models.size());
+	workers.run(models.size(), [&](size_t i) { loadTimes[i] = models[i]->loadAssets(); });
+	auto cpuEnd = std::chrono::high_resolution_clock::now();
+
+	// GPU stages (pipelines, images, buffers, descriptors) in this thread. Their uploads are only recorded here.
+	for (modelData& model : m)
+		model.createResources();
+	auto gpuEnd = std::chrono::high_resolution_clock::now();
+
+	// Submit the uploads of every model (vertices, indices, textures) in a single batch. Rendering is submitted to the same queue, so it's ordered after them.
+	e.uploader.flush();
+	auto end = std::chrono::high_resolution_clock::now();
+
+	AssetLoadTimes summed;
+	for (const AssetLoadTimes& times : loadTimes)
+	{
+		summed.texture	+= times.texture;
+		summed.mesh		+= times.mesh;
+	}
+
+	auto ms = [](std::chrono::high_resolution_clock::time_point a, std::chrono::high_resolution_clock::time_point b) { return std::chrono::duration<double, std::milli>(b - a).count(); };
+	std::cout << "Assets loaded in " << ms(start, end) << " ms (" << m.size() << " models, " << workers.size() << " threads):" << std::endl
+			  << "   CPU stages: " << ms(start, cpuEnd) << " ms (textures " << summed.texture << " ms, meshes " << summed.mesh << " ms, summed over threads)" << std::endl
+			  << "   GPU resources: " << ms(cpuEnd, gpuEnd) << " ms" << std::endl
+			  << "   Upload submission: " << ms(gpuEnd, end) << " ms" << std::endl;
+
+	if (e.printInfo) e.printPipelineStats();		// Startup pipeline creation time (cold vs warm cache)
+	if (e.printInfo) e.states.printStats();		// Objects shared among models
+	if (e.printInfo) e.textures.printStats();	// Textures shared among models (and memory saved)
+
+	// Models added or removed while rendering are loaded by the streaming thread. The startup models are registered in it, so their instances can be changed too.
+	streamer.start(e);
+	std::list<modelData>::iterator model = m.begin();
+	for (size_t i = 0; i < modelConfigs.size(); i++, model++)
+	{
+		startupHandles.push_back(streamer.track(modelConfigs[i]));
+		handles[startupHandles.back()] = model;
+	}
 }
 
-Renderer::~Renderer() { }
+Renderer::~Renderer() { streamer.stop(); }
 
 void Renderer::run()
 {
+	if (e.gpuDriven)
+	{
+		perFrameRecording = false;		// What is drawn is decided on the GPU, so the command buffers don't change between frames.
+		gpuScene.init(e, m, cullShaderPath.c_str());
+	}
+	else if (useCulling || useLods || useMeshletCulling)
+		perFrameRecording = true;		// What is drawn depends on the camera, so the command buffers are recorded every frame.
+
+	createGlobalDescriptorSets();
+	profiler.init(e, profiling);
+	profiler.createFrameResources(static_cast<uint32_t>(e.swapChainImages.size()));
 	createCommandBuffers();
 	createSyncObjects();
-	mainLoop();
+	if (e.headless) headlessLoop();
+	else mainLoop();
+
+	profiler.collectAll();			// The device is idle
+	profiler.printSummary();
+	if (!tracePath.empty())
+	{
+		std::lock_guard<std::mutex> lock(traceMutex);
+		traceRequest = tracePath;
+	}
+	exportRequestedTrace();
 	cleanup();
+
+	if (e.headless) checkLastFrame();
+}
+
+ModelHandle Renderer::addModel(const modelConfig& config) { return streamer.add(config); }
+
+void Renderer::removeModel(ModelHandle model) { streamer.remove(model); }
+
+void Renderer::addInstance(ModelHandle model, const std::function<glm::mat4(float)>& getModelMatrix) { streamer.addInstance(model, getModelMatrix); }
+
+void Renderer::removeInstance(ModelHandle model, size_t instance) { streamer.removeInstance(model, instance); }
+
+void Renderer::exportTrace(const std::string& path)
+{
+	std::lock_guard<std::mutex> lock(traceMutex);
+	traceRequest = path;
+}
+
+void Renderer::exportRequestedTrace()
+{
+	std::string path;
+	{
+		std::lock_guard<std::mutex> lock(traceMutex);
+		path.swap(traceRequest);
+	}
+	if (path.empty()) return;
+
+	if (profiler.exportChromeTrace(path)) std::cout << "Trace saved to " << path << std::endl;
+	else std::cerr << "Failed to write trace " << path << std::endl;
+}
+
+void Renderer::createGlobalDescriptorSets()
+{
+	// Descriptor pool
+	std::array<VkDescriptorPoolSize, 2> poolSizes{};
+	poolSizes[0].type				= VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER;
+	poolSizes[0].descriptorCount	= static_cast<uint32_t>(e.swapChainImages.size());
+	poolSizes[1].type				= VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;			// GPU-driven mode: instance table and visible list
+	poolSizes[1].descriptorCount	= 2 * static_cast<uint32_t>(e.swapChainImages.size());
+
+	VkDescriptorPoolCreateInfo poolInfo{};
+	poolInfo.sType			= VK_STRUCTURE_TYPE_DESCRIPTOR_POOL_CREATE_INFO;
+	poolInfo.poolSizeCount	= e.gpuDriven ? 2 : 1;
+	poolInfo.pPoolSizes		= poolSizes.data();
+	poolInfo.maxSets		= static_cast<uint32_t>(e.swapChainImages.size());
+
+	if (vkCreateDescriptorPool(e.device, &poolInfo, nullptr, &globalDescriptorPool) != VK_SUCCESS)
+		throw std::runtime_error("Failed to create global descriptor pool!");
+
+	// Descriptor sets (one per swap chain image)
+	std::vector<VkDescriptorSetLayout> layouts(e.swapChainImages.size(), e.globalDescriptorSetLayout);
+
+	VkDescriptorSetAllocateInfo allocInfo{};
+	allocInfo.sType					= VK_STRUCTURE_TYPE_DESCRIPTOR_SET_ALLOCATE_INFO;
+	allocInfo.descriptorPool		= globalDescriptorPool;
+	allocInfo.descriptorSetCount	= static_cast<uint32_t>(e.swapChainImages.size());
+	allocInfo.pSetLayouts			= layouts.data();
+
+	globalDescriptorSets.resize(e.swapChainImages.size());
+	if (vkAllocateDescriptorSets(e.device, &allocInfo, globalDescriptorSets.data()) != VK_SUCCESS)
+		throw std::runtime_error("Failed to allocate global descriptor sets!");
+
+	for (size_t i = 0; i < e.swapChainImages.size(); i++)
+	{
+		VkDescriptorBufferInfo bufferInfo{};
+		bufferInfo.buffer	= e.uniforms.buffer;
+		bufferInfo.offset	= e.uniforms.getOffset(static_cast<uint32_t>(i), globalUniformOffset);
+		bufferInfo.range	= sizeof(GlobalUBO);
+
+		VkWriteDescriptorSet descriptorWrite{};
+		descriptorWrite.sType			= VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET;
+		descriptorWrite.dstSet			= globalDescriptorSets[i];
+		descriptorWrite.dstBinding		= 0;
+		descriptorWrite.dstArrayElement	= 0;
+		descriptorWrite.descriptorType	= VK_DESCRIPTOR_TYPE_UNIFORM_BUFFER;
+		descriptorWrite.descriptorCount	= 1;
+		descriptorWrite.pBufferInfo		= &bufferInfo;
+
+		vkUpdateDescriptorSets(e.device, 1, &descriptorWrite, 0, nullptr);
+
+		if (e.gpuDriven)		// Bindings 1 and 2 (vertex shader): instance table and visible list of this swap chain image
+		{
+			std::array<VkDescriptorBufferInfo, 2> storageInfos = { gpuScene.getInstanceBufferInfo(static_cast<uint32_t>(i)), gpuScene.getVisibleBufferInfo(static_cast<uint32_t>(i)) };
+			std::array<VkWriteDescriptorSet, 2> storageWrites{};
+			for (uint32_t b = 0; b < storageWrites.size(); b++)
+			{
+				storageWrites[b]					= descriptorWrite;
+				storageWrites[b].dstBinding			= b + 1;
+				storageWrites[b].descriptorType		= VK_DESCRIPTOR_TYPE_STORAGE_BUFFER;
+				storageWrites[b].pBufferInfo		= &storageInfos[b];
+			}
+			vkUpdateDescriptorSets(e.device, static_cast<uint32_t>(storageWrites.size()), storageWrites.data(), 0, nullptr);
+		}
+	}
 }
 
 // (24)
 void Renderer::createCommandBuffers()
 {
-	// Commmand buffer allocation
 	commandBuffers.resize(e.swapChainFramebuffers.size());				// One commandBuffer per swapChainFramebuffer
 
+	if (perFrameRecording)
+	{
+		createFrameCommandPools();		// Command buffers are allocated from per-frame pools and recorded every frame (recordCommandBuffer()).
+		return;
+	}
+
+	// Commmand buffer allocation
 	VkCommandBufferAllocateInfo allocInfo{};
 	allocInfo.sType					= VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
 	allocInfo.commandPool			= e.commandPool;
@@ -53,6 +227,9 @@ void Renderer::createCommandBuffers()
 	if (vkAllocateCommandBuffers(e.device, &allocInfo, commandBuffers.data()) != VK_SUCCESS)
 		throw std::runtime_error("Failed to allocate command buffers!");
 
+	// Draws of every model (recorded once, so they are only sorted by state)
+	if (!e.gpuDriven) buildRenderQueue(false);
+
 	// Start command buffer recording and a render pass
 	for (size_t i = 0; i < commandBuffers.size(); i++)
 	{
@@ -65,51 +242,357 @@ void Renderer::createCommandBuffers()
 		if (vkBeginCommandBuffer(commandBuffers[i], &beginInfo) != VK_SUCCESS)		// If a command buffer was already recorded once, this call resets it. It's not possible to append commands to a buffer at a later time.
 			throw std::runtime_error("Failed to begin recording command buffer!");
 
-		// Starting a render pass
-		VkRenderPassBeginInfo renderPassInfo{};
-		renderPassInfo.sType				= VK_STRUCTURE_TYPE_RENDER_PASS_BEGIN_INFO;
-		renderPassInfo.renderPass			= e.renderPass;
-		renderPassInfo.framebuffer			= e.swapChainFramebuffers[i];
-		renderPassInfo.renderArea.offset	= { 0, 0 };
-		renderPassInfo.renderArea.extent	= e.swapChainExtent;						// Size of the render area (where shader loads and stores will take place). Pixels outside this region will have undefined values. It should match the size of the attachments for best performance.
-		std::array<VkClearValue, 2> clearValues{};									// The order of clearValues should be identical to the order of your attachments.
-		clearValues[0].color				= backgroundColor;										// Background color (alpha = 1 means 100% opacity)
-		clearValues[1].depthStencil			= { 1.0f, 0 };									// Depth buffer range in Vulkan is [0.0, 1.0], where 1.0 lies at the far view plane and 0.0 at the near view plane. The initial value at each point in the depth buffer should be the furthest possible depth (1.0).
-		renderPassInfo.clearValueCount		= static_cast<uint32_t>(clearValues.size());	// Clear values to use for VK_ATTACHMENT_LOAD_OP_CLEAR, which we ...
-		renderPassInfo.pClearValues			= clearValues.data();							// ... used as load operation for the color attachment and depth buffer.
-
-		vkCmdBeginRenderPass(commandBuffers[i], &renderPassInfo, VK_SUBPASS_CONTENTS_INLINE);		// VK_SUBPASS_CONTENTS_INLINE (the render pass commands will be embedded in the primary command buffer itself and no secondary command buffers will be executed), VK_SUBPASS_CONTENTS_SECONDARY_COMMAND_BUFFERS (the render pass commands will be executed from secondary command buffers).
-
-		// Basic drawing commands (for each model)
-		for (std::list<modelData>::iterator it = m.begin(); it != m.end(); it++)
+		uint32_t image = static_cast<uint32_t>(i);
+		profiler.resetScopes(image);
+		profiler.recordReset(commandBuffers[i], image);
+
+		if (e.gpuDriven)		// Culling (compute passes go before the render pass)
 		{
-			vkCmdBindPipeline(commandBuffers[i], VK_PIPELINE_BIND_POINT_GRAPHICS, it->graphicsPipeline);// Second parameter: Specifies if the pipeline object is a graphics or compute pipeline.
-			//VkBuffer vertexBuffers[]	= { it->vertexBuffer };	// <<< Why not passing it directly (like the index buffer) instead of copying it? BTW, you are passing a local object to vkCmdBindVertexBuffers, how can it be possible?
-			VkDeviceSize offsets[]		= { 0 };	// <<<
-			//vkCmdBindVertexBuffers(commandBuffers[i], 0, 1, vertexBuffers, offsets);					// Bind the vertex buffer to bindings.
-			vkCmdBindVertexBuffers(commandBuffers[i], 0, 1, &it->vertexBuffer, offsets);					// Bind the vertex buffer to bindings.
-			vkCmdBindIndexBuffer(commandBuffers[i], it->indexBuffer, 0, VK_INDEX_TYPE_UINT32);			// Bind the index buffer. VK_INDEX_TYPE_ ... UINT16, UINT32.
-			if (it->getModelMatrix.size() == 1)
+			uint32_t cullScope = profiler.beginGpuScope(commandBuffers[i], image, "Culling", 0, true);
+			gpuScene.recordCulling(commandBuffers[i], image);
+			profiler.endGpuScope(commandBuffers[i], image, cullScope);
+		}
+
+		uint32_t passScope = profiler.beginGpuScope(commandBuffers[i], image, "Render pass", 0, e.gpuDriven);	// Pipeline statistics of the whole pass in GPU-driven mode (there are no model draws to measure). Otherwise, recordDraws() measures them per model.
+		beginRenderPass(commandBuffers[i], i, VK_SUBPASS_CONTENTS_INLINE);
+
+		if (e.gpuDriven)		// Indirect draws
+		{
+			if (!m.empty())
 			{
-				vkCmdBindDescriptorSets(commandBuffers[i], VK_PIPELINE_BIND_POINT_GRAPHICS, it->pipelineLayout, 0, 1, &it->descriptorSets[i], 0, nullptr);	// Bind the right descriptor set for each swap chain image to the descriptors in the shader.
-				vkCmdDrawIndexed(commandBuffers[i], static_cast<uint32_t>(it->indices.size()), 1, 0, 0, 0);	// Draw the triangles using indices. Parameters: command buffer, number of indices, number of instances, offset into the index buffer, offset to add to the indices in the index buffer, offset for instancing. 
-				//vkCmdDraw(commandBuffers[i], static_cast<uint32_t>(vertices.size()), 1, 0, 0);			// Draw the triangles without using indices. Parameters: command buffer, vertexCount (we have 3 vertices to draw), instanceCount (0 if you're doing instanced rendering), firstVertex (offset into the vertex buffer, lowest value of gl_VertexIndex), firstInstance (offset for instanced rendering, lowest value of gl_InstanceIndex).												
+				vkCmdBindDescriptorSets(commandBuffers[i], VK_PIPELINE_BIND_POINT_GRAPHICS, m.begin()->pipelineLayout, 0, 1, &globalDescriptorSets[i], 0, nullptr);
+				gpuScene.recordDraws(commandBuffers[i], image, m);
 			}
-			else
-				for (size_t j = 0; j < it->dynamicOffsets.size(); j++)
-				{
-					vkCmdBindDescriptorSets(commandBuffers[i], VK_PIPELINE_BIND_POINT_GRAPHICS, it->pipelineLayout, 0, 1, &it->descriptorSets[i], 1, &it->dynamicOffsets[j]);
-					vkCmdDrawIndexed(commandBuffers[i], static_cast<uint32_t>(it->indices.size()), 1, 0, 0, 0);
-				}
+		}
+		else
+		{
+			queueStats = RenderQueueStats();
+			recordDraws(commandBuffers[i], i, renderQueue.getItems().data(), renderQueue.getItems().data() + renderQueue.size(), queueStats);
 		}
 
 		// Finish up
 		vkCmdEndRenderPass(commandBuffers[i]);
+		profiler.endGpuScope(commandBuffers[i], image, passScope);
 		if (vkEndCommandBuffer(commandBuffers[i]) != VK_SUCCESS)
 			throw std::runtime_error("Failed to record command buffer!");
 	}
 }
 
+void Renderer::beginRenderPass(VkCommandBuffer commandBuffer, size_t imageIndex, VkSubpassContents contents)
+{
+	VkRenderPassBeginInfo renderPassInfo{};
+	renderPassInfo.sType				= VK_STRUCTURE_TYPE_RENDER_PASS_BEGIN_INFO;
+	renderPassInfo.renderPass			= e.renderPass;
+	renderPassInfo.framebuffer			= e.swapChainFramebuffers[imageIndex];
+	renderPassInfo.renderArea.offset	= { 0, 0 };
+	renderPassInfo.renderArea.extent	= e.swapChainExtent;						// Size of the render area (where shader loads and stores will take place). Pixels outside this region will have undefined values. It should match the size of the attachments for best performance.
+	std::array<VkClearValue, 2> clearValues{};									// The order of clearValues should be identical to the order of your attachments.
+	clearValues[0].color				= backgroundColor;										// Background color (alpha = 1 means 100% opacity)
+	clearValues[1].depthStencil			= { 1.0f, 0 };									// Depth buffer range in Vulkan is [0.0, 1.0], where 1.0 lies at the far view plane and 0.0 at the near view plane. The initial value at each point in the depth buffer should be the furthest possible depth (1.0).
+	renderPassInfo.clearValueCount		= static_cast<uint32_t>(clearValues.size());	// Clear values to use for VK_ATTACHMENT_LOAD_OP_CLEAR, which we ...
+	renderPassInfo.pClearValues			= clearValues.data();							// ... used as load operation for the color attachment and depth buffer.
+
+	vkCmdBeginRenderPass(commandBuffer, &renderPassInfo, contents);		// VK_SUBPASS_CONTENTS_INLINE (the render pass commands will be embedded in the primary command buffer itself and no secondary command buffers will be executed), VK_SUBPASS_CONTENTS_SECONDARY_COMMAND_BUFFERS (the render pass commands will be executed from secondary command buffers).
+}
+
+/// File name of a path (the profiler names the model draws after their model file).
+static std::string fileName(const char* path)
+{
+	std::string name(path);
+	size_t slash = name.find_last_of("/\\");
+	return slash == std::string::npos ? name : name.substr(slash + 1);
+}
+
+/**
+*	Fill the render queue with the draws of the visible instances of every model. Instanced and single-draw models are one item (all their draws), dynamic UBO models are one item per visible instance (each one is a draw with its own dynamic offset).
+*	The state of a model is its pipeline, its descriptor sets (material) and its vertex buffer (mesh). The depth of an item is the distance from the camera to its nearest instance, but it's only known after updateUniformBuffer() (withDepth). The static command buffers are recorded before that, so they are only sorted by state.
+*/
+void Renderer::buildRenderQueue(bool withDepth)
+{
+	renderQueue.mode = frontToBack && withDepth ? SortMode::FrontToBack : SortMode::State;
+	renderQueue.clear();
+	queueModels.clear();
+	queueNames.clear();
+
+	size_t firstObject = 0;
+	for (std::list<modelData>::iterator it = m.begin(); it != m.end(); firstObject += it->getModelMatrix.size(), it++)
+	{
+		uint32_t model = static_cast<uint32_t>(queueModels.size());
+		queueModels.push_back(&*it);
+
+		auto name = modelNames.find(&*it);
+		if (name == modelNames.end())
+			name = modelNames.emplace(&*it, profiler.intern(fileName(it->getModelPath()))).first;
+		queueNames.push_back(name->second);
+
+		if (it->visibleInstances.empty()) continue;		// Culled
+
+		uint64_t state = renderQueue.getState((uint64_t)it->graphicsPipeline, (uint64_t)&*it, (uint64_t)it->vertexBuffer);	// Each model has its own descriptor sets, so the model is the material.
+
+		auto depth = [&](uint32_t i)
+		{
+			if (!withDepth) return 0.f;
+			glm::vec3 center = glm::vec3(modelMatrices[firstObject + i] * glm::vec4(glm::vec3(it->boundingSphere), 1.f));
+			return glm::length(center - input.cam.Position);
+		};
+
+		if (it->dynamicUBO)
+			for (uint32_t i : it->visibleInstances)
+				renderQueue.add(renderQueue.makeKey(0, state, depth(i)), model, i);
+		else
+		{
+			float nearest = depth(it->visibleInstances[0]);
+			for (uint32_t i : it->visibleInstances)
+				nearest = std::min(nearest, depth(i));
+			renderQueue.add(renderQueue.makeKey(0, state, nearest), model);
+		}
+	}
+
+	if (sortDraws) renderQueue.sort();
+}
+
+/**
+*	Record the drawing commands of a range of the render queue [first, last). Only touches the command buffer, the models (read only) and stats, so different ranges can be recorded in parallel into different command buffers.
+*	The state bound by the previous draw is remembered, and binds of the same pipeline, descriptor set, vertex buffer or index buffer are skipped (and counted in stats). With a sorted queue, draws with the same state are consecutive.
+*/
+void Renderer::recordDraws(VkCommandBuffer commandBuffer, size_t i, const DrawItem* first, const DrawItem* last, RenderQueueStats& stats)
+{
+	if (first == last) return;
+
+	// Bind the global descriptor set (set 0) once. All the pipeline layouts share the same set 0 layout, so it stays bound when the pipeline changes.
+	vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, queueModels[first->model]->pipelineLayout, 0, 1, &globalDescriptorSets[i], 0, nullptr);
+
+	// Currently bound state
+	VkPipeline			boundPipeline		= VK_NULL_HANDLE;
+	VkPipelineLayout	boundLayout			= VK_NULL_HANDLE;
+	VkDescriptorSet		boundSet			= VK_NULL_HANDLE;
+	VkBuffer			boundVertexBuffer	= VK_NULL_HANDLE;
+	VkBuffer			boundIndexBuffer	= VK_NULL_HANDLE;
+	VkIndexType			boundIndexType		= VK_INDEX_TYPE_UINT32;
+	uint32_t			boundMaterial		= UINT32_MAX;
+
+	// Profiler: a GPU scope (with pipeline statistics) per run of draws of the same model
+	uint32_t			image				= static_cast<uint32_t>(i);
+	uint32_t			scopeModel			= UINT32_MAX;
+	uint32_t			modelScope			= UINT32_MAX;
+
+	for (const DrawItem* item = first; item != last; item++)
+	{
+		const modelData* it = queueModels[item->model];
+
+		if (item->model != scopeModel)
+		{
+			profiler.endGpuScope(commandBuffer, image, modelScope);
+			modelScope = profiler.beginGpuScope(commandBuffer, image, queueNames[item->model], 1, true);
+			scopeModel = item->model;
+		}
+
+		stats.pipelines.count(it->graphicsPipeline != boundPipeline);
+		if (it->graphicsPipeline != boundPipeline)		// Models share pipelines (e.states), so it's only rebound when it changes.
+		{
+			vkCmdBindPipeline(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, it->graphicsPipeline);// Second parameter: Specifies if the pipeline object is a graphics or compute pipeline.
+			boundPipeline = it->graphicsPipeline;
+		}
+		if (it->pipelineLayout != boundLayout)			// Set 1 may not be compatible with another layout, so it's bound again (and so are the sets after it).
+		{
+			boundLayout		= it->pipelineLayout;
+			boundSet		= VK_NULL_HANDLE;
+			boundMaterial	= UINT32_MAX;
+			if (e.bindless)								// Set 2: every texture and material
+			{
+				vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, it->pipelineLayout, 2, 1, &e.materials.descriptorSet, 0, nullptr);
+				stats.descriptorSets.count(true);
+			}
+		}
+
+		if (e.bindless)									// Material changes are a push constant (no descriptor binds)
+		{
+			stats.materials.count(it->materialIndex != boundMaterial);
+			if (it->materialIndex != boundMaterial)
+			{
+				vkCmdPushConstants(commandBuffer, it->pipelineLayout, VK_SHADER_STAGE_FRAGMENT_BIT, 0, sizeof(uint32_t), &it->materialIndex);
+				boundMaterial = it->materialIndex;
+			}
+		}
+
+		stats.vertexBuffers.count(it->vertexBuffer != boundVertexBuffer);
+		if (it->vertexBuffer != boundVertexBuffer)
+		{
+			VkDeviceSize offsets[] = { 0 };
+			vkCmdBindVertexBuffers(commandBuffer, 0, 1, &it->vertexBuffer, offsets);			// Bind the vertex buffer to bindings.
+			boundVertexBuffer = it->vertexBuffer;
+		}
+
+		stats.indexBuffers.count(it->indexBuffer != boundIndexBuffer || it->indexType != boundIndexType);
+		if (it->indexBuffer != boundIndexBuffer || it->indexType != boundIndexType)
+		{
+			vkCmdBindIndexBuffer(commandBuffer, it->indexBuffer, 0, it->indexType);				// Bind the index buffer. VK_INDEX_TYPE_ ... UINT16, UINT32.
+			boundIndexBuffer	= it->indexBuffer;
+			boundIndexType		= it->indexType;
+		}
+
+		if (it->dynamicUBO)		// One instance: the set is bound with its dynamic offset (always a new bind).
+		{
+			const MeshLod& lod = it->lods[it->instanceLods[item->instance]];
+			stats.descriptorSets.count(true);
+			vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, it->pipelineLayout, 1, 1, &it->descriptorSets[i], 1, &it->dynamicOffsets[item->instance]);
+			boundSet = VK_NULL_HANDLE;
+			vkCmdDrawIndexed(commandBuffer, lod.indexCount, 1, it->baseIndex + lod.firstIndex, it->baseVertex, 0);
+			stats.draws++;
+			continue;
+		}
+
+		stats.descriptorSets.count(it->descriptorSets[i] != boundSet);
+		if (it->descriptorSets[i] != boundSet)
+		{
+			vkCmdBindDescriptorSets(commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS, it->pipelineLayout, 1, 1, &it->descriptorSets[i], 0, nullptr);	// Bind the right descriptor set for each swap chain image to the descriptors in the shader (set 1: per object).
+			boundSet = it->descriptorSets[i];
+		}
+
+		if (it->instanced)
+		{
+			VkDeviceSize instanceOffset = i * it->instanceRegionSize;								// Region of the instance buffer for this swap chain image
+			vkCmdBindVertexBuffers(commandBuffer, 1, 1, &it->instanceBuffer, &instanceOffset);	// Bind the per-instance model matrices to binding 1 (own buffer of each model, so it's never skipped).
+			stats.vertexBuffers.count(true);
+			for (size_t lod = 0; lod < it->lods.size(); lod++)												// All the instances of each LOD in a single draw call (they are grouped by LOD in the instance buffer).
+			{
+				uint32_t instanceCount = it->lodFirstInstance[lod + 1] - it->lodFirstInstance[lod];
+				if (!instanceCount) continue;
+				vkCmdDrawIndexed(commandBuffer, it->lods[lod].indexCount, instanceCount, it->baseIndex + it->lods[lod].firstIndex, it->baseVertex, it->lodFirstInstance[lod]);
+				stats.draws++;
+			}
+		}
+		else
+			for (const DrawRange& range : it->drawRanges)		// The selected LOD, or its visible meshlets
+			{
+				vkCmdDrawIndexed(commandBuffer, range.indexCount, 1, it->baseIndex + range.firstIndex, it->baseVertex, 0);	// Draw the triangles using indices. Parameters: command buffer, number of indices, number of instances, offset into the index buffer, offset to add to the indices in the index buffer, offset for instancing. 
+				stats.draws++;
+			}
+	}
+
+	profiler.endGpuScope(commandBuffer, image, modelScope);
+}
+
+/**
+*	Per-frame recording mode. For each swap chain image: one pool for the primary command buffer, and one pool (with one secondary command buffer) per recording slice.
+*	Command pools are externally synchronized, so each slice (recorded by a single thread) gets its own pool. Pools are reset as a whole before recording (cheaper than resetting each command buffer).
+*/
+void Renderer::createFrameCommandPools()
+{
+	recordingSlices = workers.size();
+	size_t imageCount = e.swapChainFramebuffers.size();
+
+	QueueFamilyIndices queueFamilyIndices = e.findQueueFamilies(e.physicalDevice);
+
+	VkCommandPoolCreateInfo poolInfo{};
+	poolInfo.sType				= VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO;
+	poolInfo.queueFamilyIndex	= queueFamilyIndices.graphicsFamily.value();
+	poolInfo.flags				= VK_COMMAND_POOL_CREATE_TRANSIENT_BIT;		// Command buffers are rerecorded every frame
+
+	primaryPools.resize(imageCount);
+	secondaryPools.resize(imageCount * recordingSlices);
+	secondaryCommandBuffers.resize(imageCount * recordingSlices);
+
+	for (size_t i = 0; i < primaryPools.size(); i++)
+		if (vkCreateCommandPool(e.device, &poolInfo, nullptr, &primaryPools[i]) != VK_SUCCESS)
+			throw std::runtime_error("Failed to create command pool!");
+
+	for (size_t i = 0; i < secondaryPools.size(); i++)
+		if (vkCreateCommandPool(e.device, &poolInfo, nullptr, &secondaryPools[i]) != VK_SUCCESS)
+			throw std::runtime_error("Failed to create command pool!");
+
+	VkCommandBufferAllocateInfo allocInfo{};
+	allocInfo.sType					= VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
+	allocInfo.commandBufferCount	= 1;
+
+	for (size_t i = 0; i < imageCount; i++)
+	{
+		allocInfo.commandPool	= primaryPools[i];
+		allocInfo.level			= VK_COMMAND_BUFFER_LEVEL_PRIMARY;
+		if (vkAllocateCommandBuffers(e.device, &allocInfo, &commandBuffers[i]) != VK_SUCCESS)
+			throw std::runtime_error("Failed to allocate command buffers!");
+
+		for (size_t s = 0; s < recordingSlices; s++)
+		{
+			allocInfo.commandPool	= secondaryPools[i * recordingSlices + s];
+			allocInfo.level			= VK_COMMAND_BUFFER_LEVEL_SECONDARY;
+			if (vkAllocateCommandBuffers(e.device, &allocInfo, &secondaryCommandBuffers[i * recordingSlices + s]) != VK_SUCCESS)
+				throw std::runtime_error("Failed to allocate secondary command buffers!");
+		}
+	}
+}
+
+/**
+*	Record the command buffer of a swap chain image (per-frame recording mode). The models are split in slices, and each slice is recorded in parallel into a secondary command buffer. Then, the primary command buffer executes them inside the render pass.
+*	The command buffer must not be in use by the GPU (call it after waiting for the image's fence).
+*/
+void Renderer::recordCommandBuffer(uint32_t imageIndex)
+{
+	profiler.resetScopes(imageIndex);
+
+	// Sort the draws of the visible instances, and split them in slices (contiguous ranges of similar size)
+	buildRenderQueue(true);
+
+	const DrawItem* items	= renderQueue.getItems().data();
+	size_t itemCount		= renderQueue.size();
+	size_t sliceCount		= std::min(recordingSlices, itemCount);
+	std::vector<const DrawItem*> bounds(sliceCount + 1, items);
+	for (size_t s = 1; s <= sliceCount; s++)
+		bounds[s] = items + (itemCount * s) / sliceCount;
+	sliceStats.assign(sliceCount, RenderQueueStats());
+
+	// Record the secondary command buffers in parallel
+	VkCommandBufferInheritanceInfo inheritanceInfo{};
+	inheritanceInfo.sType		= VK_STRUCTURE_TYPE_COMMAND_BUFFER_INHERITANCE_INFO;
+	inheritanceInfo.renderPass	= e.renderPass;								// Render pass and subpass where they will be executed
+	inheritanceInfo.subpass		= 0;
+	inheritanceInfo.framebuffer	= e.swapChainFramebuffers[imageIndex];		// [Optional] Knowing the framebuffer may help the driver
+
+	workers.run(sliceCount, [&](size_t s)
+	{
+		size_t index = imageIndex * recordingSlices + s;
+		vkResetCommandPool(e.device, secondaryPools[index], 0);
+
+		VkCommandBufferBeginInfo beginInfo{};
+		beginInfo.sType				= VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+		beginInfo.flags				= VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT | VK_COMMAND_BUFFER_USAGE_RENDER_PASS_CONTINUE_BIT;	// Entirely inside a render pass
+		beginInfo.pInheritanceInfo	= &inheritanceInfo;
+
+		if (vkBeginCommandBuffer(secondaryCommandBuffers[index], &beginInfo) != VK_SUCCESS)
+			throw std::runtime_error("Failed to begin recording secondary command buffer!");
+
+		recordDraws(secondaryCommandBuffers[index], imageIndex, bounds[s], bounds[s + 1], sliceStats[s]);	// Secondary command buffers don't inherit bound state, so each one binds the global set again (and the first state of each slice is never skipped).
+
+		if (vkEndCommandBuffer(secondaryCommandBuffers[index]) != VK_SUCCESS)
+			throw std::runtime_error("Failed to record secondary command buffer!");
+	});
+
+	queueStats = RenderQueueStats();
+	for (const RenderQueueStats& stats : sliceStats)
+		queueStats.add(stats);
+
+	// Record the primary command buffer
+	vkResetCommandPool(e.device, primaryPools[imageIndex], 0);
+
+	VkCommandBufferBeginInfo beginInfo{};
+	beginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+	beginInfo.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+
+	if (vkBeginCommandBuffer(commandBuffers[imageIndex], &beginInfo) != VK_SUCCESS)
+		throw std::runtime_error("Failed to begin recording command buffer!");
+
+	profiler.recordReset(commandBuffers[imageIndex], imageIndex);		// Before the scopes of the secondary command buffers execute
+	uint32_t passScope = profiler.beginGpuScope(commandBuffers[imageIndex], imageIndex, "Render pass", 0, false);	// No pipeline statistics: the model scopes of the secondary command buffers have them (they can't be nested).
+	beginRenderPass(commandBuffers[imageIndex], imageIndex, VK_SUBPASS_CONTENTS_SECONDARY_COMMAND_BUFFERS);
+	if (sliceCount)
+		vkCmdExecuteCommands(commandBuffers[imageIndex], static_cast<uint32_t>(sliceCount), &secondaryCommandBuffers[imageIndex * recordingSlices]);
+	vkCmdEndRenderPass(commandBuffers[imageIndex]);
+	profiler.endGpuScope(commandBuffers[imageIndex], imageIndex, passScope);
+
+	if (vkEndCommandBuffer(commandBuffers[imageIndex]) != VK_SUCCESS)
+		throw std::runtime_error("Failed to record command buffer!");
+}
+
 // (25)
 /// Create semaphores and fences for synchronizing the events occuring in each frame (drawFrame()).
 void Renderer::createSyncObjects()
@@ -145,7 +628,10 @@ void Renderer::mainLoop()
 	{
 		glfwPollEvents();	// Check for events (processes only those events that have already been received and then returns immediately)
 
+		profiler.beginFrame();
 		drawFrame();
+		profiler.endFrame();
+		exportRequestedTrace();
 
 		if (glfwGetKey(e.window, GLFW_KEY_ESCAPE) == GLFW_PRESS)
 			glfwSetWindowShouldClose(e.window, true);
@@ -154,6 +640,128 @@ void Renderer::mainLoop()
 	vkDeviceWaitIdle(e.device);	// Waits for the logical device to finish operations. Needed for cleaning up once drawing and presentation operations (drawFrame) have finished. Use vkQueueWaitIdle for waiting for operations in a specific command queue to be finished.
 }
 
+/**
+*	Headless mode: render headlessFrames frames without FPS limit and print statistics of their frame times (time between the start of consecutive frames, so it includes waiting for the GPU once MAX_FRAMES_IN_FLIGHT frames are queued).
+*	The last frame is read back for checkLastFrame().
+*/
+void Renderer::headlessLoop()
+{
+	typedef std::chrono::high_resolution_clock clock;
+	std::vector<double> frameTimes;
+	frameTimes.reserve(headlessFrames);
+
+	timer.startTimer();
+	clock::time_point start = clock::now();
+	for (size_t f = 0; f < headlessFrames; f++)
+	{
+		clock::time_point frameStart = clock::now();
+		profiler.beginFrame();
+		drawFrame();
+		profiler.endFrame();
+		exportRequestedTrace();
+		if (f >= headlessWarmupFrames)
+			frameTimes.push_back(std::chrono::duration<double, std::milli>(clock::now() - frameStart).count());
+	}
+
+	vkDeviceWaitIdle(e.device);
+	double total = std::chrono::duration<double, std::milli>(clock::now() - start).count();
+
+	// Frame time statistics (ms)
+	std::cout << "Headless: " << headlessFrames << " frames in " << total << " ms (" << e.swapChainExtent.width << "x" << e.swapChainExtent.height << ")" << std::endl;
+	if (!frameTimes.empty())
+	{
+		std::vector<double> sorted = frameTimes;
+		std::sort(sorted.begin(), sorted.end());
+		auto percentile = [&sorted](double p) { return sorted[std::min(sorted.size() - 1, (size_t)(p * (sorted.size() - 1) + 0.5))]; };
+
+		double sum = 0;
+		for (double time : frameTimes) sum += time;
+		double average = sum / frameTimes.size();
+
+		std::cout << "   Frame times (" << frameTimes.size() << " frames, " << std::min(headlessWarmupFrames, headlessFrames) << " warm-up frames left out): "
+				  << "min " << sorted.front() << " ms, avg " << average << " ms, median " << percentile(0.5) << " ms, p95 " << percentile(0.95)
+				  << " ms, p99 " << percentile(0.99) << " ms, max " << sorted.back() << " ms (" << 1000. / average << " FPS)" << std::endl;
+	}
+
+	// Read back the last frame (its offscreen image was left in VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL by the render pass)
+	if (frameCount && (!headlessImagePath.empty() || !goldenImagePath.empty()))
+		e.readOffscreenImage(static_cast<uint32_t>((frameCount - 1) % e.swapChainImages.size()), lastFrame);
+}
+
+/// Write RGBA8 pixels to a binary PPM (P6) file (alpha is dropped).
+static bool writePpm(const std::string& path, const std::vector<uint8_t>& rgba, uint32_t width, uint32_t height)
+{
+	std::ofstream out(path, std::ios::binary | std::ios::trunc);
+	if (!out.is_open()) return false;
+
+	out << "P6\n" << width << " " << height << "\n255\n";
+	std::vector<uint8_t> rgb((size_t)width * height * 3);
+	for (size_t p = 0; p < (size_t)width * height; p++)
+		for (size_t c = 0; c < 3; c++)
+			rgb[p * 3 + c] = rgba[p * 4 + c];
+	out.write((const char*)rgb.data(), (std::streamsize)rgb.size());
+	return (bool)out;
+}
+
+/// Read the header of a binary PPM (P6, maxval 255) file, skipping comment lines. The stream is left at the first pixel (RGB8), so the caller can check the size before reading them.
+static bool readPpmHeader(std::istream& in, uint32_t& width, uint32_t& height)
+{
+	auto field = [&in]() -> std::istream&		// Skip the whitespace and comments ('#' up to the end of the line) before a field
+	{
+		while (in >> std::ws && in.peek() == '#')
+			in.ignore(std::numeric_limits<std::streamsize>::max(), '\n');
+		return in;
+	};
+
+	std::string magic;
+	int maxValue = 0;
+	if (!(field() >> magic) || magic != "P6" || !(field() >> width) || !(field() >> height) || !(field() >> maxValue) || maxValue != 255) return false;
+	in.get();		// Single whitespace before the pixels
+	return true;
+}
+
+void Renderer::checkLastFrame()
+{
+	if (lastFrame.empty()) return;
+	uint32_t width	= e.swapChainExtent.width;
+	uint32_t height	= e.swapChainExtent.height;
+
+	if (!headlessImagePath.empty())
+	{
+		if (!writePpm(headlessImagePath, lastFrame, width, height))
+			throw std::runtime_error("Failed to write headless image " + headlessImagePath + "!");
+		std::cout << "Last frame saved to " << headlessImagePath << std::endl;
+	}
+
+	if (goldenImagePath.empty()) return;
+
+	std::ifstream in(goldenImagePath, std::ios::binary);
+	uint32_t goldenWidth, goldenHeight;
+	if (!readPpmHeader(in, goldenWidth, goldenHeight))
+		throw std::runtime_error("Failed to read golden image " + goldenImagePath + "!");
+	if (goldenWidth != width || goldenHeight != height)
+		throw std::runtime_error("Golden image " + goldenImagePath + " has a different size than the last frame!");
+
+	std::vector<uint8_t> golden((size_t)width * height * 3);		// Allocated once the header matches the frame
+	if (!in.read((char*)golden.data(), (std::streamsize)golden.size()))
+		throw std::runtime_error("Failed to read golden image " + goldenImagePath + "!");
+
+	size_t differing = 0;
+	int maxDifference = 0;
+	for (size_t p = 0; p < (size_t)width * height; p++)
+	{
+		int difference = 0;
+		for (size_t c = 0; c < 3; c++)
+			difference = std::max(difference, std::abs((int)lastFrame[p * 4 + c] - (int)golden[p * 3 + c]));
+		if (difference > goldenTolerance) differing++;
+		maxDifference = std::max(maxDifference, difference);
+	}
+
+	std::cout << "Golden image comparison: " << differing << " pixels differ by more than " << goldenTolerance << " (max difference " << maxDifference << ")" << std::endl;
+	if (differing > goldenMaxDiffering * width * height)
+		throw std::runtime_error("The last frame doesn't match the golden image " + goldenImagePath + "!");
+}
+
 /**
 *	Acquire image from swap chain, execute command buffer with that image as attachment in the framebuffer, and return the image to the swap chain for presentation.
 *	This method performs 3 operations asynchronously (the function call returns before the operations are finished, with undefined order of execution):
@@ -168,11 +776,25 @@ void Renderer::mainLoop()
 */
 void Renderer::drawFrame()
 {
-	vkWaitForFences(e.device, 1, &inFlightFences[currentFrame], VK_TRUE, UINT64_MAX);		// Wait for the frame to be finished. If VK_TRUE, we wait for all fences.
+	{
+		ProfileScope scope(profiler, "Fence wait");
+		vkWaitForFences(e.device, 1, &inFlightFences[currentFrame], VK_TRUE, UINT64_MAX);		// Wait for the frame to be finished. If VK_TRUE, we wait for all fences.
+	}
+
+	// Models added, removed or replaced by the streaming thread (it never makes this thread wait for the disk)
+	{
+		ProfileScope scope(profiler, "Scene changes");
+		applySceneChanges();
+	}
 
-	// Acquire an image from the swap chain
+	// Acquire an image from the swap chain (headless mode: the offscreen images are used in turn)
 	uint32_t imageIndex;
-	VkResult result = vkAcquireNextImageKHR(e.device, e.swapChain, UINT64_MAX, imageAvailableSemaphores[currentFrame], VK_NULL_HANDLE, &imageIndex);		// Swap chain is an extension feature. imageIndex: index to the VkImage in our swapChainImages.
+	VkResult result = VK_SUCCESS;
+	uint32_t acquireScope = profiler.beginCpuScope("Acquire");		// Until the image is free (an early return leaves it open until endFrame())
+	if (e.headless)
+		imageIndex = static_cast<uint32_t>(frameCount % e.swapChainImages.size());
+	else
+		result = vkAcquireNextImageKHR(e.device, e.swapChain, UINT64_MAX, imageAvailableSemaphores[currentFrame], VK_NULL_HANDLE, &imageIndex);		// Swap chain is an extension feature. imageIndex: index to the VkImage in our swapChainImages.
 	if (result == VK_ERROR_OUT_OF_DATE_KHR) {					// VK_ERROR_OUT_OF_DATE_KHR: The swap chain became incompatible with the surface and can no longer be used for rendering. Usually happens after window resize.
 		recreateSwapChain();
 		return;
@@ -180,33 +802,57 @@ void Renderer::drawFrame()
 	else if (result != VK_SUCCESS && result != VK_SUBOPTIMAL_KHR)	// VK_SUBOPTIMAL_KHR: The swap chain can still be used to successfully present to the surface, but the surface properties are no longer matched exactly.
 		throw std::runtime_error("Failed to acquire swap chain image!");
 
-	// <<< Update uniforms
-	updateUniformBuffer(imageIndex);
-
 	// Check if this image is being used. If used, wait. Then, mark it as used by this frame.
 	if (imagesInFlight[imageIndex] != VK_NULL_HANDLE)									// Check if a previous frame is using this image (i.e. there is its fence to wait on)
 		vkWaitForFences(e.device, 1, &imagesInFlight[imageIndex], VK_TRUE, UINT64_MAX);
 	imagesInFlight[imageIndex] = inFlightFences[currentFrame];							// Mark the image as now being in use by this frame
+	profiler.endCpuScope(acquireScope);
+
+	// GPU results of the last frame that used this image (it has finished, so they are read without waiting)
+	profiler.collect(imageIndex);
+
+	// <<< Update uniforms (after waiting for the image, since the GPU may still be reading the uniform arena region of this image)
+	{
+		ProfileScope scope(profiler, "Uniform update");
+		updateUniformBuffer(imageIndex);
+	}
+
+	// Record the command buffer (per-frame recording mode)
+	if (perFrameRecording)
+	{
+		ProfileScope scope(profiler, "Recording");
+		recordCommandBuffer(imageIndex);
+	}
 
 	// <<< Submit the command buffer
 	VkSubmitInfo submitInfo{};
 	submitInfo.sType					= VK_STRUCTURE_TYPE_SUBMIT_INFO;
 	VkSemaphore waitSemaphores[]		= { imageAvailableSemaphores[currentFrame] };			// Which semaphores to wait on before execution begins.
 	VkPipelineStageFlags waitStages[]	= { VK_PIPELINE_STAGE_COLOR_ATTACHMENT_OUTPUT_BIT };	// In which stages of the pipeline to wait the semaphore. VK_PIPELINE_STAGE_ ... TOP_OF_PIPE_BIT (ensures that the render passes don't begin until the image is available), COLOR_ATTACHMENT_OUTPUT_BIT (makes the render pass wait for this stage).
-	submitInfo.waitSemaphoreCount		= 1;
+	submitInfo.waitSemaphoreCount		= e.headless ? 0 : 1;		// Headless mode: nothing to wait for (no acquire) nor to signal (no present)
 	submitInfo.pWaitSemaphores			= waitSemaphores;
 	submitInfo.pWaitDstStageMask		= waitStages;
 	submitInfo.commandBufferCount		= 1;
 	submitInfo.pCommandBuffers			= &commandBuffers[imageIndex];
 	//submitInfo.pCommandBuffers		= commandBuffers.data();						// Command buffers to submit for execution (here, the one that binds the swap chain image we just acquired as color attachment).
 	VkSemaphore signalSemaphores[]		= { renderFinishedSemaphores[currentFrame] };	// Which semaphores to signal once the command buffers have finished execution.
-	submitInfo.signalSemaphoreCount		= 1;
+	submitInfo.signalSemaphoreCount		= e.headless ? 0 : 1;
 	submitInfo.pSignalSemaphores		= signalSemaphores;
 
 	vkResetFences(e.device, 1, &inFlightFences[currentFrame]);		// Reset the fence to the unsignaled state.
 
+	uint32_t submitScope = profiler.beginCpuScope("Submit");
 	if (vkQueueSubmit(e.graphicsQueue, 1, &submitInfo, inFlightFences[currentFrame]) != VK_SUCCESS)	// Submit the command buffer to the graphics queue. An array of VkSubmitInfo structs can be taken as argument when workload is much larger, for efficiency.
 		throw std::runtime_error("Failed to submit draw command buffer!");
+	profiler.endCpuScope(submitScope);
+	profiler.submitted(imageIndex);
+	frameCount++;
+
+	if (e.headless)
+	{
+		currentFrame = (currentFrame + 1) % MAX_FRAMES_IN_FLIGHT;
+		return;
+	}
 
 	// Note:
 	// Subpass dependencies: Subpasses in a render pass automatically take care of image layout transitions. These transitions are controlled by subpass dependencies (specify memory and execution dependencies between subpasses).
@@ -226,8 +872,11 @@ void Renderer::drawFrame()
 	presentInfo.pImageIndices		= &imageIndex;
 	presentInfo.pResults			= nullptr;			// Optional
 
+	uint32_t presentScope = profiler.beginCpuScope("Present");
 	result = vkQueuePresentKHR(e.presentQueue, &presentInfo);		// Submit request to present an image to the swap chain. Our triangle may look a bit different because the shader interpolates in linear color space and then converts to sRGB color space.
 
+	profiler.endCpuScope(presentScope);
+
 	if (result == VK_ERROR_OUT_OF_DATE_KHR || result == VK_SUBOPTIMAL_KHR || input.framebufferResized) {
 		input.framebufferResized = false;
 		recreateSwapChain();
@@ -240,6 +889,88 @@ void Renderer::drawFrame()
 	// vkQueueWaitIdle(presentQueue);							// Make the whole graphics pipeline to be used only one frame at a time (instead of using this, we use multiple semaphores for processing frames concurrently).
 }
 
+/**
+*	Apply the changes loaded by the streaming thread (at most maxSceneChangesPerFrame per frame): new models get their GPU resources here, removed ones are retired, and models whose instances changed are replaced by a new version that keeps their assets (the old one is retired).
+*	Retired models can't be destroyed right away, since frames in flight may still draw them. A model retired before recording frame f was last used by frame f - 1. The fence waited at the start of frame f' means that frame f' - MAX_FRAMES_IN_FLIGHT has finished (and the ones before it, submitted earlier to the same queue), so the model is destroyed at frame f - 1 + MAX_FRAMES_IN_FLIGHT.
+*	The static command buffers (and the GPU-driven scene) are built from the list of models, so they are recorded again when it changes.
+*/
+void Renderer::applySceneChanges()
+{
+	destroyRetiredModels(false);
+
+	size_t applied = 0;
+	for (; applied < maxSceneChangesPerFrame; applied++)
+	{
+		std::unique_ptr<SceneChange> change(streamer.poll());
+		if (!change) break;
+
+		auto it = handles.find(change->handle);
+		if (change->type == SceneChange::Add)
+		{
+			m.push_back(std::move(*change->model));
+			m.back().createResources();
+			handles[change->handle] = std::prev(m.end());
+		}
+		else if (it == handles.end()) continue;
+		else if (change->type == SceneChange::Remove)
+		{
+			retireModel(it->second);
+			handles.erase(it);
+		}
+		else		// Instances: the new version takes the position and the mesh of the old one, and gets its own per-instance resources
+		{
+			std::list<modelData>::iterator model = m.emplace(it->second, std::move(*it->second), change->modelMatrices);
+			retireModel(it->second);
+			it->second = model;
+		}
+	}
+
+	if (!applied) return;
+
+	e.uploader.flush();					// Uploads of the new models. The frame is submitted to the same queue, so it's ordered after them.
+	modelMatrices.clear();				// Objects are numbered in list order: every one is set again in updateUniformBuffer().
+	renderQueue.resetIds();				// The handles of new and retired models: ids are given again to the current ones, so streaming doesn't grow the maps forever.
+	if (!perFrameRecording) rebuildCommandBuffers();
+}
+
+void Renderer::retireModel(std::list<modelData>::iterator model)
+{
+	retired.splice(retired.end(), m, model);
+	retiredFrames.push_back(frameCount);
+}
+
+void Renderer::destroyRetiredModels(bool all)
+{
+	while (!retired.empty() && (all || frameCount + 1 >= retiredFrames.front() + MAX_FRAMES_IN_FLIGHT))
+	{
+		modelNames.erase(&retired.front());
+		retired.front().cleanupSwapChain();
+		retired.front().cleanup();
+		retired.pop_front();
+		retiredFrames.pop_front();
+	}
+}
+
+void Renderer::rebuildCommandBuffers()
+{
+	vkWaitForFences(e.device, static_cast<uint32_t>(inFlightFences.size()), inFlightFences.data(), VK_TRUE, UINT64_MAX);	// The command buffers may be pending in other frames
+	vkFreeCommandBuffers(e.device, e.commandPool, static_cast<uint32_t>(commandBuffers.size()), commandBuffers.data());
+
+	if (e.gpuDriven)		// Instance table and draws of the new list of models
+	{
+		VkShaderModule cullShader = e.states.getShaderModule(cullShaderPath.c_str());	// An extra reference keeps the culling shader alive while the scene is rebuilt (so it's not read from disk again).
+		gpuScene.destroyFrameResources();
+		gpuScene.cleanup();
+		gpuScene.init(e, m, cullShaderPath.c_str());
+		e.states.releaseShaderModule(cullShader);
+
+		vkDestroyDescriptorPool(e.device, globalDescriptorPool, nullptr);	// The global descriptor sets point to the instance table and the visible list
+		createGlobalDescriptorSets();
+	}
+
+	createCommandBuffers();
+}
+
 /// The window surface may change, making the swap chain no longer compatible with it (example: window resizing). Here, we catch these events and recreate the swap chain.
 void Renderer::recreateSwapChain()
 {
@@ -251,6 +982,7 @@ void Renderer::recreateSwapChain()
 	}
 
 	vkDeviceWaitIdle(e.device);			// We shouldn't touch resources that may be in use.
+	destroyRetiredModels(true);			// Nothing is in flight now
 
 	// Cleanup swapChain:
 	cleanupSwapChain();
@@ -264,6 +996,10 @@ void Renderer::recreateSwapChain()
 		it->recreateSwapChain();
 
 	//    - Renderer
+	renderQueue.resetIds();				// Pipelines and buffers were recreated (new handles).
+	if (e.gpuDriven) gpuScene.createFrameResources();	// Regions per swap chain image (the instance table is written again in full).
+	createGlobalDescriptorSets();		// Global descriptor sets (one per swap chain image).
+	profiler.createFrameResources(static_cast<uint32_t>(e.swapChainImages.size()));	// Query pools (one set per swap chain image).
 	createCommandBuffers();				// Command buffers directly depend on the swap chain images.
 	imagesInFlight.resize(e.swapChainImages.size(), VK_NULL_HANDLE);
 }
@@ -281,47 +1017,203 @@ void Renderer::updateUniformBuffer(uint32_t currentImage)
 	//float deltaTime		= time - prevTime;
 	//prevTime				= time;
 	
-	// Compute transformation matrix
-	input.cam.ProcessCameraInput(timer.getDeltaTime());
+	// Compute transformation matrix (headless mode: fixed time step, no input)
+	float time = e.headless ? (float)(frameCount * headlessTimeStep) : (float)timer.getTime();
+	if (!e.headless) input.cam.ProcessCameraInput(timer.getDeltaTime());
+
+	// Write the UBOs straight into the uniform arena region of the current image (persistently mapped and host coherent: no vkMapMemory, no staging copy, no heap allocation).
+	//    - Global UBO (once per frame)
+	GlobalUBO* global	= (GlobalUBO*)e.uniforms.getMapped(currentImage, globalUniformOffset);
+	global->view		= input.cam.GetViewMatrix();
+	global->proj		= input.cam.GetProjectionMatrix(e.swapChainExtent.width / (float)e.swapChainExtent.height);
+	global->viewProj	= global->proj * global->view;
+	global->camPos		= glm::vec4(input.cam.Position, 1.0f);
+	global->time		= time;
+
+	//    - Model matrix and world bounds of every instance
+
+	size_t objectCount = 0;
+	for (std::list<modelData>::iterator it = m.begin(); it != m.end(); it++)
+		objectCount += it->getModelMatrix.size();
+
+	if (culling.size() != objectCount || modelMatrices.size() != objectCount)		// Objects added or removed (modelMatrices is cleared when the models change)
+	{
+		culling.resize(objectCount);
+		modelMatrices.assign(objectCount, glm::mat4(0.f));		// Not a valid model matrix: every object is set below
+		worldMin.resize(objectCount);
+		worldMax.resize(objectCount);
+		sceneBvhValid = false;
+	}
+
+	//      Only the objects whose matrix changed are updated (and refitted in the BVH).
+	bool useBvh = useCulling && perFrameRecording && objectCount >= bvhMinObjects;
+	if (!useBvh) sceneBvhValid = false;
+	size_t object = 0;
+	for (std::list<modelData>::iterator it = m.begin(); it != m.end(); it++)
+		for (size_t i = 0; i < it->getModelMatrix.size(); i++, object++)
+		{
+			glm::mat4 modelMatrix = it->getModelMatrix[i](time);
+			if (modelMatrix == modelMatrices[object]) continue;
+
+			modelMatrices[object] = modelMatrix;
+
+			if (e.gpuDriven)		// Only the instance table (culling happens on the GPU)
+			{
+				glm::vec3 center	= glm::vec3(modelMatrix * glm::vec4(glm::vec3(it->boundingSphere), 1.f));
+				float scale			= std::max(glm::length(glm::vec3(modelMatrix[0])), std::max(glm::length(glm::vec3(modelMatrix[1])), glm::length(glm::vec3(modelMatrix[2]))));
+				gpuScene.setInstance(object, it->getModel(modelMatrix), glm::vec4(center, it->boundingSphere.w * scale));
+				continue;
+			}
+
+			culling.set(object, it->boundsMin, it->boundsMax, it->boundingSphere.w, modelMatrix);
+			transformBox(it->boundsMin, it->boundsMax, modelMatrix, worldMin[object], worldMax[object]);
+			if (sceneBvhValid) sceneBvh.update(static_cast<uint32_t>(object), worldMin[object], worldMax[object]);
+		}
 
-	UniformBufferObject ubo{};
-	ubo.view = input.cam.GetViewMatrix();
-	ubo.proj = input.cam.GetProjectionMatrix(e.swapChainExtent.width / (float)e.swapChainExtent.height);
+	//    - GPU-driven mode: culling parameters (the cull pass selects the LODs with the same thresholds as selectLod()). Nothing else is done per object.
+	if (e.gpuDriven)
+	{
+		GpuCullParams params{};
+		Frustum frustum(global->viewProj);
+		std::copy(frustum.planes, frustum.planes + 6, params.planes);
+		params.camPos				= global->camPos;
+		params.lodThresholdCount	= static_cast<uint32_t>(std::min<size_t>(lodScreenSizes.size(), 4));
+		for (uint32_t l = 0; l < params.lodThresholdCount; l++)
+			params.lodScreenSizes[l] = lodScreenSizes[l];
+		params.tanHalfFov			= std::tan(glm::radians(input.cam.fov) / 2.f);
+		params.lodHysteresis		= lodHysteresis;
+		params.useCulling			= useCulling;
+		params.useLods				= useLods;
+
+		gpuScene.update(currentImage, params);
+		return;
+	}
 
-	// Copy the data in the uniform buffer object to the current uniform buffer
+	//    - Frustum culling. The visible list drives the recording of the draws (the command buffer of this image is recorded after this), so it's only used in per-frame recording mode.
+	//      Big scenes use the BVH: whole groups of instances are accepted or rejected at once. Its result isn't sorted, but the loop below needs the objects in increasing order.
+	size_t visibleCount = objectCount;
+	if (useBvh)
+	{
+		if (!sceneBvhValid)
+		{
+			sceneBvh.build(worldMin.data(), worldMax.data(), objectCount, &workers);
+			sceneBvhValid = true;
+		}
+		else sceneBvh.refit();
+
+		visibleObjects.clear();
+		sceneBvh.queryFrustum(Frustum(global->viewProj), visibleObjects, &workers);
+		std::sort(visibleObjects.begin(), visibleObjects.end());
+		visibleCount = visibleObjects.size();
+	}
+	else if (useCulling && perFrameRecording)
+	{
+		visibleObjects.resize(objectCount);
+		visibleCount = culling.cull(Frustum(global->viewProj), visibleObjects.data());
+	}
+	else
+	{
+		visibleObjects.resize(objectCount);
+		for (size_t o = 0; o < objectCount; o++) visibleObjects[o] = static_cast<uint32_t>(o);
+	}
+
+	cullingStats.visible	= visibleCount;
+	cullingStats.culled		= objectCount - visibleCount;
+
+	//    - Per-object UBOs (just the model matrices) and LOD of each visible instance
 	// <<< Using a UBO this way is not the most efficient way to pass frequently changing values to the shader. Push constants are more efficient for passing a small buffer of data to shaders.
+	float tanHalfFov	= std::tan(glm::radians(input.cam.fov) / 2.f);
+	size_t firstObject	= 0;
+	size_t v			= 0;
+	meshletStats		= MeshletCullingStats();
+
 	for (std::list<modelData>::iterator it = m.begin(); it != m.end(); it++)
 	{
-		if (it->getModelMatrix.size() == 1)
+		size_t instanceCount		= it->getModelMatrix.size();
+		const glm::mat4* matrices	= &modelMatrices[firstObject];
+
+		it->visibleInstances.clear();
+		for (; v < visibleCount && visibleObjects[v] < firstObject + instanceCount; v++)
+			it->visibleInstances.push_back(static_cast<uint32_t>(visibleObjects[v] - firstObject));
+		firstObject += instanceCount;
+
+		bool selectLods = useLods && perFrameRecording && it->lods.size() > 1;
+		for (uint32_t i : it->visibleInstances)
+			it->instanceLods[i] = selectLods ? selectLod(*it, it->instanceLods[i], matrices[i], tanHalfFov) : 0;
+
+		void* dst = e.uniforms.getMapped(currentImage, it->uniformOffset);
+
+		if (it->instanced)
 		{
-			ubo.model = it->getModelMatrix[0](timer.getTime());
+			// Write the visible instances grouped by LOD (counting sort), so each LOD is drawn with a single instanced draw call.
+			InstanceData* instances = (InstanceData*)((char*)it->instanceBufferMemory.mapped + currentImage * it->instanceRegionSize);
+
+			uint32_t cursor[modelData::maxLods + 1] = { };
+			for (uint32_t i : it->visibleInstances)
+				cursor[it->instanceLods[i] + 1]++;
+			for (size_t lod = 0; lod < it->lods.size(); lod++)
+				cursor[lod + 1] += cursor[lod];
+			std::copy(cursor, cursor + it->lods.size() + 1, it->lodFirstInstance.begin());
 
-			void* data;
-			vkMapMemory(e.device, it->uniformBuffersMemory[currentImage], 0, sizeof(ubo), 0, &data);	// Get a pointer to some Vulkan/GPU memory of size X. vkMapMemory retrieves a host virtual address pointer (data) to a region of a mappable memory object (uniformBuffersMemory[]). We have to provide the logical device that owns the memory (e.device).
-			memcpy(data, &ubo, sizeof(ubo));															// Copy some data in that memory. Copies a number of bytes (sizeof(ubo)) from a source (ubo) to a destination (data).
-			vkUnmapMemory(e.device, it->uniformBuffersMemory[currentImage]);							// "Get rid" of the pointer. Unmap a previously mapped memory object (uniformBuffersMemory[]).
+			for (uint32_t i : it->visibleInstances)
+				instances[cursor[it->instanceLods[i]]++].model = it->getModel(matrices[i]);
 		}
-		else
+		else if (!it->dynamicUBO)
 		{
-			UBOdynamic uboD(it->getModelMatrix.size(), it->dynamicOffsets[1]);	// dynamicOffsets[1] == individual UBO size
-			for (size_t i = 0; i < uboD.UBOcount; i++)
+			UniformBufferObject* ubo = (UniformBufferObject*)dst;
+			ubo->model	= it->getModel(matrices[0]);
+
+			// Ranges of the index buffer to draw: the selected LOD, or the meshlets of LOD 0 that may be visible (tested in model space: the frustum and the camera are transformed to it).
+			it->drawRanges.clear();
+			if (useMeshletCulling && perFrameRecording && it->instanceLods[0] == 0 && !it->meshlets.empty() && !it->visibleInstances.empty())
 			{
-				uboD.setModel(i, it->getModelMatrix[i](timer.getTime()));
-				uboD.setView (i, ubo.view);
-				uboD.setProj (i, ubo.proj);
+				MeshletCullingStats stats = cullMeshlets(it->meshlets.data(), it->meshlets.size(), Frustum(global->viewProj * matrices[0]), glm::vec3(glm::inverse(matrices[0]) * global->camPos), it->drawRanges, meshletMergeGap);
+				meshletStats.visible	+= stats.visible;
+				meshletStats.backFacing	+= stats.backFacing;
+				meshletStats.outside	+= stats.outside;
+			}
+			else
+			{
+				const MeshLod& lod = it->lods[it->instanceLods[0]];
+				it->drawRanges.push_back(DrawRange{ lod.firstIndex, lod.indexCount });
 			}
-
-			void* data;
-			vkMapMemory(e.device, it->uniformBuffersMemory[currentImage], 0, uboD.totalBytes, 0, &data);	// Get a pointer to some Vulkan/GPU memory of size X. vkMapMemory retrieves a host virtual address pointer (data) to a region of a mappable memory object (uniformBuffersMemory[]). We have to provide the logical device that owns the memory (e.device).
-			memcpy(data, uboD.data, uboD.totalBytes);														// Copy some data in that memory. Copies a number of bytes (sizeof(ubo)) from a source (ubo) to a destination (data).
-			vkUnmapMemory(e.device, it->uniformBuffersMemory[currentImage]);								// "Get rid" of the pointer. Unmap a previously mapped memory object (uniformBuffersMemory[]).
+		}
+		else
+		{
+			UBOdynamic uboD(it->getModelMatrix.size(), it->dynamicOffsets[1], dst);	// dynamicOffsets[1] == individual UBO size
+			for (uint32_t i : it->visibleInstances)
+				uboD.setModel(i, it->getModel(matrices[i]));
 		}
 	}
 }
 
+/**
+*	Projected size of an instance: diameter of its bounding sphere relative to the screen height (radius / (distance * tan(fov / 2))). It's compared with the LOD thresholds (lodScreenSizes) with some margin (lodHysteresis), so an instance near a threshold doesn't switch LOD every frame.
+*/
+uint32_t Renderer::selectLod(const modelData& model, uint32_t currentLod, const glm::mat4& modelMatrix, float tanHalfFov)
+{
+	glm::vec3 center	= glm::vec3(modelMatrix * glm::vec4(glm::vec3(model.boundingSphere), 1.f));
+	float scale			= std::max(glm::length(glm::vec3(modelMatrix[0])), std::max(glm::length(glm::vec3(modelMatrix[1])), glm::length(glm::vec3(modelMatrix[2]))));
+	float radius		= model.boundingSphere.w * scale;
+	float distance		= glm::length(center - input.cam.Position);
+	if (distance <= radius) return 0;								// Camera inside the bounding sphere
+	float size			= radius / (distance * tanHalfFov);
+
+	uint32_t lod = std::min(currentLod, static_cast<uint32_t>(model.lods.size() - 1));
+	while (lod + 1 < model.lods.size() && lod < lodScreenSizes.size() && size < lodScreenSizes[lod] * (1.f - lodHysteresis))
+		lod++;
+	while (lod > 0 && size > lodScreenSizes[lod - 1] * (1.f + lodHysteresis))
+		lod--;
+	return lod;
+}
+
 /// Cleanup after render loop terminated
 void Renderer::cleanup()
 {
+	// Streaming thread and models waiting to be destroyed (the device is idle)
+	streamer.stop();
+	destroyRetiredModels(true);
+
 	// Cleanup renderer
 	cleanupSwapChain();
 
@@ -331,6 +1223,9 @@ void Renderer::cleanup()
 		vkDestroyFence(e.device, inFlightFences[i], nullptr);
 	}
 
+	e.uniforms.release(globalUniformOffset, sizeof(GlobalUBO));				// Global UBO
+	if (e.gpuDriven) gpuScene.cleanup();									// Instance table, draws and culling pipelines
+
 	// Cleanup each model
 	for(std::list<modelData>::iterator it = m.begin(); it != m.end(); it++)
 		it->cleanup();
@@ -343,7 +1238,18 @@ void Renderer::cleanup()
 void Renderer::cleanupSwapChain()
 {
 	// Renderer (free Command buffers)
-	vkFreeCommandBuffers(e.device, e.commandPool, static_cast<uint32_t>(commandBuffers.size()), commandBuffers.data());
+	if (perFrameRecording)
+	{
+		for (VkCommandPool pool : primaryPools)		vkDestroyCommandPool(e.device, pool, nullptr);	// Destroying a pool frees its command buffers
+		for (VkCommandPool pool : secondaryPools)	vkDestroyCommandPool(e.device, pool, nullptr);
+		primaryPools.clear();
+		secondaryPools.clear();
+	}
+	else
+		vkFreeCommandBuffers(e.device, e.commandPool, static_cast<uint32_t>(commandBuffers.size()), commandBuffers.data());
+	vkDestroyDescriptorPool(e.device, globalDescriptorPool, nullptr);		// Global descriptor sets are freed with the pool
+	if (e.gpuDriven) gpuScene.destroyFrameResources();
+	profiler.destroyFrameResources();		// Collects the results of the frames in flight (the device is idle)
 
 	// Models
 	for (std::list<modelData>::iterator it = m.begin(); it != m.end(); it++)
@@ -0,0 +1,184 @@
+#include <iostream>
+#include <chrono>
+
+#include "sceneStreamer.hpp"
+
+SceneStreamer::~SceneStreamer() { stop(); }
+
+void SceneStreamer::start(VulkanEnvironment& environment)
+{
+	e			= &environment;
+	stopping	= false;
+	thread		= std::thread(&SceneStreamer::run, this);
+}
+
+void SceneStreamer::stop()
+{
+	{
+		std::lock_guard<std::mutex> lock(mtx);
+		stopping = true;
+		requests.clear();
+	}
+	requestReady.notify_one();
+	if (thread.joinable()) thread.join();
+
+	while (SceneChange* change = poll())
+		delete change;
+	configs.clear();
+}
+
+ModelHandle SceneStreamer::track(const modelConfig& config)
+{
+	Request request;
+	request.type	= Request::Track;
+	request.handle	= nextHandle++;
+	request.config.reset(new modelConfig(config));
+
+	ModelHandle handle = request.handle;
+	enqueue(std::move(request));
+	return handle;
+}
+
+ModelHandle SceneStreamer::add(const modelConfig& config)
+{
+	Request request;
+	request.type	= Request::Add;
+	request.handle	= nextHandle++;
+	request.config.reset(new modelConfig(config));
+
+	ModelHandle handle = request.handle;
+	enqueue(std::move(request));
+	return handle;
+}
+
+void SceneStreamer::remove(ModelHandle model)
+{
+	Request request;
+	request.type	= Request::Remove;
+	request.handle	= model;
+	enqueue(std::move(request));
+}
+
+void SceneStreamer::addInstance(ModelHandle model, const std::function<glm::mat4(float)>& getModelMatrix)
+{
+	Request request;
+	request.type			= Request::AddInstance;
+	request.handle			= model;
+	request.getModelMatrix	= getModelMatrix;
+	enqueue(std::move(request));
+}
+
+void SceneStreamer::removeInstance(ModelHandle model, size_t instance)
+{
+	Request request;
+	request.type		= Request::RemoveInstance;
+	request.handle		= model;
+	request.instance	= instance;
+	enqueue(std::move(request));
+}
+
+void SceneStreamer::enqueue(Request&& request)
+{
+	{
+		std::lock_guard<std::mutex> lock(mtx);
+		if (stopping) return;
+		requests.push_back(std::move(request));
+	}
+	requestReady.notify_one();
+}
+
+void SceneStreamer::run()
+{
+	while (true)
+	{
+		Request request;
+		{
+			std::unique_lock<std::mutex> lock(mtx);
+			requestReady.wait(lock, [this]() { return stopping || !requests.empty(); });
+			if (stopping) return;
+
+			request = std::move(requests.front());
+			requests.pop_front();
+		}
+
+		process(request);		// Outside the lock: requests can be made while a model loads
+	}
+}
+
+void SceneStreamer::process(Request& request)
+{
+	auto it = configs.find(request.handle);
+
+	if (request.type == Request::Track)
+	{
+		configs[request.handle] = std::move(request.config);
+		return;
+	}
+
+	if (request.type == Request::Add)
+	{
+		if (SceneChange* change = load(request.handle, *request.config))
+		{
+			configs[request.handle] = std::move(request.config);
+			send(change);
+		}
+		return;
+	}
+
+	if (it == configs.end()) return;		// Unknown model, already removed, or it couldn't be loaded
+
+	// Instances: the render thread rebuilds only the per-instance resources of the model (its assets stay loaded)
+	modelConfig config(*it->second);
+	if (request.type == Request::AddInstance)
+		config.getModelMatrices.push_back(request.getModelMatrix);
+	else if (request.type == Request::RemoveInstance)
+	{
+		if (request.instance >= config.getModelMatrices.size()) return;
+		config.getModelMatrices.erase(config.getModelMatrices.begin() + request.instance);
+	}
+
+	if (request.type == Request::Remove || config.getModelMatrices.empty())
+	{
+		configs.erase(it);
+		send(new SceneChange{ SceneChange::Remove, request.handle, nullptr, {} });
+		return;
+	}
+
+	it->second.reset(new modelConfig(config));
+	send(new SceneChange{ SceneChange::Instances, request.handle, nullptr, config.getModelMatrices });
+}
+
+SceneChange* SceneStreamer::load(ModelHandle handle, const modelConfig& config)
+{
+	try
+	{
+		std::unique_ptr<modelData> model(new modelData(*e, config, true));
+		model->loadAssets();
+		return new SceneChange{ SceneChange::Add, handle, std::move(model), {} };
+	}
+	catch (const std::exception& ex)
+	{
+		std::cerr << "Failed to load model " << config.modelPath << ": " << ex.what() << std::endl;
+		return nullptr;
+	}
+}
+
+void SceneStreamer::send(SceneChange* change)
+{
+	while (!ready.push(change))
+	{
+		if (stopping)
+		{
+			delete change;
+			return;
+		}
+		std::this_thread::sleep_for(std::chrono::milliseconds(1));
+	}
+}
+
+SceneChange* SceneStreamer::poll()
+{
+	SceneChange* change = nullptr;
+	ready.pop(change);
+	return change;
+}
@@ -0,0 +1,288 @@
+#include <algorithm>
+#include <cstring>
+#include <cmath>
+
+#include "simplifier.hpp"
+
+
+namespace
+{
+	/// Symmetric 4x4 matrix Q such that the error of a point p is [p 1] Q [p 1]^T (sum of squared distances to a set of planes, weighted by area).
+	struct Quadric
+	{
+		double a00 = 0, a01 = 0, a02 = 0, a11 = 0, a12 = 0, a22 = 0;
+		double b0 = 0, b1 = 0, b2 = 0;
+		double c = 0;
+
+		static Quadric fromPlane(double nx, double ny, double nz, double d, double weight)
+		{
+			Quadric q;
+			q.a00 = weight * nx * nx;	q.a01 = weight * nx * ny;	q.a02 = weight * nx * nz;
+			q.a11 = weight * ny * ny;	q.a12 = weight * ny * nz;	q.a22 = weight * nz * nz;
+			q.b0  = weight * nx * d;	q.b1  = weight * ny * d;	q.b2  = weight * nz * d;
+			q.c   = weight * d * d;
+			return q;
+		}
+
+		Quadric& operator+=(const Quadric& q)
+		{
+			a00 += q.a00; a01 += q.a01; a02 += q.a02; a11 += q.a11; a12 += q.a12; a22 += q.a22;
+			b0 += q.b0; b1 += q.b1; b2 += q.b2;
+			c += q.c;
+			return *this;
+		}
+
+		double error(const float* p) const
+		{
+			double x = p[0], y = p[1], z = p[2];
+			double e =	a00 * x * x + a11 * y * y + a22 * z * z + 2 * (a01 * x * y + a02 * x * z + a12 * y * z) +
+						2 * (b0 * x + b1 * y + b2 * z) + c;
+			return e > 0 ? e : 0;
+		}
+	};
+
+	/// How a position can move.
+	enum VertexKind : uint8_t
+	{
+		MANIFOLD,		///< Interior vertex (one vertex id): it can collapse onto any neighbour.
+		BORDER,			///< On an open border (one vertex id, 2 border edges): it can only slide along the border.
+		SEAM,			///< On an attribute seam (two vertex ids, 2 seam edges): it can only slide along the seam (both ids at once).
+		LOCKED			///< Anything else (seam corners, non-manifold edges...): it doesn't move.
+	};
+
+	struct Collapse
+	{
+		double		cost;
+		uint32_t	from, to;
+
+		bool operator<(const Collapse& other) const { return cost < other.cost; }
+	};
+
+	uint64_t edgeKey(uint32_t a, uint32_t b) { return uint64_t(std::min(a, b)) << 32 | std::max(a, b); }
+
+	/// Number of times an edge appears in a sorted edge list.
+	size_t edgeCount(const std::vector<uint64_t>& edges, uint64_t key)
+	{
+		auto range = std::equal_range(edges.begin(), edges.end(), key);
+		return range.second - range.first;
+	}
+
+	void triangleNormal(const float* a, const float* b, const float* c, float n[3])
+	{
+		float e1[3] = { b[0] - a[0], b[1] - a[1], b[2] - a[2] };
+		float e2[3] = { c[0] - a[0], c[1] - a[1], c[2] - a[2] };
+		n[0] = e1[1] * e2[2] - e1[2] * e2[1];
+		n[1] = e1[2] * e2[0] - e1[0] * e2[2];
+		n[2] = e1[0] * e2[1] - e1[1] * e2[0];
+	}
+}
+
+std::vector<uint32_t> simplifyMesh(const std::vector<uint32_t>& input, const float* positions, size_t positionStride, size_t vertexCount, size_t targetIndexCount)
+{
+	auto position = [&](uint32_t v) { return (const float*)((const char*)positions + v * positionStride); };
+
+	std::vector<uint32_t> indices = input;
+	if (indices.size() <= targetIndexCount || vertexCount == 0) return indices;
+
+	// 1. Canonical vertex of each position (vertices split by attribute seams share it), and the ids of each position (CSR: ids of position p are members[groupStart[p]] ... members[groupStart[p + 1] - 1]).
+	std::vector<uint32_t> canonical(vertexCount), groupStart(vertexCount + 1, 0), members(vertexCount);
+	{
+		std::vector<uint32_t> order(vertexCount);
+		for (uint32_t v = 0; v < vertexCount; v++) order[v] = v;
+		auto less = [&](uint32_t a, uint32_t b) { return memcmp(position(a), position(b), 3 * sizeof(float)) < 0; };
+		std::sort(order.begin(), order.end(), less);
+
+		for (size_t i = 0; i < vertexCount; i++)
+			canonical[order[i]] = (i > 0 && !less(order[i - 1], order[i])) ? canonical[order[i - 1]] : order[i];
+
+		for (uint32_t v = 0; v < vertexCount; v++) groupStart[canonical[v] + 1]++;
+		for (size_t v = 0; v < vertexCount; v++) groupStart[v + 1] += groupStart[v];
+		std::vector<uint32_t> fill(groupStart.begin(), groupStart.end() - 1);
+		for (uint32_t v = 0; v < vertexCount; v++) members[fill[canonical[v]]++] = v;
+	}
+
+	// 2. Quadric of each position: planes of its triangles
+	std::vector<Quadric> quadrics(vertexCount);
+	for (size_t i = 0; i < indices.size(); i += 3)
+	{
+		const float* a = position(indices[i]);
+		float n[3];
+		triangleNormal(a, position(indices[i + 1]), position(indices[i + 2]), n);
+
+		double length = std::sqrt(double(n[0]) * n[0] + double(n[1]) * n[1] + double(n[2]) * n[2]);
+		if (length == 0) continue;
+		double nx = n[0] / length, ny = n[1] / length, nz = n[2] / length;
+		Quadric q = Quadric::fromPlane(nx, ny, nz, -(nx * a[0] + ny * a[1] + nz * a[2]), length * 0.5);
+
+		for (int k = 0; k < 3; k++) quadrics[canonical[indices[i + k]]] += q;
+	}
+
+	// 3. Collapse the cheapest edges in passes. In each pass, the 1-ring of a collapsed position isn't modified again (so the flip test holds). The topology (vertex kinds) is classified again in each pass.
+	std::vector<uint64_t>	idEdges, positionEdges;
+	std::vector<uint8_t>	kinds(vertexCount);
+	std::vector<uint32_t>	offsets, triangles, remap(vertexCount);
+	std::vector<bool>		touched(vertexCount);
+	std::vector<Collapse>	candidates;
+
+	while (indices.size() > targetIndexCount)
+	{
+		// Edges between vertex ids and between positions (sorted, an edge appears once per triangle)
+		idEdges.clear();
+		positionEdges.clear();
+		for (size_t i = 0; i < indices.size(); i += 3)
+			for (int k = 0; k < 3; k++)
+			{
+				uint32_t a = indices[i + k], b = indices[i + (k + 1) % 3];
+				idEdges.push_back(edgeKey(a, b));
+				positionEdges.push_back(edgeKey(canonical[a], canonical[b]));
+			}
+		std::sort(idEdges.begin(), idEdges.end());
+		std::sort(positionEdges.begin(), positionEdges.end());
+
+		// Vertex kinds (per position): count border, seam and non-manifold edges around each position
+		{
+			std::vector<uint8_t> borderEdges(vertexCount, 0), seamEdges(vertexCount, 0), nonManifold(vertexCount, 0);
+			auto saturatedIncrement = [](uint8_t& counter) { if (counter < 255) counter++; };
+
+			for (size_t i = 0; i < positionEdges.size(); )
+			{
+				size_t j = i;
+				while (j < positionEdges.size() && positionEdges[j] == positionEdges[i]) j++;
+				uint32_t a = uint32_t(positionEdges[i] >> 32), b = uint32_t(positionEdges[i]);
+				if (j - i == 1)	{ saturatedIncrement(borderEdges[a]); saturatedIncrement(borderEdges[b]); }
+				if (j - i > 2)	{ saturatedIncrement(nonManifold[a]); saturatedIncrement(nonManifold[b]); }
+				i = j;
+			}
+
+			for (size_t i = 0; i < idEdges.size(); )		// Seam edge: used once between these ids, but twice between their positions
+			{
+				size_t j = i;
+				while (j < idEdges.size() && idEdges[j] == idEdges[i]) j++;
+				uint32_t a = canonical[uint32_t(idEdges[i] >> 32)], b = canonical[uint32_t(idEdges[i])];
+				if (j - i == 1 && edgeCount(positionEdges, edgeKey(a, b)) == 2) { saturatedIncrement(seamEdges[a]); saturatedIncrement(seamEdges[b]); }
+				i = j;
+			}
+
+			for (uint32_t p = 0; p < vertexCount; p++)
+			{
+				if (canonical[p] != p) continue;
+				uint32_t ids = groupStart[p + 1] - groupStart[p];
+
+				if (nonManifold[p])												kinds[p] = LOCKED;
+				else if (ids == 1 && borderEdges[p] == 0 && seamEdges[p] == 0)	kinds[p] = MANIFOLD;
+				else if (ids == 1 && borderEdges[p] == 2 && seamEdges[p] == 0)	kinds[p] = BORDER;
+				else if (ids == 2 && borderEdges[p] == 0 && seamEdges[p] == 4)	kinds[p] = SEAM;		// 2 seam edges, each one seen from both sides (2 id edges)
+				else															kinds[p] = LOCKED;
+			}
+		}
+
+		// Triangles adjacent to each vertex id
+		offsets.assign(vertexCount + 1, 0);
+		triangles.resize(indices.size());
+		for (uint32_t v : indices) offsets[v + 1]++;
+		for (size_t v = 0; v < vertexCount; v++) offsets[v + 1] += offsets[v];
+		{
+			std::vector<uint32_t> fill(offsets.begin(), offsets.end() - 1);
+			for (size_t i = 0; i < indices.size(); i++)
+				triangles[fill[indices[i]]++] = uint32_t(i / 3);
+		}
+
+		// Candidate collapses (both directions of each edge), cheapest first
+		auto allowed = [&](uint32_t from, uint32_t to)
+		{
+			switch (kinds[canonical[from]])
+			{
+			case MANIFOLD:	return true;
+			case BORDER:	return edgeCount(positionEdges, edgeKey(canonical[from], canonical[to])) == 1;		// Along the border
+			case SEAM:		return edgeCount(idEdges, edgeKey(from, to)) == 1 && edgeCount(positionEdges, edgeKey(canonical[from], canonical[to])) == 2;	// Along the seam
+			default:		return false;
+			}
+		};
+
+		candidates.clear();
+		for (size_t i = 0; i < indices.size(); i += 3)
+			for (int k = 0; k < 3; k++)
+			{
+				uint32_t a = indices[i + k], b = indices[i + (k + 1) % 3];
+				Quadric q = quadrics[canonical[a]];
+				q += quadrics[canonical[b]];
+				if (allowed(a, b)) candidates.push_back({ q.error(position(b)), a, b });
+				if (allowed(b, a)) candidates.push_back({ q.error(position(a)), b, a });
+			}
+		std::sort(candidates.begin(), candidates.end());
+
+		// Each collapse removes 2 triangles (6 indices) in a closed region
+		size_t goal			= (indices.size() - targetIndexCount + 5) / 6;
+		size_t collapses	= 0;
+		for (uint32_t v = 0; v < vertexCount; v++) remap[v] = v;
+		touched.assign(vertexCount, false);
+
+		for (const Collapse& collapse : candidates)
+		{
+			if (collapses >= goal) break;
+			uint32_t pu = canonical[collapse.from], pv = canonical[collapse.to];
+			if (touched[pu] || touched[pv]) continue;
+
+			// Target of every id of the collapsed position: the id of the other position it shares an edge with (seams have one per side)
+			uint32_t targets[2] = { 0, 0 };
+			bool valid = true;
+			for (uint32_t g = groupStart[pu]; g < groupStart[pu + 1] && valid; g++)
+			{
+				uint32_t u = members[g], target = ~0u;
+				for (uint32_t k = offsets[u]; k < offsets[u + 1] && target == ~0u; k++)
+					for (int c = 0; c < 3; c++)
+						if (canonical[indices[3 * triangles[k] + c]] == pv) target = indices[3 * triangles[k] + c];
+				if (u == collapse.from) target = collapse.to;
+				targets[g - groupStart[pu]] = target;
+				valid = target != ~0u;
+			}
+			if (!valid) continue;
+
+			// Reject the collapse if a remaining triangle around the position would flip
+			bool flips = false;
+			for (uint32_t g = groupStart[pu]; g < groupStart[pu + 1] && !flips; g++)
+				for (uint32_t k = offsets[members[g]]; k < offsets[members[g] + 1] && !flips; k++)
+				{
+					const uint32_t* t = &indices[3 * triangles[k]];
+					if (canonical[t[0]] == pv || canonical[t[1]] == pv || canonical[t[2]] == pv) continue;		// It's removed by the collapse
+
+					const float* p[3]		= { position(t[0]), position(t[1]), position(t[2]) };
+					const float* moved[3]	= { p[0], p[1], p[2] };
+					for (int c = 0; c < 3; c++) if (canonical[t[c]] == pu) moved[c] = position(collapse.to);
+
+					float before[3], after[3];
+					triangleNormal(p[0], p[1], p[2], before);
+					triangleNormal(moved[0], moved[1], moved[2], after);
+					flips = before[0] * after[0] + before[1] * after[1] + before[2] * after[2] <= 0.f;
+				}
+			if (flips) continue;
+
+			// Collapse the position onto the other one (every id at once)
+			for (uint32_t g = groupStart[pu]; g < groupStart[pu + 1]; g++)
+			{
+				uint32_t u = members[g];
+				remap[u] = targets[g - groupStart[pu]];
+				for (uint32_t k = offsets[u]; k < offsets[u + 1]; k++)
+					for (int c = 0; c < 3; c++) touched[canonical[indices[3 * triangles[k] + c]]] = true;
+			}
+			quadrics[pv] += quadrics[pu];
+			collapses++;
+		}
+
+		if (collapses == 0) break;		// Nothing else can be collapsed
+
+		// Apply the collapses and remove the degenerate triangles
+		size_t out = 0;
+		for (size_t i = 0; i < indices.size(); i += 3)
+		{
+			uint32_t a = remap[indices[i]], b = remap[indices[i + 1]], c = remap[indices[i + 2]];
+			if (canonical[a] == canonical[b] || canonical[b] == canonical[c] || canonical[c] == canonical[a]) continue;
+			indices[out++] = a;
+			indices[out++] = b;
+			indices[out++] = c;
+		}
+		indices.resize(out);
+	}
+
+	return indices;
+}
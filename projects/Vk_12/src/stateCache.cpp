@@ -0,0 +1,227 @@
+#include <iostream>
+#include <fstream>
+#include <stdexcept>
+
+#include "stateCache.hpp"
+
+/// Append the bytes of a value to a key (only for values without padding bytes).
+template<typename T>
+static void append(std::string& key, const T& value) { key.append((const char*)&value, sizeof(T)); }
+
+std::string PipelineState::key() const
+{
+	std::string key;
+	append(key, vertexShader);
+	append(key, fragmentShader);
+	append(key, layout);
+	append(key, renderPass);
+	append(key, extent);
+	append(key, samples);
+	append(key, sampleShading);
+	append(key, instanced);
+	append(key, packedVertices);
+	append(key, topology);
+	append(key, polygonMode);
+	append(key, cullMode);
+	append(key, depthTest);
+	append(key, depthWrite);
+	append(key, blend);
+	return key;
+}
+
+void StateCache::init(VkDevice device) { this->device = device; }
+
+std::vector<char> StateCache::readFile(const char* filename)
+{
+	std::ifstream file(filename, std::ios::ate | std::ios::binary);		// ate: Start reading at the end of the of the file (its position is the file size)  /  binary: Read file as binary file (avoid text transformations)
+	if (!file.is_open())
+		throw std::runtime_error("Failed to open file!");
+
+	size_t fileSize = (size_t)file.tellg();
+	std::vector<char> buffer(fileSize);
+
+	file.seekg(0);
+	file.read(buffer.data(), fileSize);
+	return buffer;
+}
+
+VkShaderModule StateCache::getShaderModule(const char* path)
+{
+	{
+		std::lock_guard<std::mutex> lock(mtx);
+		if (shaderModules.contains(path))
+			return shaderModules.acquire(path, nullptr);		// Cached: create() isn't called
+	}
+
+	std::vector<char> code = readFile(path);		// Outside the lock (like TextureCache::prepare), so other threads (the render thread) never wait for the disk. If another thread creates the module meanwhile, this copy is discarded.
+
+	std::lock_guard<std::mutex> lock(mtx);
+
+	return shaderModules.acquire(path, [&]()
+	{
+		VkShaderModuleCreateInfo createInfo{};
+		createInfo.sType	= VK_STRUCTURE_TYPE_SHADER_MODULE_CREATE_INFO;
+		createInfo.codeSize	= code.size();
+		createInfo.pCode	= reinterpret_cast<const uint32_t*>(code.data());	// The default allocator from std::vector ensures that the data satisfies the alignment requirements of `uint32_t`.
+
+		VkShaderModule shaderModule;
+		if (vkCreateShaderModule(device, &createInfo, nullptr, &shaderModule) != VK_SUCCESS)
+			throw std::runtime_error("Failed to create shader module!");
+
+		return shaderModule;
+	});
+}
+
+VkDescriptorSetLayout StateCache::getDescriptorSetLayout(const std::vector<VkDescriptorSetLayoutBinding>& bindings)
+{
+	std::string key;
+	for (const VkDescriptorSetLayoutBinding& binding : bindings)
+	{
+		if (binding.pImmutableSamplers)
+			throw std::runtime_error("Immutable samplers are not supported by the state cache!");
+		append(key, binding.binding);
+		append(key, binding.descriptorType);
+		append(key, binding.descriptorCount);
+		append(key, binding.stageFlags);
+	}
+
+	std::lock_guard<std::mutex> lock(mtx);
+
+	return setLayouts.acquire(key, [&]()
+	{
+		VkDescriptorSetLayoutCreateInfo layoutInfo{};
+		layoutInfo.sType		= VK_STRUCTURE_TYPE_DESCRIPTOR_SET_LAYOUT_CREATE_INFO;
+		layoutInfo.bindingCount	= static_cast<uint32_t>(bindings.size());
+		layoutInfo.pBindings	= bindings.data();
+
+		VkDescriptorSetLayout layout;
+		if (vkCreateDescriptorSetLayout(device, &layoutInfo, nullptr, &layout) != VK_SUCCESS)
+			throw std::runtime_error("Failed to create descriptor set layout!");
+
+		return layout;
+	});
+}
+
+VkPipelineLayout StateCache::getPipelineLayout(const std::vector<VkDescriptorSetLayout>& layouts, const std::vector<VkPushConstantRange>& pushConstants)
+{
+	std::string key;
+	for (VkDescriptorSetLayout layout : layouts)
+		append(key, layout);
+	for (const VkPushConstantRange& range : pushConstants)
+		append(key, range);
+
+	std::lock_guard<std::mutex> lock(mtx);
+
+	return pipelineLayouts.acquire(key, [&]()
+	{
+		VkPipelineLayoutCreateInfo pipelineLayoutInfo{};
+		pipelineLayoutInfo.sType					= VK_STRUCTURE_TYPE_PIPELINE_LAYOUT_CREATE_INFO;
+		pipelineLayoutInfo.setLayoutCount			= static_cast<uint32_t>(layouts.size());
+		pipelineLayoutInfo.pSetLayouts				= layouts.data();
+		pipelineLayoutInfo.pushConstantRangeCount	= static_cast<uint32_t>(pushConstants.size());
+		pipelineLayoutInfo.pPushConstantRanges		= pushConstants.data();
+
+		VkPipelineLayout pipelineLayout;
+		if (vkCreatePipelineLayout(device, &pipelineLayoutInfo, nullptr, &pipelineLayout) != VK_SUCCESS)
+			throw std::runtime_error("Failed to create pipeline layout!");
+
+		return pipelineLayout;
+	});
+}
+
+VkPipeline StateCache::getPipeline(const PipelineState& state, const std::function<VkPipeline()>& create)
+{
+	std::lock_guard<std::mutex> lock(mtx);
+	return pipelines.acquire(state.key(), create);
+}
+
+VkSampler StateCache::getSampler(const VkSamplerCreateInfo& samplerInfo)
+{
+	if (samplerInfo.pNext)
+		throw std::runtime_error("Sampler pNext chains are not supported by the state cache!");
+
+	std::string key;
+	append(key, samplerInfo.flags);
+	append(key, samplerInfo.magFilter);
+	append(key, samplerInfo.minFilter);
+	append(key, samplerInfo.mipmapMode);
+	append(key, samplerInfo.addressModeU);
+	append(key, samplerInfo.addressModeV);
+	append(key, samplerInfo.addressModeW);
+	append(key, samplerInfo.mipLodBias);
+	append(key, samplerInfo.anisotropyEnable);
+	append(key, samplerInfo.maxAnisotropy);
+	append(key, samplerInfo.compareEnable);
+	append(key, samplerInfo.compareOp);
+	append(key, samplerInfo.minLod);
+	append(key, samplerInfo.maxLod);
+	append(key, samplerInfo.borderColor);
+	append(key, samplerInfo.unnormalizedCoordinates);
+
+	std::lock_guard<std::mutex> lock(mtx);
+
+	return samplers.acquire(key, [&]()
+	{
+		VkSampler sampler;
+		if (vkCreateSampler(device, &samplerInfo, nullptr, &sampler) != VK_SUCCESS)
+			throw std::runtime_error("Failed to create texture sampler!");
+
+		return sampler;
+	});
+}
+
+void StateCache::releaseShaderModule(VkShaderModule module)
+{
+	std::lock_guard<std::mutex> lock(mtx);
+	if (shaderModules.release(module))
+		vkDestroyShaderModule(device, module, nullptr);
+}
+
+void StateCache::releaseDescriptorSetLayout(VkDescriptorSetLayout layout)
+{
+	std::lock_guard<std::mutex> lock(mtx);
+	if (setLayouts.release(layout))
+		vkDestroyDescriptorSetLayout(device, layout, nullptr);
+}
+
+void StateCache::releasePipelineLayout(VkPipelineLayout layout)
+{
+	std::lock_guard<std::mutex> lock(mtx);
+	if (pipelineLayouts.release(layout))
+		vkDestroyPipelineLayout(device, layout, nullptr);
+}
+
+void StateCache::releasePipeline(VkPipeline pipeline)
+{
+	std::lock_guard<std::mutex> lock(mtx);
+	if (pipelines.release(pipeline))
+		vkDestroyPipeline(device, pipeline, nullptr);
+}
+
+void StateCache::releaseSampler(VkSampler sampler)
+{
+	std::lock_guard<std::mutex> lock(mtx);
+	if (samplers.release(sampler))
+		vkDestroySampler(device, sampler, nullptr);
+}
+
+void StateCache::printStats()
+{
+	std::lock_guard<std::mutex> lock(mtx);
+	std::cout	<< "State cache (created / requested): "
+				<< pipelines.created		<< '/' << pipelines.requests		<< " pipelines, "
+				<< pipelineLayouts.created	<< '/' << pipelineLayouts.requests	<< " pipeline layouts, "
+				<< setLayouts.created		<< '/' << setLayouts.requests		<< " descriptor set layouts, "
+				<< shaderModules.created	<< '/' << shaderModules.requests	<< " shader modules, "
+				<< samplers.created			<< '/' << samplers.requests			<< " samplers" << std::endl;
+}
+
+void StateCache::cleanup()
+{
+	std::lock_guard<std::mutex> lock(mtx);
+	pipelines		.clear([this](VkPipeline handle)			{ vkDestroyPipeline(device, handle, nullptr); });
+	pipelineLayouts	.clear([this](VkPipelineLayout handle)		{ vkDestroyPipelineLayout(device, handle, nullptr); });
+	setLayouts		.clear([this](VkDescriptorSetLayout handle)	{ vkDestroyDescriptorSetLayout(device, handle, nullptr); });
+	shaderModules	.clear([this](VkShaderModule handle)		{ vkDestroyShaderModule(device, handle, nullptr); });
+	samplers		.clear([this](VkSampler handle)				{ vkDestroySampler(device, handle, nullptr); });
+}
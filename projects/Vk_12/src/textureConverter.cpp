@@ -0,0 +1,690 @@
+#include <algorithm>
+#include <cmath>
+#include <cfloat>
+#include <cstring>
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+	#include <emmintrin.h>
+	#define TEXTURE_SSE
+#endif
+
+#include "textureConverter.hpp"
+#include "workers.hpp"
+
+
+// Encodings -------------------------------------------------------------------------------------
+
+uint32_t getBlockBytes(TextureEncoding encoding)
+{
+	switch (encoding)
+	{
+	case TextureEncoding::BC1:	return 8;
+	case TextureEncoding::BC3:
+	case TextureEncoding::BC5:
+	case TextureEncoding::BC7:	return 16;
+	default:					return 4;
+	}
+}
+
+uint64_t getLevelBytes(TextureEncoding encoding, uint32_t width, uint32_t height)
+{
+	if (encoding == TextureEncoding::RGBA8)
+		return (uint64_t)width * height * 4;
+
+	return (uint64_t)((width + 3) / 4) * ((height + 3) / 4) * getBlockBytes(encoding);
+}
+
+TextureEncoding chooseEncoding(const uint8_t* rgba, size_t texelCount, bool highQuality)
+{
+	if (highQuality) return TextureEncoding::BC7;
+
+	for (size_t i = 0; i < texelCount; i++)
+		if (rgba[i * 4 + 3] != 255) return TextureEncoding::BC3;
+
+	return TextureEncoding::BC1;
+}
+
+
+// Mipmaps ---------------------------------------------------------------------------------------
+
+namespace
+{
+	/// sRGB <-> linear conversion tables (linear values are quantized to 16 bits for the way back, enough to round trip every 8-bit value).
+	struct SrgbTables
+	{
+		float	toLinear[256];
+		uint8_t	toSrgb[65536];
+
+		SrgbTables()
+		{
+			for (int i = 0; i < 256; i++)
+			{
+				float c = i / 255.f;
+				toLinear[i] = c <= 0.04045f ? c / 12.92f : std::pow((c + 0.055f) / 1.055f, 2.4f);
+			}
+
+			for (int i = 0; i < 65536; i++)
+			{
+				float l = i / 65535.f;
+				float c = l <= 0.0031308f ? l * 12.92f : 1.055f * std::pow(l, 1.f / 2.4f) - 0.055f;
+				toSrgb[i] = (uint8_t)(c * 255.f + 0.5f);
+			}
+		}
+	};
+
+	const SrgbTables& getSrgbTables()
+	{
+		static SrgbTables tables;				// Built once (thread safe)
+		return tables;
+	}
+
+	void toFloat(const uint8_t* src, float* dst, size_t texelCount, bool srgb)
+	{
+		const SrgbTables& tables = getSrgbTables();
+
+		for (size_t i = 0; i < texelCount * 4; i++)
+			dst[i] = (srgb && (i & 3) != 3) ? tables.toLinear[src[i]] : src[i] / 255.f;
+	}
+
+	void toBytes(const float* src, uint8_t* dst, size_t texelCount, bool srgb)
+	{
+		const SrgbTables& tables = getSrgbTables();
+
+		for (size_t i = 0; i < texelCount * 4; i++)
+		{
+			float value = std::min(std::max(src[i], 0.f), 1.f);		// Sharp filters overshoot
+			dst[i] = (srgb && (i & 3) != 3) ? tables.toSrgb[(int)(value * 65535.f + 0.5f)] : (uint8_t)(value * 255.f + 0.5f);
+		}
+	}
+
+	/// Weights of the source texels that make each destination texel along one axis. Taps outside the image are folded into the edge texel (clamp to edge), so each destination texel reads a contiguous range of source texels.
+	struct FilterTable
+	{
+		uint32_t				taps;			///< Maximum number of source texels per destination texel
+		std::vector<uint32_t>	first;			///< First source texel of each destination texel
+		std::vector<uint32_t>	count;			///< Number of source texels of each destination texel
+		std::vector<float>		weights;		///< taps weights per destination texel (they add up to 1)
+	};
+
+	double besselI0(double x)
+	{
+		double sum = 1, term = 1;
+		for (int k = 1; k < 25; k++)
+		{
+			term *= (x / (2 * k)) * (x / (2 * k));
+			sum += term;
+		}
+		return sum;
+	}
+
+	FilterTable makeFilter(MipFilter filter, uint32_t srcSize, uint32_t dstSize)
+	{
+		const double pi		= 3.14159265358979323846;
+		const double lobes	= 2;				// Kaiser: support of the sinc, in destination texels
+		const double alpha	= 4;				// Kaiser: window shape (higher: less ringing, blurrier)
+
+		double scale	= (double)srcSize / dstSize;
+		double radius	= filter == MipFilter::Box ? scale / 2 : lobes * scale;		// In source texels
+
+		FilterTable table;
+		table.taps = (uint32_t)std::ceil(2 * radius) + 2;
+		table.first.resize(dstSize);
+		table.count.resize(dstSize);
+		table.weights.assign((size_t)dstSize * table.taps, 0.f);
+
+		for (uint32_t x = 0; x < dstSize; x++)
+		{
+			double center	= (x + 0.5) * scale;
+			int start		= (int)std::floor(center - radius);
+			int end			= (int)std::ceil(center + radius);
+			int lo			= std::max(start, 0);
+			int hi			= std::min(end, (int)srcSize);
+			float* weights	= &table.weights[(size_t)x * table.taps];
+			double sum		= 0;
+
+			for (int i = start; i < end; i++)
+			{
+				double weight;
+				if (filter == MipFilter::Box)			// Overlap of the source texel with the destination one
+					weight = std::max(0., std::min(i + 1., center + radius) - std::max((double)i, center - radius));
+				else
+				{
+					double u = (i + 0.5 - center) / scale;
+					if (std::abs(u) >= lobes) continue;
+					double sinc = u == 0 ? 1 : std::sin(pi * u) / (pi * u);
+					weight = sinc * besselI0(alpha * std::sqrt(1 - (u / lobes) * (u / lobes))) / besselI0(alpha);
+				}
+
+				int texel = std::min(std::max(i, 0), (int)srcSize - 1);
+				weights[texel - lo] += (float)weight;
+				sum += weight;
+			}
+
+			for (int t = 0; t < hi - lo; t++)
+				weights[t] = (float)(weights[t] / sum);
+
+			table.first[x] = lo;
+			table.count[x] = hi - lo;
+		}
+
+		return table;
+	}
+
+	/// Horizontal pass: each destination texel is a weighted sum of a range of source texels of the same row.
+	void filterRows(const float* src, uint32_t srcWidth, float* dst, uint32_t dstWidth, uint32_t rows, const FilterTable& table)
+	{
+		for (uint32_t y = 0; y < rows; y++)
+		{
+			const float* srcRow	= src + (size_t)y * srcWidth * 4;
+			float* dstRow		= dst + (size_t)y * dstWidth * 4;
+
+			for (uint32_t x = 0; x < dstWidth; x++)
+			{
+				const float* texels	 = srcRow + (size_t)table.first[x] * 4;
+				const float* weights = &table.weights[(size_t)x * table.taps];
+
+#ifdef TEXTURE_SSE
+				__m128 sum = _mm_setzero_ps();
+				for (uint32_t t = 0; t < table.count[x]; t++)
+					sum = _mm_add_ps(sum, _mm_mul_ps(_mm_loadu_ps(texels + t * 4), _mm_set1_ps(weights[t])));
+				_mm_storeu_ps(dstRow + x * 4, sum);
+#else
+				float sum[4] = { 0, 0, 0, 0 };
+				for (uint32_t t = 0; t < table.count[x]; t++)
+					for (int c = 0; c < 4; c++)
+						sum[c] += texels[t * 4 + c] * weights[t];
+				std::memcpy(dstRow + x * 4, sum, sizeof(sum));
+#endif
+			}
+		}
+	}
+
+	/// Vertical pass: each destination row is a weighted sum of a range of source rows (4 floats per iteration).
+	void filterColumns(const float* src, float* dst, uint32_t width, uint32_t dstHeight, const FilterTable& table)
+	{
+		size_t rowFloats = (size_t)width * 4;
+
+		for (uint32_t y = 0; y < dstHeight; y++)
+		{
+			float* dstRow = dst + y * rowFloats;
+			std::fill(dstRow, dstRow + rowFloats, 0.f);
+
+			for (uint32_t t = 0; t < table.count[y]; t++)
+			{
+				const float* srcRow	= src + (table.first[y] + t) * rowFloats;
+				float weight		= table.weights[(size_t)y * table.taps + t];
+
+#ifdef TEXTURE_SSE
+				__m128 w = _mm_set1_ps(weight);
+				for (size_t i = 0; i < rowFloats; i += 4)
+					_mm_storeu_ps(dstRow + i, _mm_add_ps(_mm_loadu_ps(dstRow + i), _mm_mul_ps(_mm_loadu_ps(srcRow + i), w)));
+#else
+				for (size_t i = 0; i < rowFloats; i++)
+					dstRow[i] += srcRow[i] * weight;
+#endif
+			}
+		}
+	}
+}
+
+void buildMipChain(const uint8_t* rgba, uint32_t width, uint32_t height, bool srgb, MipFilter filter, std::vector<std::vector<uint8_t>>& levels)
+{
+	levels.clear();
+	levels.emplace_back(rgba, rgba + (size_t)width * height * 4);
+
+	std::vector<float> current((size_t)width * height * 4), temp, next;
+	toFloat(rgba, current.data(), (size_t)width * height, srgb);
+
+	while (width > 1 || height > 1)
+	{
+		uint32_t dstWidth	= std::max(1u, width / 2);
+		uint32_t dstHeight	= std::max(1u, height / 2);
+
+		temp.resize((size_t)dstWidth * height * 4);
+		next.resize((size_t)dstWidth * dstHeight * 4);
+		filterRows(current.data(), width, temp.data(), dstWidth, height, makeFilter(filter, width, dstWidth));
+		filterColumns(temp.data(), next.data(), dstWidth, dstHeight, makeFilter(filter, height, dstHeight));
+
+		levels.emplace_back((size_t)dstWidth * dstHeight * 4);
+		toBytes(next.data(), levels.back().data(), (size_t)dstWidth * dstHeight, srgb);
+
+		current.swap(next);
+		width	= dstWidth;
+		height	= dstHeight;
+	}
+}
+
+
+// Block compression -----------------------------------------------------------------------------
+
+namespace
+{
+	const int bc7Weights[16] = { 0, 4, 9, 13, 17, 21, 26, 30, 34, 38, 43, 47, 51, 55, 60, 64 };		///< BC7 interpolation weights for 4-bit indices (out of 64)
+
+	uint16_t packRgb565(const float* color)
+	{
+		int r = std::min(std::max((int)(color[0] * 31.f / 255.f + 0.5f), 0), 31);
+		int g = std::min(std::max((int)(color[1] * 63.f / 255.f + 0.5f), 0), 63);
+		int b = std::min(std::max((int)(color[2] * 31.f / 255.f + 0.5f), 0), 31);
+		return (uint16_t)((r << 11) | (g << 5) | b);
+	}
+
+	void unpackRgb565(uint16_t color, int* rgb)
+	{
+		int r = color >> 11, g = (color >> 5) & 63, b = color & 31;
+		rgb[0] = (r << 3) | (r >> 2);
+		rgb[1] = (g << 2) | (g >> 4);
+		rgb[2] = (b << 3) | (b >> 2);
+	}
+
+	/// Mean and principal axis (eigenvector of the covariance with the largest eigenvalue, by power iteration) of the first `channels` components of the 16 texels of a block.
+	void principalAxis(const uint8_t* block, int channels, float* mean, float* axis)
+	{
+		for (int c = 0; c < channels; c++)
+		{
+			mean[c] = 0;
+			for (int i = 0; i < 16; i++) mean[c] += block[i * 4 + c];
+			mean[c] /= 16.f;
+		}
+
+		float covariance[4][4] = {};
+		for (int i = 0; i < 16; i++)
+			for (int a = 0; a < channels; a++)
+				for (int b = 0; b < channels; b++)
+					covariance[a][b] += (block[i * 4 + a] - mean[a]) * (block[i * 4 + b] - mean[b]);
+
+		int largest = 0;						// Start from the column of the channel with most variance (never orthogonal to the principal axis, unlike a fixed vector)
+		for (int c = 1; c < channels; c++)
+			if (covariance[c][c] > covariance[largest][largest]) largest = c;
+		for (int c = 0; c < channels; c++)
+			axis[c] = covariance[c][largest];
+
+		for (int iteration = 0; iteration < 8; iteration++)
+		{
+			float next[4] = {}, norm = 0;
+			for (int a = 0; a < channels; a++)
+			{
+				for (int b = 0; b < channels; b++) next[a] += covariance[a][b] * axis[b];
+				norm = std::max(norm, std::abs(next[a]));
+			}
+			if (norm == 0) break;
+			for (int c = 0; c < channels; c++) axis[c] = next[c] / norm;
+		}
+
+		float length = 0;
+		for (int c = 0; c < channels; c++) length += axis[c] * axis[c];
+		length = std::sqrt(length);
+		for (int c = 0; c < channels; c++) axis[c] = length > 0 ? axis[c] / length : 0;
+	}
+
+	/// Range of the projections of the texels on a line (mean + t * axis).
+	void project(const uint8_t* block, int channels, const float* mean, const float* axis, float& minT, float& maxT)
+	{
+		minT = FLT_MAX;
+		maxT = -FLT_MAX;
+		for (int i = 0; i < 16; i++)
+		{
+			float t = 0;
+			for (int c = 0; c < channels; c++) t += (block[i * 4 + c] - mean[c]) * axis[c];
+			minT = std::min(minT, t);
+			maxT = std::max(maxT, t);
+		}
+	}
+
+	/// Nearest palette entry of a texel (squared distance of the first `channels` components).
+	int nearest(const uint8_t* texel, const int (*palette)[4], int paletteSize, int channels)
+	{
+		int best = 0, bestError = INT32_MAX;
+		for (int p = 0; p < paletteSize; p++)
+		{
+			int error = 0;
+			for (int c = 0; c < channels; c++)
+				error += (texel[c] - palette[p][c]) * (texel[c] - palette[p][c]);
+			if (error < bestError) { bestError = error; best = p; }
+		}
+		return best;
+	}
+
+	/// Writes and reads bit fields of a 128-bit block (lowest bit first).
+	struct BitStream
+	{
+		uint8_t*	data;
+		uint32_t	position = 0;
+
+		void write(uint32_t value, uint32_t bits)
+		{
+			for (uint32_t b = 0; b < bits; b++, position++)
+				if ((value >> b) & 1) data[position >> 3] |= (uint8_t)(1 << (position & 7));
+		}
+
+		uint32_t read(uint32_t bits)
+		{
+			uint32_t value = 0;
+			for (uint32_t b = 0; b < bits; b++, position++)
+				value |= (uint32_t)((data[position >> 3] >> (position & 7)) & 1) << b;
+			return value;
+		}
+	};
+
+	void decodeBC1(const uint8_t* in, uint8_t* block, bool fourColorsOnly)
+	{
+		uint16_t color0 = (uint16_t)(in[0] | (in[1] << 8));
+		uint16_t color1 = (uint16_t)(in[2] | (in[3] << 8));
+		uint32_t indices = in[4] | (in[5] << 8) | (in[6] << 16) | ((uint32_t)in[7] << 24);
+
+		int palette[4][4];
+		unpackRgb565(color0, palette[0]);
+		unpackRgb565(color1, palette[1]);
+		for (int c = 0; c < 3; c++)
+		{
+			if (color0 > color1 || fourColorsOnly)
+			{
+				palette[2][c] = (2 * palette[0][c] + palette[1][c]) / 3;
+				palette[3][c] = (palette[0][c] + 2 * palette[1][c]) / 3;
+			}
+			else
+			{
+				palette[2][c] = (palette[0][c] + palette[1][c]) / 2;
+				palette[3][c] = 0;
+			}
+		}
+
+		for (int i = 0; i < 16; i++)
+			for (int c = 0; c < 3; c++)
+				block[i * 4 + c] = (uint8_t)palette[(indices >> (2 * i)) & 3][c];
+	}
+
+	void decodeBC4(const uint8_t* in, int channel, uint8_t* block)
+	{
+		int a0 = in[0], a1 = in[1];
+		int palette[8] = { a0, a1 };
+		if (a0 > a1)
+			for (int i = 2; i < 8; i++) palette[i] = ((8 - i) * a0 + (i - 1) * a1) / 7;
+		else
+		{
+			for (int i = 2; i < 6; i++) palette[i] = ((6 - i) * a0 + (i - 1) * a1) / 5;
+			palette[6] = 0;
+			palette[7] = 255;
+		}
+
+		uint64_t indices = 0;
+		for (int b = 0; b < 6; b++) indices |= (uint64_t)in[2 + b] << (8 * b);
+		for (int i = 0; i < 16; i++)
+			block[i * 4 + channel] = (uint8_t)palette[(indices >> (3 * i)) & 7];
+	}
+
+	void decodeBC7(const uint8_t* in, uint8_t* block)
+	{
+		uint8_t data[16];
+		std::memcpy(data, in, 16);
+		BitStream bits{ data };
+
+		if (bits.read(7) != (1 << 6))			// Not mode 6
+		{
+			std::memset(block, 0, 64);
+			return;
+		}
+
+		int endpoints[2][4];
+		for (int c = 0; c < 4; c++)
+			for (int n = 0; n < 2; n++)
+				endpoints[n][c] = bits.read(7) << 1;
+		for (int n = 0; n < 2; n++)
+		{
+			uint32_t p = bits.read(1);
+			for (int c = 0; c < 4; c++) endpoints[n][c] |= p;
+		}
+
+		for (int i = 0; i < 16; i++)
+		{
+			uint32_t index = bits.read(i == 0 ? 3 : 4);
+			for (int c = 0; c < 4; c++)
+				block[i * 4 + c] = (uint8_t)(((64 - bc7Weights[index]) * endpoints[0][c] + bc7Weights[index] * endpoints[1][c] + 32) >> 6);
+		}
+	}
+
+	void encodeBlock(TextureEncoding encoding, const uint8_t* block, uint8_t* out)
+	{
+		switch (encoding)
+		{
+		case TextureEncoding::BC1:	encodeBC1(block, out); break;
+		case TextureEncoding::BC3:	encodeBC3(block, out); break;
+		case TextureEncoding::BC5:	encodeBC5(block, out); break;
+		case TextureEncoding::BC7:	encodeBC7(block, out); break;
+		default:					std::memcpy(out, block, 64); break;
+		}
+	}
+}
+
+void encodeBC1(const uint8_t* block, uint8_t* out)
+{
+	// Endpoints: extremes of the colors along their principal axis, inset 1/16 of the range (the extremes are rarely hit exactly by the interpolated colors)
+	float mean[4], axis[4], minT, maxT;
+	principalAxis(block, 3, mean, axis);
+	project(block, 3, mean, axis, minT, maxT);
+
+	float inset = (maxT - minT) / 16.f;
+	float ends[2][3];
+	for (int c = 0; c < 3; c++)
+	{
+		ends[0][c] = std::min(std::max(mean[c] + axis[c] * (maxT - inset), 0.f), 255.f);
+		ends[1][c] = std::min(std::max(mean[c] + axis[c] * (minT + inset), 0.f), 255.f);
+	}
+
+	uint16_t color0 = packRgb565(ends[0]);
+	uint16_t color1 = packRgb565(ends[1]);
+	if (color0 < color1) std::swap(color0, color1);		// color0 > color1 selects the 4-color mode
+
+	uint32_t indices = 0;
+	if (color0 != color1)								// Otherwise every texel uses color0 (index 0)
+	{
+		int palette[4][4];
+		unpackRgb565(color0, palette[0]);
+		unpackRgb565(color1, palette[1]);
+		for (int c = 0; c < 3; c++)
+		{
+			palette[2][c] = (2 * palette[0][c] + palette[1][c]) / 3;
+			palette[3][c] = (palette[0][c] + 2 * palette[1][c]) / 3;
+		}
+
+		for (int i = 0; i < 16; i++)
+			indices |= (uint32_t)nearest(block + i * 4, palette, 4, 3) << (2 * i);
+	}
+
+	out[0] = (uint8_t)(color0 & 0xFF);
+	out[1] = (uint8_t)(color0 >> 8);
+	out[2] = (uint8_t)(color1 & 0xFF);
+	out[3] = (uint8_t)(color1 >> 8);
+	for (int b = 0; b < 4; b++) out[4 + b] = (uint8_t)(indices >> (8 * b));
+}
+
+void encodeBC4(const uint8_t* block, int channel, uint8_t* out)
+{
+	int lo = 255, hi = 0;
+	for (int i = 0; i < 16; i++)
+	{
+		lo = std::min(lo, (int)block[i * 4 + channel]);
+		hi = std::max(hi, (int)block[i * 4 + channel]);
+	}
+
+	// 8-value mode (a0 > a1): a1 + (a0 - a1) * k / 7, where k = 7 is index 0, k = 0 is index 1, and k = 1..6 are indices 7..2
+	uint64_t indices = 0;
+	if (hi > lo)
+		for (int i = 0; i < 16; i++)
+		{
+			int k = ((block[i * 4 + channel] - lo) * 14 + (hi - lo)) / (2 * (hi - lo));		// round(7 * (v - lo) / (hi - lo))
+			uint64_t index = k == 7 ? 0 : (k == 0 ? 1 : 8 - k);
+			indices |= index << (3 * i);
+		}
+
+	out[0] = (uint8_t)hi;
+	out[1] = (uint8_t)lo;
+	for (int b = 0; b < 6; b++) out[2 + b] = (uint8_t)(indices >> (8 * b));
+}
+
+void encodeBC3(const uint8_t* block, uint8_t* out)
+{
+	encodeBC4(block, 3, out);
+	encodeBC1(block, out + 8);					// BC3 colors are always in 4-color mode (encodeBC1 never uses the other one)
+}
+
+void encodeBC5(const uint8_t* block, uint8_t* out)
+{
+	encodeBC4(block, 0, out);
+	encodeBC4(block, 1, out + 8);
+}
+
+void encodeBC7(const uint8_t* block, uint8_t* out)
+{
+	// Endpoints: extremes of the texels along their principal axis in RGBA
+	float mean[4], axis[4], minT, maxT;
+	principalAxis(block, 4, mean, axis);
+	project(block, 4, mean, axis, minT, maxT);
+
+	float ends[2][4];
+	for (int c = 0; c < 4; c++)
+	{
+		ends[0][c] = std::min(std::max(mean[c] + axis[c] * minT, 0.f), 255.f);
+		ends[1][c] = std::min(std::max(mean[c] + axis[c] * maxT, 0.f), 255.f);
+	}
+
+	// Quantize them to 7 bits per channel plus a p-bit (the lowest bit, shared by the 4 channels of an endpoint). Choose the p-bit with less error.
+	int quantized[2][4], pBits[2], endpoints[2][4];
+	for (int n = 0; n < 2; n++)
+	{
+		float bestError = FLT_MAX;
+		for (int p = 0; p < 2; p++)
+		{
+			int candidate[4];
+			float error = 0;
+			for (int c = 0; c < 4; c++)
+			{
+				candidate[c] = std::min(std::max((int)std::floor((ends[n][c] - p) / 2.f + 0.5f), 0), 127);
+				float difference = (candidate[c] * 2 + p) - ends[n][c];
+				error += difference * difference;
+			}
+			if (error < bestError)
+			{
+				bestError = error;
+				pBits[n] = p;
+				std::memcpy(quantized[n], candidate, sizeof(candidate));
+			}
+		}
+		for (int c = 0; c < 4; c++) endpoints[n][c] = (quantized[n][c] << 1) | pBits[n];
+	}
+
+	int palette[16][4];
+	for (int k = 0; k < 16; k++)
+		for (int c = 0; c < 4; c++)
+			palette[k][c] = ((64 - bc7Weights[k]) * endpoints[0][c] + bc7Weights[k] * endpoints[1][c] + 32) >> 6;
+
+	int indices[16];
+	for (int i = 0; i < 16; i++)
+		indices[i] = nearest(block + i * 4, palette, 16, 4);
+
+	// The index of the first texel (anchor) is stored without its highest bit, which must be 0: swap the endpoints if it isn't (weights are symmetric)
+	if (indices[0] & 8)
+	{
+		std::swap(quantized[0], quantized[1]);
+		std::swap(pBits[0], pBits[1]);
+		for (int i = 0; i < 16; i++) indices[i] = 15 - indices[i];
+	}
+
+	std::memset(out, 0, 16);
+	BitStream bits{ out };
+	bits.write(1 << 6, 7);						// Mode 6 (unary: six 0 bits and a 1)
+	for (int c = 0; c < 4; c++)					// R0 R1 G0 G1 B0 B1 A0 A1
+		for (int n = 0; n < 2; n++)
+			bits.write(quantized[n][c], 7);
+	bits.write(pBits[0], 1);
+	bits.write(pBits[1], 1);
+	for (int i = 0; i < 16; i++)
+		bits.write(indices[i], i == 0 ? 3 : 4);
+}
+
+void decodeBlock(TextureEncoding encoding, const uint8_t* in, uint8_t* block)
+{
+	for (int i = 0; i < 16; i++)
+	{
+		block[i * 4 + 2] = 0;
+		block[i * 4 + 3] = 255;
+	}
+
+	switch (encoding)
+	{
+	case TextureEncoding::BC1:	decodeBC1(in, block, false); break;
+	case TextureEncoding::BC3:	decodeBC4(in, 3, block); decodeBC1(in + 8, block, true); break;
+	case TextureEncoding::BC5:	decodeBC4(in, 0, block); decodeBC4(in + 8, 1, block); break;
+	case TextureEncoding::BC7:	decodeBC7(in, block); break;
+	default:					std::memcpy(block, in, 64); break;
+	}
+}
+
+
+// Conversion ------------------------------------------------------------------------------------
+
+ConvertedImage convertImage(const uint8_t* rgba, uint32_t width, uint32_t height, TextureEncoding encoding, bool srgb, MipFilter filter, WorkerPool* workers)
+{
+	std::vector<std::vector<uint8_t>> mips;
+	buildMipChain(rgba, width, height, srgb, filter, mips);
+
+	ConvertedImage image;
+	image.encoding	= encoding;
+	image.srgb		= srgb;
+
+	// Layout: levels one after the other, each one at a 16-byte aligned offset (copies from a buffer need offsets aligned to the block size)
+	uint64_t size = 0;
+	for (size_t l = 0; l < mips.size(); l++)
+	{
+		ImageLevel level;
+		level.width		= std::max(1u, width >> l);
+		level.height	= std::max(1u, height >> l);
+		level.offset	= size;
+		level.size		= getLevelBytes(encoding, level.width, level.height);
+		image.levels.push_back(level);
+		size += (level.size + 15) & ~15ull;
+	}
+	image.data.resize((size_t)size);
+
+	uint32_t blockBytes = getBlockBytes(encoding);
+
+	for (size_t l = 0; l < mips.size(); l++)
+	{
+		const ImageLevel& level	= image.levels[l];
+		const uint8_t* texels	= mips[l].data();
+		uint8_t* dst			= image.data.data() + level.offset;
+
+		if (encoding == TextureEncoding::RGBA8)
+		{
+			std::memcpy(dst, texels, (size_t)level.size);
+			continue;
+		}
+
+		// Encode a row of blocks. Blocks on the right and bottom edges repeat the last column and row of texels.
+		uint32_t blocksX = (level.width + 3) / 4;
+		uint32_t blocksY = (level.height + 3) / 4;
+		auto encodeRow = [&](size_t by)
+		{
+			uint8_t block[64];
+			for (uint32_t bx = 0; bx < blocksX; bx++)
+			{
+				for (uint32_t y = 0; y < 4; y++)
+					for (uint32_t x = 0; x < 4; x++)
+					{
+						size_t sx = std::min<size_t>(bx * 4 + x, level.width - 1);
+						size_t sy = std::min<size_t>(by * 4 + y, level.height - 1);
+						std::memcpy(block + (y * 4 + x) * 4, texels + (sy * level.width + sx) * 4, 4);
+					}
+
+				encodeBlock(encoding, block, dst + (by * blocksX + bx) * blockBytes);
+			}
+		};
+
+		if (workers && workers->size() > 1 && blocksY > 1)
+			workers->run(blocksY, encodeRow);
+		else
+			for (uint32_t by = 0; by < blocksY; by++) encodeRow(by);
+	}
+
+	return image;
+}
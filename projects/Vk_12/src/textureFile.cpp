@@ -0,0 +1,116 @@
+#include <fstream>
+#include <vector>
+#include <algorithm>
+#include <cstdio>			// std::rename, std::remove
+#include <thread>
+#include <functional>		// std::hash
+
+#include "textureFile.hpp"
+
+#define TEXTURE_MAGIC	0x43584554		// "TEXC"
+#define TEXTURE_VERSION	1
+
+
+std::string TextureFile::cachePath(const char* sourcePath) { return std::string(sourcePath) + ".tex"; }
+
+bool TextureFile::open(const char* sourcePath, uint32_t flags)
+{
+	close();
+
+	// Hash the source (it's mapped, not decoded)
+	MappedFile source;
+	if (!source.open(sourcePath)) return false;
+	uint64_t sourceHash = MeshFile::hash(source.getData(), source.getSize());
+
+	// Map the cache and validate it
+	if (!file.open(cachePath(sourcePath).c_str())) return false;
+	if (file.getSize() < sizeof(TextureFileHeader)) { file.close(); return false; }
+
+	const TextureFileHeader* h = (const TextureFileHeader*)file.getData();
+	uint32_t expectedLevels = 1;
+	while ((h->width >> expectedLevels) || (h->height >> expectedLevels)) expectedLevels++;
+
+	if (h->magic		!= TEXTURE_MAGIC		||
+		h->version		!= TEXTURE_VERSION		||
+		h->sourceHash	!= sourceHash			||
+		h->sourceSize	!= source.getSize()		||
+		h->flags		!= flags				||
+		h->encoding		>  (uint32_t)TextureEncoding::BC7 ||
+		h->levelCount	!= expectedLevels		||
+		file.getSize()	<  sizeof(TextureFileHeader) + (uint64_t)h->levelCount * sizeof(ImageLevel))
+	{
+		file.close();
+		return false;
+	}
+
+	// Every level must be inside the file, aligned, and have the size of its encoding
+	const ImageLevel* levels = (const ImageLevel*)(file.getData() + sizeof(TextureFileHeader));
+	for (uint32_t l = 0; l < h->levelCount; l++)
+	{
+		uint32_t width	= std::max(1u, h->width >> l);
+		uint32_t height	= std::max(1u, h->height >> l);
+
+		if (levels[l].width		!= width	||
+			levels[l].height	!= height	||
+			levels[l].size		!= getLevelBytes((TextureEncoding)h->encoding, width, height) ||
+			levels[l].offset % 16			||
+			levels[l].offset + levels[l].size > file.getSize())
+		{
+			file.close();
+			return false;
+		}
+	}
+
+	header = h;
+	return true;
+}
+
+void TextureFile::close()
+{
+	file.close();
+	header = nullptr;
+}
+
+const ImageLevel* TextureFile::getLevels() const { return (const ImageLevel*)(file.getData() + sizeof(TextureFileHeader)); }
+
+bool TextureFile::write(const char* sourcePath, const ConvertedImage& image, uint32_t flags)
+{
+	MappedFile source;
+	if (!source.open(sourcePath) || image.levels.empty()) return false;
+
+	TextureFileHeader header{};
+	header.magic		= TEXTURE_MAGIC;
+	header.version		= TEXTURE_VERSION;
+	header.sourceHash	= MeshFile::hash(source.getData(), source.getSize());
+	header.sourceSize	= source.getSize();
+	header.flags		= flags;
+	header.encoding		= (uint32_t)image.encoding;
+	header.width		= image.levels[0].width;
+	header.height		= image.levels[0].height;
+	header.levelCount	= static_cast<uint32_t>(image.levels.size());
+
+	// Level data starts at a 16-byte aligned offset (the level offsets of the image stay aligned)
+	uint64_t indexEnd	= sizeof(TextureFileHeader) + image.levels.size() * sizeof(ImageLevel);
+	uint64_t dataStart	= (indexEnd + 15) & ~15ull;
+
+	std::vector<ImageLevel> levels = image.levels;
+	for (ImageLevel& level : levels)
+		level.offset += dataStart;
+
+	// Write to a temporary file and rename it, so a reader never maps a half-written cache (the temporary name is unique per thread, like in MeshFile::write).
+	std::string path	= cachePath(sourcePath);
+	std::string tmpPath	= path + "." + std::to_string(std::hash<std::thread::id>()(std::this_thread::get_id())) + ".tmp";
+	{
+		std::ofstream out(tmpPath, std::ios::binary | std::ios::trunc);
+		if (!out.is_open()) return false;
+		const char zeros[16] = {};
+		out.write((const char*)&header, sizeof(header));
+		out.write((const char*)levels.data(), (std::streamsize)(levels.size() * sizeof(ImageLevel)));
+		out.write(zeros, (std::streamsize)(dataStart - indexEnd));
+		out.write((const char*)image.data.data(), (std::streamsize)image.data.size());
+		if (!out) { out.close(); std::remove(tmpPath.c_str()); return false; }
+	}
+
+	std::remove(path.c_str());			// std::rename doesn't replace existing files on Windows
+	return std::rename(tmpPath.c_str(), path.c_str()) == 0;
+}
@@ -0,0 +1,302 @@
+#include <iostream>
+#include <stdexcept>
+#include <string>
+#include <cmath>
+#include <algorithm>
+#include <chrono>
+
+#include "stb_image.h"
+
+#include "textures.hpp"
+#include "textureFile.hpp"
+
+namespace
+{
+	/// Texture cache flags for a requested format. Returns false if the format is not converted (it's loaded uncompressed).
+	bool getFileFlags(VkFormat format, MipFilter mipFilter, bool highQuality, uint32_t& flags)
+	{
+		switch (format)
+		{
+		case VK_FORMAT_R8G8B8A8_SRGB:	flags = TEXTURE_SRGB;	break;
+		case VK_FORMAT_R8G8B8A8_UNORM:	flags = 0;				break;
+		case VK_FORMAT_R8G8_UNORM:		flags = TEXTURE_RG;		break;
+		default:						return false;
+		}
+
+		if (mipFilter == MipFilter::Kaiser)		flags |= TEXTURE_KAISER;
+		if (highQuality && !(flags & TEXTURE_RG))	flags |= TEXTURE_BC7;
+		return true;
+	}
+
+	VkFormat getImageFormat(TextureEncoding encoding, bool srgb)
+	{
+		switch (encoding)
+		{
+		case TextureEncoding::BC1:	return srgb ? VK_FORMAT_BC1_RGB_SRGB_BLOCK	: VK_FORMAT_BC1_RGB_UNORM_BLOCK;
+		case TextureEncoding::BC3:	return srgb ? VK_FORMAT_BC3_SRGB_BLOCK		: VK_FORMAT_BC3_UNORM_BLOCK;
+		case TextureEncoding::BC5:	return VK_FORMAT_BC5_UNORM_BLOCK;
+		case TextureEncoding::BC7:	return srgb ? VK_FORMAT_BC7_SRGB_BLOCK		: VK_FORMAT_BC7_UNORM_BLOCK;
+		default:					return srgb ? VK_FORMAT_R8G8B8A8_SRGB		: VK_FORMAT_R8G8B8A8_UNORM;
+		}
+	}
+}
+
+void TextureCache::init(VkDevice device, MemoryAllocator* allocator, UploadManager* uploader, bool compress)
+{
+	this->device	= device;
+	this->allocator	= allocator;
+	this->uploader	= uploader;
+	this->compress	= compress;
+}
+
+Texture TextureCache::create(VkFormat format, uint32_t width, uint32_t height, uint32_t mipLevels, VkImageUsageFlags usage)
+{
+	Texture texture;
+	texture.format		= format;
+	texture.width		= width;
+	texture.height		= height;
+	texture.mipLevels	= mipLevels;
+
+	// Create the image
+	VkImageCreateInfo imageInfo{};
+	imageInfo.sType			= VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO;
+	imageInfo.imageType		= VK_IMAGE_TYPE_2D;
+	imageInfo.extent		= { texture.width, texture.height, 1 };
+	imageInfo.mipLevels		= texture.mipLevels;
+	imageInfo.arrayLayers	= 1;
+	imageInfo.format		= format;
+	imageInfo.tiling		= VK_IMAGE_TILING_OPTIMAL;
+	imageInfo.initialLayout	= VK_IMAGE_LAYOUT_UNDEFINED;
+	imageInfo.usage			= usage;
+	imageInfo.samples		= VK_SAMPLE_COUNT_1_BIT;
+	imageInfo.sharingMode	= VK_SHARING_MODE_EXCLUSIVE;
+
+	if (vkCreateImage(device, &imageInfo, nullptr, &texture.image) != VK_SUCCESS)
+		throw std::runtime_error("Failed to create image!");
+
+	VkMemoryRequirements memRequirements;
+	vkGetImageMemoryRequirements(device, texture.image, &memRequirements);
+	texture.memory = allocator->allocate(memRequirements, VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, false);
+	vkBindImageMemory(device, texture.image, texture.memory.memory, texture.memory.offset);
+
+	// Image view
+	VkImageViewCreateInfo viewInfo{};
+	viewInfo.sType								= VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO;
+	viewInfo.image								= texture.image;
+	viewInfo.viewType							= VK_IMAGE_VIEW_TYPE_2D;
+	viewInfo.format								= format;
+	viewInfo.subresourceRange.aspectMask		= VK_IMAGE_ASPECT_COLOR_BIT;
+	viewInfo.subresourceRange.baseMipLevel		= 0;
+	viewInfo.subresourceRange.levelCount		= texture.mipLevels;
+	viewInfo.subresourceRange.baseArrayLayer	= 0;
+	viewInfo.subresourceRange.layerCount		= 1;
+
+	if (vkCreateImageView(device, &viewInfo, nullptr, &texture.view) != VK_SUCCESS)
+		throw std::runtime_error("Failed to create texture image view!");
+
+	return texture;
+}
+
+Texture TextureCache::upload(const TextureData& data)
+{
+	VkImageUsageFlags usage = VK_IMAGE_USAGE_TRANSFER_DST_BIT | VK_IMAGE_USAGE_SAMPLED_BIT;
+	if (data.blitMipmaps) usage |= VK_IMAGE_USAGE_TRANSFER_SRC_BIT;		// Mipmaps are blitted from the previous level
+
+	Texture texture = create(data.format, data.width, data.height, data.mipLevels, usage);
+
+	// Copy the data, and generate the mipmaps if they are not in it (submitted with the next uploader->flush())
+	if (data.blitMipmaps)
+		uploader->uploadImage(texture.image, data.format, data.data, data.size, texture.width, texture.height, texture.mipLevels);
+	else
+	{
+		uploader->uploadImageLevels(texture.image, data.data, data.size, texture.width, texture.height, texture.mipLevels, data.levelOffsets.data());
+		compressedCount++;
+	}
+
+	return texture;
+}
+
+void TextureCache::read(const char* path, VkFormat format, TextureData& data)
+{
+	uint32_t flags;
+	if (compress && getFileFlags(format, mipFilter, highQuality, flags))
+		return readCompressed(path, flags, data);
+
+	// Load the image (always as 4 channels)
+	int texWidth, texHeight, texChannels;
+	stbi_uc* pixels = stbi_load(path, &texWidth, &texHeight, &texChannels, STBI_rgb_alpha);
+	if (!pixels)
+		throw std::runtime_error("Failed to load texture image!");
+
+	data.pixels.reset(pixels, stbi_image_free);
+	data.format			= format;
+	data.width			= static_cast<uint32_t>(texWidth);
+	data.height			= static_cast<uint32_t>(texHeight);
+	data.mipLevels		= static_cast<uint32_t>(std::floor(std::log2(std::max(texWidth, texHeight)))) + 1;
+	data.blitMipmaps	= true;
+	data.data			= (const char*)pixels;
+	data.size			= texWidth * texHeight * 4;
+}
+
+void TextureCache::readCompressed(const char* path, uint32_t flags, TextureData& data)
+{
+	const char* base;					// Level offsets are relative to it
+	const ImageLevel* levels;
+	uint32_t levelCount;
+	TextureEncoding encoding;
+
+	if (data.file.open(path, flags))	// Mapped: the levels are copied straight from the file to the staging buffer
+	{
+		base		= data.file.getData();
+		levels		= data.file.getLevels();
+		levelCount	= data.file.getHeader().levelCount;
+		encoding	= (TextureEncoding)data.file.getHeader().encoding;
+	}
+	else								// Decode and convert once, and save the result for the next runs
+	{
+		int texWidth, texHeight, texChannels;
+		stbi_uc* pixels = stbi_load(path, &texWidth, &texHeight, &texChannels, STBI_rgb_alpha);
+		if (!pixels)
+			throw std::runtime_error("Failed to load texture image!");
+
+		encoding		= (flags & TEXTURE_RG) ? TextureEncoding::BC5 : chooseEncoding(pixels, (size_t)texWidth * texHeight, (flags & TEXTURE_BC7) != 0);
+		data.converted	= convertImage(pixels, texWidth, texHeight, encoding, (flags & TEXTURE_SRGB) != 0, (flags & TEXTURE_KAISER) ? MipFilter::Kaiser : MipFilter::Box);
+		stbi_image_free(pixels);
+
+		if (!TextureFile::write(path, data.converted, flags))
+			std::cerr << "Failed to write the texture cache (" << TextureFile::cachePath(path) << ")" << std::endl;
+
+		base		= (const char*)data.converted.data.data();
+		levels		= data.converted.levels.data();
+		levelCount	= static_cast<uint32_t>(data.converted.levels.size());
+	}
+
+	// Levels are stored one after the other: they are uploaded in a single copy
+	data.format			= getImageFormat(encoding, (flags & TEXTURE_SRGB) != 0);
+	data.width			= levels[0].width;
+	data.height			= levels[0].height;
+	data.mipLevels		= levelCount;
+	data.blitMipmaps	= false;
+	data.data			= base + levels[0].offset;
+	data.size			= levels[levelCount - 1].offset + levels[levelCount - 1].size - levels[0].offset;
+	data.levelOffsets.resize(levelCount);
+	for (uint32_t l = 0; l < levelCount; l++)
+		data.levelOffsets[l] = levels[l].offset - levels[0].offset;
+}
+
+void TextureCache::readPending(PendingTexture& entry, const char* path, VkFormat format)
+{
+	std::call_once(entry.once, [&]()
+	{
+		auto start = std::chrono::high_resolution_clock::now();
+		try { read(path, format, entry.data); }
+		catch (...) { entry.error = std::current_exception(); }
+		entry.readTime = std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - start).count();
+	});
+
+	if (entry.error) std::rethrow_exception(entry.error);
+}
+
+std::string TextureCache::makeKey(const char* path, VkFormat format)
+{
+	std::string key(path);
+	key.append((const char*)&format, sizeof(format));
+	return key;
+}
+
+void TextureCache::prepare(const char* path, VkFormat format)
+{
+	std::string key = makeKey(path, format);
+	std::shared_ptr<PendingTexture> entry;
+	{
+		std::lock_guard<std::mutex> lock(mtx);
+		std::shared_ptr<PendingTexture>& slot = pending[key];
+		if (!slot) slot = std::make_shared<PendingTexture>();
+		entry = slot;
+	}
+
+	readPending(*entry, path, format);		// Outside the lock: other files are read in parallel
+}
+
+Texture TextureCache::get(const char* path, VkFormat format)
+{
+	std::string key = makeKey(path, format);
+
+	std::lock_guard<std::mutex> lock(mtx);
+
+	VkImageView view = views.acquire(key, [&]()
+	{
+		// Read the file, unless prepare() did it
+		std::shared_ptr<PendingTexture> entry;
+		auto it = pending.find(key);
+		if (it != pending.end())
+		{
+			entry = it->second;
+			pending.erase(it);
+		}
+		else entry = std::make_shared<PendingTexture>();
+
+		readPending(*entry, path, format);
+		readTime += entry->readTime;
+
+		auto start = std::chrono::high_resolution_clock::now();
+		Texture texture = upload(entry->data);
+		uploadTime += std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - start).count();
+
+		textures[texture.view] = texture;
+		bytesAllocated += texture.memory.size;
+		return texture.view;
+	});
+
+	pending.erase(key);			// It was already loaded: what prepare() read is not needed
+
+	const Texture& texture = textures[view];
+	bytesRequested += texture.memory.size;
+	return texture;
+}
+
+void TextureCache::release(VkImageView view)
+{
+	std::lock_guard<std::mutex> lock(mtx);
+
+	auto it = textures.find(view);
+	if (it == textures.end()) return;
+	bytesRequested -= it->second.memory.size;
+
+	if (views.release(view))
+	{
+		Texture& texture = it->second;
+		vkDestroyImageView(device, texture.view, nullptr);
+		vkDestroyImage(device, texture.image, nullptr);
+		bytesAllocated -= texture.memory.size;
+		allocator->free(texture.memory);
+		textures.erase(it);
+	}
+}
+
+void TextureCache::printStats()
+{
+	std::lock_guard<std::mutex> lock(mtx);
+	std::cout	<< "Textures: " << views.size() << " in memory for " << views.requests << " requests, "
+				<< bytesAllocated / (1024. * 1024.) << " MB (" << (bytesRequested - bytesAllocated) / (1024. * 1024.) << " MB saved by sharing), "
+				<< compressedCount << " block compressed. Read in " << readTime << " ms (summed over threads), images created in " << uploadTime << " ms" << std::endl;
+}
+
+void TextureCache::cleanup()
+{
+	std::lock_guard<std::mutex> lock(mtx);
+
+	for (auto& entry : textures)
+	{
+		vkDestroyImageView(device, entry.second.view, nullptr);
+		vkDestroyImage(device, entry.second.image, nullptr);
+		allocator->free(entry.second.memory);
+	}
+
+	views.clear([](VkImageView) { });
+	textures.clear();
+	bytesRequested = bytesAllocated = 0;
+	pending.clear();
+	compressedCount = 0;
+	readTime = uploadTime = 0;
+}
@@ -0,0 +1,55 @@
+#include <stdexcept>
+
+#include "uniforms.hpp"
+
+void UniformArena::init(VkDevice device, MemoryAllocator* allocator, VkDeviceSize minUniformBufferOffsetAlignment)
+{
+	this->device	= device;
+	this->allocator	= allocator;
+	alignment		= minUniformBufferOffsetAlignment ? minUniformBufferOffsetAlignment : 1;
+	regionSize		= (regionSize + alignment - 1) / alignment * alignment;		// Every region starts at an aligned offset
+	ranges			= RangeAllocator(regionSize);
+}
+
+void UniformArena::createBuffer(uint32_t swapChainImagesCount)
+{
+	regionCount = swapChainImagesCount;
+
+	VkBufferCreateInfo bufferInfo{};
+	bufferInfo.sType		= VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
+	bufferInfo.size			= regionSize * regionCount;
+	bufferInfo.usage		= VK_BUFFER_USAGE_UNIFORM_BUFFER_BIT;
+	bufferInfo.sharingMode	= VK_SHARING_MODE_EXCLUSIVE;
+
+	if (vkCreateBuffer(device, &bufferInfo, nullptr, &buffer) != VK_SUCCESS)
+		throw std::runtime_error("Failed to create uniform buffer!");
+
+	VkMemoryRequirements memRequirements;
+	vkGetBufferMemoryRequirements(device, buffer, &memRequirements);
+	memory = allocator->allocate(memRequirements, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT);	// Coherent: writes don't need vkFlushMappedMemoryRanges
+	vkBindBufferMemory(device, buffer, memory.memory, memory.offset);
+}
+
+void UniformArena::destroyBuffer()
+{
+	vkDestroyBuffer(device, buffer, nullptr);
+	allocator->free(memory);
+	buffer = VK_NULL_HANDLE;
+}
+
+VkDeviceSize UniformArena::reserve(VkDeviceSize size)
+{
+	VkDeviceSize offset;
+	if (!ranges.allocate(size, alignment, offset))
+		throw std::runtime_error("Uniform arena is full!");
+
+	return offset;
+}
+
+void UniformArena::release(VkDeviceSize offset, VkDeviceSize size) { ranges.free(offset, size); }
+
+VkDeviceSize UniformArena::getOffset(uint32_t imageIndex, VkDeviceSize offset) { return imageIndex * regionSize + offset; }
+
+void* UniformArena::getMapped(uint32_t imageIndex, VkDeviceSize offset) { return (char*)memory.mapped + imageIndex * regionSize + offset; }
+
+VkDeviceSize UniformArena::getAlignment() { return alignment; }
@@ -0,0 +1,434 @@
+#include <stdexcept>
+#include <cstring>				// memcpy
+#include <algorithm>
+
+#include "uploader.hpp"
+
+void UploadManager::init(VkPhysicalDevice physicalDevice, VkDevice device, VkQueue queue, uint32_t queueFamily, MemoryAllocator* allocator)
+{
+	this->physicalDevice	= physicalDevice;
+	this->device			= device;
+	this->queue				= queue;
+	this->allocator			= allocator;
+
+	head = tail				= 0;
+	recordingActive			= false;
+	nextBatchId				= 1;
+	lastCompleted			= 0;
+	recording.id			= 0;
+	recording.commandBuffer	= VK_NULL_HANDLE;
+	recording.fence			= VK_NULL_HANDLE;
+
+	// Command pool
+	VkCommandPoolCreateInfo poolInfo{};
+	poolInfo.sType				= VK_STRUCTURE_TYPE_COMMAND_POOL_CREATE_INFO;
+	poolInfo.queueFamilyIndex	= queueFamily;
+	poolInfo.flags				= VK_COMMAND_POOL_CREATE_TRANSIENT_BIT | VK_COMMAND_POOL_CREATE_RESET_COMMAND_BUFFER_BIT;	// Short-lived command buffers that are reset individually.
+
+	if (vkCreateCommandPool(device, &poolInfo, nullptr, &commandPool) != VK_SUCCESS)
+		throw std::runtime_error("Failed to create upload command pool!");
+
+	// Staging ring buffer
+	VkBufferCreateInfo bufferInfo{};
+	bufferInfo.sType		= VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
+	bufferInfo.size			= stagingCapacity;
+	bufferInfo.usage		= VK_BUFFER_USAGE_TRANSFER_SRC_BIT;
+	bufferInfo.sharingMode	= VK_SHARING_MODE_EXCLUSIVE;
+
+	if (vkCreateBuffer(device, &bufferInfo, nullptr, &stagingBuffer) != VK_SUCCESS)
+		throw std::runtime_error("Failed to create staging buffer!");
+
+	VkMemoryRequirements memRequirements;
+	vkGetBufferMemoryRequirements(device, stagingBuffer, &memRequirements);
+	stagingMemory = allocator->allocate(memRequirements, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT);
+	vkBindBufferMemory(device, stagingBuffer, stagingMemory.memory, stagingMemory.offset);
+}
+
+VkCommandBuffer UploadManager::getCommandBuffer()
+{
+	if (recordingActive) return recording.commandBuffer;
+
+	// Reuse a retired batch or create a new one
+	if (freeBatches.size())
+	{
+		recording = freeBatches.back();
+		freeBatches.pop_back();
+		vkResetCommandBuffer(recording.commandBuffer, 0);
+		vkResetFences(device, 1, &recording.fence);
+	}
+	else
+	{
+		VkCommandBufferAllocateInfo allocInfo{};
+		allocInfo.sType					= VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO;
+		allocInfo.level					= VK_COMMAND_BUFFER_LEVEL_PRIMARY;
+		allocInfo.commandPool			= commandPool;
+		allocInfo.commandBufferCount	= 1;
+
+		if (vkAllocateCommandBuffers(device, &allocInfo, &recording.commandBuffer) != VK_SUCCESS)
+			throw std::runtime_error("Failed to allocate upload command buffer!");
+
+		VkFenceCreateInfo fenceInfo{};
+		fenceInfo.sType = VK_STRUCTURE_TYPE_FENCE_CREATE_INFO;
+
+		if (vkCreateFence(device, &fenceInfo, nullptr, &recording.fence) != VK_SUCCESS)
+			throw std::runtime_error("Failed to create upload fence!");
+	}
+
+	recording.id = nextBatchId++;
+	recording.tempBuffers.clear();
+	recording.tempMemory.clear();
+
+	VkCommandBufferBeginInfo beginInfo{};
+	beginInfo.sType = VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO;
+	beginInfo.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+
+	if (vkBeginCommandBuffer(recording.commandBuffer, &beginInfo) != VK_SUCCESS)
+		throw std::runtime_error("Failed to begin recording upload command buffer!");
+
+	recordingActive = true;
+	return recording.commandBuffer;
+}
+
+bool UploadManager::isRingEmpty() { return inFlight.empty() && head == tail; }
+
+/// Staging data lives in [tail, head) (circular). New data is placed after head, wrapping to the beginning when it doesn't fit at the end.
+bool UploadManager::allocateRing(VkDeviceSize size, VkDeviceSize alignment, VkDeviceSize& offset)
+{
+	if (isRingEmpty()) head = tail = 0;
+
+	VkDeviceSize aligned = (head + alignment - 1) / alignment * alignment;
+
+	if (head >= tail)		// Free space: [head, capacity) and [0, tail)
+	{
+		if (aligned + size <= stagingCapacity)	offset = aligned;
+		else if (size < tail)					offset = 0;
+		else									return false;
+	}
+	else					// Free space: [head, tail)
+	{
+		if (aligned + size < tail)				offset = aligned;
+		else									return false;
+	}
+
+	head = offset + size;
+	return true;
+}
+
+void* UploadManager::allocateStaging(VkDeviceSize size, VkDeviceSize alignment, VkBuffer& buffer, VkDeviceSize& offset)
+{
+	getCommandBuffer();
+
+	if (size < stagingCapacity)
+	{
+		retire(false);
+		while (!allocateRing(size, alignment, offset))
+		{
+			if (inFlight.empty()) flush();		// The ring is full of data recorded in this batch: submit it.
+			retire(true);
+			getCommandBuffer();
+		}
+
+		buffer = stagingBuffer;
+		return (char*)stagingMemory.mapped + offset;
+	}
+
+	// Too big for the ring: temporary staging buffer, destroyed when the batch retires.
+	VkBufferCreateInfo bufferInfo{};
+	bufferInfo.sType		= VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO;
+	bufferInfo.size			= size;
+	bufferInfo.usage		= VK_BUFFER_USAGE_TRANSFER_SRC_BIT;
+	bufferInfo.sharingMode	= VK_SHARING_MODE_EXCLUSIVE;
+
+	if (vkCreateBuffer(device, &bufferInfo, nullptr, &buffer) != VK_SUCCESS)
+		throw std::runtime_error("Failed to create staging buffer!");
+
+	VkMemoryRequirements memRequirements;
+	vkGetBufferMemoryRequirements(device, buffer, &memRequirements);
+	Allocation memory = allocator->allocate(memRequirements, VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT);
+	vkBindBufferMemory(device, buffer, memory.memory, memory.offset);
+
+	recording.tempBuffers.push_back(buffer);
+	recording.tempMemory.push_back(memory);
+
+	offset = 0;
+	return memory.mapped;
+}
+
+void UploadManager::uploadBuffer(VkBuffer dstBuffer, const void* data, VkDeviceSize size, VkDeviceSize dstOffset)
+{
+	VkBuffer srcBuffer;
+	VkDeviceSize srcOffset;
+	memcpy(allocateStaging(size, 16, srcBuffer, srcOffset), data, (size_t)size);
+
+	VkBufferCopy copyRegion{};
+	copyRegion.srcOffset	= srcOffset;
+	copyRegion.dstOffset	= dstOffset;
+	copyRegion.size			= size;
+
+	vkCmdCopyBuffer(getCommandBuffer(), srcBuffer, dstBuffer, 1, &copyRegion);
+}
+
+void UploadManager::uploadImage(VkImage image, VkFormat format, const void* pixels, VkDeviceSize size, uint32_t width, uint32_t height, uint32_t mipLevels)
+{
+	VkBuffer srcBuffer;
+	VkDeviceSize srcOffset;
+	memcpy(allocateStaging(size, 16, srcBuffer, srcOffset), pixels, (size_t)size);		// bufferOffset must be a multiple of the texel size (and of 4)
+
+	VkCommandBuffer commandBuffer = getCommandBuffer();
+
+	// Transition the whole image to VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL
+	VkImageMemoryBarrier barrier{};
+	barrier.sType							= VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
+	barrier.oldLayout						= VK_IMAGE_LAYOUT_UNDEFINED;
+	barrier.newLayout						= VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
+	barrier.srcQueueFamilyIndex				= VK_QUEUE_FAMILY_IGNORED;
+	barrier.dstQueueFamilyIndex				= VK_QUEUE_FAMILY_IGNORED;
+	barrier.image							= image;
+	barrier.subresourceRange.aspectMask		= VK_IMAGE_ASPECT_COLOR_BIT;
+	barrier.subresourceRange.baseMipLevel	= 0;
+	barrier.subresourceRange.levelCount		= mipLevels;
+	barrier.subresourceRange.baseArrayLayer	= 0;
+	barrier.subresourceRange.layerCount		= 1;
+	barrier.srcAccessMask					= 0;
+	barrier.dstAccessMask					= VK_ACCESS_TRANSFER_WRITE_BIT;
+
+	vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT, 0, 0, nullptr, 0, nullptr, 1, &barrier);
+
+	// Copy the staging data to the level 0
+	VkBufferImageCopy region{};
+	region.bufferOffset						= srcOffset;
+	region.bufferRowLength					= 0;					// Pixels are tightly packed
+	region.bufferImageHeight				= 0;
+	region.imageSubresource.aspectMask		= VK_IMAGE_ASPECT_COLOR_BIT;
+	region.imageSubresource.mipLevel		= 0;
+	region.imageSubresource.baseArrayLayer	= 0;
+	region.imageSubresource.layerCount		= 1;
+	region.imageOffset						= { 0, 0, 0 };
+	region.imageExtent						= { width, height, 1 };
+
+	vkCmdCopyBufferToImage(commandBuffer, srcBuffer, image, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, 1, &region);
+
+	// Generate the rest of levels (it transitions every level to VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL)
+	generateMipmaps(commandBuffer, image, format, (int32_t)width, (int32_t)height, mipLevels);
+}
+
+void UploadManager::uploadImageLevels(VkImage image, const void* data, VkDeviceSize size, uint32_t width, uint32_t height, uint32_t mipLevels, const VkDeviceSize* levelOffsets)
+{
+	VkBuffer srcBuffer;
+	VkDeviceSize srcOffset;
+	memcpy(allocateStaging(size, 16, srcBuffer, srcOffset), data, (size_t)size);		// bufferOffset must be a multiple of the texel block size (and of 4)
+
+	VkCommandBuffer commandBuffer = getCommandBuffer();
+
+	// Transition the whole image to VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL
+	VkImageMemoryBarrier barrier{};
+	barrier.sType							= VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
+	barrier.oldLayout						= VK_IMAGE_LAYOUT_UNDEFINED;
+	barrier.newLayout						= VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
+	barrier.srcQueueFamilyIndex				= VK_QUEUE_FAMILY_IGNORED;
+	barrier.dstQueueFamilyIndex				= VK_QUEUE_FAMILY_IGNORED;
+	barrier.image							= image;
+	barrier.subresourceRange.aspectMask		= VK_IMAGE_ASPECT_COLOR_BIT;
+	barrier.subresourceRange.baseMipLevel	= 0;
+	barrier.subresourceRange.levelCount		= mipLevels;
+	barrier.subresourceRange.baseArrayLayer	= 0;
+	barrier.subresourceRange.layerCount		= 1;
+	barrier.srcAccessMask					= 0;
+	barrier.dstAccessMask					= VK_ACCESS_TRANSFER_WRITE_BIT;
+
+	vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT, 0, 0, nullptr, 0, nullptr, 1, &barrier);
+
+	// Copy every level in a single command (one region per level)
+	std::vector<VkBufferImageCopy> regions(mipLevels);
+	for (uint32_t i = 0; i < mipLevels; i++)
+	{
+		VkBufferImageCopy& region = regions[i];
+		region.bufferOffset						= srcOffset + levelOffsets[i];
+		region.bufferRowLength					= 0;				// Texels (or blocks) are tightly packed
+		region.bufferImageHeight				= 0;
+		region.imageSubresource.aspectMask		= VK_IMAGE_ASPECT_COLOR_BIT;
+		region.imageSubresource.mipLevel		= i;
+		region.imageSubresource.baseArrayLayer	= 0;
+		region.imageSubresource.layerCount		= 1;
+		region.imageOffset						= { 0, 0, 0 };
+		region.imageExtent						= { std::max(1u, width >> i), std::max(1u, height >> i), 1 };	// Not a multiple of the block size in the smallest levels: the copy covers the partial blocks
+	}
+
+	vkCmdCopyBufferToImage(commandBuffer, srcBuffer, image, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, mipLevels, regions.data());
+
+	// Transition the whole image to VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL (waits for the copy)
+	barrier.oldLayout		= VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
+	barrier.newLayout		= VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+	barrier.srcAccessMask	= VK_ACCESS_TRANSFER_WRITE_BIT;
+	barrier.dstAccessMask	= VK_ACCESS_SHADER_READ_BIT;
+
+	vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT, 0, 0, nullptr, 0, nullptr, 1, &barrier);
+}
+
+void UploadManager::generateMipmaps(VkCommandBuffer commandBuffer, VkImage image, VkFormat imageFormat, int32_t texWidth, int32_t texHeight, uint32_t mipLevels)
+{
+	// Check if the image format supports linear blitting. We are using vkCmdBlitImage, but it's not guaranteed to be supported on all platforms bacause it requires our texture image format to support linear filtering, so we check it with vkGetPhysicalDeviceFormatProperties.
+	VkFormatProperties formatProperties;
+	vkGetPhysicalDeviceFormatProperties(physicalDevice, imageFormat, &formatProperties);
+	if (mipLevels > 1 && !(formatProperties.optimalTilingFeatures & VK_FORMAT_FEATURE_SAMPLED_IMAGE_FILTER_LINEAR_BIT))
+		throw std::runtime_error("Texture image format does not support linear blitting!");
+
+	// Specify the barriers
+	VkImageMemoryBarrier barrier{};
+	barrier.sType							= VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER;
+	barrier.image							= image;
+	barrier.srcQueueFamilyIndex				= VK_QUEUE_FAMILY_IGNORED;
+	barrier.dstQueueFamilyIndex				= VK_QUEUE_FAMILY_IGNORED;
+	barrier.subresourceRange.aspectMask		= VK_IMAGE_ASPECT_COLOR_BIT;
+	barrier.subresourceRange.baseArrayLayer	= 0;
+	barrier.subresourceRange.layerCount		= 1;
+	barrier.subresourceRange.levelCount		= 1;
+
+	int32_t mipWidth  = texWidth;
+	int32_t mipHeight = texHeight;
+
+	for (uint32_t i = 1; i < mipLevels; i++)	// The source mip level is i - 1 and the destination mip level is i.
+	{
+		// Transition level i - 1 to VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL (waits for level i - 1 to be filled by the previous blit or by vkCmdCopyBufferToImage)
+		barrier.subresourceRange.baseMipLevel	= i - 1;
+		barrier.oldLayout						= VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
+		barrier.newLayout						= VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL;
+		barrier.srcAccessMask					= VK_ACCESS_TRANSFER_WRITE_BIT;
+		barrier.dstAccessMask					= VK_ACCESS_TRANSFER_READ_BIT;
+
+		vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT, 0, 0, nullptr, 0, nullptr, 1, &barrier);
+
+		// Blit level i - 1 to level i
+		VkImageBlit blit{};
+		blit.srcOffsets[0]					= { 0, 0, 0 };
+		blit.srcOffsets[1]					= { mipWidth, mipHeight, 1 };
+		blit.srcSubresource.aspectMask		= VK_IMAGE_ASPECT_COLOR_BIT;
+		blit.srcSubresource.mipLevel		= i - 1;
+		blit.srcSubresource.baseArrayLayer	= 0;
+		blit.srcSubresource.layerCount		= 1;
+		blit.dstOffsets[0]					= { 0, 0, 0 };
+		blit.dstOffsets[1]					= { mipWidth > 1 ? mipWidth / 2 : 1,  mipHeight > 1 ? mipHeight / 2 : 1,  1 };
+		blit.dstSubresource.aspectMask		= VK_IMAGE_ASPECT_COLOR_BIT;
+		blit.dstSubresource.mipLevel		= i;
+		blit.dstSubresource.baseArrayLayer	= 0;
+		blit.dstSubresource.layerCount		= 1;
+
+		vkCmdBlitImage(commandBuffer,
+			image, VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL,
+			image, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
+			1, &blit,
+			VK_FILTER_LINEAR);
+
+		// Transition level i - 1 to VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL (waits for the blit)
+		barrier.oldLayout		= VK_IMAGE_LAYOUT_TRANSFER_SRC_OPTIMAL;
+		barrier.newLayout		= VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+		barrier.srcAccessMask	= VK_ACCESS_TRANSFER_READ_BIT;
+		barrier.dstAccessMask	= VK_ACCESS_SHADER_READ_BIT;
+
+		vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT, 0, 0, nullptr, 0, nullptr, 1, &barrier);
+
+		if (mipWidth  > 1) mipWidth  /= 2;
+		if (mipHeight > 1) mipHeight /= 2;
+	}
+
+	// Transition the last level (it's never blitted from)
+	barrier.subresourceRange.baseMipLevel	= mipLevels - 1;
+	barrier.oldLayout						= VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
+	barrier.newLayout						= VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+	barrier.srcAccessMask					= VK_ACCESS_TRANSFER_WRITE_BIT;
+	barrier.dstAccessMask					= VK_ACCESS_SHADER_READ_BIT;
+
+	vkCmdPipelineBarrier(commandBuffer, VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT, 0, 0, nullptr, 0, nullptr, 1, &barrier);
+}
+
+uint64_t UploadManager::flush()
+{
+	if (!recordingActive) return 0;
+
+	// Make buffer copies visible to every later use of the buffers (vertex/index fetch, uniform and shader reads (graphics and compute), other transfers)
+	VkMemoryBarrier barrier{};
+	barrier.sType			= VK_STRUCTURE_TYPE_MEMORY_BARRIER;
+	barrier.srcAccessMask	= VK_ACCESS_TRANSFER_WRITE_BIT;
+	barrier.dstAccessMask	= VK_ACCESS_VERTEX_ATTRIBUTE_READ_BIT | VK_ACCESS_INDEX_READ_BIT | VK_ACCESS_UNIFORM_READ_BIT | VK_ACCESS_SHADER_READ_BIT | VK_ACCESS_TRANSFER_READ_BIT;
+
+	vkCmdPipelineBarrier(recording.commandBuffer,
+		VK_PIPELINE_STAGE_TRANSFER_BIT,
+		VK_PIPELINE_STAGE_VERTEX_INPUT_BIT | VK_PIPELINE_STAGE_VERTEX_SHADER_BIT | VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT | VK_PIPELINE_STAGE_COMPUTE_SHADER_BIT | VK_PIPELINE_STAGE_TRANSFER_BIT,
+		0, 1, &barrier, 0, nullptr, 0, nullptr);
+
+	if (vkEndCommandBuffer(recording.commandBuffer) != VK_SUCCESS)
+		throw std::runtime_error("Failed to record upload command buffer!");
+
+	VkSubmitInfo submitInfo{};
+	submitInfo.sType				= VK_STRUCTURE_TYPE_SUBMIT_INFO;
+	submitInfo.commandBufferCount	= 1;
+	submitInfo.pCommandBuffers		= &recording.commandBuffer;
+
+	if (vkQueueSubmit(queue, 1, &submitInfo, recording.fence) != VK_SUCCESS)
+		throw std::runtime_error("Failed to submit upload command buffer!");
+
+	recording.ringEnd = head;
+	inFlight.push_back(recording);
+	recordingActive = false;
+
+	return recording.id;
+}
+
+void UploadManager::retire(bool wait)
+{
+	if (wait && inFlight.size())
+		vkWaitForFences(device, 1, &inFlight.front().fence, VK_TRUE, UINT64_MAX);
+
+	while (inFlight.size() && vkGetFenceStatus(device, inFlight.front().fence) == VK_SUCCESS)
+	{
+		Batch& batch = inFlight.front();
+
+		tail = batch.ringEnd;
+		for (size_t i = 0; i < batch.tempBuffers.size(); i++)
+		{
+			vkDestroyBuffer(device, batch.tempBuffers[i], nullptr);
+			allocator->free(batch.tempMemory[i]);
+		}
+
+		lastCompleted = batch.id;
+		freeBatches.push_back(batch);
+		inFlight.pop_front();
+	}
+}
+
+bool UploadManager::isComplete(uint64_t batchId)
+{
+	retire(false);
+	return batchId <= lastCompleted;
+}
+
+void UploadManager::wait(uint64_t batchId)
+{
+	if (recordingActive && batchId >= recording.id) flush();
+
+	while (batchId > lastCompleted && inFlight.size())
+		retire(true);
+}
+
+void UploadManager::waitIdle()
+{
+	flush();
+	while (inFlight.size())
+		retire(true);
+}
+
+void UploadManager::cleanup()
+{
+	waitIdle();
+
+	for (Batch& batch : freeBatches)
+	{
+		vkFreeCommandBuffers(device, commandPool, 1, &batch.commandBuffer);
+		vkDestroyFence(device, batch.fence, nullptr);
+	}
+	freeBatches.clear();
+
+	vkDestroyCommandPool(device, commandPool, nullptr);
+	vkDestroyBuffer(device, stagingBuffer, nullptr);
+	allocator->free(stagingMemory);
+}
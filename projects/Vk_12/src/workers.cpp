@@ -0,0 +1,77 @@
+#include "workers.hpp"
+
+WorkerPool::WorkerPool(size_t threadCount)
+	: task(nullptr), taskCount(0), nextTask(0), pendingTasks(0), stop(false)
+{
+	if (threadCount == 0)
+	{
+		unsigned hardwareThreads = std::thread::hardware_concurrency();
+		threadCount = hardwareThreads > 1 ? hardwareThreads - 1 : 0;
+	}
+
+	for (size_t i = 0; i < threadCount; i++)
+		threads.push_back(std::thread(&WorkerPool::workerLoop, this));
+}
+
+WorkerPool::~WorkerPool()
+{
+	{
+		std::lock_guard<std::mutex> lock(mtx);
+		stop = true;
+	}
+	workReady.notify_all();
+
+	for (std::thread& thread : threads)
+		thread.join();
+}
+
+size_t WorkerPool::size() const { return threads.size() + 1; }
+
+void WorkerPool::workerLoop()
+{
+	std::unique_lock<std::mutex> lock(mtx);
+
+	while (true)
+	{
+		workReady.wait(lock, [this] { return stop || nextTask < taskCount; });
+		if (stop) return;
+		execute(lock);
+	}
+}
+
+void WorkerPool::execute(std::unique_lock<std::mutex>& lock)
+{
+	size_t index = nextTask++;
+	const std::function<void(size_t)>& job = *task;
+
+	lock.unlock();
+	std::exception_ptr exception;
+	try { job(index); }
+	catch (...) { exception = std::current_exception(); }
+	lock.lock();
+
+	if (exception && !error) error = exception;
+	if (--pendingTasks == 0) workDone.notify_all();
+}
+
+void WorkerPool::run(size_t count, const std::function<void(size_t)>& task)
+{
+	if (count == 0) return;
+
+	std::lock_guard<std::mutex> job(runMtx);
+	std::unique_lock<std::mutex> lock(mtx);
+	this->task		= &task;
+	taskCount		= count;
+	nextTask		= 0;
+	pendingTasks	= count;
+	error			= nullptr;
+	workReady.notify_all();
+
+	while (nextTask < taskCount)	// The calling thread works too
+		execute(lock);
+
+	workDone.wait(lock, [this] { return pendingTasks == 0; });
+	taskCount = nextTask = 0;
+
+	if (error) std::rethrow_exception(error);
+}
@@ -0,0 +1,173 @@
+/*
+	Tool: offline texture conversion (textureConverter.hpp, textureFile.hpp).
+
+	Writes the texture cache (<image>.tex) of each image, with the same settings TextureCache uses at runtime (VulkanEnvironment::compressTextures), so the application never decodes them:
+		- decode:		stbi_load of the source image (what startup used to do per texture, before blitting the mipmaps on the GPU).
+		- convert:		mip chain (linear space) and block compression of every level (in parallel).
+		- cached:		TextureFile::open of the written cache (hash of the source, mapping and validation) and a read of every level: what startup does now.
+		- memory:		RGBA8 with mipmaps vs the compressed mip chain (device memory used by the texture).
+		- PSNR:			error of the compressed level 0 (decoded on the CPU) against the source.
+	Checks that each written cache can be opened again.
+	Usage:	texconv [-bc7] [-box] [-linear | -rg] [-threads N] <image files...>
+				-bc7:		BC7 for color textures (TextureCache::highQuality). Default: BC1 if opaque, BC3 otherwise.
+				-box:		box filter for the mipmaps. Default: Kaiser.
+				-linear:	images are not sRGB (loaded as VK_FORMAT_R8G8B8A8_UNORM).
+				-rg:		2-channel images (loaded as VK_FORMAT_R8G8_UNORM): BC5.
+*/
+
+#include <iostream>
+#include <iomanip>
+#include <vector>
+#include <string>
+#include <chrono>
+#include <cmath>
+#include <cstring>
+#include <cstdlib>
+
+#define STB_IMAGE_IMPLEMENTATION
+#include "stb_image.h"
+
+#include "textureConverter.hpp"
+#include "textureFile.hpp"
+#include "workers.hpp"
+
+
+const char* encodingNames[] = { "RGBA8", "BC1", "BC3", "BC5", "BC7" };
+volatile uint64_t sink;			///< Keeps reads from being optimized away
+
+double elapsed(std::chrono::high_resolution_clock::time_point start)
+{
+	return std::chrono::duration<double, std::milli>(std::chrono::high_resolution_clock::now() - start).count();
+}
+
+/// PSNR (dB) of the level 0 of a converted image against the source texels (only the channels the encoding keeps).
+double levelPsnr(const ConvertedImage& image, const uint8_t* rgba, int channels)
+{
+	const ImageLevel& level = image.levels[0];
+	uint32_t blockBytes = getBlockBytes(image.encoding);
+	uint32_t blocksX = (level.width + 3) / 4;
+	uint8_t block[64];
+	double error = 0;
+
+	for (uint32_t y = 0; y < level.height; y++)
+		for (uint32_t x = 0; x < level.width; x++)
+		{
+			const uint8_t* texel;
+			if (image.encoding == TextureEncoding::RGBA8)
+				texel = &image.data[(size_t)(level.offset + ((size_t)y * level.width + x) * 4)];
+			else
+			{
+				decodeBlock(image.encoding, &image.data[(size_t)(level.offset + ((size_t)(y / 4) * blocksX + x / 4) * blockBytes)], block);
+				texel = block + ((y % 4) * 4 + x % 4) * 4;
+			}
+
+			for (int c = 0; c < channels; c++)
+			{
+				double difference = (double)texel[c] - rgba[((size_t)y * level.width + x) * 4 + c];
+				error += difference * difference;
+			}
+		}
+
+	double mse = error / ((double)level.width * level.height * channels);
+	return mse > 0 ? 10 * std::log10(255. * 255. / mse) : 99.;
+}
+
+int main(int argc, char* argv[])
+{
+	bool highQuality = false, box = false, srgb = true, rg = false;
+	size_t threads = 0;
+	std::vector<const char*> files;
+
+	for (int a = 1; a < argc; a++)
+	{
+		if		(!std::strcmp(argv[a], "-bc7"))		highQuality = true;
+		else if (!std::strcmp(argv[a], "-box"))		box = true;
+		else if (!std::strcmp(argv[a], "-linear"))	srgb = false;
+		else if (!std::strcmp(argv[a], "-rg"))		{ rg = true; srgb = false; }
+		else if (!std::strcmp(argv[a], "-threads") && a + 1 < argc) threads = std::strtoul(argv[++a], nullptr, 10);
+		else files.push_back(argv[a]);
+	}
+
+	if (files.empty())
+	{
+		std::cout << "Usage: texconv [-bc7] [-box] [-linear | -rg] [-threads N] <image files...>" << std::endl;
+		return 1;
+	}
+
+	// Same flags as TextureCache
+	uint32_t flags = (srgb ? uint32_t(TEXTURE_SRGB) : 0u) | (rg ? uint32_t(TEXTURE_RG) : 0u) | (box ? 0u : uint32_t(TEXTURE_KAISER)) | (highQuality && !rg ? uint32_t(TEXTURE_BC7) : 0u);
+	MipFilter filter = box ? MipFilter::Box : MipFilter::Kaiser;
+	WorkerPool workers(threads ? threads - 1 : 0);
+
+	double totalDecode = 0, totalConvert = 0, totalCached = 0;
+	uint64_t totalRaw = 0, totalCompressed = 0;
+	bool ok = true;
+
+	std::cout << std::left << std::setw(40) << "File" << std::right << std::setw(11) << "Size" << std::setw(7) << "Enc"
+			  << std::setw(12) << "Decode ms" << std::setw(12) << "Convert ms" << std::setw(12) << "Cached ms"
+			  << std::setw(12) << "RGBA8 KB" << std::setw(12) << "Comp. KB" << std::setw(9) << "PSNR" << std::endl;
+
+	for (const char* path : files)
+	{
+		auto start = std::chrono::high_resolution_clock::now();
+		int width, height, channels;
+		stbi_uc* pixels = stbi_load(path, &width, &height, &channels, STBI_rgb_alpha);
+		if (!pixels)
+		{
+			std::cout << path << ": can't be loaded" << std::endl;
+			ok = false;
+			continue;
+		}
+		double decode = elapsed(start);
+
+		start = std::chrono::high_resolution_clock::now();
+		TextureEncoding encoding = rg ? TextureEncoding::BC5 : chooseEncoding(pixels, (size_t)width * height, highQuality);
+		ConvertedImage image = convertImage(pixels, width, height, encoding, srgb, filter, &workers);
+		double convert = elapsed(start);
+
+		bool written = TextureFile::write(path, image, flags);
+
+		// What TextureCache does now: map the cache and read the levels (copied to the staging buffer)
+		start = std::chrono::high_resolution_clock::now();
+		TextureFile file;
+		bool opened = written && file.open(path, flags);
+		if (opened)
+		{
+			const ImageLevel* levels = file.getLevels();
+			const ImageLevel& last = levels[file.getHeader().levelCount - 1];
+			sink = MeshFile::hash(file.getData() + levels[0].offset, (size_t)(last.offset + last.size - levels[0].offset));		// Reads every level once, like the copy to the staging buffer
+		}
+		double cached = elapsed(start);
+
+		uint64_t raw = 0;
+		for (const ImageLevel& level : image.levels)
+			raw += (uint64_t)level.width * level.height * 4;
+		uint64_t compressed = image.levels.back().offset + image.levels.back().size;
+		double psnr = levelPsnr(image, pixels, rg ? 2 : (encoding == TextureEncoding::BC1 ? 3 : 4));
+		stbi_image_free(pixels);
+
+		std::string name(path);
+		if (name.size() > 38) name = "..." + name.substr(name.size() - 35);
+		std::cout << std::left << std::setw(40) << name << std::right << std::setw(11) << (std::to_string(width) + "x" + std::to_string(height))
+				  << std::setw(7) << encodingNames[(int)encoding] << std::fixed << std::setprecision(2)
+				  << std::setw(12) << decode << std::setw(12) << convert << std::setw(12) << cached
+				  << std::setw(12) << raw / 1024 << std::setw(12) << compressed / 1024 << std::setw(9) << psnr
+				  << (opened ? "" : (written ? "  (cache can't be opened)" : "  (cache can't be written)")) << std::endl;
+
+		ok				= ok && opened;
+		totalDecode		+= decode;
+		totalConvert	+= convert;
+		totalCached		+= cached;
+		totalRaw		+= raw;
+		totalCompressed	+= compressed;
+	}
+
+	std::cout << std::fixed << std::setprecision(2)
+			  << "Startup (decode, before GPU mipmaps): " << std::setw(10) << totalDecode << " ms" << std::endl
+			  << "Startup (texture caches):             " << std::setw(10) << totalCached << " ms" << std::endl
+			  << "Conversion (once):                    " << std::setw(10) << totalConvert << " ms" << std::endl
+			  << "Memory RGBA8 + mipmaps:               " << std::setw(10) << totalRaw / (1024. * 1024.) << " MB" << std::endl
+			  << "Memory compressed:                    " << std::setw(10) << totalCompressed / (1024. * 1024.) << " MB" << std::endl;
+
+	return ok ? 0 : 1;
+}